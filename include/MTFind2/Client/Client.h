@@ -18,20 +18,58 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <random>
 
 #include <MTFind2/MessagePassing/MessageReceiver.h>
 #include <Shared/NonCopyable.h>
 #include <Shared/Tagged.h>
+#include <Shared/TextHelper.h>
 
 namespace mtfind2 {
 struct NotEnoughCreditMessage;
 struct CreditRechargeResponseMessage;
 struct NoSearchResultsFoundMessage;
 struct SearchResultFoundMessage;
+struct SearchCountMessage;
+struct SearchFinishedMessage;
+struct ServiceOverloadedMessage;
+struct SearchRequest;
+struct SearchResult;
+struct ContentSource;
+
+/**
+ * Handles the messages received by a client on its behalf, e.g. to relay them
+ * to a remote peer. Methods may be called from several threads at once, but
+ * the messages about a given search request arrive in order, and
+ * on_search_finished() is always the last one of them.
+ */
+struct ClientDelegate {
+    virtual ~ClientDelegate() = default;
+
+    /**
+     * @param content_source Only guaranteed to be alive during the call
+     */
+    virtual void on_search_result(const SearchRequest &search_request, const ContentSource &content_source, const SearchResult &search_result) = 0;
+    virtual void on_search_count(const SearchRequest &search_request, size_t occurrence_count) = 0;
+    virtual void on_service_overloaded(const SearchRequest &search_request, std::chrono::milliseconds retry_after) = 0;
+
+    /**
+     * @param started_time When the provider started working on the request
+     * (which may be before it was issued, if it joined a search in progress),
+     * or a default-constructed time point if it never did
+     */
+    virtual void on_search_finished(const SearchRequest &search_request, std::chrono::steady_clock::time_point started_time) = 0;
+
+    /**
+     * @param amount Credit recharged, zero if the client is not allowed to
+     */
+    virtual void on_credit_recharged(size_t amount) = 0;
+};
 
 /**
  * Represents a client, this is, a service consumer. It is also capable of
@@ -45,6 +83,12 @@ struct Client final : MessageReceiver, NonCopyable, Tagged<std::string> {
      */
     static constexpr int32_t NotUsingCredit = -1;
 
+    /**
+     * A client with this value as credit is never charged, e.g. because its
+     * credit is accounted for somewhere else.
+     */
+    static constexpr int32_t UnlimitedCredit = std::numeric_limits<int32_t>::max();
+
     /**
      * Enumerates the different subscription types.
      */
@@ -96,38 +140,78 @@ struct Client final : MessageReceiver, NonCopyable, Tagged<std::string> {
     static Client *create_random()
     {
         static std::atomic<uint32_t> s_last_id(0);
-        static std::default_random_engine s_random_engine(std::chrono::system_clock::now().time_since_epoch().count());
 
         std::uniform_int_distribution<int> generate_random_boolean(0, 1);
 
-        const auto subscription_type = generate_random_boolean(s_random_engine) ? SubscriptionType::Premium : SubscriptionType::Standard;
+        const auto subscription_type = generate_random_boolean(random_engine()) ? SubscriptionType::Premium : SubscriptionType::Standard;
         const auto credit = subscription_type == SubscriptionType::Premium ? 15 : NotUsingCredit;
 
         return new Client(s_last_id++, subscription_type, credit);
     }
 
+    /**
+     * Makes random clients repeat from one run to the next. This is meant to
+     * be called once, before any random client is created.
+     */
+    static void set_random_seed(uint32_t seed) { random_engine().seed(seed); }
+
+    /**
+     * Sets how much text around each search result clients display. This is
+     * meant to be called once, before any search request is issued.
+     */
+    static void set_context_width(TextHelper::ContextWidth context_width) { s_context_width = context_width; }
+    static TextHelper::ContextWidth context_width() { return s_context_width; }
+
+    /**
+     * Hands every message over to a delegate instead of printing it. This is
+     * meant to be called once, before any search request is issued.
+     * @param delegate Must outlive this client
+     */
+    void set_delegate(ClientDelegate *delegate) { m_delegate = delegate; }
+
+    /**
+     * @return Whether no credit recharge is in progress, in which case nothing
+     * refers to this client other than its pending search requests
+     */
+    bool is_idle() const { return m_pending_recharge_count.load() == 0; }
+
     uint32_t id() const { return m_id; }
     SubscriptionType subscription_type() const { return m_subscription_type; }
-    bool has_credit() const { return m_credit > 0; }
+    bool has_credit() const { return m_credit.load() > 0; }
+    int32_t credit() const { return m_credit.load(); }
 
     /**
      * Consumes exactly 1 credit.
      */
     void consume_credit()
     {
-        if (has_credit())
-            m_credit--;
+        // Recharges may be applied concurrently from a dispatcher thread
+        int32_t credit = m_credit.load();
+        while (credit > 0 && credit != UnlimitedCredit && !m_credit.compare_exchange_weak(credit, credit - 1)) { }
     }
 
     void push_message(const NotEnoughCreditMessage &message);
     void push_message(const CreditRechargeResponseMessage &message);
     void push_message(const NoSearchResultsFoundMessage &message);
     void push_message(const SearchResultFoundMessage &message);
+    void push_message(const SearchCountMessage &message);
+    void push_message(const SearchFinishedMessage &message);
+    void push_message(const ServiceOverloadedMessage &message);
     void push_message(const Message &message);
 
 private:
+    static inline TextHelper::ContextWidth s_context_width;
+
+    static std::default_random_engine &random_engine()
+    {
+        static std::default_random_engine s_random_engine(std::chrono::system_clock::now().time_since_epoch().count());
+        return s_random_engine;
+    }
+
     uint32_t m_id;
     SubscriptionType m_subscription_type;
-    int32_t m_credit;
+    std::atomic<int32_t> m_credit;
+    ClientDelegate *m_delegate = nullptr;
+    std::atomic<size_t> m_pending_recharge_count = 0;
 };
 }
\ No newline at end of file
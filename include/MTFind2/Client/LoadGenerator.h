@@ -0,0 +1,175 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <MTFind2/Search/SearchProvider.h>
+#include <Shared/Histogram.h>
+#include <Shared/Mailbox.h>
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+#include "Client.h"
+#include "Workload.h"
+
+namespace mtfind2 {
+/**
+ * Issues search requests at a given rate regardless of how fast they are
+ * answered (open loop), so that the provider can be pushed past saturation
+ * and its tail latency measured honestly. Queries are dictionary words picked
+ * with a Zipfian popularity, and each request comes from a new client with a
+ * random subscription type. Latencies are measured from the time a request
+ * was scheduled to be sent, so that a late generator doesn't hide queueing.
+ * Alternatively, it replays a captured workload, so that runs before and
+ * after some change can be compared request for request.
+ */
+struct LoadGenerator final : ClientDelegate, NonCopyable, NonMoveable {
+    enum struct ArrivalProcess {
+        /**
+         * Exponentially distributed gaps between requests.
+         */
+        Poisson,
+        Constant
+    };
+
+    struct Options final {
+        /**
+         * Requests per second.
+         */
+        double rate = 50;
+        ArrivalProcess arrival_process = ArrivalProcess::Poisson;
+
+        /**
+         * Exponent of the Zipfian distribution of query popularity, zero
+         * meaning that every word is equally popular.
+         */
+        double zipf_exponent = 1;
+
+        /**
+         * Fraction of the requests issued by premium clients.
+         */
+        double premium_ratio = 0.5;
+
+        /**
+         * For how long requests are issued, forever if zero.
+         */
+        std::chrono::seconds duration { 30 };
+
+        /**
+         * Seed for every random decision, a random one if zero.
+         */
+        uint32_t seed = 0;
+    };
+
+    /**
+     * @param words Queries, from the most popular to the least popular
+     * @param mailbox_dispatcher Dispatcher for the mailboxes of clients, if
+     * messages are to be handled asynchronously
+     */
+    LoadGenerator(SearchProvider &search_provider, std::vector<std::string> words, const Options &options, MailboxDispatcher *mailbox_dispatcher = nullptr);
+    ~LoadGenerator();
+
+    /**
+     * Issues requests for the configured duration or until told to stop, and
+     * then waits a little for the outstanding ones to finish.
+     */
+    void run(const std::atomic<bool> &keep_running);
+
+    /**
+     * Issues captured requests, and then waits a little for the outstanding
+     * ones to finish.
+     * @param speed How much faster than captured requests are issued, or
+     * zero to issue them as fast as possible
+     * @param max_outstanding_count When issuing requests as fast as possible,
+     * how many may be outstanding at once, so that the provider is pushed to
+     * its limit rather than flooded
+     */
+    void replay(const std::vector<CapturedRequest> &requests, double speed, size_t max_outstanding_count, const std::atomic<bool> &keep_running);
+
+    /**
+     * Prints the achieved rate and latency percentiles of each subscription
+     * type.
+     */
+    void print_report(std::ostream &stream) const;
+
+    void on_search_result(const SearchRequest &search_request, const ContentSource &, const SearchResult &) override;
+    void on_search_count(const SearchRequest &, size_t) override { }
+    void on_service_overloaded(const SearchRequest &search_request, std::chrono::milliseconds) override;
+    void on_search_finished(const SearchRequest &search_request, std::chrono::steady_clock::time_point started_time) override;
+    void on_credit_recharged(size_t) override { }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request;
+
+    /**
+     * What happened to the requests of a subscription type.
+     */
+    struct Statistics final : NonCopyable, NonMoveable {
+        std::atomic<size_t> issued_count = 0;
+        std::atomic<size_t> finished_count = 0;
+        std::atomic<size_t> overloaded_count = 0;
+        std::atomic<size_t> result_count = 0;
+
+        /**
+         * Time from scheduling to finishing, split into the time spent
+         * waiting to be attended and the time spent being attended. Requests
+         * turned away are only counted as overloaded.
+         */
+        Histogram end_to_end;
+        Histogram queue_wait;
+        Histogram service_time;
+    };
+
+    SearchProvider &m_search_provider;
+    const std::vector<std::string> m_words;
+    const Options m_options;
+    MailboxDispatcher *const m_mailbox_dispatcher;
+
+    std::map<Client::SubscriptionType, Statistics> m_statistics;
+    Clock::time_point m_start_time;
+    Clock::time_point m_end_time;
+
+    std::mutex m_requests_lock;
+    std::unordered_map<const SearchRequest *, std::unique_ptr<Request>> m_requests;
+    std::condition_variable m_request_finished_condition;
+
+    /**
+     * Finished requests whose client may still be waiting for a credit
+     * recharge, see Client::is_idle().
+     */
+    std::vector<std::unique_ptr<Request>> m_finished_requests;
+
+    Statistics &statistics(const SearchRequest &search_request);
+    void issue(std::unique_ptr<Request> request);
+    void drain(const std::atomic<bool> &keep_running);
+    size_t reap_finished_requests();
+};
+}
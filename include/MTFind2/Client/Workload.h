@@ -0,0 +1,107 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <MTFind2/Search/SearchProvider.h>
+
+#include "Client.h"
+
+namespace mtfind2 {
+/**
+ * Search request as it arrived, so that it can be issued again later.
+ */
+struct CapturedRequest final {
+    /**
+     * Time since the capture started.
+     */
+    std::chrono::microseconds arrival_offset;
+    Client::SubscriptionType subscription_type;
+
+    /**
+     * Credit the client had when it issued the request.
+     */
+    int32_t credit;
+    std::string query;
+};
+
+/**
+ * Layout of a captured workload. Every record takes a handful of bytes plus
+ * its query, so a long capture stays small:
+ *
+ *   Header | (varint arrival delta | type | varint credit | varint length | query)*
+ *
+ * Arrival deltas are the microseconds since the previous request. Types are
+ * 'S' for standard and 'P' for premium. Credits are zigzag-encoded, since
+ * clients that don't use credit have -1.
+ */
+struct WorkloadFormat final {
+    static constexpr char Magic[8] = { 'M', 'T', 'F', '2', 'W', 'K', 'L', 'D' };
+    static constexpr uint32_t Version = 1;
+
+#pragma pack(push, 1)
+    struct Header {
+        char magic[8];
+        uint32_t version;
+    };
+#pragma pack(pop)
+
+    /**
+     * @throws std::runtime_error if the file can't be read or is malformed
+     */
+    static std::vector<CapturedRequest> read(const std::string &file_path);
+};
+
+/**
+ * Search provider that writes down every search request before handing it to
+ * another provider, see WorkloadFormat.
+ */
+struct WorkloadRecorder final : SearchProvider {
+    /**
+     * @throws std::runtime_error if the file can't be created
+     */
+    WorkloadRecorder(SearchProvider &search_provider, const std::string &file_path);
+    ~WorkloadRecorder() { close(); }
+
+    void query(Client &client, const SearchRequest &search_request) override;
+
+    /**
+     * Writes out any buffered record. Later requests are no longer recorded.
+     */
+    void close();
+
+    size_t request_count() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    SearchProvider &m_search_provider;
+    mutable std::mutex m_lock;
+    std::ofstream m_stream;
+    std::string m_buffer;
+    Clock::time_point m_start_time;
+    std::chrono::microseconds m_last_offset {};
+    size_t m_request_count = 0;
+};
+}
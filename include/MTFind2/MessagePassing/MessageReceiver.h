@@ -17,8 +17,11 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 
+#include <Shared/Mailbox.h>
+
 #include "Message.h"
 
 namespace mtfind2 {
@@ -38,10 +41,36 @@ struct MessageReceiver {
      */
     virtual void push_message(const Message &) = 0;
 
+    /**
+     * Switches this receiver to mailbox mode: from now on, messages are handled
+     * asynchronously by the dispatcher threads, in the order they were pushed,
+     * and push_message() returns right away. This is meant to be called once,
+     * before any message is pushed.
+     * @remarks Messages must then carry everything their handlers need, since
+     * anything they refer to may be gone by the time they are handled.
+     */
+    void enable_mailbox(MailboxDispatcher &dispatcher) { m_mailbox = std::make_unique<Mailbox>(dispatcher); }
+    bool has_mailbox() const { return m_mailbox != nullptr; }
+
 protected:
     std::mutex &transaction_lock() { return m_transaction_lock; }
 
+    /**
+     * Runs a message handler, either right away or, in mailbox mode, later on
+     * a dispatcher thread.
+     * @param handler Callable owning a copy of whatever it needs from the message
+     */
+    template<typename Handler>
+    void dispatch(Handler &&handler)
+    {
+        if (m_mailbox)
+            m_mailbox->post(std::forward<Handler>(handler));
+        else
+            handler();
+    }
+
 private:
     std::mutex m_transaction_lock;
+    std::unique_ptr<Mailbox> m_mailbox;
 };
 }
\ No newline at end of file
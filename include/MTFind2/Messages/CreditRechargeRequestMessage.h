@@ -17,30 +17,33 @@
 
 #pragma once
 
+#include <memory>
+
 #include <MTFind2/MessagePassing/Message.h>
 #include <Shared/Semaphore.h>
 
 namespace mtfind2 {
+struct Client;
 
 /**
  * Message passed by a client to the payment system to requests the recharge of
  * a specific amount of credits.
  */
 struct CreditRechargeRequestMessage final : private Message {
-    CreditRechargeRequestMessage(Client &client, Semaphore &semaphore, size_t amount)
+    CreditRechargeRequestMessage(Client &client, std::shared_ptr<Semaphore> semaphore, size_t amount)
         : m_client(client)
         , m_amount(amount)
-        , m_semaphore(semaphore)
+        , m_semaphore(std::move(semaphore))
     {
     }
 
     Client &client() const { return m_client; }
     size_t amount() const { return m_amount; }
-    Semaphore &semaphore() const { return m_semaphore; }
+    const std::shared_ptr<Semaphore> &semaphore() const { return m_semaphore; }
 
 private:
     Client &m_client;
     const size_t m_amount;
-    Semaphore &m_semaphore;
+    const std::shared_ptr<Semaphore> m_semaphore;
 };
 }
\ No newline at end of file
@@ -18,8 +18,10 @@
 #pragma once
 
 #include <cstdlib>
+#include <memory>
 
 #include <MTFind2/MessagePassing/Message.h>
+#include <Shared/Semaphore.h>
 
 namespace mtfind2 {
 /**
@@ -27,14 +29,21 @@ namespace mtfind2 {
  * a specific amount of credits.
  */
 struct CreditRechargeResponseMessage final : private Message {
-    CreditRechargeResponseMessage(size_t amount)
+    CreditRechargeResponseMessage(size_t amount, std::shared_ptr<Semaphore> semaphore = nullptr)
         : m_amount(amount)
+        , m_semaphore(std::move(semaphore))
     {
     }
 
     size_t amount() const { return m_amount; }
 
+    /**
+     * To be notified by the client once the credit has been applied, if any.
+     */
+    const std::shared_ptr<Semaphore> &semaphore() const { return m_semaphore; }
+
 private:
     const size_t m_amount;
+    const std::shared_ptr<Semaphore> m_semaphore;
 };
 }
\ No newline at end of file
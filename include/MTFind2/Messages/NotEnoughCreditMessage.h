@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include <MTFind2/MessagePassing/Message.h>
 #include <Shared/Semaphore.h>
 
@@ -27,14 +29,18 @@ namespace mtfind2 {
  * search request.
  */
 struct NotEnoughCreditMessage final : private Message {
-    NotEnoughCreditMessage(Semaphore &semaphore)
-        : m_semaphore(semaphore)
+    NotEnoughCreditMessage(std::shared_ptr<Semaphore> semaphore)
+        : m_semaphore(std::move(semaphore))
     {
     }
 
-    Semaphore &semaphore() const { return m_semaphore; }
+    /**
+     * Notified once the credit has been recharged. Shared, since the search
+     * provider may not wait for it.
+     */
+    const std::shared_ptr<Semaphore> &semaphore() const { return m_semaphore; }
 
 private:
-    Semaphore &m_semaphore;
+    const std::shared_ptr<Semaphore> m_semaphore;
 };
 }
\ No newline at end of file
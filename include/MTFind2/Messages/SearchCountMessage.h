@@ -0,0 +1,45 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstddef>
+
+#include <MTFind2/MessagePassing/Message.h>
+#include <MTFind2/Search/SearchRequest.h>
+
+namespace mtfind2 {
+/**
+ * Message passed from a search provider to a client to notify the number of
+ * occurrences of a search term, instead of the occurrences themselves. This is
+ * the degraded answer given to search requests while the provider is overloaded.
+ */
+struct SearchCountMessage final : private Message {
+    SearchCountMessage(const SearchRequest &search_request, size_t occurrence_count)
+        : m_search_request(search_request)
+        , m_occurrence_count(occurrence_count)
+    {
+    }
+
+    const SearchRequest &search_request() const { return m_search_request; }
+    size_t occurrence_count() const { return m_occurrence_count; }
+
+private:
+    const SearchRequest &m_search_request;
+    const size_t m_occurrence_count;
+};
+}
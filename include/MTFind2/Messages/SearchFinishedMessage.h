@@ -0,0 +1,48 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <chrono>
+
+#include <MTFind2/MessagePassing/Message.h>
+#include <MTFind2/Search/SearchRequest.h>
+
+namespace mtfind2 {
+/**
+ * Message passed from a search provider to a client once it is done with a
+ * search request, whatever the outcome. No other message about that request
+ * follows, so the client may dispose of it.
+ */
+struct SearchFinishedMessage final : private Message {
+    /**
+     * @param started_time When the provider started working on the request,
+     * if it ever did (e.g. rejected requests never start)
+     */
+    explicit SearchFinishedMessage(const SearchRequest &search_request, std::chrono::steady_clock::time_point started_time = {})
+        : m_search_request(search_request)
+        , m_started_time(started_time)
+    {
+    }
+
+    const SearchRequest &search_request() const { return m_search_request; }
+    std::chrono::steady_clock::time_point started_time() const { return m_started_time; }
+
+private:
+    const SearchRequest &m_search_request;
+    const std::chrono::steady_clock::time_point m_started_time;
+};
+}
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <MTFind2/MessagePassing/Message.h>
+#include <MTFind2/Search/ContentSource.h>
 #include <MTFind2/Search/SearchRequest.h>
 #include <MTFind2/Search/SearchResult.h>
 
@@ -27,17 +28,25 @@ namespace mtfind2 {
  * request to notify the finding of a single occurrence.
  */
 struct SearchResultFoundMessage final : private Message {
-    SearchResultFoundMessage(const SearchRequest &search_request, const SearchResult &search_result)
+    SearchResultFoundMessage(const SearchRequest &search_request, const ContentSource &content_source, const SearchResult &search_result)
         : m_search_request(search_request)
+        , m_content_source(content_source)
         , m_search_result(search_result)
     {
     }
 
     const SearchRequest &search_request() const { return m_search_request; }
+
+    /**
+     * Content source the occurrence was found in. Only guaranteed to be alive
+     * while the message is being handled.
+     */
+    const ContentSource &content_source() const { return m_content_source; }
     const SearchResult &search_result() const { return m_search_result; }
 
 private:
     const SearchRequest &m_search_request;
-    const SearchResult &m_search_result;
+    const ContentSource &m_content_source;
+    const SearchResult m_search_result;
 };
 }
\ No newline at end of file
@@ -17,9 +17,11 @@
 
 #pragma once
 
+#include <MTFind2/Client/Client.h>
 #include <MTFind2/MessagePassing/MessageReceiver.h>
 #include <MTFind2/Messages/CreditRechargeRequestMessage.h>
 #include <MTFind2/Messages/CreditRechargeResponseMessage.h>
+#include <Shared/Metrics.h>
 #include <Shared/NonCopyable.h>
 #include <Shared/NonMoveable.h>
 
@@ -56,17 +58,20 @@ struct PaymentService final : MessageReceiver, NonCopyable, NonMoveable {
      */
     void push_message(const CreditRechargeRequestMessage &message)
     {
-        const std::scoped_lock lock(transaction_lock());
+        dispatch([this, &client = message.client(), amount = message.amount(), semaphore = message.semaphore()] {
+            const std::scoped_lock lock(transaction_lock());
 
-        // Don't recharge credit for free users!
-        if (message.client().subscription_type() == Client::SubscriptionType::Premium) {
-            message.client().push_message(CreditRechargeResponseMessage(message.amount()));
-        } else {
-            message.client().push_message(CreditRechargeResponseMessage(0));
-        }
-
-        // Notify a credit recharge response
-        message.semaphore().notify();
+            // Don't recharge credit for free users! The client notifies the
+            // semaphore once it has applied the recharge
+            if (client.subscription_type() == Client::SubscriptionType::Premium) {
+                m_granted_count.increment();
+                m_granted_credit.increment(amount);
+                client.push_message(CreditRechargeResponseMessage(amount, semaphore));
+            } else {
+                m_denied_count.increment();
+                client.push_message(CreditRechargeResponseMessage(0, semaphore));
+            }
+        });
     }
 
     void push_message(const Message &message)
@@ -74,6 +79,15 @@ struct PaymentService final : MessageReceiver, NonCopyable, NonMoveable {
     }
 
 private:
-    PaymentService() { }
+    Counter &m_granted_count;
+    Counter &m_denied_count;
+    Counter &m_granted_credit;
+
+    PaymentService()
+        : m_granted_count(MetricsRegistry::instance().counter("mtfind2_credit_recharges_total", "Credit recharge requests, by whether they were granted.", "result=\"granted\""))
+        , m_denied_count(MetricsRegistry::instance().counter("mtfind2_credit_recharges_total", "Credit recharge requests, by whether they were granted.", "result=\"denied\""))
+        , m_granted_credit(MetricsRegistry::instance().counter("mtfind2_credit_recharged_total", "Credit granted by recharges."))
+    {
+    }
 };
 }
\ No newline at end of file
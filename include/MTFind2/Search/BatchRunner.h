@@ -0,0 +1,167 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+#include <Shared/PerfCounters.h>
+
+#include "Corpus.h"
+
+namespace mtfind2 {
+/**
+ * Layout of the binary output of a batch run. Records are written in input
+ * order; a source record always precedes the first result that refers to it.
+ *
+ *   Header | ('S' SourceRecord path | 'R' ResultRecord)*
+ *
+ * Every field is little-endian and records are not padded.
+ */
+struct BatchOutputFormat final {
+    static constexpr char Magic[8] = { 'M', 'T', 'F', '2', 'B', 'R', 'E', 'S' };
+    static constexpr uint32_t Version = 1;
+
+    static constexpr char SourceTag = 'S';
+    static constexpr char ResultTag = 'R';
+
+#pragma pack(push, 1)
+    struct Header {
+        char magic[8];
+        uint32_t version;
+    };
+
+    struct SourceRecord {
+        uint32_t source_id;
+        uint16_t path_length;
+    };
+
+    struct ResultRecord {
+        /**
+         * Line of the input the query was read from, starting at 1.
+         */
+        uint32_t query_line;
+        uint32_t source_id;
+        uint32_t line;
+        uint32_t column;
+        uint64_t offset;
+        uint32_t length;
+    };
+#pragma pack(pop)
+
+    static_assert(std::is_trivially_copyable_v<ResultRecord> && sizeof(ResultRecord) == 28);
+};
+
+/**
+ * Runs a large number of queries read from a stream, one per line, against a
+ * corpus, with no clients, credit nor interactive output. Work flows through a
+ * pipeline of stages connected by bounded queues:
+ *
+ *   read -> group -> scan (one thread per core) -> format
+ *
+ * Queries are read in chunks, grouped in batches where repeated queries are
+ * only scanned for once, scanned on every core and formatted in input order.
+ */
+struct BatchRunner final : NonCopyable, NonMoveable {
+    enum struct OutputFormat {
+        /**
+         * One line per result: query line, source path, line, column, offset
+         * and length, separated by tabs.
+         */
+        Tsv,
+        /**
+         * See BatchOutputFormat.
+         */
+        Binary
+    };
+
+    struct Options final {
+        OutputFormat output_format = OutputFormat::Tsv;
+        size_t batch_size = 256;
+
+        /**
+         * Zero meaning one per core.
+         */
+        size_t scan_thread_count = 0;
+
+        /**
+         * Items each queue between stages can hold.
+         */
+        size_t queue_capacity = 16;
+    };
+
+    struct Report final {
+        size_t query_count = 0;
+        size_t distinct_query_count = 0;
+        size_t result_count = 0;
+
+        /**
+         * Size of the corpus times the number of distinct queries of every
+         * batch. Indexes spare reading some of it, so this is how much text
+         * the queries were answered for rather than how much was read.
+         */
+        uint64_t corpus_size = 0;
+        std::chrono::steady_clock::duration elapsed_time {};
+
+        /**
+         * Hardware events counted by the scan stage, if counting is on.
+         */
+        std::optional<PerfSample> perf_sample;
+
+        void print(std::ostream &stream) const;
+    };
+
+    BatchRunner(const Corpus &corpus, Options options)
+        : m_corpus(corpus)
+        , m_options(options)
+    {
+    }
+
+    /**
+     * @throws std::runtime_error if the output can't be written
+     */
+    Report run(std::istream &input, std::ostream &output) const;
+
+private:
+    struct Query;
+    struct Match;
+    struct Batch;
+
+    const Corpus &m_corpus;
+    const Options m_options;
+
+    /**
+     * Finds out which queries of a batch are repeated.
+     */
+    static void group(Batch &batch);
+    void scan(Batch &batch) const;
+
+    /**
+     * Appends the results of a batch to a buffer, in input order.
+     * @return Number of results formatted
+     */
+    static size_t format(const Batch &batch, OutputFormat output_format, std::unordered_set<uint32_t> &written_source_ids, std::string &buffer);
+};
+}
@@ -0,0 +1,157 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Shared/FoldedText.h>
+#include <Shared/NgramFilter.h>
+#include <Shared/TextHelper.h>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+/**
+ * Content source kept in memory compressed, trading scan time for memory.
+ * Both the original text and its folded copy are split into blocks that are
+ * compressed independently (see LzCodec), so that a scan only decompresses
+ * the blocks it has to search into a buffer of its thread, one at a time.
+ * Just like MemoryContentSource, every block of folded text is summarized by
+ * an n-gram filter so that blocks that can't have occurrences are not even
+ * decompressed.
+ *
+ * Instead of the offset of every line, only the line each block starts in is
+ * kept; lines are counted within the block when an occurrence is found.
+ */
+struct CompressedContentSource final : ContentSource {
+    static constexpr size_t BlockSize = 64 << 10;
+
+    /**
+     * Filters also cover the n-grams that start this far past the end of their
+     * block, see MemoryContentSource::BlockOverlap.
+     */
+    static constexpr size_t BlockOverlap = 64;
+
+    /**
+     * Maximum number of bytes decompressed on each side of an occurrence in
+     * order to extract its surrounding text.
+     */
+    static constexpr uint64_t MaxContextSize = 4 << 10;
+
+    /**
+     * Loads and compresses a plain text file.
+     */
+    CompressedContentSource(std::string file_path, TextHelper::FoldMode fold_mode = TextHelper::FoldMode::CaseInsensitive);
+
+    /**
+     * Decompresses each candidate block in turn, and the next one as well if
+     * an occurrence may continue into it.
+     */
+    void scan(std::string_view folded_query, const OccurrenceCallback &callback) const override;
+
+    std::string surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width = {}) const override;
+
+    uint64_t size() const override { return m_text.size; }
+    uint64_t memory_usage() const override;
+
+    /**
+     * @return Memory the same text would take as a MemoryContentSource
+     */
+    uint64_t uncompressed_memory_usage() const { return m_uncompressed_memory_usage; }
+
+    size_t line_count() const { return m_line_count; }
+    size_t block_count() const { return m_folded_text.block_count(); }
+
+private:
+    /**
+     * A text split into blocks of BlockSize bytes (but the last one), each
+     * compressed on its own.
+     */
+    struct BlockSequence {
+        uint64_t size = 0;
+        std::string data;
+
+        /**
+         * Where each block starts in `data', plus a trailing offset past the
+         * end of the last one.
+         */
+        std::vector<uint64_t> offsets { 0 };
+
+        BlockSequence() = default;
+        explicit BlockSequence(std::string_view text);
+
+        size_t block_count() const { return offsets.size() - 1; }
+        size_t block_size(size_t index) const { return std::min<uint64_t>(BlockSize, size - index * BlockSize); }
+        uint64_t memory_usage() const { return data.size() + offsets.size() * sizeof(uint64_t); }
+
+        /**
+         * Decompresses a block into a buffer of at least block_size(index) bytes.
+         * @return Whether the block was intact
+         */
+        bool decompress(size_t index, char *output) const;
+    };
+
+    struct BlockLines {
+        /**
+         * Index of the line the first byte of the block belongs to.
+         */
+        size_t line_index;
+
+        /**
+         * Folded offset where that line starts, which may be in an earlier block.
+         */
+        uint64_t line_offset;
+    };
+
+    /**
+     * Decompressed blocks of folded text that a thread is scanning.
+     */
+    struct Window;
+
+    /**
+     * @return The window of the calling thread
+     */
+    static Window &scan_window();
+
+    BlockSequence m_text;
+    BlockSequence m_folded_text;
+    std::vector<OffsetMap::Anchor> m_anchors;
+    std::vector<BlockLines> m_block_lines;
+    std::vector<NgramFilter> m_block_filters;
+    size_t m_line_count = 0;
+    uint64_t m_uncompressed_memory_usage = 0;
+
+    /**
+     * Makes the window hold `count' blocks of folded text starting at
+     * `first_block', keeping those it already has.
+     * @return The text of those blocks
+     */
+    std::string_view load_window(Window &window, size_t first_block, size_t count) const;
+
+    /**
+     * Tells, for each block, whether an occurrence of the query may start in
+     * it, see MemoryContentSource::find_candidate_blocks().
+     */
+    std::vector<bool> find_candidate_blocks(std::string_view folded_query) const;
+
+    uint64_t to_original(uint64_t folded_pos) const { return OffsetMap::to_original(m_anchors, folded_pos); }
+};
+}
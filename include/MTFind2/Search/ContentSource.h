@@ -17,36 +17,146 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+
 #include <Shared/NonCopyable.h>
 #include <Shared/Tagged.h>
-
-#include <fstream>
-#include <iostream>
-#include <string>
+#include <Shared/TextHelper.h>
 
 namespace mtfind2 {
+struct MemoryBudget;
+
+/**
+ * A single occurrence of a search term within a content source. Positions and
+ * lengths refer to the original (unfolded) text.
+ */
+struct Occurrence final {
+    /**
+     * Byte offset of the occurrence from the beginning of the content source.
+     */
+    uint64_t offset;
+    size_t line;
+    size_t column;
+    size_t length;
+    bool is_final;
+};
+
 /**
  * Content sources map to plain text files where search terms will be looked
- * for in. These are initialized on startup and last until program termination.
- * Since its lifetime is permanent it makes no sense for them to be copied around.
+ * for in. They are immutable once loaded and shared by every corpus snapshot
+ * they belong to, so it makes no sense for them to be copied around. They are
+ * always owned by a std::shared_ptr, so anyone needing one past the lifetime
+ * of a snapshot may obtain it through shared_from_this().
+ * @see MemoryContentSource, CompressedContentSource, StreamingContentSource, LazyContentSource
  */
-struct ContentSource final : NonCopyable, Tagged<std::string> {
-    ContentSource(std::string file_path)
-        : m_file_path(std::move(file_path))
-        , m_stream(m_file_path, std::ios::in) // Open read-only
+struct ContentSource : NonCopyable, Tagged<std::string>, std::enable_shared_from_this<ContentSource> {
+    /**
+     * Receives occurrences as they are found. Returning false stops the scan.
+     */
+    using OccurrenceCallback = std::function<bool(const Occurrence &)>;
+
+    struct Options final {
+        TextHelper::FoldMode fold_mode = TextHelper::FoldMode::CaseInsensitive;
+
+        /**
+         * Files larger than this are scanned from disk instead of being loaded
+         * into memory.
+         */
+        uint64_t streaming_threshold = std::numeric_limits<uint64_t>::max();
+
+        /**
+         * Whether files loaded into memory are kept compressed.
+         * @see CompressedContentSource
+         */
+        bool compress = false;
+
+        /**
+         * When set, files that would be loaded into memory are only loaded on
+         * first use, and unloaded again when they are the coldest ones and the
+         * budget is exceeded.
+         * @see LazyContentSource
+         */
+        std::shared_ptr<MemoryBudget> memory_budget;
+    };
+
+    /**
+     * Opens a content source, choosing the most appropriate representation.
+     * @param file_path Path to a plain text file
+     * @param options Content source options
+     * @return An instance of a class derived from ContentSource
+     */
+    static std::shared_ptr<const ContentSource> open(const std::string &file_path, const Options &options);
+
+    virtual ~ContentSource() = default;
+
+    const std::string tag() const { return "ContentSource(\"" + m_file_path + "\")"; }
+
+    /**
+     * @return An identifier that is unique to this content source during the
+     * lifetime of the program
+     */
+    uint32_t id() const { return m_id; }
+    const std::string &file_path() const { return m_file_path; }
+    TextHelper::FoldMode fold_mode() const { return m_fold_mode; }
+
+    /**
+     * @return Size of the original text, in bytes
+     */
+    virtual uint64_t size() const = 0;
+
+    /**
+     * @return Approximate number of bytes of memory held by this content
+     * source, including the text and everything derived from it
+     */
+    virtual uint64_t memory_usage() const { return 0; }
+
+    /**
+     * Looks for every non-overlapping occurrence of a query, in order.
+     * @param folded_query Query, already folded using this source's fold mode
+     * @param callback Callback invoked for every occurrence
+     */
+    virtual void scan(std::string_view folded_query, const OccurrenceCallback &callback) const = 0;
+
+    /**
+     * Counts the occurrences of a query. By default, this scans for them.
+     */
+    virtual size_t count(std::string_view folded_query) const
     {
-        for (std::string line; std::getline(m_stream, line);)
-            m_lines.push_back(std::move(line));
-        std::cout << tag() << ": " << m_lines.size() << " line(s) read" << std::endl;
-        m_stream.close();
+        size_t occurrence_count = 0;
+        scan(folded_query, [&occurrence_count](const Occurrence &) {
+            occurrence_count++;
+            return true;
+        });
+        return occurrence_count;
     }
 
-    const std::string tag() const { return "ContentSource(\"" + m_file_path + "\")"; }
-    const std::vector<std::string> &lines() const { return m_lines; }
+    /**
+     * Extracts the text around an occurrence, within the line it is in.
+     * @param offset Byte offset of the occurrence
+     * @param length Length of the occurrence, in bytes
+     * @param width How much text to extract on each side
+     */
+    virtual std::string surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width = {}) const = 0;
+
+protected:
+    ContentSource(std::string file_path, TextHelper::FoldMode fold_mode)
+        : m_id(s_last_id++)
+        , m_file_path(std::move(file_path))
+        , m_fold_mode(fold_mode)
+    {
+    }
 
 private:
+    static inline std::atomic<uint32_t> s_last_id = 0;
+
+    const uint32_t m_id;
     const std::string m_file_path;
-    std::ifstream m_stream;
-    std::vector<std::string> m_lines;
+    const TextHelper::FoldMode m_fold_mode;
 };
-}
\ No newline at end of file
+}
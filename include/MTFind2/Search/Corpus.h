@@ -0,0 +1,129 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+#include <Shared/Rcu.h>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+/**
+ * Immutable set of content sources. A new snapshot, with a higher version, is
+ * published every time the corpus changes, while in-flight queries keep using
+ * the snapshot they started with.
+ */
+struct CorpusSnapshot final : NonCopyable {
+    CorpusSnapshot(uint64_t version, std::vector<std::shared_ptr<const ContentSource>> content_sources)
+        : m_version(version)
+        , m_content_sources(std::move(content_sources))
+    {
+    }
+
+    uint64_t version() const { return m_version; }
+    const std::vector<std::shared_ptr<const ContentSource>> &content_sources() const { return m_content_sources; }
+
+private:
+    const uint64_t m_version;
+    const std::vector<std::shared_ptr<const ContentSource>> m_content_sources;
+};
+
+/**
+ * The corpus is the set of content sources shared by every search service.
+ * Readers obtain the current snapshot without taking any lock, whereas writers
+ * copy it, apply their changes and atomically swap it. Content sources are
+ * reference-counted so that they are only freed once no snapshot uses them.
+ */
+struct Corpus final : NonCopyable, NonMoveable {
+    using Snapshot = RcuCell<CorpusSnapshot>::ReadGuard;
+
+    Corpus()
+        : m_snapshot(std::make_unique<const CorpusSnapshot>(0, std::vector<std::shared_ptr<const ContentSource>>()))
+    {
+    }
+
+    /**
+     * Obtains the current snapshot. The snapshot (and every content source in
+     * it) is guaranteed to stay alive until the returned guard is destroyed.
+     */
+    Snapshot snapshot() const { return m_snapshot.read(); }
+
+    /**
+     * Adds a content source or replaces the one with the same file path.
+     */
+    void add_content_source(std::shared_ptr<const ContentSource> content_source)
+    {
+        add_content_sources({ std::move(content_source) });
+    }
+
+    /**
+     * Adds (or replaces) many content sources at once, publishing a single
+     * snapshot.
+     */
+    void add_content_sources(std::vector<std::shared_ptr<const ContentSource>> new_content_sources)
+    {
+        update([&](std::vector<std::shared_ptr<const ContentSource>> &content_sources) {
+            for (auto &content_source : new_content_sources) {
+                const auto it = find(content_sources, content_source->file_path());
+                if (it != content_sources.end())
+                    *it = std::move(content_source);
+                else
+                    content_sources.push_back(std::move(content_source));
+            }
+        });
+    }
+
+    void remove_content_source(const std::string &file_path)
+    {
+        update([&](std::vector<std::shared_ptr<const ContentSource>> &content_sources) {
+            const auto it = find(content_sources, file_path);
+            if (it != content_sources.end())
+                content_sources.erase(it);
+        });
+    }
+
+private:
+    RcuCell<CorpusSnapshot> m_snapshot;
+
+    template<typename Mutator>
+    void update(Mutator &&mutator)
+    {
+        m_snapshot.update([&](const CorpusSnapshot &current) {
+            auto content_sources = current.content_sources();
+            mutator(content_sources);
+            std::clog << "corpus: publishing snapshot v" << current.version() + 1 << " (" << content_sources.size() << " content source(s))" << std::endl;
+            return std::make_unique<const CorpusSnapshot>(current.version() + 1, std::move(content_sources));
+        });
+    }
+
+    static std::vector<std::shared_ptr<const ContentSource>>::iterator find(std::vector<std::shared_ptr<const ContentSource>> &content_sources, const std::string &file_path)
+    {
+        return std::find_if(content_sources.begin(), content_sources.end(), [&](const auto &content_source) {
+            return content_source->file_path() == file_path;
+        });
+    }
+};
+}
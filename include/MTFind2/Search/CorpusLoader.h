@@ -0,0 +1,76 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+/**
+ * Loads many content sources at once on a bounded pool of threads, so that
+ * startup is limited by disk bandwidth rather than by a single thread reading
+ * and folding one file after another.
+ */
+struct CorpusLoader final {
+    struct LoadTime {
+        std::string file_path;
+        uint64_t size;
+        std::chrono::steady_clock::duration duration;
+    };
+
+    /**
+     * @param content_source_options Options used to open every content source
+     * @param thread_count Maximum number of threads, zero meaning one per core
+     */
+    explicit CorpusLoader(ContentSource::Options content_source_options, size_t thread_count = 0);
+
+    /**
+     * Enumerates the content sources in a directory.
+     */
+    static std::vector<std::string> list_directory(const std::filesystem::path &directory);
+
+    /**
+     * Loads the given files concurrently. Files that fail to load are
+     * reported and skipped. While loading, the dictionary is warmed up too,
+     * so that the first random search request doesn't have to parse it.
+     * @return The content sources, in the same order as their paths
+     */
+    std::vector<std::shared_ptr<const ContentSource>> load(const std::vector<std::string> &file_paths);
+
+    /**
+     * @return How long it took to load each file during the last load() call
+     */
+    const std::vector<LoadTime> &load_times() const { return m_load_times; }
+
+    /**
+     * Prints per-file load times and the overall throughput.
+     */
+    void print_report(std::ostream &stream) const;
+
+private:
+    const ContentSource::Options m_content_source_options;
+    const size_t m_thread_count;
+    std::vector<LoadTime> m_load_times;
+    std::chrono::steady_clock::duration m_total_duration {};
+};
+}
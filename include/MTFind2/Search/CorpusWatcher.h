@@ -0,0 +1,73 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+#include "ContentSource.h"
+#include "Corpus.h"
+#include "Shard.h"
+
+namespace mtfind2 {
+/**
+ * Watches a directory for new, changed, renamed or deleted `.txt' files and
+ * keeps the corpus in sync with it. Content sources are loaded on a background
+ * thread and published as a new corpus snapshot once they are ready, so that
+ * searches never stop nor wait while the corpus is being refreshed.
+ * Only available on Linux (inotify), on other platforms start() does nothing.
+ */
+struct CorpusWatcher final : NonCopyable, NonMoveable {
+    /**
+     * @param shard Files that don't belong to this shard are ignored
+     */
+    CorpusWatcher(Corpus &corpus, std::filesystem::path directory, ContentSource::Options content_source_options, Shard shard = {})
+        : m_corpus(corpus)
+        , m_directory(std::move(directory))
+        , m_content_source_options(content_source_options)
+        , m_shard(shard)
+        , m_keep_running(false)
+    {
+    }
+
+    ~CorpusWatcher() { stop(); }
+
+    void start();
+    void stop();
+
+    /**
+     * @return Whether the specified file looks like a content source
+     */
+    static bool is_content_source(const std::filesystem::path &path) { return path.extension() == ".txt"; }
+
+private:
+    Corpus &m_corpus;
+    const std::filesystem::path m_directory;
+    const ContentSource::Options m_content_source_options;
+    const Shard m_shard;
+    std::atomic<bool> m_keep_running;
+    std::thread m_thread;
+    int m_inotify_fd = -1;
+
+    void watch();
+};
+}
@@ -20,14 +20,18 @@
 #include <MTFind2/MessagePassing/MessageReceiver.h>
 #include <MTFind2/Messages/CreditRechargeRequestMessage.h>
 #include <MTFind2/Messages/CreditRechargeResponseMessage.h>
+#include <Shared/Checksum.h>
 #include <Shared/NonCopyable.h>
 #include <Shared/NonMoveable.h>
+#include <Shared/TextHelper.h>
 
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <mutex>
 #include <random>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 namespace mtfind2 {
@@ -50,16 +54,53 @@ struct Dictionary final : NonCopyable, NonMoveable {
 
     const std::string &random_word() const
     {
-        static std::default_random_engine s_random_engine(std::chrono::system_clock::now().time_since_epoch().count());
         std::uniform_int_distribution<int> get_random_index(0ul, m_words.size() - 1);
-        return m_words[get_random_index(s_random_engine)];
+        return m_words[get_random_index(random_engine())];
+    }
+
+    /**
+     * Makes random words repeat from one run to the next. This is meant to be
+     * called once, before any random word is picked.
+     */
+    static void set_random_seed(uint32_t seed) { random_engine().seed(seed); }
+
+    size_t word_count() const { return m_words.size(); }
+    const std::vector<std::string> &words() const { return m_words; }
+
+    /**
+     * Identifies the word list, so that indexes built from it can tell
+     * whether they are still up to date.
+     */
+    uint32_t fingerprint() const { return m_fingerprint; }
+
+    /**
+     * Tells whether a folded query is one of the (folded) words in the
+     * dictionary. The folded word sets are built on first use.
+     */
+    bool contains(const std::string &folded_word, TextHelper::FoldMode fold_mode) const
+    {
+        const auto mode_index = static_cast<size_t>(fold_mode);
+        std::call_once(m_folded_word_flags[mode_index], [this, fold_mode, mode_index] {
+            for (const auto &word : m_words)
+                m_folded_words[mode_index].insert(TextHelper::fold_string(word, fold_mode));
+        });
+        return m_folded_words[mode_index].contains(folded_word);
     }
 
 private:
+    static std::default_random_engine &random_engine()
+    {
+        static std::default_random_engine s_random_engine(std::chrono::system_clock::now().time_since_epoch().count());
+        return s_random_engine;
+    }
+
     const std::string k_dictionary_path { "data/dictionary.list" };
 
     std::ifstream m_dictionary_stream;
     std::vector<std::string> m_words;
+    uint32_t m_fingerprint = 0;
+    mutable std::once_flag m_folded_word_flags[2];
+    mutable std::unordered_set<std::string> m_folded_words[2];
 
     Dictionary()
     {
@@ -68,8 +109,10 @@ private:
 
         m_dictionary_stream.open(k_dictionary_path, std::ios::in);
 
-        for (std::string word; std::getline(m_dictionary_stream, word);)
+        for (std::string word; std::getline(m_dictionary_stream, word);) {
+            m_fingerprint = Checksum::crc32c(word + '\n', m_fingerprint);
             m_words.push_back(std::move(word));
+        }
     }
 };
 }
\ No newline at end of file
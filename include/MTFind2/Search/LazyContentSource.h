@@ -0,0 +1,79 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "ContentSource.h"
+#include "MemoryBudget.h"
+
+namespace mtfind2 {
+/**
+ * Content source that is only loaded into memory when first used, and may be
+ * unloaded again by its memory budget. Every use grabs a reference to the
+ * loaded source for as long as it lasts, so unloading never pulls the text
+ * from under a scan in progress; it is just loaded again next time.
+ */
+struct LazyContentSource final : ContentSource {
+    /**
+     * @param options Options to load the source with, including the memory
+     * budget it is accounted to
+     */
+    LazyContentSource(std::string file_path, const Options &options);
+    ~LazyContentSource();
+
+    void scan(std::string_view folded_query, const OccurrenceCallback &callback) const override { acquire()->scan(folded_query, callback); }
+    size_t count(std::string_view folded_query) const override { return acquire()->count(folded_query); }
+    std::string surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width = {}) const override { return acquire()->surrounding_text(offset, length, width); }
+
+    uint64_t size() const override { return m_size; }
+
+    /**
+     * @return Memory taken by the loaded source, if it is loaded at all
+     */
+    uint64_t memory_usage() const override { return m_memory_usage.load(); }
+
+    /**
+     * Obtains the loaded source, loading it if needed, and counts the access.
+     * @return The loaded source, which stays loaded until the reference is dropped
+     */
+    std::shared_ptr<const ContentSource> acquire() const;
+
+    bool is_resident() const { return m_content_source.load() != nullptr; }
+
+private:
+    friend struct MemoryBudget;
+
+    Options m_options;
+    const std::shared_ptr<MemoryBudget> m_memory_budget;
+    const uint64_t m_size;
+    mutable std::mutex m_load_lock;
+    mutable std::atomic<std::shared_ptr<const ContentSource>> m_content_source;
+
+    /**
+     * Number of times this source was used, halved by the memory budget every
+     * time some source is loaded.
+     */
+    mutable std::atomic<uint64_t> m_access_count = 0;
+    mutable std::atomic<uint64_t> m_memory_usage = 0;
+};
+}
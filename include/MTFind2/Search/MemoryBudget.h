@@ -0,0 +1,91 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+struct LazyContentSource;
+
+/**
+ * Caps the memory taken by lazily loaded content sources. Every time one is
+ * loaded, the coldest other ones are unloaded until the resident size fits in
+ * the budget again, so that a corpus larger than memory can be served as long
+ * as the files it is actually searched in do fit.
+ *
+ * Sources are ranked by how many times they were used, a count that is halved
+ * on every load so that sources that used to be hot eventually make room.
+ * Unloading a source only drops the budget's reference to its text: scans
+ * still using it keep it alive until they are done.
+ */
+struct MemoryBudget final : NonCopyable, NonMoveable {
+    /**
+     * @param capacity Maximum number of bytes resident at once. A single source
+     * larger than that is still loaded, evicting every other one.
+     */
+    explicit MemoryBudget(uint64_t capacity);
+
+    uint64_t capacity() const { return m_capacity; }
+
+    /**
+     * @return Memory taken by the sources currently loaded
+     */
+    uint64_t resident_size() const;
+
+    /**
+     * @return Size of the text of every source, loaded or not
+     */
+    uint64_t total_size() const;
+
+    /**
+     * Prints the resident and total size of the corpus and how many sources
+     * were loaded and evicted.
+     */
+    void print_summary(std::ostream &stream) const;
+
+private:
+    friend struct LazyContentSource;
+
+    const uint64_t m_capacity;
+    mutable std::mutex m_lock;
+    std::vector<const LazyContentSource *> m_sources;
+    uint64_t m_resident_size = 0;
+    uint64_t m_total_size = 0;
+    size_t m_resident_count = 0;
+    uint64_t m_load_count = 0;
+    uint64_t m_eviction_count = 0;
+
+    void add(const LazyContentSource &source);
+    void remove(const LazyContentSource &source);
+
+    /**
+     * Makes a freshly loaded source resident and evicts the coldest other
+     * sources until everything fits.
+     */
+    void admit(const LazyContentSource &source, std::shared_ptr<const ContentSource> content_source);
+};
+}
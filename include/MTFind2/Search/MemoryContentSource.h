@@ -0,0 +1,280 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <Shared/TextHelper.h>
+#include <Shared/NgramFilter.h>
+
+#include "ContentSource.h"
+#include "OccurrenceIndex.h"
+
+namespace mtfind2 {
+/**
+ * Content source whose whole text is kept in memory. Along with the original
+ * text, a folded shadow copy is computed once on load so that queries don't
+ * need to normalize the text they are looking into.
+ *
+ * The source only holds views into its data, which may be owned by itself or
+ * live somewhere else, e.g. in a memory-mapped corpus snapshot.
+ */
+struct MemoryContentSource final : ContentSource {
+    /**
+     * Size of the blocks of folded text summarized by an n-gram filter. Filters
+     * take 4 KiB each, about 6% of the text.
+     */
+    static constexpr size_t BlockSize = 64 << 10;
+
+    /**
+     * Filters also cover the n-grams that start this far past the end of their
+     * block, so that the first n-grams of any occurrence that starts in a block
+     * are all in its filter.
+     */
+    static constexpr size_t BlockOverlap = 64;
+
+    /**
+     * Everything a memory content source is made of.
+     */
+    struct Layout {
+        std::string_view text;
+        std::string_view folded_text;
+        std::span<const OffsetMap::Anchor> anchors;
+
+        /**
+         * Offsets where each line starts, plus a trailing offset right past the
+         * end of the last line. Folding preserves line terminators, so both
+         * texts have the same number of lines.
+         */
+        std::span<const uint64_t> line_offsets;
+        std::span<const uint64_t> folded_line_offsets;
+    };
+
+    /**
+     * Validates the data backing a content source.
+     * @return Whether the data is valid
+     */
+    using Validator = std::function<bool()>;
+
+    /**
+     * Loads a content source from a plain text file.
+     */
+    MemoryContentSource(std::string file_path, TextHelper::FoldMode fold_mode = TextHelper::FoldMode::CaseInsensitive)
+        : ContentSource(std::move(file_path), fold_mode)
+    {
+        auto data = std::make_shared<OwnedData>();
+        std::ifstream stream(this->file_path(), std::ios::in | std::ios::binary | std::ios::ate); // Open read-only
+        if (stream) {
+            data->text.resize(stream.tellg());
+            stream.seekg(0).read(data->text.data(), data->text.size());
+            data->text.resize(stream.gcount());
+        }
+        data->folded_text = TextHelper::fold(data->text, fold_mode);
+        data->line_offsets = split_lines(data->text);
+        data->folded_line_offsets = split_lines(data->folded_text.text);
+
+        m_layout = {
+            .text = data->text,
+            .folded_text = data->folded_text.text,
+            .anchors = data->folded_text.offsets.anchors(),
+            .line_offsets = data->line_offsets,
+            .folded_line_offsets = data->folded_line_offsets
+        };
+        m_storage = std::move(data);
+        std::clog << tag() << ": " << line_count() << " line(s) read" << std::endl;
+    }
+
+    /**
+     * Creates a content source from data owned by someone else.
+     * @param layout Views into the data
+     * @param storage Object that keeps the data alive
+     * @param validator Optional validator, run once before the data is used
+     */
+    MemoryContentSource(std::string file_path, TextHelper::FoldMode fold_mode, const Layout &layout, std::shared_ptr<const void> storage, Validator validator = nullptr)
+        : ContentSource(std::move(file_path), fold_mode)
+        , m_layout(layout)
+        , m_storage(std::move(storage))
+        , m_validator(std::move(validator))
+    {
+    }
+
+    /**
+     * Looks the query up in the occurrence index if there is one that covers
+     * it, otherwise scans the whole folded buffer at once (see scan_whole_buffer()).
+     */
+    void scan(std::string_view folded_query, const OccurrenceCallback &callback) const override;
+
+    /**
+     * Takes the count from the occurrence index, if it covers the query.
+     */
+    size_t count(std::string_view folded_query) const override;
+
+    /**
+     * Looks for the query in the whole folded buffer in a single pass, and only
+     * resolves line and column numbers for actual occurrences, so that no cost
+     * is paid per line. Occurrences spanning several lines are found as well.
+     * Blocks whose n-gram filters rule out an occurrence are skipped.
+     */
+    void scan_whole_buffer(std::string_view folded_query, const OccurrenceCallback &callback) const;
+
+    /**
+     * Looks for the query one line at a time. Mostly useful for comparison.
+     */
+    void scan_line_by_line(std::string_view folded_query, const OccurrenceCallback &callback) const;
+
+    std::string surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width = {}) const override
+    {
+        const auto line_index = this->line_index(offset);
+        const auto column = offset - line_offset(line_index);
+        return std::string(TextHelper::get_surrounding_text(line(line_index), column, column + length, width));
+    }
+
+    const Layout &layout() const { return m_layout; }
+    std::string_view text() const { return m_layout.text; }
+    uint64_t size() const override { return m_layout.text.size(); }
+
+    /**
+     * Counts the text, its folded copy, the offsets and the block filters
+     * (whether or not they have been built yet), but not the occurrence index.
+     */
+    uint64_t memory_usage() const override
+    {
+        const uint64_t block_count = (m_layout.folded_text.size() + BlockSize - 1) / BlockSize;
+        return m_layout.text.size() + m_layout.folded_text.size() + m_layout.anchors.size_bytes()
+            + m_layout.line_offsets.size_bytes() + m_layout.folded_line_offsets.size_bytes()
+            + block_count * sizeof(NgramFilter);
+    }
+    std::string_view folded_text() const { return m_layout.folded_text; }
+    uint64_t to_original(uint64_t folded_pos) const { return OffsetMap::to_original(m_layout.anchors, folded_pos); }
+
+    size_t line_count() const { return m_layout.line_offsets.size() - 1; }
+    uint64_t line_offset(size_t index) const { return m_layout.line_offsets[index]; }
+    uint64_t folded_line_offset(size_t index) const { return m_layout.folded_line_offsets[index]; }
+
+    /**
+     * @return The line at the specified index, without its line terminator
+     */
+    std::string_view line(size_t index) const { return line_at(m_layout.text, m_layout.line_offsets, index); }
+    std::string_view folded_line(size_t index) const { return line_at(m_layout.folded_text, m_layout.folded_line_offsets, index); }
+
+    /**
+     * Finds the line an original position belongs to, by binary search.
+     */
+    size_t line_index(uint64_t pos) const
+    {
+        const auto it = std::upper_bound(m_layout.line_offsets.begin() + 1, m_layout.line_offsets.end(), pos);
+        return std::min<size_t>(it - m_layout.line_offsets.begin() - 1, line_count() - 1);
+    }
+
+    /**
+     * Finds the line a folded position belongs to, by binary search.
+     * @param first_index Index of a line known to start at or before the position
+     * @return The line index
+     */
+    size_t folded_line_index(uint64_t folded_pos, size_t first_index = 0) const
+    {
+        const auto it = std::upper_bound(m_layout.folded_line_offsets.begin() + first_index + 1, m_layout.folded_line_offsets.end(), folded_pos);
+        return std::min<size_t>(it - m_layout.folded_line_offsets.begin() - 1, line_count() - 1);
+    }
+
+    /**
+     * N-gram filters of each block of the folded text, built on first use.
+     */
+    const std::vector<NgramFilter> &block_filters() const
+    {
+        std::call_once(m_block_filters_flag, [this] {
+            const auto folded_text = this->folded_text();
+            m_block_filters.resize((folded_text.size() + BlockSize - 1) / BlockSize);
+            for (size_t i = 0; i < m_block_filters.size(); i++)
+                m_block_filters[i].add(folded_text.substr(i * BlockSize), BlockSize + BlockOverlap);
+        });
+        return m_block_filters;
+    }
+
+    /**
+     * Attaches an occurrence index. Indexes don't change search results, just
+     * how fast they are found, so they can be attached at any time.
+     */
+    void set_occurrence_index(std::shared_ptr<const OccurrenceIndex> occurrence_index) const { m_occurrence_index.store(std::move(occurrence_index)); }
+    std::shared_ptr<const OccurrenceIndex> occurrence_index() const { return m_occurrence_index.load(); }
+
+    /**
+     * Runs the validator on first use.
+     * @return Whether the content source can be used
+     */
+    bool is_valid() const
+    {
+        std::call_once(m_validation_flag, [this] {
+            m_is_valid = !m_validator || m_validator();
+            if (!m_is_valid)
+                std::cerr << tag() << ": data is corrupt, ignoring content source" << std::endl;
+        });
+        return m_is_valid;
+    }
+
+private:
+    struct OwnedData {
+        std::string text;
+        FoldedText folded_text;
+        std::vector<uint64_t> line_offsets;
+        std::vector<uint64_t> folded_line_offsets;
+    };
+
+    Layout m_layout;
+    std::shared_ptr<const void> m_storage;
+    Validator m_validator;
+    mutable std::once_flag m_validation_flag;
+    mutable bool m_is_valid = false;
+    mutable std::atomic<std::shared_ptr<const OccurrenceIndex>> m_occurrence_index;
+    mutable std::once_flag m_block_filters_flag;
+    mutable std::vector<NgramFilter> m_block_filters;
+
+    /**
+     * Tells, for each block, whether an occurrence of the query may start in
+     * it, this is, whether its filter may contain the first n-grams of the query.
+     */
+    std::vector<bool> find_candidate_blocks(std::string_view folded_query) const;
+
+    static std::vector<uint64_t> split_lines(std::string_view text)
+    {
+        std::vector<uint64_t> offsets { 0 };
+        for (size_t pos = text.find('\n'); pos != std::string::npos; pos = text.find('\n', pos + 1))
+            offsets.push_back(pos + 1);
+
+        // Just like std::getline(), don't count an empty trailing line
+        if (offsets.back() != text.size())
+            offsets.push_back(text.size() + 1);
+        return offsets;
+    }
+
+    static std::string_view line_at(std::string_view text, std::span<const uint64_t> offsets, size_t index)
+    {
+        return text.substr(offsets[index], offsets[index + 1] - offsets[index] - 1);
+    }
+};
+}
\ No newline at end of file
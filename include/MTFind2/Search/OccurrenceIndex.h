@@ -0,0 +1,162 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <Shared/AhoCorasick.h>
+#include <Shared/NonCopyable.h>
+#include <Shared/TextHelper.h>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+struct MemoryContentSource;
+
+/**
+ * Layout of an occurrence index. Indexes are plain byte strings that can be
+ * kept in memory or stored as a section of a corpus snapshot and used in place.
+ *
+ *   Header | Displacements (padded to 8 bytes) | Slot[] | Words | Postings
+ *
+ * Slots are addressed by a perfect hash of the folded word. Each posting list
+ * holds the occurrences of a word in increasing offset order, every one of
+ * them encoded as varint((offset delta << 1) | has_length), followed by
+ * varint(length) only when the original length differs from the folded one.
+ */
+struct OccurrenceIndexFormat final {
+    static constexpr char Magic[8] = { 'M', 'T', 'F', '2', 'O', 'C', 'C', 'I' };
+    static constexpr uint32_t Version = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t fold_mode;
+        uint32_t dictionary_fingerprint;
+        uint32_t word_count;
+        uint64_t seed;
+        uint64_t bucket_count;
+        uint64_t slot_count;
+        uint64_t words_size;
+        uint64_t postings_size;
+    };
+
+    struct Slot {
+        uint64_t postings_offset;
+        uint32_t word_offset;
+        /**
+         * Zero for unused slots.
+         */
+        uint32_t word_length;
+        uint32_t occurrence_count;
+        uint32_t reserved;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) == 64);
+    static_assert(std::is_trivially_copyable_v<Slot> && sizeof(Slot) == 24);
+};
+
+/**
+ * Precomputes the answer to every dictionary query for memory content sources.
+ * The automaton for the whole word list is built once, and then each content
+ * source is indexed in a single pass over its folded text.
+ */
+struct OccurrenceIndexBuilder final : NonCopyable {
+    OccurrenceIndexBuilder(const std::vector<std::string> &words, uint32_t dictionary_fingerprint, TextHelper::FoldMode fold_mode);
+
+    /**
+     * @return The serialized index for a content source
+     * @throws std::runtime_error if the content source can't be indexed
+     */
+    std::string build(const MemoryContentSource &content_source) const;
+
+private:
+    const uint32_t m_dictionary_fingerprint;
+    const TextHelper::FoldMode m_fold_mode;
+    std::vector<std::string> m_folded_words;
+    std::unique_ptr<const AhoCorasick> m_automaton;
+};
+
+/**
+ * Every occurrence of every dictionary word in a content source. Queries for
+ * a dictionary word are answered with a single lookup, while any other query
+ * must be scanned for as usual.
+ */
+struct OccurrenceIndex final : NonCopyable {
+    /**
+     * Uses an index in place.
+     * @param storage Object that keeps the data alive
+     * @throws std::runtime_error if the index is malformed
+     */
+    static std::shared_ptr<const OccurrenceIndex> open(std::string_view data, std::shared_ptr<const void> storage);
+
+    /**
+     * @throws std::runtime_error if the index is malformed
+     */
+    static std::shared_ptr<const OccurrenceIndex> open(std::string data);
+
+    TextHelper::FoldMode fold_mode() const { return static_cast<TextHelper::FoldMode>(header().fold_mode); }
+    uint32_t dictionary_fingerprint() const { return header().dictionary_fingerprint; }
+    size_t word_count() const { return header().word_count; }
+    size_t size() const { return m_data.size(); }
+
+    /**
+     * Tells whether the index can answer a query, this is, whether it was
+     * built from the current dictionary and the query is one of its words.
+     */
+    bool covers(const std::string &folded_query) const;
+
+    /**
+     * Reports the occurrences of a word exactly as MemoryContentSource::scan()
+     * would. The query must be covered by this index.
+     */
+    void scan(std::string_view folded_query, const MemoryContentSource &content_source, const ContentSource::OccurrenceCallback &callback) const;
+
+    /**
+     * Counts the occurrences of a word without decoding them.
+     */
+    size_t count(std::string_view folded_query) const
+    {
+        const auto *slot = find(folded_query);
+        return slot != nullptr ? slot->occurrence_count : 0;
+    }
+
+private:
+    std::string_view m_data;
+    std::shared_ptr<const void> m_storage;
+    std::span<const uint32_t> m_displacements;
+    std::span<const OccurrenceIndexFormat::Slot> m_slots;
+    std::string_view m_words;
+    std::string_view m_postings;
+
+    OccurrenceIndex(std::string_view data, std::shared_ptr<const void> storage);
+
+    const OccurrenceIndexFormat::Header &header() const { return *reinterpret_cast<const OccurrenceIndexFormat::Header *>(m_data.data()); }
+
+    /**
+     * @return The slot of a word, or nullptr if it has no occurrences
+     */
+    const OccurrenceIndexFormat::Slot *find(std::string_view folded_word) const;
+};
+}
@@ -0,0 +1,106 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <Shared/CpuTopology.h>
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+/**
+ * Decides which CPUs search work runs on. Each search worker is pinned to a
+ * CPU of its own, and every content source is assigned to the CPUs sharing
+ * one cache, so that its text stays in that cache from one query to the next
+ * instead of following whichever CPU the scheduler picked. Content sources
+ * are spread over caches by size as they are first scanned.
+ */
+struct Placement final : NonCopyable, NonMoveable {
+    enum class Policy {
+        /**
+         * Nothing is pinned; the scheduler decides as usual.
+         */
+        None,
+
+        /**
+         * Workers fill every CPU sharing a cache, core by core, before moving
+         * on to the next cache.
+         */
+        Compact,
+
+        /**
+         * Workers are spread over caches first and then over cores, so that
+         * hyperthreads are only shared when every core has a worker.
+         */
+        Scatter,
+    };
+
+    struct Options final {
+        Policy policy = Policy::None;
+
+        /**
+         * Cache shared by the CPUs scanning the same content source: 2 or 3.
+         */
+        unsigned cache_level = 3;
+    };
+
+    Placement(CpuTopology topology, Options options);
+
+    static const char *policy_name(Policy policy);
+
+    bool is_enabled() const { return m_options.policy != Policy::None; }
+
+    /**
+     * Pins the calling thread as the given search worker.
+     */
+    void pin_worker(size_t worker_index) const;
+
+    /**
+     * Pins the calling thread to the CPUs that scan a content source,
+     * assigning them if it's the first time it is scanned.
+     */
+    void pin_scan(const ContentSource &content_source) const;
+
+    void print_summary(std::ostream &stream) const;
+
+private:
+    const CpuTopology m_topology;
+    const Options m_options;
+
+    /**
+     * CPUs the workers are pinned to, one per worker and wrapping around.
+     */
+    std::vector<unsigned> m_worker_cpu_ids;
+
+    /**
+     * CPUs sharing the chosen cache, i.e. where content sources go.
+     */
+    std::vector<std::vector<unsigned>> m_domains;
+
+    mutable std::mutex m_assignment_lock;
+    mutable std::unordered_map<uint32_t, size_t> m_source_domains;
+    mutable std::vector<uint64_t> m_domain_sizes;
+};
+}
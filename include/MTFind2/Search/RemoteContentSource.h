@@ -0,0 +1,65 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+/**
+ * Stands for a content source that lives in another process, as seen through
+ * the results of a single search request. Only its path and the text around
+ * those results are known, so it can't be scanned.
+ * @see ShardCoordinator
+ */
+struct RemoteContentSource final : ContentSource {
+    /**
+     * @param surrounding_texts Text around each result, by offset, as extracted
+     * by the process that found it
+     */
+    RemoteContentSource(std::string file_path, TextHelper::FoldMode fold_mode, std::unordered_map<uint64_t, std::string> surrounding_texts)
+        : ContentSource(std::move(file_path), fold_mode)
+        , m_surrounding_texts(std::move(surrounding_texts))
+    {
+    }
+
+    /**
+     * @return Zero, the size of the file is not known
+     */
+    uint64_t size() const override { return 0; }
+
+    void scan(std::string_view, const OccurrenceCallback &) const override
+    {
+        throw std::runtime_error(tag() + " is remote and can't be scanned");
+    }
+
+    /**
+     * @remarks The width is that of the process that found the result
+     */
+    std::string surrounding_text(uint64_t offset, size_t, TextHelper::ContextWidth) const override
+    {
+        const auto it = m_surrounding_texts.find(offset);
+        return it != m_surrounding_texts.end() ? it->second : std::string();
+    }
+
+private:
+    const std::unordered_map<uint64_t, std::string> m_surrounding_texts;
+};
+}
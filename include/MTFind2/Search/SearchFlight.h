@@ -0,0 +1,366 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+#include <Shared/Tracing.h>
+
+#include "../Client/Client.h"
+#include "../Messages/SearchCountMessage.h"
+#include "../Messages/SearchFinishedMessage.h"
+#include "../Messages/ServiceOverloadedMessage.h"
+#include "SearchRequest.h"
+#include "SearchResult.h"
+#include "SearchService.h"
+
+namespace mtfind2 {
+/**
+ * A single scan shared by every client that asked for the same query while it
+ * was queued or running. Results are recorded as they are found and delivered
+ * to each subscriber in order, so clients that subscribe late get the results
+ * found so far before any new ones. Credit is still charged to every client
+ * for every result it receives. Results every subscriber has been given are
+ * eventually forgotten, after which the flight takes no more subscribers.
+ */
+struct SearchFlight final : NonCopyable, NonMoveable {
+    /**
+     * @param is_count_only Whether subscribers only get the number of
+     * occurrences instead of the occurrences themselves
+     */
+    SearchFlight(Client &client, const SearchRequest &search_request, bool is_count_only = false)
+        : m_search_request(search_request)
+        , m_request_id(search_request.id())
+        , m_query(search_request.query())
+        , m_is_count_only(is_count_only)
+    {
+        subscribe(client, search_request);
+    }
+
+    /**
+     * @return The search request that started this flight
+     * @remarks Only guaranteed to be alive until the flight is finished, since
+     * its client may dispose of it then
+     */
+    const SearchRequest &search_request() const { return m_search_request; }
+    size_t request_id() const { return m_request_id; }
+    const std::string &query() const { return m_query; }
+    bool is_count_only() const { return m_is_count_only; }
+
+    /**
+     * Attaches a client to this flight.
+     * @return False if the flight can't take any more subscribers, because it
+     * is over, some content source was not fully scanned or some results were
+     * already forgotten
+     */
+    bool subscribe(Client &client, const SearchRequest &search_request)
+    {
+        const std::scoped_lock lock(m_lock);
+        if (m_state == State::Finished || m_is_truncated || m_forgotten_count > 0)
+            return false;
+
+        m_subscribers.push_back(std::make_unique<Subscriber>(client, search_request));
+        return true;
+    }
+
+    /**
+     * Records that this flight has been enqueued for a subscription type.
+     * @return Whether it was not already in that queue
+     */
+    bool mark_queued(Client::SubscriptionType subscription_type)
+    {
+        return !m_queued[static_cast<size_t>(subscription_type)].exchange(true);
+    }
+
+    /**
+     * Records that this flight has been dropped from the queue of a
+     * subscription type.
+     * @return Whether it is still in some other queue
+     */
+    bool unmark_queued(Client::SubscriptionType subscription_type)
+    {
+        m_queued[static_cast<size_t>(subscription_type)] = false;
+        return m_queued[0] || m_queued[1];
+    }
+
+    /**
+     * Claims this flight for running. A flight may sit in more than one queue,
+     * but only the first worker to dequeue it actually runs it.
+     */
+    bool begin()
+    {
+        const std::scoped_lock lock(m_lock);
+        if (m_state != State::Queued)
+            return false;
+
+        m_state = State::Running;
+        m_started_time = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    /**
+     * Gives up on a flight that has not started running yet, letting every
+     * subscriber know that the service is overloaded.
+     * @return Whether the flight was cancelled
+     */
+    bool cancel(std::chrono::milliseconds retry_after)
+    {
+        {
+            const std::scoped_lock lock(m_lock);
+            if (m_state != State::Queued)
+                return false;
+            m_state = State::Finished;
+        }
+
+        // Nobody else can touch the subscribers of a finished flight
+        for (const auto &subscriber : m_subscribers) {
+            subscriber->client.push_message(ServiceOverloadedMessage(subscriber->search_request, retry_after));
+            subscriber->client.push_message(SearchFinishedMessage(subscriber->search_request));
+        }
+        return true;
+    }
+
+    /**
+     * Delivers the number of occurrences to every subscriber and closes the
+     * flight. Counts are not charged for.
+     */
+    void finish_count(size_t occurrence_count)
+    {
+        {
+            const std::scoped_lock lock(m_lock);
+            m_state = State::Finished;
+        }
+
+        for (const auto &subscriber : m_subscribers) {
+            subscriber->client.push_message(SearchCountMessage(subscriber->search_request, occurrence_count));
+            subscriber->client.push_message(SearchFinishedMessage(subscriber->search_request, m_started_time));
+        }
+    }
+
+    /**
+     * Result sink for SearchService::query(). May be called from several
+     * threads at once.
+     * @return Whether any subscriber wants more results
+     */
+    bool publish(const ContentSource &content_source, const SearchResult &search_result)
+    {
+        {
+            const std::scoped_lock lock(m_lock);
+            m_results.push_back({ &content_source, search_result });
+        }
+
+        drain();
+
+        // Late subscribers may still need the rest of this content source
+        const std::scoped_lock lock(m_lock);
+        if (std::none_of(m_subscribers.begin(), m_subscribers.end(), [](const auto &subscriber) { return subscriber->is_active.load(); })) {
+            m_is_truncated = true;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Delivers whatever is left to every subscriber, including those that
+     * arrived after the last result was found, and closes the flight.
+     * @remarks Must be called while the content sources of the results are
+     * still alive, see SearchService::query()
+     */
+    void finish()
+    {
+        for (;;) {
+            drain();
+
+            const std::scoped_lock lock(m_lock);
+            if (std::all_of(m_subscribers.begin(), m_subscribers.end(), [this](const auto &subscriber) {
+                    return !subscriber->is_active || subscriber->delivered == recorded_count();
+                })) {
+                m_state = State::Finished;
+                break;
+            }
+        }
+
+        for (const auto &subscriber : m_subscribers)
+            subscriber->client.push_message(SearchFinishedMessage(subscriber->search_request, m_started_time));
+    }
+
+    size_t subscriber_count() const
+    {
+        const std::scoped_lock lock(m_lock);
+        return m_subscribers.size();
+    }
+
+private:
+    enum struct State {
+        Queued,
+        Running,
+        Finished
+    };
+
+    struct Subscriber final : NonCopyable {
+        Subscriber(Client &client, const SearchRequest &search_request)
+            : client(client)
+            , search_request(search_request)
+        {
+        }
+
+        Client &client;
+        const SearchRequest &search_request;
+
+        /**
+         * Number of results delivered so far, in the order they were recorded.
+         */
+        std::atomic<size_t> delivered = 0;
+        std::atomic<bool> is_active = true;
+
+        /**
+         * Held while delivering, so that each subscriber gets its results in
+         * order and one at a time.
+         */
+        std::mutex delivery_lock;
+    };
+
+    struct Result {
+        const ContentSource *content_source;
+        SearchResult search_result;
+    };
+
+    /**
+     * Number of results every subscriber must have been given before they are
+     * forgotten. Flights with fewer results keep taking subscribers until
+     * they finish.
+     */
+    static constexpr size_t ForgetThreshold = 1024;
+
+    const SearchRequest &m_search_request;
+    const size_t m_request_id;
+    const std::string m_query;
+    const bool m_is_count_only;
+    mutable std::mutex m_lock;
+    State m_state = State::Queued;
+    std::chrono::steady_clock::time_point m_started_time;
+    bool m_is_truncated = false;
+    std::atomic<bool> m_queued[2] = { false, false };
+    std::vector<std::unique_ptr<Subscriber>> m_subscribers;
+
+    /**
+     * Results not given to every subscriber yet, preceded by as many that
+     * were forgotten.
+     */
+    std::deque<Result> m_results;
+    size_t m_forgotten_count = 0;
+
+    /**
+     * @remarks Must be called with m_lock held
+     */
+    size_t recorded_count() const { return m_forgotten_count + m_results.size(); }
+
+    /**
+     * Delivers every pending result to every subscriber. Subscribers that
+     * another thread is already delivering to are left to it, rather than
+     * waiting for it while it is blocked on the credit of its client.
+     */
+    void drain()
+    {
+        std::vector<Subscriber *> subscribers;
+        {
+            const std::scoped_lock lock(m_lock);
+            for (const auto &subscriber : m_subscribers)
+                subscribers.push_back(subscriber.get());
+        }
+
+        for (auto *subscriber : subscribers) {
+            for (;;) {
+                std::unique_lock delivery_lock(subscriber->delivery_lock, std::try_to_lock);
+                if (!delivery_lock.owns_lock())
+                    break;
+                deliver_pending(*subscriber);
+                delivery_lock.unlock();
+
+                // Whoever failed to take the lock meanwhile left its results to us
+                const std::scoped_lock lock(m_lock);
+                if (!subscriber->is_active || subscriber->delivered == recorded_count())
+                    break;
+            }
+        }
+
+        const std::scoped_lock lock(m_lock);
+        forget_delivered();
+    }
+
+    /**
+     * Delivers the results a subscriber has not been given yet.
+     * @remarks Must be called with the delivery lock of the subscriber held
+     */
+    void deliver_pending(Subscriber &subscriber)
+    {
+        const bool is_sampled = Tracer::instance().is_sampled(subscriber.search_request.id());
+        const auto start_time = is_sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        size_t delivered_count = 0;
+        while (subscriber.is_active) {
+            Result result;
+            {
+                const std::scoped_lock lock(m_lock);
+                if (subscriber.delivered == recorded_count())
+                    break;
+                result = m_results[subscriber.delivered - m_forgotten_count];
+            }
+
+            // Results found before the client asked are delivered right now
+            if (result.search_result.timestamp < subscriber.search_request.timestamp())
+                result.search_result.timestamp = std::chrono::steady_clock::now();
+
+            subscriber.delivered++;
+            delivered_count++;
+            if (!SearchService::deliver(subscriber.client, subscriber.search_request, *result.content_source, result.search_result))
+                subscriber.is_active = false;
+        }
+
+        if (is_sampled && delivered_count > 0)
+            Tracer::instance().record("deliver", subscriber.search_request.id(), start_time, std::chrono::steady_clock::now(), std::to_string(delivered_count) + " result(s)");
+    }
+
+    /**
+     * Forgets the results every active subscriber has been given, once there
+     * are enough of them, since they would otherwise be kept for as long as
+     * the scan goes on.
+     * @remarks Must be called with m_lock held
+     */
+    void forget_delivered()
+    {
+        size_t delivered_count = recorded_count();
+        for (const auto &subscriber : m_subscribers) {
+            if (subscriber->is_active)
+                delivered_count = std::min(delivered_count, subscriber->delivered.load());
+        }
+        if (delivered_count - m_forgotten_count < ForgetThreshold)
+            return;
+
+        m_results.erase(m_results.begin(), m_results.begin() + (delivered_count - m_forgotten_count));
+        m_forgotten_count = delivered_count;
+    }
+};
+}
@@ -31,6 +31,10 @@ namespace mtfind2 {
  * should not be copied or moved around.
  */
 struct SearchProvider : NonCopyable, NonMoveable {
+    /**
+     * Attends a search request. Clients are sent a SearchFinishedMessage
+     * once the provider is done with it.
+     */
     virtual void query(Client &client, const SearchRequest &search_request) = 0;
 };
 }
\ No newline at end of file
@@ -17,53 +17,178 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <map>
-#include <queue>
-#include <tuple>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include <Shared/ConcurrencyLimit.h>
+#include <Shared/Metrics.h>
+#include <Shared/QueueDelayMonitor.h>
+#include <Shared/Tracing.h>
 
 #include "../Client/Client.h"
+#include "../Messages/SearchFinishedMessage.h"
+#include "../Messages/ServiceOverloadedMessage.h"
+#include "SearchFlight.h"
 #include "SearchProvider.h"
 #include "SearchRequest.h"
 #include "SearchService.h"
 
 namespace mtfind2 {
-using SearchTask = std::pair<Client *, const SearchRequest *>;
-
-struct SearchTaskCompare final {
-    bool operator()(const SearchTask &lhs, const SearchTask &rhs)
-    {
-        return std::get<1>(lhs)->timestamp() < std::get<1>(rhs)->timestamp();
-    }
+/**
+ * What to do with new search requests when a queue is full or overloaded.
+ */
+enum struct OverloadPolicy {
+    /**
+     * Turn new requests away.
+     */
+    Reject,
+    /**
+     * Make room by dropping the requests that have been waiting the longest.
+     */
+    DropOldest,
+    /**
+     * Accept new requests, but only send back the number of occurrences.
+     * Requests are still turned away if the queue is full.
+     */
+    CountOnly
 };
 
 /**
- * Basic search service implementation. Its responsibility is that of attending
- * search queries directly by allocating all required resources and using them
- * all at once to provide a search result or notify any kind of errors.
- * If you are looking for a search provider that prioritizes clients based on
- * subscription types, credits and enqueues search requests to more efficiently
- * manage compute and memory resources, see the SearchProxy class.
+ * Search provider that prioritizes clients based on their subscription type.
+ * Search requests are put into one bounded queue per subscription type and
+ * attended in order by one worker thread per search service. Once requests
+ * have been waiting for longer than a target delay for a while, the queue is
+ * considered overloaded and its overload policy kicks in. Clients whose
+ * requests are turned away or dropped get a ServiceOverloadedMessage.
+ * Optionally, how many workers attend requests at once is adapted to the
+ * latency of the searches, see ConcurrencyLimit.
+ * If you are looking for a search provider that attends search queries
+ * directly, see the SearchService class.
  */
-struct SearchProxy final : private SearchProvider {
-    explicit SearchProxy()
-        : m_keep_running()
+struct SearchProxy final : SearchProvider {
+    struct QueueOptions {
+        size_t capacity = 256;
+        OverloadPolicy overload_policy = OverloadPolicy::Reject;
+
+        /**
+         * The queue is overloaded once requests have waited for longer than the
+         * target delay during a whole interval.
+         */
+        std::chrono::milliseconds target_delay { 500 };
+        std::chrono::milliseconds interval { 2000 };
+    };
+
+    using Options = std::map<Client::SubscriptionType, QueueOptions>;
+
+    /**
+     * @param concurrency_options Bounds of the adaptive limit on workers
+     * attending requests at once. Without it, every worker may.
+     */
+    explicit SearchProxy(const Options &options = {}, const std::optional<ConcurrencyLimit::Options> &concurrency_options = {})
+        : m_keep_running(false)
         , m_random_engine(std::chrono::system_clock::now().time_since_epoch().count())
+        , m_active_worker_count(MetricsRegistry::instance().gauge("mtfind2_proxy_active_workers", "Workers attending a search request."))
+        , m_service_duration(MetricsRegistry::instance().histogram("mtfind2_proxy_service_duration_seconds", "Time taken to attend a search request once dequeued."))
+        , m_concurrency_limit(concurrency_options ? std::make_unique<ConcurrencyLimit>(*concurrency_options) : nullptr)
+        , m_concurrency_limit_gauge(MetricsRegistry::instance().gauge("mtfind2_proxy_concurrency_limit", "Workers allowed to attend search requests at once."))
     {
+        if (m_concurrency_limit) {
+            m_exported_concurrency_limit = m_concurrency_limit->limit();
+            m_concurrency_limit_gauge.increment(static_cast<int64_t>(m_exported_concurrency_limit));
+        }
+
+        for (const auto subscription_type : { Client::SubscriptionType::Premium, Client::SubscriptionType::Standard }) {
+            const auto it = options.find(subscription_type);
+            m_queues.try_emplace(subscription_type, it != options.end() ? it->second : QueueOptions(), subscription_type == Client::SubscriptionType::Premium ? "premium" : "standard");
+        }
     }
 
+    ~SearchProxy() { stop(); }
+
+    /**
+     * Enqueues a search request. Requests for a query that is already queued
+     * or running don't cause another scan: the client subscribes to the one
+     * in flight instead.
+     */
     void query(Client &client, const SearchRequest &search_request)
     {
-        const std::scoped_lock lock(m_queue_locks[client.subscription_type()]);
-        m_queues[client.subscription_type()].push(SearchTask(&client, &search_request));
+        const TraceSpan span("enqueue", search_request.id(), search_request.query());
+        const auto subscription_type = client.subscription_type();
+        auto &queue = m_queues.at(subscription_type);
+        std::vector<std::shared_ptr<SearchFlight>> dropped_flights;
+        Admission admission;
+        {
+            const std::scoped_lock lock(m_flights_lock);
+            const auto it = m_flights.find(search_request.query());
+            if (it != m_flights.end() && it->second->subscribe(client, search_request)) {
+                std::cout << search_request << ": coalesced with " << it->second->search_request() << std::endl;
+                queue.coalesced_count++;
+                queue.metrics.coalesced_count.increment();
+
+                // Premium clients don't wait behind standard ones, even if they share a flight
+                if (it->second->mark_queued(subscription_type)) {
+                    const std::scoped_lock queue_lock(queue.lock);
+                    if (admit(queue, dropped_flights) == Admission::Accepted) {
+                        queue.entries.push_back({ it->second, Clock::now() });
+                        queue.metrics.depth.increment();
+                    } else
+                        it->second->unmark_queued(subscription_type);
+                }
+                admission = Admission::Accepted;
+            } else {
+                const std::scoped_lock queue_lock(queue.lock);
+                admission = admit(queue, dropped_flights);
+                if (admission != Admission::Rejected) {
+                    auto flight = std::make_shared<SearchFlight>(client, search_request, admission == Admission::CountOnly);
+                    flight->mark_queued(subscription_type);
+                    queue.entries.push_back({ flight, Clock::now() });
+                    queue.metrics.depth.increment();
+
+                    // Count-only flights can't take subscribers that want results
+                    if (!flight->is_count_only())
+                        m_flights[search_request.query()] = std::move(flight);
+                }
+            }
+        }
+
+        for (const auto &dropped_flight : dropped_flights)
+            drop(queue, subscription_type, dropped_flight);
+
+        switch (admission) {
+        case Admission::Accepted:
+            queue.metrics.accepted_count.increment();
+            break;
+        case Admission::CountOnly:
+            queue.degraded_count++;
+            queue.metrics.degraded_count.increment();
+            break;
+        case Admission::Rejected:
+            queue.rejected_count++;
+            queue.metrics.rejected_count.increment();
+            client.push_message(ServiceOverloadedMessage(search_request, retry_after(queue)));
+            client.push_message(SearchFinishedMessage(search_request));
+            break;
+        }
     }
 
+    /**
+     * Registers a search service. If the proxy is already running, a worker
+     * thread is spawned for it right away.
+     */
     void add_search_service(SearchService &search_service)
     {
-        if (m_keep_running)
-            throw std::runtime_error("Can't add search service while search proxy is running");
-
         const std::scoped_lock lock(m_search_services_lock);
         m_search_services.push_back(&search_service);
+        if (m_keep_running)
+            spawn_worker(search_service);
     }
 
     void start()
@@ -72,12 +197,8 @@ struct SearchProxy final : private SearchProvider {
         m_keep_running = true;
         m_thread_pool.clear();
 
-        for (auto *search_service : m_search_services) {
-            m_thread_pool.emplace_back([this, search_service] {
-                while (m_keep_running)
-                    this->handle_service_request(*search_service);
-            });
-        }
+        for (auto *search_service : m_search_services)
+            spawn_worker(*search_service);
     }
 
     void stop()
@@ -93,7 +214,83 @@ struct SearchProxy final : private SearchProvider {
         m_thread_pool.clear();
     }
 
+    /**
+     * Prints what happened to the search requests of each queue.
+     */
+    void print_statistics(std::ostream &stream) const
+    {
+        for (const auto &[subscription_type, queue] : m_queues) {
+            stream << (subscription_type == Client::SubscriptionType::Premium ? "premium" : "standard") << " queue: "
+                   << queue.coalesced_count << " coalesced, " << queue.degraded_count << " count-only, "
+                   << queue.rejected_count << " rejected, " << queue.dropped_count << " dropped" << std::endl;
+        }
+        if (m_concurrency_limit)
+            stream << "concurrency limit: " << m_concurrency_limit->limit() << " worker(s)" << std::endl;
+    }
+
 private:
+    using Clock = std::chrono::steady_clock;
+
+    enum struct Admission {
+        Accepted,
+        CountOnly,
+        Rejected
+    };
+
+    struct Queue final : NonCopyable, NonMoveable {
+        struct Entry {
+            std::shared_ptr<SearchFlight> flight;
+            Clock::time_point enqueue_time;
+        };
+
+        /**
+         * Same as the statistics below, but process-wide and exported.
+         */
+        struct Metrics {
+            explicit Metrics(const std::string &class_name)
+                : accepted_count(request_count(class_name, "accepted"))
+                , coalesced_count(request_count(class_name, "coalesced"))
+                , degraded_count(request_count(class_name, "count_only"))
+                , rejected_count(request_count(class_name, "rejected"))
+                , dropped_count(request_count(class_name, "dropped"))
+                , depth(MetricsRegistry::instance().gauge("mtfind2_proxy_queue_depth", "Search requests waiting in a queue.", "class=\"" + class_name + "\""))
+                , wait_duration(MetricsRegistry::instance().histogram("mtfind2_proxy_queue_wait_seconds", "Time search requests spent in a queue.", "class=\"" + class_name + "\""))
+            {
+            }
+
+            Counter &accepted_count;
+            Counter &coalesced_count;
+            Counter &degraded_count;
+            Counter &rejected_count;
+            Counter &dropped_count;
+            Gauge &depth;
+            Histogram &wait_duration;
+
+            static Counter &request_count(const std::string &class_name, const std::string &outcome)
+            {
+                return MetricsRegistry::instance().counter("mtfind2_proxy_requests_total", "Search requests received, by what became of them.", "class=\"" + class_name + "\",outcome=\"" + outcome + "\"");
+            }
+        };
+
+        Queue(const QueueOptions &options, const std::string &class_name)
+            : options(options)
+            , delay_monitor(options.target_delay, options.interval)
+            , metrics(class_name)
+        {
+        }
+
+        const QueueOptions options;
+        std::mutex lock;
+        std::deque<Entry> entries;
+        QueueDelayMonitor delay_monitor;
+        Metrics metrics;
+
+        std::atomic<size_t> coalesced_count = 0;
+        std::atomic<size_t> degraded_count = 0;
+        std::atomic<size_t> rejected_count = 0;
+        std::atomic<size_t> dropped_count = 0;
+    };
+
     /**
      * We declare random engine instance and uniform random generator as members
      * because declaring them as static variables on a concurrent method is not
@@ -102,19 +299,179 @@ private:
     std::default_random_engine m_random_engine;
     std::uniform_real_distribution<float> generate_random_float;
 
-    bool m_keep_running;
+    std::atomic<bool> m_keep_running;
+    Gauge &m_active_worker_count;
+    Histogram &m_service_duration;
+
+    /**
+     * Adaptive limit on workers attending requests at once, if any, and the
+     * value last exported to its gauge.
+     */
+    const std::unique_ptr<ConcurrencyLimit> m_concurrency_limit;
+    Gauge &m_concurrency_limit_gauge;
+    std::atomic<size_t> m_exported_concurrency_limit = 0;
     std::vector<SearchService *> m_search_services;
-    std::map<Client::SubscriptionType, std::priority_queue<SearchTask, std::vector<SearchTask>, SearchTaskCompare>> m_queues;
-    std::map<Client::SubscriptionType, std::mutex> m_queue_locks;
+    std::map<Client::SubscriptionType, Queue> m_queues;
     std::vector<std::thread> m_thread_pool;
 
+    /**
+     * Flights that can still be subscribed to, by query.
+     */
+    std::unordered_map<std::string, std::shared_ptr<SearchFlight>> m_flights;
+    std::mutex m_flights_lock;
+
     /**
      * Not really needed (when using SearchProxy), but we are cautious enough
      * to lock content sources when modifying or iterating over.
      */
     std::mutex m_search_services_lock;
 
+    /**
+     * Decides whether a new flight may enter a queue, making room for it if
+     * the overload policy says so.
+     * @remarks The queue lock must be held
+     */
+    static Admission admit(Queue &queue, std::vector<std::shared_ptr<SearchFlight>> &dropped_flights)
+    {
+        const auto now = Clock::now();
+        const auto oldest_delay = queue.entries.empty() ? Clock::duration::zero() : now - queue.entries.front().enqueue_time;
+        const bool is_overloaded = queue.delay_monitor.observe(oldest_delay, now);
+        const bool is_full = queue.entries.size() >= queue.options.capacity;
+        if (!is_overloaded && !is_full)
+            return Admission::Accepted;
+
+        switch (queue.options.overload_policy) {
+        case OverloadPolicy::Reject:
+            return Admission::Rejected;
+        case OverloadPolicy::DropOldest:
+            // Stale requests are dropped as they are dequeued, see next_flight()
+            if (is_full) {
+                dropped_flights.push_back(std::move(queue.entries.front().flight));
+                queue.entries.pop_front();
+                queue.metrics.depth.decrement();
+            }
+            return Admission::Accepted;
+        case OverloadPolicy::CountOnly:
+            return is_full ? Admission::Rejected : Admission::CountOnly;
+        }
+        return Admission::Rejected;
+    }
+
+    /**
+     * Suggests clients to wait for as long as the oldest request has.
+     */
+    static std::chrono::milliseconds retry_after(Queue &queue)
+    {
+        const std::scoped_lock lock(queue.lock);
+        const auto oldest_delay = queue.entries.empty() ? Clock::duration::zero() : Clock::now() - queue.entries.front().enqueue_time;
+        return std::chrono::ceil<std::chrono::milliseconds>(std::max<Clock::duration>(oldest_delay, queue.options.target_delay));
+    }
+
+    /**
+     * Takes the next flight out of a queue. While the queue is overloaded,
+     * queues with the DropOldest policy drop the requests that have waited for
+     * longer than the target delay, as CoDel does.
+     */
+    std::shared_ptr<SearchFlight> next_flight(Client::SubscriptionType subscription_type)
+    {
+        auto &queue = m_queues.at(subscription_type);
+        std::shared_ptr<SearchFlight> flight;
+        std::vector<std::shared_ptr<SearchFlight>> dropped_flights;
+        {
+            const std::scoped_lock lock(queue.lock);
+            while (!queue.entries.empty() && !flight) {
+                auto entry = std::move(queue.entries.front());
+                queue.entries.pop_front();
+                queue.metrics.depth.decrement();
+
+                const auto now = Clock::now();
+                const auto delay = now - entry.enqueue_time;
+                queue.metrics.wait_duration.record(delay);
+                const bool is_overloaded = queue.delay_monitor.observe(delay, now);
+                if (Tracer::instance().is_sampled(entry.flight->request_id()))
+                    Tracer::instance().record("queued", entry.flight->request_id(), entry.enqueue_time, now, entry.flight->query(), true);
+                if (is_overloaded && queue.options.overload_policy == OverloadPolicy::DropOldest && delay > queue.options.target_delay)
+                    dropped_flights.push_back(std::move(entry.flight));
+                else
+                    flight = std::move(entry.flight);
+            }
+        }
+
+        for (const auto &dropped_flight : dropped_flights)
+            drop(queue, subscription_type, dropped_flight);
+        return flight;
+    }
+
+    /**
+     * Drops a flight from a queue. Its subscribers are told that the service
+     * is overloaded, unless the flight is still in another queue or has already
+     * started running.
+     */
+    void drop(Queue &queue, Client::SubscriptionType subscription_type, const std::shared_ptr<SearchFlight> &flight)
+    {
+        if (flight->unmark_queued(subscription_type) || !flight->cancel(retry_after(queue)))
+            return;
+
+        queue.dropped_count += flight->subscriber_count();
+        queue.metrics.dropped_count.increment(flight->subscriber_count());
+        forget(flight);
+    }
+
+    /**
+     * Stops new subscribers from joining a flight.
+     */
+    void forget(const std::shared_ptr<SearchFlight> &flight)
+    {
+        const std::scoped_lock lock(m_flights_lock);
+        const auto it = m_flights.find(flight->query());
+        if (it != m_flights.end() && it->second == flight)
+            m_flights.erase(it);
+    }
+
+    void spawn_worker(SearchService &search_service)
+    {
+        m_thread_pool.emplace_back([this, &search_service] {
+            search_service.pin_worker_thread();
+            while (m_keep_running)
+                this->handle_service_request(search_service);
+        });
+    }
+
+    /**
+     * Attends a request if the concurrency limit allows, and otherwise
+     * leaves the worker idle for a while.
+     */
     void handle_service_request(SearchService &search_service)
+    {
+        if (!m_concurrency_limit) {
+            handle_service_request(search_service, nullptr);
+            return;
+        }
+
+        if (!m_concurrency_limit->try_acquire()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
+
+        std::optional<Clock::duration> service_duration;
+        handle_service_request(search_service, &service_duration);
+        if (!service_duration) {
+            m_concurrency_limit->release();
+            return;
+        }
+
+        m_concurrency_limit->release(*service_duration);
+        const size_t limit = m_concurrency_limit->limit();
+        const size_t previous_limit = m_exported_concurrency_limit.exchange(limit);
+        if (limit != previous_limit)
+            m_concurrency_limit_gauge.increment(static_cast<int64_t>(limit) - static_cast<int64_t>(previous_limit));
+    }
+
+    /**
+     * @param service_duration Where to store how long the request took, if
+     * there was one
+     */
+    void handle_service_request(SearchService &search_service, std::optional<Clock::duration> *service_duration)
     {
         Client::SubscriptionType key;
         float p = generate_random_float(m_random_engine);
@@ -123,21 +480,31 @@ private:
         else
             key = Client::SubscriptionType::Standard;
 
-        Client *client_ptr;
-        SearchRequest const *search_request_ptr;
-        {
-            const std::scoped_lock lock(m_queue_locks[key]);
-            auto &queue = m_queues[key];
-
-            if (queue.empty())
-                return;
+        const auto flight = next_flight(key);
+        if (!flight || !flight->begin())
+            return; // Nothing to do, or already taken from the other queue
 
-            std::tie(client_ptr, search_request_ptr) = queue.top();
-            std::cout << "[" << std::this_thread::get_id() << "] " << *search_request_ptr << std::endl;
-            queue.pop();
+        const auto &search_request = flight->search_request();
+        std::cout << "[" << std::this_thread::get_id() << "] " << search_request << std::endl;
+        const TraceSpan span("search", flight->request_id(), flight->query());
+        const auto start_time = Clock::now();
+        m_active_worker_count.increment();
+        if (flight->is_count_only()) {
+            flight->finish_count(search_service.count(search_request));
+        } else {
+            search_service.query(
+                search_request,
+                [&flight](const ContentSource &content_source, const SearchResult &search_result) {
+                    return flight->publish(content_source, search_result);
+                },
+                [&flight] { flight->finish(); });
+            forget(flight);
         }
-
-        search_service.query(*client_ptr, *search_request_ptr);
+        m_active_worker_count.decrement();
+        const auto duration = Clock::now() - start_time;
+        m_service_duration.record(duration);
+        if (service_duration)
+            *service_duration = duration;
     }
 };
-}
\ No newline at end of file
+}
@@ -23,17 +23,24 @@
 #include <MTFind2/Search/Dictionary.h>
 #include <Shared/NonCopyable.h>
 #include <Shared/Tagged.h>
+#include <Shared/TextHelper.h>
 
 namespace mtfind2 {
 /**
  * Search requests simply contain the search term (query) and a timestamp for
  * calculating response time. As they are short-lived and intended to be
  * single-instance, no copy semantics are allowed on search request objects.
+ * The query is folded once upon creation for every supported folding mode, so
+ * that content sources never need to normalize it again.
  */
 struct SearchRequest final : NonCopyable, Tagged<std::string> {
     explicit SearchRequest(size_t id, const std::string &query)
         : m_id(id)
         , m_query(query)
+        , m_folded_queries {
+            TextHelper::fold_string(query, TextHelper::FoldMode::CaseInsensitive),
+            TextHelper::fold_string(query, TextHelper::FoldMode::CaseAndAccentInsensitive)
+        }
         , m_timestamp(std::chrono::steady_clock::now())
     {
     }
@@ -48,11 +55,13 @@ struct SearchRequest final : NonCopyable, Tagged<std::string> {
 
     size_t id() const { return m_id; }
     const std::string &query() const { return m_query; }
+    const std::string &folded_query(TextHelper::FoldMode mode) const { return m_folded_queries[static_cast<size_t>(mode)]; }
     const std::chrono::time_point<std::chrono::steady_clock> &timestamp() const { return m_timestamp; }
 
 private:
     const size_t m_id;
-    const std::string &m_query;
+    const std::string m_query;
+    const std::string m_folded_queries[2];
     const std::chrono::time_point<std::chrono::steady_clock> m_timestamp;
 };
 }
\ No newline at end of file
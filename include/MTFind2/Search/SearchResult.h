@@ -17,50 +17,50 @@
 
 #pragma once
 
-#include <Shared/NonCopyable.h>
 #include <chrono>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include <Shared/TextHelper.h>
 
 #include "ContentSource.h"
 
 namespace mtfind2 {
 /**
- * Search results are intended to have a short lifetime and thus dont need to
- * be copied around. They represent a single search occurrence that is sent as
- * a message to a client.
+ * A single search occurrence that is sent as a message to a client. Results
+ * are plain values that don't own nor reference any text, so they are cheap to
+ * copy, queue and send around. The text surrounding the occurrence is only
+ * extracted from the content source if somebody asks for it.
  */
-struct SearchResult final : NonCopyable {
-    SearchResult(
-        const ContentSource &content_source,
-        const std::string_view &surrounding_text,
-        size_t line,
-        size_t column,
-        size_t length,
-        bool is_final_result = false)
-        : m_content_source(content_source)
-        , m_surrounding_text(surrounding_text)
-        , m_line(line)
-        , m_column(column)
-        , m_length(length)
-        , m_is_final_result(is_final_result)
-        , m_timestamp(std::chrono::steady_clock::now())
-    {
-    }
+struct SearchResult final {
+    /**
+     * Identifier of the content source the occurrence was found in.
+     */
+    uint32_t source_id;
 
-    const ContentSource &content_source() const { return m_content_source; }
-    const std::string_view &surrounding_text() const { return m_surrounding_text; }
-    size_t line() const { return m_line; }
-    size_t column() const { return m_column; }
-    size_t length() const { return m_length; }
-    bool is_final_result() const { return m_is_final_result; }
-    const std::chrono::time_point<std::chrono::steady_clock> &timestamp() const { return m_timestamp; }
+    /**
+     * Byte offset of the occurrence within the content source.
+     */
+    uint64_t offset;
+    uint32_t line;
+    uint32_t column;
+    uint32_t length;
+    bool is_final_result;
+    std::chrono::steady_clock::time_point timestamp;
 
-private:
-    const ContentSource &m_content_source;
-    const std::string_view &m_surrounding_text;
-    const size_t m_line;
-    const size_t m_column;
-    const size_t m_length;
-    const bool m_is_final_result;
-    const std::chrono::time_point<std::chrono::steady_clock> m_timestamp;
+    /**
+     * Extracts the text around this occurrence.
+     * @param content_source Content source the occurrence was found in
+     * @param width How much text to extract on each side
+     */
+    std::string surrounding_text(const ContentSource &content_source, TextHelper::ContextWidth width = {}) const
+    {
+        if (content_source.id() != source_id)
+            throw std::runtime_error("search result does not belong to " + content_source.tag());
+        return content_source.surrounding_text(offset, length, width);
+    }
 };
-}
\ No newline at end of file
+
+static_assert(std::is_trivially_copyable_v<SearchResult>);
+}
@@ -17,11 +17,15 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
 
 #include "ContentSource.h"
+#include "Corpus.h"
+#include "Placement.h"
 #include "SearchProvider.h"
+#include "SearchResult.h"
 
 namespace mtfind2 {
 /**
@@ -34,38 +38,85 @@ namespace mtfind2 {
  */
 struct SearchService final : private SearchProvider {
     /**
-     * Performs a search query on all registered content sources.
+     * Receives every search result found by a query, possibly from several
+     * threads at once. Returning false stops looking in that content source.
+     * The content source is only guaranteed to be alive during the call.
+     */
+    using ResultSink = std::function<bool(const ContentSource &, const SearchResult &)>;
+
+    /**
+     * @param placement Where to run scans and the worker attending this
+     * service, if anywhere in particular
+     * @param worker_index Index of this service among those sharing the
+     * placement
+     */
+    explicit SearchService(const Corpus &corpus, const Placement *placement = nullptr, size_t worker_index = 0)
+        : m_corpus(corpus)
+        , m_placement(placement)
+        , m_worker_index(worker_index)
+    {
+    }
+
+    /**
+     * Pins the calling thread, which is to attend requests for this service,
+     * as the placement says.
+     */
+    void pin_worker_thread() const
+    {
+        if (m_placement)
+            m_placement->pin_worker(m_worker_index);
+    }
+
+    /**
+     * Performs a search query on all content sources in the current corpus
+     * snapshot. Changes to the corpus take effect in subsequent queries.
      * @param client Client that issued this search request
      * @param search_request Search request object
      */
     void query(Client &client, const SearchRequest &search_request);
 
-    void add_content_source(const ContentSource &content_source)
-    {
-        const std::scoped_lock lock(m_content_sources_lock);
-        m_content_sources.push_back(&content_source);
-    }
+    /**
+     * Performs a search query and hands the results to a sink instead of a
+     * client, so that they can be shared by several clients.
+     * @param search_request Search request object
+     * @param sink Receiver of the search results
+     * @param on_scanned Called once every content source has been scanned,
+     * while they are still guaranteed to be alive
+     */
+    void query(const SearchRequest &search_request, const ResultSink &sink, const std::function<void()> &on_scanned = {});
+
+    /**
+     * Counts the occurrences of a query in the current corpus snapshot. This
+     * is cheaper than a query, since no result is ever delivered, and content
+     * sources may know the count beforehand.
+     */
+    size_t count(const SearchRequest &search_request) const;
+
+    /**
+     * Sends a search result to a client, charging it one credit. Standard
+     * clients that run out of credit don't get the result, whereas premium
+     * clients wait for their credit to be recharged.
+     * @return Whether the client wants any more results
+     */
+    static bool deliver(Client &client, const SearchRequest &search_request, const ContentSource &content_source, const SearchResult &search_result);
 
 private:
     /**
      * Performs a single-thread query on a specific content source.
      * @param content_source Content source where the search term will be looked up
-     * @param client Client that issued this search request
      * @param search_request Search request object
+     * @param sink Receiver of the search results
      */
-    void find_in_source(const ContentSource &content_source, Client &client, const SearchRequest &search_request) const;
+    void find_in_source(const ContentSource &content_source, const SearchRequest &search_request, const ResultSink &sink) const;
 
     /**
-     * Content sources are not bound to a SearchService instance. This is by-design,
+     * The corpus is not bound to a SearchService instance. This is by-design,
      * because more than one instance of SearchService may be created (e.g. for
-     * parallelism) and shared ownership of these objects is unnecessarily complex.
+     * parallelism) and they all look into the same set of content sources.
      */
-    std::vector<const ContentSource *> m_content_sources;
+    const Corpus &m_corpus;
 
-    /**
-     * Not really needed (when using SearchProxy), but we are cautious enough
-     * to lock content sources when modifying or iterating over.
-     */
-    std::mutex m_content_sources_lock;
+    const Placement *const m_placement;
+    const size_t m_worker_index;
 };
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+#include <Shared/Checksum.h>
+
+namespace mtfind2 {
+/**
+ * Part of the corpus a process is responsible for, when the corpus is split
+ * across several processes. Files are assigned by a hash of their name, so
+ * that processes agree on it without talking to each other and files added
+ * later end up in exactly one shard.
+ */
+struct Shard final {
+    size_t index = 0;
+    size_t count = 1;
+
+    bool contains(const std::filesystem::path &path) const
+    {
+        return count <= 1 || Checksum::crc32c(path.filename().string()) % count == index;
+    }
+};
+}
@@ -0,0 +1,88 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ContentSource.h"
+
+namespace mtfind2 {
+/**
+ * Content source that is never loaded into memory as a whole. Instead, it is
+ * scanned from disk in fixed-size chunks that are read ahead while the previous
+ * chunk is being matched, so memory usage doesn't depend on the file size.
+ * Only a sparse index of line checkpoints is kept resident.
+ */
+struct StreamingContentSource final : ContentSource {
+    static constexpr size_t DefaultChunkSize = 1 << 20;
+
+    /**
+     * Maximum length of a partial line carried over from one chunk to the next.
+     * Longer lines are split, and so is their surrounding text.
+     */
+    static constexpr size_t MaxCarrySize = 64 << 10;
+
+    /**
+     * Approximate distance, in bytes, between two line checkpoints.
+     */
+    static constexpr uint64_t CheckpointInterval = 4 << 20;
+
+    /**
+     * Maximum number of bytes read on each side of an occurrence in order to
+     * extract its surrounding text.
+     */
+    static constexpr uint64_t MaxContextSize = 4 << 10;
+
+    StreamingContentSource(std::string file_path, TextHelper::FoldMode fold_mode = TextHelper::FoldMode::CaseInsensitive, size_t chunk_size = DefaultChunkSize);
+    ~StreamingContentSource();
+
+    void scan(std::string_view folded_query, const OccurrenceCallback &callback) const override;
+    std::string surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width = {}) const override;
+
+    /**
+     * Resolves the line a byte offset belongs to by reading forward from the
+     * closest checkpoint.
+     * @return The (1-based) line number and the offset where that line starts
+     */
+    std::tuple<size_t, uint64_t> locate_line(uint64_t offset) const;
+
+    uint64_t size() const override { return m_size; }
+    uint64_t memory_usage() const override { return m_checkpoints.size() * sizeof(Checkpoint); }
+    size_t line_count() const { return m_line_count; }
+
+private:
+    struct Checkpoint {
+        /**
+         * Offset where the line starts.
+         */
+        uint64_t offset;
+        size_t line;
+    };
+
+    int m_fd;
+    uint64_t m_size;
+    const size_t m_chunk_size;
+    size_t m_line_count;
+    std::vector<Checkpoint> m_checkpoints;
+
+    void build_checkpoints();
+};
+}
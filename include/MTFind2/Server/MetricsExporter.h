@@ -0,0 +1,77 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <Shared/Metrics.h>
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+namespace mtfind2 {
+/**
+ * Exposes the metrics registry in the Prometheus text format, over HTTP on a
+ * localhost port and/or by rewriting a file periodically. A single thread
+ * serves one scrape at a time, which is all a scraper needs.
+ * HTTP is only available on Linux.
+ */
+struct MetricsExporter final : NonCopyable, NonMoveable {
+    struct Options final {
+        /**
+         * Port to serve GET /metrics (and GET /trace, if tracing is enabled)
+         * on at 127.0.0.1, none if zero.
+         */
+        uint16_t http_port = 0;
+
+        /**
+         * File to write the metrics to, none if empty. The file is replaced
+         * atomically, so readers never see half of it.
+         */
+        std::string dump_path;
+        std::chrono::seconds dump_interval { 10 };
+    };
+
+    explicit MetricsExporter(Options options, const MetricsRegistry &metrics_registry = MetricsRegistry::instance());
+    ~MetricsExporter();
+
+    /**
+     * @throws std::runtime_error if the port can't be listened on
+     */
+    void start();
+
+    /**
+     * Stops serving, and dumps the metrics one last time.
+     */
+    void stop();
+
+private:
+    const Options m_options;
+    const MetricsRegistry &m_metrics_registry;
+    std::atomic<bool> m_keep_running;
+    std::thread m_thread;
+    int m_listen_fd = -1;
+
+    void run();
+    void serve(int fd) const;
+    void dump() const;
+};
+}
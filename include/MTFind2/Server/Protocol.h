@@ -0,0 +1,214 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace mtfind2 {
+/**
+ * Wire format spoken by the server. Every frame is a 32-bit payload length
+ * followed by the payload, which starts with a one-byte frame type. Integers
+ * are little-endian; strings that are not the last field of a frame are
+ * prefixed with their 16-bit length.
+ *
+ *   Hello       subscription_type:u8 [flags:u8 [coordinator_key:*]]
+ *                                               client -> server, first frame
+ *   Query       tag:u32 query:*                 client -> server
+ *   Result      tag:u32 line:u32 column:u32 offset:u64 length:u32 flags:u8
+ *               source_path:str16 surrounding_text:*
+ *   Count       tag:u32 occurrence_count:u64
+ *   Overloaded  tag:u32 retry_after_ms:u32
+ *   Done        tag:u32 result_count:u32        last frame for a query
+ *   Credit      amount:u32                      zero if no credit was granted
+ *   Error       message:*                       the connection is closed next
+ *
+ * Tags are chosen by the client and echoed back in every frame about its
+ * query, since the results of concurrent queries may be interleaved.
+ *
+ * Any client may connect, and clients are trusted with nothing but the
+ * subscription type they claim, which is what they are charged for. The one
+ * exception is a ShardCoordinator talking to a shard worker: it charges its
+ * own clients, so the worker must not charge it again. A worker only believes
+ * a Hello with IsCoordinator set if it was started with a coordinator key and
+ * the Hello carries that same key; every other server refuses such a Hello.
+ * The key is sent in the clear, so workers should only listen where nothing
+ * but the coordinator can eavesdrop, as they do on 127.0.0.1 or a Unix socket.
+ */
+struct Protocol final {
+    enum struct FrameType : uint8_t {
+        Hello = 0x01,
+        Query = 0x02,
+        Result = 0x81,
+        Count = 0x82,
+        Overloaded = 0x83,
+        Done = 0x84,
+        Credit = 0x85,
+        Error = 0xff
+    };
+
+    /**
+     * Hello flag set by a ShardCoordinator, which charges its own clients for
+     * the results instead. It must be followed by the coordinator key the
+     * worker was started with.
+     */
+    static constexpr uint8_t IsCoordinator = 0x01;
+
+    /**
+     * Result flag set on the last occurrence found in a content source.
+     */
+    static constexpr uint8_t IsFinalResult = 0x01;
+
+    static constexpr size_t LengthSize = sizeof(uint32_t);
+
+    /**
+     * Frames larger than this are rejected as malformed.
+     */
+    static constexpr size_t MaxFrameSize = 1 << 20;
+
+    /**
+     * Builds a frame field by field.
+     */
+    struct Writer final {
+        explicit Writer(FrameType type)
+        {
+            m_frame.append(LengthSize, '\0');
+            put(static_cast<uint8_t>(type));
+        }
+
+        template<typename T>
+        requires std::is_unsigned_v<T>
+        Writer &put(T value)
+        {
+            for (size_t i = 0; i < sizeof(T); i++)
+                m_frame.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+            return *this;
+        }
+
+        Writer &put_string16(std::string_view value)
+        {
+            value = value.substr(0, UINT16_MAX);
+            put(static_cast<uint16_t>(value.size()));
+            m_frame.append(value);
+            return *this;
+        }
+
+        Writer &put_rest(std::string_view value)
+        {
+            m_frame.append(value);
+            return *this;
+        }
+
+        /**
+         * @return The frame, length included. The writer is left empty
+         */
+        std::string finish()
+        {
+            const auto length = static_cast<uint32_t>(m_frame.size() - LengthSize);
+            for (size_t i = 0; i < LengthSize; i++)
+                m_frame[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+            return std::move(m_frame);
+        }
+
+    private:
+        std::string m_frame;
+    };
+
+    /**
+     * Reads the fields of a frame payload in order.
+     * @remarks Reading past the end throws std::runtime_error.
+     */
+    struct Reader final {
+        explicit Reader(std::string_view payload)
+            : m_payload(payload)
+        {
+        }
+
+        FrameType type() { return static_cast<FrameType>(get<uint8_t>()); }
+
+        template<typename T>
+        requires std::is_unsigned_v<T>
+        T get()
+        {
+            require(sizeof(T));
+            T value = 0;
+            for (size_t i = 0; i < sizeof(T); i++)
+                value |= static_cast<T>(static_cast<uint8_t>(m_payload[i])) << (8 * i);
+            m_payload.remove_prefix(sizeof(T));
+            return value;
+        }
+
+        std::string_view get_string16()
+        {
+            const auto length = get<uint16_t>();
+            require(length);
+            const auto value = m_payload.substr(0, length);
+            m_payload.remove_prefix(length);
+            return value;
+        }
+
+        /**
+         * @return Whether every field has been read, e.g. to tell whether
+         * optional trailing fields are present
+         */
+        bool is_empty() const { return m_payload.empty(); }
+
+        std::string_view get_rest()
+        {
+            const auto value = m_payload;
+            m_payload = {};
+            return value;
+        }
+
+    private:
+        std::string_view m_payload;
+
+        void require(size_t size) const
+        {
+            if (m_payload.size() < size)
+                throw std::runtime_error("truncated frame");
+        }
+    };
+
+    /**
+     * Takes the next complete frame out of a buffer.
+     * @return The frame payload, or nothing if the buffer doesn't hold a
+     * complete frame yet
+     * @throws std::runtime_error if the frame is too large
+     */
+    static std::optional<std::string_view> next_frame(std::string_view &buffer)
+    {
+        if (buffer.size() < LengthSize)
+            return std::nullopt;
+
+        Reader reader(buffer);
+        const size_t length = reader.get<uint32_t>();
+        if (length == 0 || length > MaxFrameSize)
+            throw std::runtime_error("bad frame length " + std::to_string(length));
+        if (buffer.size() < LengthSize + length)
+            return std::nullopt;
+
+        const auto payload = buffer.substr(LengthSize, length);
+        buffer.remove_prefix(LengthSize + length);
+        return payload;
+    }
+};
+}
@@ -0,0 +1,128 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <MTFind2/Search/SearchProvider.h>
+#include <Shared/Mailbox.h>
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+namespace mtfind2 {
+/**
+ * Accepts search requests from other processes over a Unix domain socket
+ * and/or a localhost TCP port, speaking the Protocol. A single thread runs an
+ * epoll loop that accepts connections, reads requests and writes responses;
+ * each connection is a Client with the subscription type it announced.
+ * Responses are queued by whichever thread produces them and written in
+ * batches, with non-blocking scatter-gather I/O, by the loop.
+ * Only available on Linux, on other platforms start() does nothing.
+ */
+struct Server final : NonCopyable, NonMoveable {
+    struct Options final {
+        /**
+         * Unix domain socket to listen on, none if empty.
+         */
+        std::string unix_socket_path;
+
+        /**
+         * Port to listen on at 127.0.0.1, none if zero.
+         */
+        uint16_t tcp_port = 0;
+
+        /**
+         * Key a ShardCoordinator must present for its requests not to be
+         * charged, see Protocol. Coordinators are refused if empty, as they
+         * are by anything but a shard worker.
+         */
+        std::string coordinator_key;
+    };
+
+    /**
+     * Bytes of responses that may be waiting for a connection to read them.
+     * Connections that fall further behind are closed.
+     */
+    static constexpr size_t MaxBacklogSize = 16 << 20;
+
+    /**
+     * @param mailbox_dispatcher Dispatcher for the mailboxes of connection
+     * clients, if messages are to be handled asynchronously
+     */
+    Server(SearchProvider &search_provider, Options options, MailboxDispatcher *mailbox_dispatcher = nullptr);
+    ~Server();
+
+    /**
+     * @throws std::runtime_error if a socket can't be set up
+     */
+    void start();
+
+    /**
+     * Stops accepting connections and requests. Connections with search
+     * requests in progress are only disposed of upon destruction, so the
+     * search proxy must be stopped in between.
+     */
+    void stop();
+
+private:
+    struct Session;
+
+    SearchProvider &m_search_provider;
+    const Options m_options;
+    MailboxDispatcher *const m_mailbox_dispatcher;
+    std::atomic<bool> m_keep_running;
+    std::thread m_thread;
+    int m_epoll_fd = -1;
+    int m_wake_fd = -1;
+    std::vector<int> m_listen_fds;
+    std::atomic<uint32_t> m_last_client_id = 0;
+    std::atomic<size_t> m_last_request_id = 0;
+
+    /**
+     * Open connections by socket. Only touched by the loop.
+     */
+    std::unordered_map<int, std::shared_ptr<Session>> m_sessions;
+
+    /**
+     * Closed connections whose client may still receive messages.
+     */
+    std::vector<std::shared_ptr<Session>> m_closed_sessions;
+
+    /**
+     * Connections with responses waiting to be written.
+     */
+    std::mutex m_dirty_sessions_lock;
+    std::vector<std::shared_ptr<Session>> m_dirty_sessions;
+
+    void run();
+    void listen_on(int fd, const void *address, size_t address_size, const std::string &description);
+    void accept_all(int listen_fd);
+    void schedule_flush(std::shared_ptr<Session> session);
+    void read(Session &session);
+    void handle_frame(Session &session, std::string_view payload);
+    void flush(Session &session);
+    void close_session(Session &session);
+    void reap_closed_sessions();
+};
+}
@@ -0,0 +1,116 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <MTFind2/Client/Client.h>
+#include <MTFind2/Search/SearchProvider.h>
+#include <MTFind2/Search/SearchRequest.h>
+#include <Shared/TextHelper.h>
+
+namespace mtfind2 {
+/**
+ * Search provider for a corpus that is split across several worker processes,
+ * each of them running `mtfind2 --shard` in server mode. Every search request
+ * is sent to every worker, and their results are merged in (source, line,
+ * column) order once all of them are done, so that the outcome doesn't depend
+ * on which worker answers first. Workers don't charge for results, clients
+ * are charged here instead as results are delivered to them.
+ * Workers are reconnected to on demand; requests that a worker could not
+ * answer, or did not answer in time, are reported as overloaded.
+ */
+struct ShardCoordinator final : SearchProvider {
+    static constexpr std::chrono::milliseconds DefaultRequestTimeout { 30'000 };
+
+    /**
+     * @param worker_addresses Unix socket path or HOST:PORT of each worker
+     * @param fold_mode Folding mode the workers were started with
+     * @param delivery_thread_count Threads delivering merged results to clients
+     * @param coordinator_key Key the workers were started with, so that they
+     * trust us not to need charging
+     * @param request_timeout How long workers have to answer a request, after
+     * which the ones still silent are given up on
+     */
+    ShardCoordinator(std::vector<std::string> worker_addresses, TextHelper::FoldMode fold_mode, size_t delivery_thread_count, std::string coordinator_key,
+        std::chrono::milliseconds request_timeout = DefaultRequestTimeout);
+    ~ShardCoordinator();
+
+    void start();
+    void stop();
+
+    void query(Client &client, const SearchRequest &search_request) override;
+
+    void print_statistics(std::ostream &stream) const;
+
+private:
+    struct Link;
+    struct PendingRequest;
+
+    const TextHelper::FoldMode m_fold_mode;
+    const size_t m_delivery_thread_count;
+    const std::string m_coordinator_key;
+    const std::chrono::milliseconds m_request_timeout;
+    std::atomic<bool> m_keep_running;
+
+    /**
+     * One connection per worker and subscription type, so that workers keep
+     * prioritizing premium requests.
+     */
+    std::vector<std::unique_ptr<Link>> m_links;
+    size_t m_worker_count;
+
+    std::atomic<uint32_t> m_last_tag = 0;
+    std::mutex m_pending_lock;
+    std::unordered_map<uint32_t, std::shared_ptr<PendingRequest>> m_pending;
+
+    std::mutex m_completed_lock;
+    std::condition_variable m_completed_condition;
+    std::deque<std::shared_ptr<PendingRequest>> m_completed;
+    bool m_is_delivering = false;
+    std::vector<std::thread> m_delivery_threads;
+
+    /**
+     * When delivery threads next look for requests that timed out.
+     */
+    std::atomic<std::chrono::steady_clock::time_point> m_next_expiry_time {};
+
+    std::atomic<size_t> m_request_count = 0;
+    std::atomic<size_t> m_result_count = 0;
+    std::atomic<size_t> m_failure_count = 0;
+
+    Link &link(size_t worker_index, Client::SubscriptionType subscription_type);
+    bool connect(Link &link);
+    bool send(Link &link, uint32_t tag, const std::string &frame);
+    void read(Link &link, int fd, uint64_t generation);
+    void fail(size_t worker_index, uint64_t generation, Client::SubscriptionType subscription_type);
+    void complete(uint32_t tag);
+    void expire(std::chrono::steady_clock::time_point now);
+    void deliver(PendingRequest &pending_request);
+};
+}
@@ -0,0 +1,186 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <MTFind2/Search/MemoryContentSource.h>
+#include <Shared/MappedFile.h>
+#include <Shared/NonCopyable.h>
+#include <Shared/NonMoveable.h>
+
+namespace mtfind2 {
+/**
+ * On-disk layout of a corpus snapshot. Snapshots are meant to be memory-mapped
+ * and used in place, so every structure has a fixed size and every section is
+ * aligned. All integers are stored in the host byte order (little-endian); a
+ * snapshot built on a big-endian host won't pass the magic/version check.
+ *
+ *   Header | Section data... | SourceEntry[] | Section[] | Path strings
+ */
+struct SnapshotFormat final {
+    static constexpr char Magic[8] = { 'M', 'T', 'F', '2', 'S', 'N', 'A', 'P' };
+    static constexpr uint32_t Version = 1;
+    static constexpr uint64_t Alignment = 64;
+
+    enum struct SectionKind : uint32_t {
+        Text = 1,
+        FoldedText = 2,
+        Anchors = 3,
+        LineOffsets = 4,
+        FoldedLineOffsets = 5,
+        /**
+         * Kinds from here on are optional indexes. Loaders ignore the kinds
+         * they don't know about.
+         */
+        FirstIndex = 0x100,
+        /**
+         * Occurrences of every dictionary word (see OccurrenceIndex).
+         */
+        OccurrenceIndex = FirstIndex
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t fold_mode;
+        uint64_t file_size;
+        uint64_t source_count;
+        uint64_t sources_offset;
+        uint64_t section_count;
+        uint64_t sections_offset;
+        uint64_t strings_offset;
+        uint64_t strings_size;
+        /**
+         * Covers source entries, sections and path strings.
+         */
+        uint32_t directory_checksum;
+        /**
+         * Covers this header, with this very field set to zero.
+         */
+        uint32_t header_checksum;
+    };
+
+    struct SourceEntry {
+        uint64_t path_offset;
+        uint64_t path_length;
+        uint64_t first_section;
+        uint64_t section_count;
+    };
+
+    struct Section {
+        uint32_t kind;
+        uint32_t checksum;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) == 80);
+    static_assert(std::is_trivially_copyable_v<SourceEntry> && sizeof(SourceEntry) == 32);
+    static_assert(std::is_trivially_copyable_v<Section> && sizeof(Section) == 24);
+};
+
+/**
+ * Builds corpus snapshots out of memory content sources.
+ */
+struct SnapshotWriter final : NonCopyable {
+    explicit SnapshotWriter(TextHelper::FoldMode fold_mode)
+        : m_fold_mode(fold_mode)
+    {
+    }
+
+    /**
+     * Adds a content source to the snapshot.
+     * @return The index of the content source within the snapshot
+     */
+    size_t add_content_source(std::shared_ptr<const MemoryContentSource> content_source);
+
+    /**
+     * Adds an optional index section to a content source.
+     */
+    void add_index(size_t source_index, SnapshotFormat::SectionKind kind, std::string data);
+
+    /**
+     * Writes the snapshot to a temporary file and atomically renames it.
+     * @throws std::runtime_error on I/O errors
+     */
+    void write(const std::string &file_path) const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const MemoryContentSource> content_source;
+        std::vector<std::pair<SnapshotFormat::SectionKind, std::string>> indexes;
+    };
+
+    const TextHelper::FoldMode m_fold_mode;
+    std::vector<Entry> m_entries;
+};
+
+/**
+ * Memory-mapped corpus snapshot. Opening a snapshot only validates its header
+ * and directory; section checksums are verified the first time each content
+ * source is used.
+ */
+struct SnapshotFile final : NonCopyable, NonMoveable, std::enable_shared_from_this<SnapshotFile> {
+    /**
+     * @throws std::runtime_error if the file can't be mapped or is malformed
+     */
+    static std::shared_ptr<const SnapshotFile> open(const std::string &file_path);
+
+    TextHelper::FoldMode fold_mode() const { return static_cast<TextHelper::FoldMode>(header().fold_mode); }
+    size_t source_count() const { return header().source_count; }
+    std::string_view source_path(size_t source_index) const;
+
+    /**
+     * Finds a section of a content source. Checksums are not verified.
+     */
+    std::optional<std::string_view> section(size_t source_index, SnapshotFormat::SectionKind kind) const;
+
+    /**
+     * Verifies the checksum of every section of a content source.
+     */
+    bool validate(size_t source_index) const;
+
+    /**
+     * Creates a content source that uses the snapshot data in place, along
+     * with its occurrence index if the snapshot has one.
+     */
+    std::shared_ptr<const MemoryContentSource> content_source(size_t source_index) const;
+
+    /**
+     * @return Every content source in the snapshot
+     */
+    std::vector<std::shared_ptr<const ContentSource>> content_sources() const;
+
+private:
+    const std::string m_file_path;
+    const std::shared_ptr<const MappedFile> m_mapped_file;
+
+    SnapshotFile(std::string file_path, std::shared_ptr<const MappedFile> mapped_file);
+
+    const SnapshotFormat::Header &header() const { return *reinterpret_cast<const SnapshotFormat::Header *>(m_mapped_file->data()); }
+    const SnapshotFormat::SourceEntry &source_entry(size_t source_index) const;
+    const SnapshotFormat::Section &section_at(size_t section_index) const;
+};
+}
@@ -0,0 +1,163 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Aho-Corasick automaton: finds every occurrence of any of a set of patterns in
+ * a single pass over a text, regardless of how many patterns there are.
+ *
+ * Edges are stored sorted in one flat array, except for the root node, which
+ * has a full transition table since most of the time is spent there.
+ */
+struct AhoCorasick final {
+    static constexpr uint32_t NoPattern = UINT32_MAX;
+
+    /**
+     * Builds the automaton. Empty patterns are ignored, as are repeated ones
+     * (only the first of them is ever reported).
+     */
+    explicit AhoCorasick(const std::vector<std::string> &patterns)
+        : m_pattern_count(patterns.size())
+    {
+        // Build the trie
+        std::vector<std::vector<std::pair<uint8_t, uint32_t>>> children(1);
+        m_nodes.push_back({});
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (patterns[i].empty())
+                continue;
+
+            uint32_t node = 0;
+            for (const char c : patterns[i]) {
+                const auto byte = static_cast<uint8_t>(c);
+                auto &edges = children[node];
+                const auto it = std::find_if(edges.begin(), edges.end(), [byte](const auto &edge) { return edge.first == byte; });
+                if (it != edges.end()) {
+                    node = it->second;
+                } else {
+                    const auto child = static_cast<uint32_t>(m_nodes.size());
+                    edges.emplace_back(byte, child);
+                    m_nodes.push_back({});
+                    children.emplace_back();
+                    node = child;
+                }
+            }
+            if (m_nodes[node].pattern == NoPattern)
+                m_nodes[node].pattern = i;
+        }
+
+        // Flatten the edges
+        for (uint32_t node = 0; node < m_nodes.size(); node++) {
+            auto &edges = children[node];
+            std::sort(edges.begin(), edges.end());
+            m_nodes[node].first_edge = m_edge_bytes.size();
+            m_nodes[node].edge_count = edges.size();
+            for (const auto &[byte, child] : edges) {
+                m_edge_bytes.push_back(byte);
+                m_edge_targets.push_back(child);
+            }
+        }
+
+        m_root_transitions.fill(0);
+        for (const auto &[byte, child] : children[0])
+            m_root_transitions[byte] = child;
+
+        // Compute failure and output links breadth-first, so that the links of
+        // shallower nodes are always ready
+        std::queue<uint32_t> queue;
+        for (const auto &[byte, child] : children[0])
+            queue.push(child);
+
+        while (!queue.empty()) {
+            const uint32_t node = queue.front();
+            queue.pop();
+
+            for (const auto &[byte, child] : children[node]) {
+                uint32_t failure = m_nodes[node].failure;
+                while (failure != 0 && find_child(failure, byte) == 0)
+                    failure = m_nodes[failure].failure;
+                failure = find_child(failure, byte);
+
+                m_nodes[child].failure = failure;
+                m_nodes[child].output = m_nodes[failure].pattern != NoPattern ? failure : m_nodes[failure].output;
+                queue.push(child);
+            }
+        }
+    }
+
+    size_t pattern_count() const { return m_pattern_count; }
+    size_t node_count() const { return m_nodes.size(); }
+
+    /**
+     * Reports every occurrence of every pattern, in order of their end, as
+     * callback(pattern_index, end_pos). Occurrences may overlap.
+     */
+    template<typename Callback>
+    void match(std::string_view text, Callback &&callback) const
+    {
+        uint32_t state = 0;
+        for (size_t pos = 0; pos < text.size(); pos++) {
+            const auto byte = static_cast<uint8_t>(text[pos]);
+            while (state != 0 && find_child(state, byte) == 0)
+                state = m_nodes[state].failure;
+            state = find_child(state, byte);
+
+            for (uint32_t node = m_nodes[state].pattern != NoPattern ? state : m_nodes[state].output; node != 0; node = m_nodes[node].output)
+                callback(static_cast<size_t>(m_nodes[node].pattern), pos + 1);
+        }
+    }
+
+private:
+    struct Node {
+        uint32_t first_edge = 0;
+        uint32_t edge_count = 0;
+        uint32_t failure = 0;
+
+        /**
+         * Closest node down the failure chain that completes a pattern.
+         */
+        uint32_t output = 0;
+        uint32_t pattern = NoPattern;
+    };
+
+    size_t m_pattern_count;
+    std::vector<Node> m_nodes;
+    std::vector<uint8_t> m_edge_bytes;
+    std::vector<uint32_t> m_edge_targets;
+    std::array<uint32_t, 256> m_root_transitions;
+
+    /**
+     * @return The child of a node along an edge, or zero (the root) if none
+     */
+    uint32_t find_child(uint32_t node, uint8_t byte) const
+    {
+        if (node == 0)
+            return m_root_transitions[byte];
+
+        const auto begin = m_edge_bytes.begin() + m_nodes[node].first_edge;
+        const auto end = begin + m_nodes[node].edge_count;
+        const auto it = std::lower_bound(begin, end, byte);
+        return it != end && *it == byte ? m_edge_targets[it - m_edge_bytes.begin()] : 0;
+    }
+};
@@ -0,0 +1,203 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.h"
+
+/**
+ * Minimal benchmark harness. Every benchmark is run in batches of iterations
+ * sized so that each batch takes a fraction of the minimum time, and the
+ * per-iteration time of every batch is kept as a sample. Results are meant to
+ * be written as TSV and compared against a previous run. When hardware
+ * counters are enabled, results also tell how well the CPU was used.
+ */
+struct Benchmark final {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        /**
+         * Minimum time spent in each benchmark, split among the samples.
+         */
+        std::chrono::milliseconds min_time { 200 };
+        size_t sample_count = 10;
+    };
+
+    struct Result {
+        std::string name;
+        uint64_t iterations;
+        double median_ns;
+        double min_ns;
+        double p99_ns;
+
+        /**
+         * Bytes and items (e.g. queries) processed per second, or zero if the
+         * benchmark did not say how many it processes per iteration.
+         */
+        double bytes_per_second;
+        double items_per_second;
+
+        /**
+         * Hardware counter figures, or zero if counting is off. They include
+         * the work of threads that the benchmark waits for, but not of those
+         * still running when it ends.
+         */
+        double cycles_per_iteration;
+        double instructions_per_cycle;
+        double bytes_per_cycle;
+    };
+
+    /**
+     * Work done by a single iteration, used to compute throughputs.
+     */
+    struct Work {
+        uint64_t bytes = 0;
+        uint64_t items = 0;
+    };
+
+    explicit Benchmark(const Options &options)
+        : m_options(options)
+    {
+    }
+
+    /**
+     * Prevents the compiler from optimizing away a value computed by a
+     * benchmark.
+     */
+    template<typename T>
+    static void keep(const T &value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    /**
+     * Runs a benchmark whose iterations are all alike.
+     */
+    Result run(const std::string &name, Work work, const std::function<void()> &iteration) const
+    {
+        // Warm up, and find out how many iterations fit in a sample
+        const auto sample_time = m_options.min_time / std::max<size_t>(m_options.sample_count, 1);
+        uint64_t batch_size = 1;
+        for (;;) {
+            const auto elapsed_time = time(batch_size, iteration);
+            if (elapsed_time >= sample_time || batch_size >= (1ull << 40))
+                break;
+            batch_size = elapsed_time.count() > 0 ? std::max(batch_size * 2, static_cast<uint64_t>(batch_size * 1.2 * sample_time / elapsed_time)) : batch_size * 10;
+        }
+
+        const auto start_perf_totals = PerfCounters::totals();
+        std::vector<double> samples;
+        {
+            const PerfScope perf_scope;
+            for (size_t i = 0; i < m_options.sample_count; i++)
+                samples.push_back(std::chrono::duration<double, std::nano>(time(batch_size, iteration)).count() / batch_size);
+        }
+        const uint64_t iterations = batch_size * samples.size();
+        auto result = summarize(name, iterations, work, std::move(samples));
+        if (PerfCounters::is_enabled())
+            add_perf_sample(result, PerfCounters::totals() - start_perf_totals, work);
+        return result;
+    }
+
+    /**
+     * Builds a result out of samples measured by the caller, e.g. the latency
+     * of each request of an end-to-end benchmark.
+     * @param samples Nanoseconds per iteration
+     */
+    static Result summarize(const std::string &name, uint64_t iterations, Work work, std::vector<double> samples)
+    {
+        Result result { .name = name, .iterations = iterations };
+        if (samples.empty())
+            return result;
+
+        std::sort(samples.begin(), samples.end());
+        result.median_ns = samples[samples.size() / 2];
+        result.min_ns = samples.front();
+        result.p99_ns = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+        if (result.median_ns > 0) {
+            result.bytes_per_second = work.bytes * 1e9 / result.median_ns;
+            result.items_per_second = work.items * 1e9 / result.median_ns;
+        }
+        return result;
+    }
+
+    /**
+     * Fills in the hardware counter figures of a result.
+     * @param sample Events counted over all of its iterations
+     */
+    static void add_perf_sample(Result &result, const PerfSample &sample, Work work)
+    {
+        if (result.iterations == 0 || sample.cycles == 0)
+            return;
+
+        result.cycles_per_iteration = static_cast<double>(sample.cycles) / result.iterations;
+        result.instructions_per_cycle = sample.instructions_per_cycle();
+        result.bytes_per_cycle = static_cast<double>(work.bytes) * result.iterations / sample.cycles;
+    }
+
+    static void write_header(std::ostream &stream)
+    {
+        stream << "benchmark\titerations\tmedian_ns\tmin_ns\tp99_ns\tbytes_per_second\titems_per_second\tcycles_per_iteration\tinstructions_per_cycle\tbytes_per_cycle\n";
+    }
+
+    static void write(std::ostream &stream, const Result &result)
+    {
+        stream << result.name << '\t' << result.iterations << '\t' << result.median_ns << '\t' << result.min_ns << '\t' << result.p99_ns << '\t'
+               << result.bytes_per_second << '\t' << result.items_per_second << '\t' << result.cycles_per_iteration << '\t' << result.instructions_per_cycle << '\t'
+               << result.bytes_per_cycle << std::endl;
+    }
+
+    /**
+     * Reads the median times of a previous run, by benchmark name.
+     */
+    static std::map<std::string, double> read_medians(std::istream &stream)
+    {
+        std::map<std::string, double> medians;
+        std::string line;
+        std::getline(stream, line); // Header
+        while (std::getline(stream, line)) {
+            std::istringstream fields(line);
+            std::string name;
+            uint64_t iterations;
+            double median_ns;
+            if (std::getline(fields, name, '\t') && fields >> iterations >> median_ns)
+                medians[name] = median_ns;
+        }
+        return medians;
+    }
+
+private:
+    const Options m_options;
+
+    static Clock::duration time(uint64_t batch_size, const std::function<void()> &iteration)
+    {
+        const auto start_time = Clock::now();
+        for (uint64_t i = 0; i < batch_size; i++)
+            iteration();
+        return Clock::now() - start_time;
+    }
+};
@@ -0,0 +1,93 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * FIFO queue of limited capacity connecting the stages of a pipeline.
+ * Producers block while the queue is full and consumers while it's empty, so
+ * that a slow stage holds back the ones before it instead of letting work pile
+ * up in memory. Closing the queue lets consumers drain it and then stop.
+ */
+template<typename T>
+struct BoundedQueue final : NonCopyable, NonMoveable {
+    explicit BoundedQueue(size_t capacity)
+        : m_capacity(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    /**
+     * @return False if the queue was closed, in which case the item is dropped
+     */
+    bool push(T item)
+    {
+        std::unique_lock lock(m_lock);
+        m_not_full.wait(lock, [this] { return m_items.size() < m_capacity || m_is_closed; });
+        if (m_is_closed)
+            return false;
+
+        m_items.push_back(std::move(item));
+        lock.unlock();
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * @return The oldest item, or nothing once the queue is closed and empty
+     */
+    std::optional<T> pop()
+    {
+        std::unique_lock lock(m_lock);
+        m_not_empty.wait(lock, [this] { return !m_items.empty() || m_is_closed; });
+        if (m_items.empty())
+            return std::nullopt;
+
+        T item = std::move(m_items.front());
+        m_items.pop_front();
+        lock.unlock();
+        m_not_full.notify_one();
+        return item;
+    }
+
+    /**
+     * Stops accepting items. Those already queued can still be popped.
+     */
+    void close()
+    {
+        {
+            const std::scoped_lock lock(m_lock);
+            m_is_closed = true;
+        }
+        m_not_full.notify_all();
+        m_not_empty.notify_all();
+    }
+
+private:
+    const size_t m_capacity;
+    std::mutex m_lock;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::deque<T> m_items;
+    bool m_is_closed = false;
+};
@@ -0,0 +1,62 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+/**
+ * CRC-32C (Castagnoli) checksums, using the SSE 4.2 instruction when the
+ * compiler is allowed to and a lookup table otherwise.
+ */
+struct Checksum final {
+    static uint32_t crc32c(std::string_view data, uint32_t crc = 0)
+    {
+        static const auto k_table = make_table();
+        crc = ~crc;
+        size_t i = 0;
+#ifdef __SSE4_2__
+        for (; i + 8 <= data.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, sizeof word);
+            crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+        }
+#endif
+        for (; i < data.size(); i++)
+            crc = k_table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+private:
+    static constexpr std::array<uint32_t, 256> make_table()
+    {
+        std::array<uint32_t, 256> table {};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+            table[i] = crc;
+        }
+        return table;
+    }
+};
@@ -0,0 +1,141 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+#include "Semaphore.h"
+
+/**
+ * Reads a file sequentially into two alternating buffers. While the caller is
+ * busy with one of them, the next chunk is read into the other one from a
+ * background thread, so that I/O overlaps with whatever the caller does.
+ * Each buffer reserves some headroom before the chunk data, where callers may
+ * prepend data of their own (e.g. the tail of the previous chunk).
+ */
+struct ChunkReader final : NonCopyable, NonMoveable {
+    struct Chunk {
+        char *data;
+        size_t length;
+    };
+
+    ChunkReader(int fd, uint64_t start_offset, uint64_t end_offset, size_t chunk_size, size_t headroom = 0)
+        : m_fd(fd)
+        , m_start_offset(start_offset)
+        , m_end_offset(end_offset)
+        , m_chunk_size(chunk_size)
+        , m_headroom(headroom)
+        , m_buffers { std::vector<char>(headroom + chunk_size), std::vector<char>(headroom + chunk_size) }
+        , m_free_buffers(2)
+        , m_thread([this] { this->read_ahead(); })
+    {
+    }
+
+    ~ChunkReader()
+    {
+        m_stop = true;
+        m_free_buffers.notify();
+        m_free_buffers.notify();
+        m_thread.join();
+    }
+
+    /**
+     * Releases the previous chunk and obtains the next one, waiting for it to
+     * be read if needed. The previous chunk must not be used after this call.
+     * @return Whether there was a chunk left to read
+     */
+    bool next(Chunk &chunk)
+    {
+        if (m_done)
+            return false;
+
+        if (m_chunks_consumed > 0)
+            m_free_buffers.notify();
+
+        m_filled_buffers.wait();
+        const size_t index = m_chunks_consumed++ % 2;
+        if (m_lengths[index] == 0) {
+            m_done = true;
+            return false;
+        }
+
+        chunk = { m_buffers[index].data() + m_headroom, m_lengths[index] };
+        return true;
+    }
+
+    /**
+     * @return Whether reading stopped early because of an I/O error
+     */
+    bool failed() const { return m_failed; }
+
+private:
+    const int m_fd;
+    const uint64_t m_start_offset;
+    const uint64_t m_end_offset;
+    const size_t m_chunk_size;
+    const size_t m_headroom;
+    std::vector<char> m_buffers[2];
+    size_t m_lengths[2] = { 0, 0 };
+    Semaphore m_free_buffers;
+    Semaphore m_filled_buffers;
+    std::atomic<bool> m_stop = false;
+    std::atomic<bool> m_failed = false;
+    size_t m_chunks_consumed = 0;
+    bool m_done = false;
+    std::thread m_thread;
+
+    void read_ahead()
+    {
+        for (size_t chunk_index = 0;; chunk_index++) {
+            m_free_buffers.wait();
+            if (m_stop)
+                return;
+
+            const size_t index = chunk_index % 2;
+            uint64_t offset = m_start_offset + chunk_index * m_chunk_size;
+            size_t length = 0;
+            while (offset < m_end_offset && length < m_chunk_size) {
+                const size_t wanted = std::min<uint64_t>(m_chunk_size - length, m_end_offset - offset);
+                const ssize_t count = pread(m_fd, m_buffers[index].data() + m_headroom + length, wanted, offset);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count < 0)
+                    m_failed = true;
+                if (count <= 0)
+                    break;
+
+                length += count;
+                offset += count;
+            }
+
+            // A zero-length chunk signals the end of the file
+            m_lengths[index] = length;
+            m_filled_buffers.notify();
+            if (length == 0)
+                return;
+        }
+    }
+};
@@ -0,0 +1,160 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Limit on how much work may run at once that adapts to how latency responds
+ * to it, as gradient concurrency limits do. Every window, the limit is scaled
+ * by how much the latency of work exceeds the lowest seen (i.e. without
+ * contention) and then grown by its square root. Once more concurrency no
+ * longer buys throughput, work only waits longer for CPUs, disks or locks, so
+ * the limit settles slightly above what the system can do at once. Work that
+ * blocks without using up resources, like waiting for I/O, barely gets any
+ * slower as it piles up, so its limit keeps growing.
+ */
+struct ConcurrencyLimit final : NonCopyable, NonMoveable {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        size_t min_limit = 1;
+        size_t max_limit = 64;
+
+        /**
+         * Limit to start with, clamped between the bounds.
+         */
+        size_t initial_limit = 1;
+
+        /**
+         * Latencies are averaged over windows this long, provided there are
+         * enough of them.
+         */
+        Clock::duration window = std::chrono::milliseconds(250);
+        size_t min_sample_count = 8;
+
+        /**
+         * How much latency may exceed the lowest seen before the limit shrinks.
+         */
+        double tolerance = 1.2;
+
+        /**
+         * How much of each new estimate is taken, so that the limit doesn't
+         * swing with noise.
+         */
+        double smoothing = 0.2;
+    };
+
+    explicit ConcurrencyLimit(const Options &options)
+        : m_options(options)
+        , m_limit(std::clamp<double>(options.initial_limit, options.min_limit, options.max_limit))
+        , m_integer_limit(static_cast<size_t>(m_limit))
+    {
+    }
+
+    /**
+     * Takes a slot if the limit allows, which must then be released.
+     */
+    bool try_acquire()
+    {
+        size_t in_flight_count = m_in_flight_count.load(std::memory_order_relaxed);
+        do {
+            if (in_flight_count >= m_integer_limit.load(std::memory_order_relaxed))
+                return false;
+        } while (!m_in_flight_count.compare_exchange_weak(in_flight_count, in_flight_count + 1, std::memory_order_relaxed));
+        return true;
+    }
+
+    /**
+     * Gives a slot back without doing any work in it.
+     */
+    void release() { m_in_flight_count.fetch_sub(1, std::memory_order_relaxed); }
+
+    /**
+     * Gives a slot back after doing some work in it.
+     * @param latency How long the work took
+     */
+    void release(Clock::duration latency)
+    {
+        const size_t in_flight_count = m_in_flight_count.fetch_sub(1, std::memory_order_relaxed);
+        const auto now = Clock::now();
+        const std::scoped_lock lock(m_lock);
+        m_latency_sum += std::chrono::duration<double>(latency).count();
+        m_sample_count++;
+        m_max_in_flight_count = std::max(m_max_in_flight_count, in_flight_count);
+        if (m_window_start_time == Clock::time_point {})
+            m_window_start_time = now;
+        if (now - m_window_start_time >= m_options.window && m_sample_count >= m_options.min_sample_count)
+            update(now);
+    }
+
+    size_t limit() const { return m_integer_limit.load(std::memory_order_relaxed); }
+    size_t in_flight_count() const { return m_in_flight_count.load(std::memory_order_relaxed); }
+
+private:
+    const Options m_options;
+    std::atomic<size_t> m_in_flight_count = 0;
+
+    std::mutex m_lock;
+    double m_limit;
+    std::atomic<size_t> m_integer_limit;
+
+    /**
+     * Lowest average latency of a window, in seconds. It creeps up by 0.1%
+     * every window, so that a lasting change of the workload (e.g. a corpus
+     * twice as large) is eventually taken as the new normal. Since it can
+     * only be measured without contention, the limit should start low.
+     */
+    double m_min_latency = 0;
+
+    Clock::time_point m_window_start_time {};
+    double m_latency_sum = 0;
+    size_t m_sample_count = 0;
+    size_t m_max_in_flight_count = 0;
+
+    /**
+     * @remarks The lock must be held
+     */
+    void update(Clock::time_point now)
+    {
+        const double latency = m_latency_sum / m_sample_count;
+        m_min_latency = m_min_latency == 0 ? latency : std::min(m_min_latency * 1.001, latency);
+
+        const double gradient = std::clamp(m_options.tolerance * m_min_latency / latency, 0.5, 1.0);
+        double next_limit = m_limit * gradient + std::sqrt(m_limit);
+
+        // The limit can't be shown to be too low if it wasn't even reached
+        if (m_max_in_flight_count < m_integer_limit.load(std::memory_order_relaxed))
+            next_limit = std::min(next_limit, m_limit);
+
+        m_limit = std::clamp(m_limit * (1 - m_options.smoothing) + next_limit * m_options.smoothing, static_cast<double>(m_options.min_limit), static_cast<double>(m_options.max_limit));
+        m_integer_limit.store(static_cast<size_t>(m_limit), std::memory_order_relaxed);
+
+        m_window_start_time = now;
+        m_latency_sum = 0;
+        m_sample_count = 0;
+        m_max_in_flight_count = 0;
+    }
+};
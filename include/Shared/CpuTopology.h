@@ -0,0 +1,216 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * Logical CPUs this process may run on and how they share cores, caches and
+ * memory nodes, as told by sysfs.
+ */
+struct CpuTopology final {
+    struct Cpu {
+        unsigned id;
+        unsigned package_id;
+        unsigned core_id;
+
+        /**
+         * Identifiers of the L2 and last-level caches of this CPU, which are
+         * only comparable with those of the same level.
+         */
+        unsigned l2_id;
+        unsigned l3_id;
+
+        unsigned node_id;
+    };
+
+    /**
+     * Reads the topology of the CPUs in the affinity mask of this process.
+     * Anything sysfs doesn't tell is made up so that every CPU seems to be
+     * on a core of its own, sharing caches and memory with every other.
+     * @param sysfs_path Usually /sys/devices/system
+     */
+    static CpuTopology discover(const std::filesystem::path &sysfs_path = "/sys/devices/system")
+    {
+        std::vector<unsigned> cpu_ids = parse_cpu_list(read_line(sysfs_path / "cpu" / "online"));
+        cpu_set_t affinity;
+        if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+            std::erase_if(cpu_ids, [&](unsigned id) { return id >= CPU_SETSIZE || !CPU_ISSET(id, &affinity); });
+            if (cpu_ids.empty()) {
+                for (unsigned id = 0; id < CPU_SETSIZE; id++) {
+                    if (CPU_ISSET(id, &affinity))
+                        cpu_ids.push_back(id);
+                }
+            }
+        }
+        if (cpu_ids.empty()) {
+            for (unsigned id = 0; id < std::max(1u, std::thread::hardware_concurrency()); id++)
+                cpu_ids.push_back(id);
+        }
+
+        CpuTopology topology;
+        for (const unsigned id : cpu_ids) {
+            const auto cpu_path = sysfs_path / "cpu" / ("cpu" + std::to_string(id));
+            Cpu cpu { .id = id, .package_id = 0, .core_id = id, .l2_id = id, .l3_id = 0, .node_id = 0 };
+            read_number(cpu_path / "topology" / "physical_package_id", cpu.package_id);
+            read_number(cpu_path / "topology" / "core_id", cpu.core_id);
+
+            // Cores are only numbered within their package
+            cpu.core_id = cpu.core_id + (cpu.package_id << 16);
+            cpu.l2_id = cpu.core_id;
+            cpu.l3_id = cpu.package_id;
+
+            std::error_code error_code;
+            for (const auto &entry : std::filesystem::directory_iterator(cpu_path / "cache", error_code)) {
+                unsigned level;
+                if (!read_number(entry.path() / "level", level) || read_line(entry.path() / "type") == "Instruction")
+                    continue;
+
+                // Older kernels don't number caches, but then the first CPU
+                // sharing one will do
+                unsigned cache_id;
+                if (!read_number(entry.path() / "id", cache_id)) {
+                    const auto shared_cpu_ids = parse_cpu_list(read_line(entry.path() / "shared_cpu_list"));
+                    cache_id = shared_cpu_ids.empty() ? id : shared_cpu_ids.front();
+                }
+                if (level == 2)
+                    cpu.l2_id = cache_id;
+                else if (level == 3)
+                    cpu.l3_id = cache_id;
+            }
+
+            for (const auto &entry : std::filesystem::directory_iterator(cpu_path, error_code)) {
+                const auto name = entry.path().filename().string();
+                if (name.starts_with("node") && name.size() > 4 && std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                    cpu.node_id = std::stoul(name.substr(4));
+            }
+
+            topology.m_cpus.push_back(cpu);
+        }
+
+        std::sort(topology.m_cpus.begin(), topology.m_cpus.end(), [](const Cpu &a, const Cpu &b) {
+            return std::tie(a.node_id, a.package_id, a.l3_id, a.l2_id, a.core_id, a.id) < std::tie(b.node_id, b.package_id, b.l3_id, b.l2_id, b.core_id, b.id);
+        });
+        return topology;
+    }
+
+    /**
+     * CPUs sorted so that those sharing a memory node, a package, a cache and
+     * finally a core are next to each other.
+     */
+    const std::vector<Cpu> &cpus() const { return m_cpus; }
+
+    /**
+     * Groups CPUs by the cache they share.
+     * @param cache_level 2 or 3
+     * @return CPU identifiers of each group, in topology order
+     */
+    std::vector<std::vector<unsigned>> cache_domains(unsigned cache_level) const
+    {
+        std::map<std::tuple<unsigned, unsigned, unsigned>, std::vector<unsigned>> domains;
+        for (const auto &cpu : m_cpus)
+            domains[{ cpu.node_id, cpu.package_id, cache_level == 2 ? cpu.l2_id : cpu.l3_id }].push_back(cpu.id);
+
+        std::vector<std::vector<unsigned>> cpu_ids;
+        for (auto &[key, domain] : domains)
+            cpu_ids.push_back(std::move(domain));
+        return cpu_ids;
+    }
+
+    size_t core_count() const { return count_distinct([](const Cpu &cpu) { return cpu.core_id; }); }
+    size_t node_count() const { return count_distinct([](const Cpu &cpu) { return cpu.node_id; }); }
+
+    /**
+     * Restricts the calling thread to some CPUs.
+     * @return Whether it could be done
+     */
+    static bool pin_this_thread(std::span<const unsigned> cpu_ids)
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (const unsigned id : cpu_ids) {
+            if (id < CPU_SETSIZE)
+                CPU_SET(id, &cpu_set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+    }
+
+    /**
+     * Parses a list of CPUs in sysfs format, e.g. "0-3,8,10-11".
+     */
+    static std::vector<unsigned> parse_cpu_list(const std::string &cpu_list)
+    {
+        std::vector<unsigned> cpu_ids;
+        std::istringstream stream(cpu_list);
+        for (std::string range; std::getline(stream, range, ',');) {
+            unsigned first, last;
+            char dash;
+            std::istringstream range_stream(range);
+            if (!(range_stream >> first))
+                continue;
+            if (!(range_stream >> dash >> last) || dash != '-')
+                last = first;
+            for (unsigned id = first; id <= last; id++)
+                cpu_ids.push_back(id);
+        }
+        return cpu_ids;
+    }
+
+private:
+    std::vector<Cpu> m_cpus;
+
+    static std::string read_line(const std::filesystem::path &path)
+    {
+        std::ifstream stream(path);
+        std::string line;
+        std::getline(stream, line);
+        return line;
+    }
+
+    static bool read_number(const std::filesystem::path &path, unsigned &number)
+    {
+        std::ifstream stream(path);
+        unsigned value;
+        if (!(stream >> value))
+            return false;
+        number = value;
+        return true;
+    }
+
+    template<typename Key>
+    size_t count_distinct(Key key) const
+    {
+        std::vector<unsigned> keys;
+        for (const auto &cpu : m_cpus)
+            keys.push_back(key(cpu));
+        std::sort(keys.begin(), keys.end());
+        return std::unique(keys.begin(), keys.end()) - keys.begin();
+    }
+};
@@ -0,0 +1,78 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * Maps byte positions of a folded text back to the text it was folded from.
+ * Folding only ever shrinks sequences (e.g. "á" becomes "a"), so instead of
+ * keeping one entry per byte we only record an anchor wherever the distance
+ * between both texts changes. Pure ASCII text has no anchors at all.
+ */
+struct OffsetMap final {
+    struct Anchor {
+        uint64_t folded_pos;
+        uint64_t original_pos;
+    };
+
+    /**
+     * Records that the folded position `folded_pos` corresponds to the original
+     * position `original_pos`, and so do all positions up to the next anchor.
+     * @remarks Anchors must be added in increasing order.
+     */
+    void add_anchor(uint64_t folded_pos, uint64_t original_pos)
+    {
+        m_anchors.push_back({ folded_pos, original_pos });
+    }
+
+    uint64_t to_original(uint64_t folded_pos) const { return to_original(m_anchors, folded_pos); }
+
+    /**
+     * Translates a folded position using a list of anchors that may live
+     * somewhere else (e.g. in a memory-mapped file).
+     */
+    static uint64_t to_original(std::span<const Anchor> anchors, uint64_t folded_pos)
+    {
+        const auto it = std::upper_bound(anchors.begin(), anchors.end(), folded_pos,
+            [](uint64_t pos, const Anchor &anchor) { return pos < anchor.folded_pos; });
+        if (it == anchors.begin())
+            return folded_pos;
+
+        const auto &anchor = *std::prev(it);
+        return anchor.original_pos + (folded_pos - anchor.folded_pos);
+    }
+
+    bool is_identity() const { return m_anchors.empty(); }
+    const std::vector<Anchor> &anchors() const { return m_anchors; }
+
+private:
+    std::vector<Anchor> m_anchors;
+};
+
+/**
+ * Shadow copy of a text with its case (and optionally, its accents) folded,
+ * along with the offset map needed to translate matches back to the original.
+ */
+struct FoldedText final {
+    std::string text;
+    OffsetMap offsets;
+};
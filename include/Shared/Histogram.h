@@ -0,0 +1,143 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Histogram of non-negative integer values (e.g. latencies in nanoseconds)
+ * with a bounded relative error, as HdrHistogram does: values below 128 get
+ * a bucket each, and every power of two above that is split in 64 buckets,
+ * so that any value is known to within 1/64 (about 1.6%). Values are
+ * recorded with relaxed atomic increments, so any thread may record at once.
+ */
+struct Histogram final : NonCopyable, NonMoveable {
+    /**
+     * Values above this (about 18 minutes, in nanoseconds) are clamped.
+     */
+    static constexpr uint64_t MaxValue = (1ull << 40) - 1;
+
+    void record(uint64_t value)
+    {
+        value = std::min(value, MaxValue);
+        m_counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) { }
+    }
+
+    template<typename Rep, typename Period>
+    void record(std::chrono::duration<Rep, Period> duration)
+    {
+        record(static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count())));
+    }
+
+    /**
+     * Adds the values recorded by another histogram to this one.
+     */
+    void merge(const Histogram &other)
+    {
+        for (size_t i = 0; i < BucketCount; i++)
+            m_counts[i].fetch_add(other.m_counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_count.fetch_add(other.count(), std::memory_order_relaxed);
+        m_sum.fetch_add(other.sum(), std::memory_order_relaxed);
+
+        const uint64_t other_max = other.max();
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (other_max > max && !m_max.compare_exchange_weak(max, other_max, std::memory_order_relaxed)) { }
+    }
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    double mean() const { return count() ? static_cast<double>(sum()) / count() : 0; }
+
+    /**
+     * @param quantile Between 0 and 1, e.g. 0.999 for the 99.9th percentile
+     * @return A value no smaller than that fraction of the recorded values,
+     * to within the precision of the histogram, or zero if it is empty
+     */
+    uint64_t percentile(double quantile) const
+    {
+        const uint64_t total_count = count();
+        if (total_count == 0)
+            return 0;
+
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * total_count + 0.5));
+        uint64_t cumulative_count = 0;
+        for (size_t i = 0; i < BucketCount; i++) {
+            cumulative_count += m_counts[i].load(std::memory_order_relaxed);
+            if (cumulative_count >= rank)
+                return std::min(bucket_upper_bound(i), max());
+        }
+        return max();
+    }
+
+    /**
+     * Calls `visitor(upper_bound, count)' for every non-empty bucket, in
+     * increasing order.
+     */
+    template<typename Visitor>
+    void for_each_bucket(Visitor &&visitor) const
+    {
+        for (size_t i = 0; i < BucketCount; i++) {
+            if (const auto bucket_count = m_counts[i].load(std::memory_order_relaxed))
+                visitor(bucket_upper_bound(i), bucket_count);
+        }
+    }
+
+private:
+    static constexpr unsigned LinearBits = 7;
+    static constexpr uint64_t SubBucketCount = 1ull << (LinearBits - 1);
+    static constexpr size_t BucketCount = (std::bit_width(MaxValue) - LinearBits + 2) * SubBucketCount;
+
+    std::array<std::atomic<uint64_t>, BucketCount> m_counts {};
+    std::atomic<uint64_t> m_count = 0;
+    std::atomic<uint64_t> m_sum = 0;
+    std::atomic<uint64_t> m_max = 0;
+
+    static constexpr size_t bucket_index(uint64_t value)
+    {
+        if (value < (1ull << LinearBits))
+            return value;
+
+        // Keep the top LinearBits - 1 bits after the leading one
+        const unsigned shift = std::bit_width(value) - LinearBits;
+        return shift * SubBucketCount + (value >> shift);
+    }
+
+    static constexpr uint64_t bucket_upper_bound(size_t index)
+    {
+        if (index < (1ull << LinearBits))
+            return index;
+
+        const unsigned shift = index / SubBucketCount - 1;
+        const uint64_t sub_bucket = index - shift * SubBucketCount;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+};
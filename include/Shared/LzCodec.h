@@ -0,0 +1,211 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Self-contained LZ77 codec in the spirit of LZ4: a compressed block is a
+ * sequence of literal runs, each followed by a back-reference of at least
+ * MinMatchLength bytes to the 64 KiB of output before it. A token byte holds
+ * the length of both, and lengths of 15 or more continue in further bytes.
+ * The last sequence only has literals.
+ *
+ * Compression looks for the longest match among the latest positions that
+ * start with the same four bytes (hash chains), which is slow but yields
+ * about a third more compression than taking the first match, whereas
+ * decompression is a plain sequence of copies either way.
+ */
+struct LzCodec final {
+    static constexpr size_t MinMatchLength = 4;
+    static constexpr size_t MaxOffset = 0xffff;
+
+    /**
+     * How many earlier positions are tried for each match.
+     */
+    static constexpr size_t MaxChainLength = 32;
+
+    /**
+     * Compresses a block of data and appends it to `output'. Decompressing it
+     * requires its size, which is not stored.
+     */
+    static void compress(std::string_view input, std::string &output)
+    {
+        constexpr size_t HashLog = 14;
+        std::vector<uint32_t> heads(size_t(1) << HashLog, NoPosition);
+        std::vector<uint32_t> chain(input.size(), NoPosition);
+        const auto hash = [&](size_t pos) { return (read32(input.data() + pos) * 2654435761u) >> (32 - HashLog); };
+        const auto insert = [&](size_t pos) {
+            const auto h = hash(pos);
+            chain[pos] = heads[h];
+            heads[h] = pos;
+        };
+
+        size_t literal_start = 0;
+        for (size_t pos = 0; pos + MinMatchLength <= input.size();) {
+            size_t best_length = 0;
+            size_t best_offset = 0;
+            uint32_t candidate = heads[hash(pos)];
+            for (size_t attempts = 0; candidate != NoPosition && pos - candidate <= MaxOffset && attempts < MaxChainLength; attempts++) {
+                if (input[candidate + best_length] == input[pos + best_length]) {
+                    size_t length = 0;
+                    while (pos + length < input.size() && input[candidate + length] == input[pos + length])
+                        length++;
+                    if (length > best_length) {
+                        best_length = length;
+                        best_offset = pos - candidate;
+                    }
+                    if (pos + best_length == input.size())
+                        break;
+                }
+                candidate = chain[candidate];
+            }
+
+            if (best_length < MinMatchLength) {
+                insert(pos++);
+                continue;
+            }
+
+            write_sequence(input.substr(literal_start, pos - literal_start), best_offset, best_length, output);
+            for (const size_t end = pos + best_length; pos < end; pos++) {
+                if (pos + MinMatchLength <= input.size())
+                    insert(pos);
+            }
+            literal_start = pos;
+        }
+        write_sequence(input.substr(literal_start), 0, 0, output);
+    }
+
+    static std::string compress(std::string_view input)
+    {
+        std::string output;
+        compress(input, output);
+        return output;
+    }
+
+    /**
+     * Decompresses a block that is exactly `output_size' bytes long.
+     * @return Whether the block was valid, otherwise the output is garbage
+     */
+    static bool decompress(std::string_view input, char *output, size_t output_size)
+    {
+        const auto *in = reinterpret_cast<const uint8_t *>(input.data());
+        const auto *in_end = in + input.size();
+        char *out = output;
+        char *const out_end = output + output_size;
+
+        for (;;) {
+            if (in == in_end)
+                return false;
+            const uint8_t token = *in++;
+
+            size_t literal_length = token >> 4;
+            if (!read_length(in, in_end, literal_length) || literal_length > size_t(in_end - in) || literal_length > size_t(out_end - out))
+                return false;
+            if (literal_length <= 16 && in_end - in >= 16 && out_end - out >= 16)
+                std::memcpy(out, in, 16);
+            else
+                std::memcpy(out, in, literal_length);
+            in += literal_length;
+            out += literal_length;
+            if (out == out_end)
+                return in == in_end;
+
+            if (in_end - in < 2)
+                return false;
+            const size_t offset = in[0] | size_t(in[1]) << 8;
+            in += 2;
+            size_t match_length = token & 0xf;
+            if (!read_length(in, in_end, match_length) || offset == 0 || offset > size_t(out - output))
+                return false;
+            match_length += MinMatchLength;
+            if (match_length > size_t(out_end - out))
+                return false;
+
+            // Matches may overlap what they are copying, e.g. a run of spaces.
+            // Copying eight bytes at a time is still right as long as they are
+            // eight bytes apart, and may write past the match if there's room.
+            const char *match = out - offset;
+            char *const match_end = out + match_length;
+            if (offset >= 8 && size_t(out_end - match_end) >= 8) {
+                for (; out < match_end; out += 8, match += 8)
+                    std::memcpy(out, match, 8);
+                out = match_end;
+            } else {
+                while (out < match_end)
+                    *out++ = *match++;
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t NoPosition = UINT32_MAX;
+
+    static uint32_t read32(const char *data)
+    {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof value);
+        return value;
+    }
+
+    static void write_length(size_t length, std::string &output)
+    {
+        for (length -= 15; length >= 255; length -= 255)
+            output.push_back(char(255));
+        output.push_back(char(length));
+    }
+
+    /**
+     * Appends a run of literals and, unless `match_length' is zero, a match.
+     */
+    static void write_sequence(std::string_view literals, size_t offset, size_t match_length, std::string &output)
+    {
+        const size_t match_code = match_length ? match_length - MinMatchLength : 0;
+        output.push_back(char(std::min<size_t>(literals.size(), 15) << 4 | std::min<size_t>(match_code, 15)));
+        if (literals.size() >= 15)
+            write_length(literals.size(), output);
+        output.append(literals);
+        if (match_length == 0)
+            return;
+
+        output.push_back(char(offset & 0xff));
+        output.push_back(char(offset >> 8));
+        if (match_code >= 15)
+            write_length(match_code, output);
+    }
+
+    /**
+     * Adds the continuation bytes of a length that didn't fit in the token.
+     */
+    static bool read_length(const uint8_t *&in, const uint8_t *in_end, size_t &length)
+    {
+        if (length < 15)
+            return true;
+        for (uint8_t byte = 255; byte == 255; length += byte) {
+            if (in == in_end)
+                return false;
+            byte = *in++;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,347 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Intrusive multiple-producer, single-consumer queue. Producers never block
+ * nor take a lock: pushing is a single atomic exchange. Popping may transiently
+ * report the queue as empty while a producer is halfway through a push, so
+ * consumers must know by other means how many nodes they are waiting for.
+ */
+struct MpscQueue final : NonCopyable, NonMoveable {
+    struct Node {
+        std::atomic<Node *> next { nullptr };
+    };
+
+    MpscQueue() = default;
+
+    void push(Node *node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node *previous = m_head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * Removes the oldest node. Must only be called by one thread at a time.
+     * @return The node, or nullptr if there is none (yet)
+     */
+    Node *pop()
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (!next)
+                return nullptr;
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            return tail;
+        }
+
+        // A producer has swapped the head but not linked its node yet
+        if (tail != m_head.load(std::memory_order_acquire))
+            return nullptr;
+
+        // Put the stub back behind the last node so that it can be handed out
+        push(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    Node m_stub;
+    std::atomic<Node *> m_head { &m_stub };
+    Node *m_tail = &m_stub;
+};
+
+/**
+ * A deferred call waiting in a mailbox. The callable is stored inline when it
+ * fits, so that posting a message does not allocate once the pool is warm.
+ */
+struct MailboxTask final : MpscQueue::Node {
+    static constexpr size_t InlineSize = 96;
+
+    void (*run)(MailboxTask &) = nullptr;
+    void (*destroy)(MailboxTask &) = nullptr;
+    alignas(std::max_align_t) std::byte storage[InlineSize];
+};
+
+/**
+ * Recycles mailbox tasks. Each thread keeps a small cache of free tasks and
+ * trades them with a shared pool in batches, which matters because tasks are
+ * usually allocated by one thread (the sender) and released by another (the
+ * dispatcher).
+ */
+struct MailboxTaskPool final {
+    static constexpr size_t BatchSize = 32;
+
+    static MailboxTask *allocate()
+    {
+        auto &cache = local_cache();
+        if (cache.tasks.empty())
+            shared().take(cache.tasks);
+        MailboxTask *task = cache.tasks.back();
+        cache.tasks.pop_back();
+        return task;
+    }
+
+    static void release(MailboxTask *task)
+    {
+        auto &cache = local_cache();
+        cache.tasks.push_back(task);
+        if (cache.tasks.size() >= 2 * BatchSize)
+            shared().give(cache.tasks, BatchSize);
+    }
+
+private:
+    struct Shared final {
+        std::mutex lock;
+        std::vector<MailboxTask *> tasks;
+        std::vector<std::unique_ptr<MailboxTask[]>> chunks;
+
+        void take(std::vector<MailboxTask *> &into)
+        {
+            const std::scoped_lock scoped_lock(lock);
+            if (tasks.size() < BatchSize) {
+                chunks.push_back(std::make_unique<MailboxTask[]>(BatchSize));
+                for (size_t i = 0; i < BatchSize; i++)
+                    tasks.push_back(&chunks.back()[i]);
+            }
+            into.insert(into.end(), tasks.end() - BatchSize, tasks.end());
+            tasks.resize(tasks.size() - BatchSize);
+        }
+
+        void give(std::vector<MailboxTask *> &from, size_t count)
+        {
+            const std::scoped_lock scoped_lock(lock);
+            tasks.insert(tasks.end(), from.end() - count, from.end());
+            from.resize(from.size() - count);
+        }
+    };
+
+    struct LocalCache final {
+        std::vector<MailboxTask *> tasks;
+
+        ~LocalCache()
+        {
+            if (!tasks.empty())
+                shared().give(tasks, tasks.size());
+        }
+    };
+
+    static Shared &shared()
+    {
+        static Shared s_shared;
+        return s_shared;
+    }
+
+    static LocalCache &local_cache()
+    {
+        // Make sure the shared pool outlives every thread's cache
+        shared();
+        thread_local LocalCache t_cache;
+        return t_cache;
+    }
+};
+
+struct MailboxDispatcher;
+
+/**
+ * Queue of deferred calls that are run one at a time, in the order they were
+ * posted, by the threads of a MailboxDispatcher. Posting never blocks.
+ * @remarks A mailbox must outlive the calls posted to it.
+ */
+struct Mailbox final : NonCopyable, NonMoveable {
+    explicit Mailbox(MailboxDispatcher &dispatcher)
+        : m_dispatcher(dispatcher)
+    {
+    }
+
+    ~Mailbox() { wait_until_empty(); }
+
+    template<typename Callable>
+    void post(Callable &&callable);
+
+    /**
+     * Blocks until every call posted so far has been run. Must not be called
+     * from a call running on this mailbox.
+     */
+    void wait_until_empty() const
+    {
+        while (m_pending.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+    }
+
+private:
+    friend struct MailboxDispatcher;
+
+    /**
+     * Calls run per turn, so that a busy mailbox can't monopolize a dispatcher
+     * thread.
+     */
+    static constexpr size_t BatchSize = 64;
+
+    MailboxDispatcher &m_dispatcher;
+    MpscQueue m_queue;
+    std::atomic<size_t> m_pending { 0 };
+
+    /**
+     * Runs a batch of calls.
+     * @return Whether there are calls left, in which case the mailbox must be
+     * scheduled again
+     */
+    bool drain()
+    {
+        const size_t count = std::min(m_pending.load(std::memory_order_acquire), BatchSize);
+        for (size_t i = 0; i < count; i++) {
+            MpscQueue::Node *node;
+            while (!(node = m_queue.pop()))
+                std::this_thread::yield();
+
+            auto *task = static_cast<MailboxTask *>(node);
+            task->run(*task);
+            task->destroy(*task);
+            MailboxTaskPool::release(task);
+        }
+        return m_pending.fetch_sub(count, std::memory_order_acq_rel) != count;
+    }
+};
+
+/**
+ * Pool of threads running the calls posted to a set of mailboxes. A mailbox
+ * is only ever drained by one thread at a time, so calls posted to the same
+ * mailbox never overlap, while different mailboxes are drained in parallel.
+ */
+struct MailboxDispatcher final : NonCopyable, NonMoveable {
+    MailboxDispatcher() = default;
+    ~MailboxDispatcher() { stop(); }
+
+    void start(size_t thread_count)
+    {
+        m_keep_running = true;
+        for (size_t i = 0; i < std::max<size_t>(thread_count, 1); i++)
+            m_threads.emplace_back(&MailboxDispatcher::run, this);
+    }
+
+    /**
+     * Runs every pending call, including those posted while stopping, and
+     * joins the dispatcher threads.
+     */
+    void stop()
+    {
+        {
+            const std::scoped_lock lock(m_lock);
+            m_keep_running = false;
+        }
+        m_condition_variable.notify_all();
+        for (auto &thread : m_threads)
+            thread.join();
+        m_threads.clear();
+    }
+
+private:
+    friend struct Mailbox;
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;
+    std::condition_variable m_condition_variable;
+    std::deque<Mailbox *> m_ready;
+    size_t m_active_count = 0;
+    bool m_keep_running = true;
+
+    void schedule(Mailbox &mailbox)
+    {
+        {
+            const std::scoped_lock lock(m_lock);
+            m_ready.push_back(&mailbox);
+        }
+        m_condition_variable.notify_one();
+    }
+
+    void run()
+    {
+        std::unique_lock lock(m_lock);
+        for (;;) {
+            // Keep going until nothing is left and nothing can be posted from
+            // a call that is still running
+            m_condition_variable.wait(lock, [this] { return !m_ready.empty() || (!m_keep_running && m_active_count == 0); });
+            if (m_ready.empty())
+                break;
+
+            Mailbox *mailbox = m_ready.front();
+            m_ready.pop_front();
+            m_active_count++;
+            lock.unlock();
+
+            const bool has_more = mailbox->drain();
+
+            lock.lock();
+            m_active_count--;
+            if (has_more)
+                m_ready.push_back(mailbox);
+            if (has_more || m_active_count == 0)
+                m_condition_variable.notify_all();
+        }
+    }
+};
+
+template<typename Callable>
+void Mailbox::post(Callable &&callable)
+{
+    using Stored = std::decay_t<Callable>;
+
+    MailboxTask *task = MailboxTaskPool::allocate();
+    if constexpr (sizeof(Stored) <= MailboxTask::InlineSize && alignof(Stored) <= alignof(std::max_align_t)) {
+        new (task->storage) Stored(std::forward<Callable>(callable));
+        task->run = [](MailboxTask &task) { (*std::launder(reinterpret_cast<Stored *>(task.storage)))(); };
+        task->destroy = [](MailboxTask &task) { std::launder(reinterpret_cast<Stored *>(task.storage))->~Stored(); };
+    } else {
+        // Too large to be stored inline, fall back to the heap
+        new (task->storage) Stored *(new Stored(std::forward<Callable>(callable)));
+        task->run = [](MailboxTask &task) { (**std::launder(reinterpret_cast<Stored **>(task.storage)))(); };
+        task->destroy = [](MailboxTask &task) { delete *std::launder(reinterpret_cast<Stored **>(task.storage)); };
+    }
+
+    m_queue.push(task);
+    if (m_pending.fetch_add(1, std::memory_order_acq_rel) == 0)
+        m_dispatcher.schedule(*this);
+}
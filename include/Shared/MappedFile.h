@@ -0,0 +1,80 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Read-only memory mapping of a whole file. Pages are loaded on demand by the
+ * kernel, so mapping a file is cheap regardless of its size.
+ */
+struct MappedFile final : NonCopyable, NonMoveable {
+    static std::shared_ptr<const MappedFile> open(const std::string &file_path)
+    {
+        return std::shared_ptr<const MappedFile>(new MappedFile(file_path));
+    }
+
+    ~MappedFile()
+    {
+        if (m_data != nullptr)
+            munmap(m_data, m_size);
+    }
+
+    const char *data() const { return static_cast<const char *>(m_data); }
+    size_t size() const { return m_size; }
+    std::string_view view(size_t offset, size_t length) const { return { data() + offset, length }; }
+
+private:
+    void *m_data = nullptr;
+    size_t m_size = 0;
+
+    explicit MappedFile(const std::string &file_path)
+    {
+        const int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status;
+        if (fd == -1 || fstat(fd, &status) == -1) {
+            const int error = errno;
+            if (fd != -1)
+                close(fd);
+            throw std::runtime_error("Could not open '" + file_path + "': " + std::strerror(error));
+        }
+
+        m_size = status.st_size;
+        if (m_size > 0)
+            m_data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (m_data == MAP_FAILED) {
+            m_data = nullptr;
+            throw std::runtime_error("Could not map '" + file_path + "': " + std::strerror(errno));
+        }
+    }
+};
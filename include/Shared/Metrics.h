@@ -0,0 +1,198 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+#include "Histogram.h"
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Value that many threads add to at once. Each thread adds to one of several
+ * cache line-sized slots, so that threads seldom contend for the same line,
+ * and reading the value sums them all.
+ */
+template<typename T>
+struct ShardedValue : NonCopyable, NonMoveable {
+    static constexpr size_t ShardCount = 16;
+
+    void add(T amount) { m_shards[shard_index()].value.fetch_add(amount, std::memory_order_relaxed); }
+
+    T value() const
+    {
+        T sum = 0;
+        for (const auto &shard : m_shards)
+            sum += shard.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<T> value { 0 };
+    };
+
+    std::array<Shard, ShardCount> m_shards;
+
+    static size_t shard_index()
+    {
+        static std::atomic<size_t> s_last_index = 0;
+        thread_local const size_t t_index = s_last_index++ % ShardCount;
+        return t_index;
+    }
+};
+
+/**
+ * Monotonically increasing count of events, e.g. requests or bytes scanned.
+ */
+struct Counter final : ShardedValue<uint64_t> {
+    void increment(uint64_t amount = 1) { add(amount); }
+};
+
+/**
+ * Value that goes up and down, e.g. queue depth or busy workers.
+ */
+struct Gauge final : ShardedValue<int64_t> {
+    void increment(int64_t amount = 1) { add(amount); }
+    void decrement(int64_t amount = 1) { add(-amount); }
+};
+
+/**
+ * Set of named metrics exposed in the Prometheus text format. Metrics are
+ * created on first use and live for as long as the program does, so
+ * instrumented code looks them up once and keeps a reference to them.
+ * Histograms record durations in nanoseconds and are exported in seconds.
+ */
+struct MetricsRegistry final : NonCopyable, NonMoveable {
+    static MetricsRegistry &instance()
+    {
+        static MetricsRegistry metrics_registry;
+        return metrics_registry;
+    }
+
+    /**
+     * @param labels Label set in Prometheus syntax, without braces, e.g.
+     * `class="premium"'
+     */
+    Counter &counter(const std::string &name, const std::string &help, const std::string &labels = {}) { return get<Counter>(name, help, labels); }
+    Gauge &gauge(const std::string &name, const std::string &help, const std::string &labels = {}) { return get<Gauge>(name, help, labels); }
+    Histogram &histogram(const std::string &name, const std::string &help, const std::string &labels = {}) { return get<Histogram>(name, help, labels); }
+
+    void write_prometheus(std::ostream &stream) const
+    {
+        const std::scoped_lock lock(m_lock);
+        for (const auto &[name, family] : m_families) {
+            stream << "# HELP " << name << ' ' << family.help << '\n';
+            stream << "# TYPE " << name << ' ' << type_name(family) << '\n';
+            for (const auto &[labels, metric] : family.metrics) {
+                if (const auto *counter = std::get_if<std::unique_ptr<Counter>>(&metric))
+                    stream << name << braced(labels) << ' ' << (*counter)->value() << '\n';
+                else if (const auto *gauge = std::get_if<std::unique_ptr<Gauge>>(&metric))
+                    stream << name << braced(labels) << ' ' << (*gauge)->value() << '\n';
+                else
+                    write_histogram(stream, name, labels, *std::get<std::unique_ptr<Histogram>>(metric));
+            }
+        }
+    }
+
+private:
+    using Metric = std::variant<std::unique_ptr<Counter>, std::unique_ptr<Gauge>, std::unique_ptr<Histogram>>;
+
+    struct Family {
+        std::string help;
+        std::map<std::string, Metric> metrics;
+    };
+
+    mutable std::mutex m_lock;
+    std::map<std::string, Family> m_families;
+
+    MetricsRegistry() = default;
+
+    template<typename T>
+    T &get(const std::string &name, const std::string &help, const std::string &labels)
+    {
+        const std::scoped_lock lock(m_lock);
+        auto &family = m_families[name];
+        family.help = help;
+        auto &metric = family.metrics[labels];
+        const bool is_new = std::visit([](const auto &existing) { return !existing; }, metric);
+        if (is_new)
+            metric = std::make_unique<T>();
+        else if (!std::holds_alternative<std::unique_ptr<T>>(metric))
+            throw std::runtime_error("metric '" + name + "' was registered with another type");
+        return *std::get<std::unique_ptr<T>>(metric);
+    }
+
+    static const char *type_name(const Family &family)
+    {
+        if (family.metrics.empty())
+            return "untyped";
+        switch (family.metrics.begin()->second.index()) {
+        case 0:
+            return "counter";
+        case 1:
+            return "gauge";
+        default:
+            return "histogram";
+        }
+    }
+
+    static std::string braced(const std::string &labels) { return labels.empty() ? labels : "{" + labels + "}"; }
+
+    /**
+     * Exports a histogram with a fixed set of buckets, from 10µs to 10s.
+     */
+    static void write_histogram(std::ostream &stream, const std::string &name, const std::string &labels, const Histogram &histogram)
+    {
+        static constexpr double k_bucket_bounds[] = { 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+        const std::string separator = labels.empty() ? "" : ",";
+
+        // Histogram buckets are much finer than these, so each one falls in
+        // the first bucket that holds its upper bound
+        std::array<uint64_t, std::size(k_bucket_bounds)> counts {};
+        uint64_t total_count = 0;
+        histogram.for_each_bucket([&](uint64_t upper_bound, uint64_t count) {
+            const double seconds = upper_bound / 1e9;
+            for (size_t i = 0; i < counts.size(); i++) {
+                if (seconds <= k_bucket_bounds[i]) {
+                    counts[i] += count;
+                    break;
+                }
+            }
+            total_count += count;
+        });
+
+        uint64_t cumulative_count = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            cumulative_count += counts[i];
+            stream << name << "_bucket{" << labels << separator << "le=\"" << k_bucket_bounds[i] << "\"} " << cumulative_count << '\n';
+        }
+        stream << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << total_count << '\n';
+        stream << name << "_sum" << braced(labels) << ' ' << histogram.sum() / 1e9 << '\n';
+        stream << name << "_count" << braced(labels) << ' ' << total_count << '\n';
+    }
+};
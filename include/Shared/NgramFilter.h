@@ -0,0 +1,84 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/**
+ * Bloom filter of the n-grams (four-byte sequences) of a text. It answers
+ * whether a text may contain a given n-gram: a negative answer is always right,
+ * while a positive one may be wrong.
+ *
+ * The filter has a fixed size. At 4 KiB and two hashes per n-gram, it yields
+ * about 27% false positives per n-gram when summarizing the ~12000 distinct
+ * n-grams of 64 KiB of natural language text. Four-byte n-grams rule out far
+ * more text than trigrams do for the same false positive rate, since most
+ * trigrams of a word are common on their own.
+ */
+struct NgramFilter final {
+    static constexpr size_t GramLength = 4;
+    static constexpr size_t BitCountLog2 = 15;
+    static constexpr size_t BitCount = size_t(1) << BitCountLog2;
+    static constexpr size_t HashCount = 2;
+    static_assert(BitCountLog2 * HashCount <= 64);
+
+    /**
+     * Adds the n-grams that start in the first `count' bytes of `text'. The
+     * last ones may extend past them, as long as they are within `text'.
+     */
+    void add(std::string_view text, size_t count)
+    {
+        for (size_t pos = 0; pos < count && pos + GramLength <= text.size(); pos++) {
+            const uint64_t gram_hash = hash(text.data() + pos);
+            for (size_t i = 0; i < HashCount; i++) {
+                const size_t bit = bit_of(gram_hash, i);
+                m_words[bit / 64] |= uint64_t(1) << (bit % 64);
+            }
+        }
+    }
+
+    /**
+     * @param gram Pointer to GramLength bytes
+     */
+    bool may_contain(const char *gram) const
+    {
+        const uint64_t gram_hash = hash(gram);
+        for (size_t i = 0; i < HashCount; i++) {
+            const size_t bit = bit_of(gram_hash, i);
+            if ((m_words[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    std::array<uint64_t, BitCount / 64> m_words {};
+
+    static uint64_t hash(const char *gram)
+    {
+        uint32_t value;
+        std::memcpy(&value, gram, sizeof value);
+        return (value + 1) * 0x9e3779b97f4a7c15ull;
+    }
+
+    /**
+     * Each hash takes a different slice of the top bits of the product.
+     */
+    static size_t bit_of(uint64_t gram_hash, size_t i) { return (gram_hash >> (64 - BitCountLog2 * (i + 1))) % BitCount; }
+};
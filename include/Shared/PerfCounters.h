@@ -0,0 +1,242 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Hardware events counted over some span of time.
+ */
+struct PerfSample final {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t cache_misses = 0;
+    uint64_t branch_misses = 0;
+
+    PerfSample &operator+=(const PerfSample &other)
+    {
+        cycles += other.cycles;
+        instructions += other.instructions;
+        cache_misses += other.cache_misses;
+        branch_misses += other.branch_misses;
+        return *this;
+    }
+
+    /**
+     * Saturates at zero, since multiplexed counts are extrapolated and may
+     * seem to go backwards.
+     */
+    PerfSample operator-(const PerfSample &other) const
+    {
+        const auto difference = [](uint64_t a, uint64_t b) { return a > b ? a - b : 0; };
+        return { difference(cycles, other.cycles), difference(instructions, other.instructions), difference(cache_misses, other.cache_misses),
+            difference(branch_misses, other.branch_misses) };
+    }
+
+    double instructions_per_cycle() const { return cycles > 0 ? static_cast<double>(instructions) / cycles : 0; }
+};
+
+/**
+ * Hardware performance counters of a thread, read through perf_event_open(2).
+ * The events are opened as a group, so the kernel always schedules them onto
+ * the PMU together and their ratios stay meaningful even when it has to
+ * multiplex them. Counting is off until enable() succeeds, which it doesn't
+ * where the kernel or the hardware won't provide these events (e.g. in most
+ * containers and virtual machines), nor anywhere but on Linux.
+ */
+struct PerfCounters final : NonCopyable, NonMoveable {
+    /**
+     * Turns counting on for every thread.
+     * @throws std::runtime_error If the counters can't be opened, in which
+     * case counting stays off
+     */
+    static void enable()
+    {
+        const PerfCounters counters;
+        if (!counters.m_error.empty())
+            throw std::runtime_error(counters.m_error);
+        s_is_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    static bool is_enabled() { return s_is_enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * Reads the counters of the calling thread, opening them on first use.
+     * They are closed when the thread exits.
+     * @return Nothing if counting is off or the counters couldn't be opened
+     */
+    static std::optional<PerfSample> read_this_thread()
+    {
+        if (!is_enabled())
+            return std::nullopt;
+        thread_local const PerfCounters t_counters;
+        return t_counters.read();
+    }
+
+    /**
+     * Sum of the events counted by every PerfScope that has ended so far.
+     */
+    static PerfSample totals()
+    {
+        return {
+            s_totals[0].load(std::memory_order_relaxed),
+            s_totals[1].load(std::memory_order_relaxed),
+            s_totals[2].load(std::memory_order_relaxed),
+            s_totals[3].load(std::memory_order_relaxed),
+        };
+    }
+
+    static void add_to_totals(const PerfSample &sample)
+    {
+        s_totals[0].fetch_add(sample.cycles, std::memory_order_relaxed);
+        s_totals[1].fetch_add(sample.instructions, std::memory_order_relaxed);
+        s_totals[2].fetch_add(sample.cache_misses, std::memory_order_relaxed);
+        s_totals[3].fetch_add(sample.branch_misses, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t EventCount = 4;
+
+    /**
+     * Layout of a read with PERF_FORMAT_GROUP, PERF_FORMAT_TOTAL_TIME_ENABLED
+     * and PERF_FORMAT_TOTAL_TIME_RUNNING.
+     */
+    struct GroupReading {
+        uint64_t event_count;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[EventCount];
+    };
+
+    inline static std::atomic<bool> s_is_enabled = false;
+    inline static std::array<std::atomic<uint64_t>, EventCount> s_totals {};
+
+    std::array<int, EventCount> m_fds;
+    std::string m_error;
+
+    PerfCounters()
+    {
+        m_fds.fill(-1);
+#ifdef __linux__
+        static constexpr std::array<std::pair<uint64_t, const char *>, EventCount> k_events { {
+            { PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+            { PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+            { PERF_COUNT_HW_CACHE_MISSES, "cache misses" },
+            { PERF_COUNT_HW_BRANCH_MISSES, "branch misses" },
+        } };
+
+        for (size_t i = 0; i < EventCount; i++) {
+            perf_event_attr attributes {};
+            attributes.size = sizeof(attributes);
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = k_events[i].first;
+            attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+
+            // This thread only, on whichever CPU it runs
+            m_fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, m_fds[0], PERF_FLAG_FD_CLOEXEC));
+            if (m_fds[i] < 0) {
+                m_error = std::string("could not count ") + k_events[i].second + ": " + std::strerror(errno);
+                break;
+            }
+        }
+#else
+        m_error = "hardware counters are unsupported on this platform";
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (const int fd : m_fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+
+    std::optional<PerfSample> read() const
+    {
+#ifdef __linux__
+        GroupReading reading;
+        if (!m_error.empty() || ::read(m_fds[0], &reading, sizeof(reading)) != sizeof(reading) || reading.time_running == 0)
+            return std::nullopt;
+
+        // Extrapolate if the group was multiplexed with other events
+        const double scale = static_cast<double>(reading.time_enabled) / reading.time_running;
+        const auto scaled = [&](size_t i) { return static_cast<uint64_t>(reading.values[i] * scale); };
+        return PerfSample { scaled(0), scaled(1), scaled(2), scaled(3) };
+#else
+        return std::nullopt;
+#endif
+    }
+};
+
+/**
+ * Counts the hardware events of the calling thread from its construction
+ * until it is stopped or destroyed, and then adds them to the totals.
+ */
+struct PerfScope final : NonCopyable {
+    PerfScope()
+        : m_start_sample(PerfCounters::read_this_thread())
+    {
+    }
+
+    ~PerfScope() { stop(); }
+
+    /**
+     * @return Events counted since construction, or nothing if counting is
+     * off or the scope was already stopped
+     */
+    std::optional<PerfSample> stop()
+    {
+        if (!m_start_sample)
+            return std::nullopt;
+
+        const auto end_sample = PerfCounters::read_this_thread();
+        const auto start_sample = *m_start_sample;
+        m_start_sample.reset();
+        if (!end_sample)
+            return std::nullopt;
+
+        const auto sample = *end_sample - start_sample;
+        PerfCounters::add_to_totals(sample);
+        return sample;
+    }
+
+private:
+    std::optional<PerfSample> m_start_sample;
+};
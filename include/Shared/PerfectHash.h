@@ -0,0 +1,158 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/**
+ * Minimal-ish perfect hashing of a static set of strings (hash, displace and
+ * compress). Keys are split into buckets by a first hash; then, starting with
+ * the largest bucket, each bucket is given the smallest displacement that sends
+ * all of its keys to free slots. Lookups take two hashes and one displacement
+ * read, and never probe.
+ *
+ * The table only maps keys to slots; callers store the keys themselves in the
+ * slots in order to tell keys in the set from any other string.
+ */
+struct PerfectHash final {
+    struct Parameters {
+        uint64_t seed;
+        uint64_t slot_count;
+        std::vector<uint32_t> displacements;
+
+        /**
+         * Slot assigned to each key, in the order they were given.
+         */
+        std::vector<uint32_t> slots;
+    };
+
+    /**
+     * Average number of keys per bucket.
+     */
+    static constexpr size_t BucketSize = 4;
+
+    /**
+     * @return The parameters, or nothing if no displacement was found after a
+     * few attempts (e.g. the keys are not unique)
+     */
+    static std::optional<Parameters> build(std::span<const std::string_view> keys)
+    {
+        constexpr uint32_t max_displacement = 1 << 20;
+        const size_t bucket_count = std::max<size_t>(1, keys.size() / BucketSize);
+        const uint64_t slot_count = keys.size() + keys.size() / 8 + 1;
+
+        for (uint64_t seed = 0; seed < 8; seed++) {
+            std::vector<std::vector<uint32_t>> buckets(bucket_count);
+            std::vector<uint64_t> hashes(keys.size());
+            for (size_t i = 0; i < keys.size(); i++) {
+                hashes[i] = hash(keys[i], seed);
+                buckets[bucket_of(hashes[i], bucket_count)].push_back(i);
+            }
+
+            std::vector<size_t> bucket_order(bucket_count);
+            std::iota(bucket_order.begin(), bucket_order.end(), 0);
+            std::stable_sort(bucket_order.begin(), bucket_order.end(),
+                [&](size_t lhs, size_t rhs) { return buckets[lhs].size() > buckets[rhs].size(); });
+
+            Parameters parameters { seed, slot_count, std::vector<uint32_t>(bucket_count), std::vector<uint32_t>(keys.size()) };
+            std::vector<bool> is_taken(slot_count);
+            std::vector<uint64_t> candidate_slots;
+            bool failed = false;
+
+            for (const size_t bucket : bucket_order) {
+                if (buckets[bucket].empty())
+                    break;
+
+                uint32_t displacement = 0;
+                for (; displacement < max_displacement; displacement++) {
+                    candidate_slots.clear();
+                    for (const uint32_t key : buckets[bucket]) {
+                        const uint64_t slot = slot_of(hashes[key], displacement, slot_count);
+                        if (is_taken[slot] || std::find(candidate_slots.begin(), candidate_slots.end(), slot) != candidate_slots.end())
+                            break;
+                        candidate_slots.push_back(slot);
+                    }
+                    if (candidate_slots.size() == buckets[bucket].size())
+                        break;
+                }
+
+                if (displacement == max_displacement) {
+                    failed = true;
+                    break;
+                }
+
+                parameters.displacements[bucket] = displacement;
+                for (size_t i = 0; i < candidate_slots.size(); i++) {
+                    is_taken[candidate_slots[i]] = true;
+                    parameters.slots[buckets[bucket][i]] = candidate_slots[i];
+                }
+            }
+
+            if (!failed)
+                return parameters;
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * @return The only slot the key may be in, if it is in the set at all
+     */
+    static uint64_t lookup(std::string_view key, uint64_t seed, std::span<const uint32_t> displacements, uint64_t slot_count)
+    {
+        const uint64_t key_hash = hash(key, seed);
+        return slot_of(key_hash, displacements[bucket_of(key_hash, displacements.size())], slot_count);
+    }
+
+private:
+    /**
+     * FNV-1a followed by a 64-bit finalizer, so that both halves are usable.
+     * The high half picks the bucket and the whole hash, mixed again with the
+     * displacement, picks the slot.
+     */
+    static uint64_t hash(std::string_view key, uint64_t seed)
+    {
+        uint64_t value = 0xcbf29ce484222325ull ^ (seed * 0x9e3779b97f4a7c15ull);
+        for (const char c : key) {
+            value ^= static_cast<uint8_t>(c);
+            value *= 0x100000001b3ull;
+        }
+        return mix(value);
+    }
+
+    static size_t bucket_of(uint64_t key_hash, size_t bucket_count) { return (key_hash >> 32) % bucket_count; }
+
+    static uint64_t slot_of(uint64_t key_hash, uint32_t displacement, uint64_t slot_count)
+    {
+        return mix(key_hash ^ (displacement * 0x9e3779b97f4a7c15ull)) % slot_count;
+    }
+
+    static uint64_t mix(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
+    }
+};
@@ -0,0 +1,67 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <chrono>
+
+/**
+ * Tells whether a queue is overloaded by looking at how long its items wait,
+ * as CoDel does: a queue is not overloaded because it is long, but because its
+ * delay stays above a target for a whole interval, meaning that it is not
+ * draining a burst but building up a standing backlog.
+ * @remarks Not thread-safe, it is meant to be guarded by the queue lock.
+ */
+struct QueueDelayMonitor final {
+    using Clock = std::chrono::steady_clock;
+
+    QueueDelayMonitor(Clock::duration target_delay, Clock::duration interval)
+        : m_target_delay(target_delay)
+        , m_interval(interval)
+    {
+    }
+
+    /**
+     * Records the delay of an item, either when it leaves the queue or the
+     * current age of the oldest one. An empty queue has no delay.
+     * @return Whether the queue is overloaded
+     */
+    bool observe(Clock::duration delay, Clock::time_point now)
+    {
+        if (delay < m_target_delay) {
+            m_first_above_time = {};
+            m_is_overloaded = false;
+        } else if (m_first_above_time == Clock::time_point {}) {
+            m_first_above_time = now + m_interval;
+        } else if (now >= m_first_above_time) {
+            m_is_overloaded = true;
+        }
+        return m_is_overloaded;
+    }
+
+    bool is_overloaded() const { return m_is_overloaded; }
+    Clock::duration target_delay() const { return m_target_delay; }
+
+private:
+    const Clock::duration m_target_delay;
+    const Clock::duration m_interval;
+
+    /**
+     * When the delay will have been above the target for a whole interval,
+     * or zero if it is currently below the target.
+     */
+    Clock::time_point m_first_above_time {};
+    bool m_is_overloaded = false;
+};
@@ -0,0 +1,117 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Holds an immutable value that can be read without ever taking a lock and
+ * replaced atomically (read-copy-update). Readers announce themselves on one
+ * of two counters selected by the current epoch; writers publish the new value,
+ * flip the epoch twice and wait for each counter to drain before reclaiming
+ * the previous value. Writers are serialized among themselves.
+ */
+template<typename T>
+struct RcuCell final : NonCopyable, NonMoveable {
+    /**
+     * Keeps the value that was current upon construction alive until this
+     * guard goes out of scope.
+     */
+    struct ReadGuard final : NonCopyable {
+        ReadGuard(std::atomic<size_t> &readers, const T *value)
+            : m_readers(readers)
+            , m_value(value)
+        {
+        }
+
+        ~ReadGuard() { m_readers.fetch_sub(1, std::memory_order_release); }
+
+        const T &operator*() const { return *m_value; }
+        const T *operator->() const { return m_value; }
+
+    private:
+        std::atomic<size_t> &m_readers;
+        const T *m_value;
+    };
+
+    explicit RcuCell(std::unique_ptr<const T> initial_value)
+        : m_value(initial_value.release())
+    {
+    }
+
+    ~RcuCell() { delete m_value.load(); }
+
+    /**
+     * Obtains the current value. This is wait-free.
+     */
+    ReadGuard read() const
+    {
+        auto &readers = m_readers[m_epoch.load() & 1].count;
+        readers.fetch_add(1);
+        return ReadGuard(readers, m_value.load());
+    }
+
+    /**
+     * Replaces the current value with the one returned by `updater', which is
+     * given the current value. Blocks until no reader can observe the previous
+     * value and reclaims it.
+     */
+    template<typename Updater>
+    void update(Updater &&updater)
+    {
+        const std::scoped_lock lock(m_writer_lock);
+        std::unique_ptr<const T> next_value = updater(*m_value.load());
+        std::unique_ptr<const T> previous_value(m_value.exchange(next_value.release()));
+        synchronize();
+    }
+
+private:
+    struct alignas(64) ReaderCount {
+        std::atomic<size_t> count { 0 };
+    };
+
+    mutable ReaderCount m_readers[2];
+    mutable std::atomic<size_t> m_epoch { 0 };
+    std::atomic<const T *> m_value;
+    std::mutex m_writer_lock;
+
+    /**
+     * Waits for a grace period, this is, until every reader that might have
+     * obtained the previous value has released it.
+     */
+    void synchronize()
+    {
+        using namespace std::chrono_literals;
+
+        for (int i = 0; i < 2; i++) {
+            const auto &readers = m_readers[m_epoch.fetch_add(1) & 1].count;
+            for (size_t spins = 0; readers.load() != 0; spins++) {
+                if (spins < 64)
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(1ms);
+            }
+        }
+    }
+};
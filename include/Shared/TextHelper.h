@@ -16,24 +16,147 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
 #include <map>
 #include <ostream>
-#include <algorithm>
+#include <string>
+#include <string_view>
+#include <tuple>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "FoldedText.h"
 
 struct TextHelper final {
+#pragma region Unicode
+    /**
+     * Determines how text is normalized before being matched. Both modes fold
+     * case (including accented Latin, Greek and Cyrillic letters), the latter
+     * also strips diacritics so that "ÚLTIMA" and "ultima" match "última".
+     */
+    enum struct FoldMode {
+        CaseInsensitive,
+        CaseAndAccentInsensitive
+    };
+
+    /**
+     * Checks whether a buffer only contains ASCII characters, 16 bytes at a
+     * time when SSE2 is available and 8 bytes at a time otherwise.
+     */
+    static inline bool is_ascii(const char *data, size_t length)
+    {
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= length; i += 16) {
+            if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i))) != 0)
+                return false;
+        }
+#endif
+        for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof word);
+            if (word & 0x8080808080808080ull)
+                return false;
+        }
+        for (; i < length; i++) {
+            if (data[i] & 0x80)
+                return false;
+        }
+        return true;
+    }
+
+    static inline bool is_ascii(std::string_view text) { return is_ascii(text.data(), text.size()); }
+
+    /**
+     * Folds a UTF-8 encoded text. Pure ASCII chunks are lowercased in bulk and
+     * never reach the Unicode path. Invalid UTF-8 sequences are copied verbatim.
+     * @param text Text to be folded
+     * @param mode Whether accents should be stripped as well
+     * @return The folded text along with its offset map
+     */
+    static FoldedText fold(std::string_view text, FoldMode mode)
+    {
+        FoldedText folded;
+        // Folding never makes a sequence longer, so the output fits in this
+        folded.text.resize(text.size());
+        char *out = folded.text.data();
+        size_t in_pos = 0, out_pos = 0;
+
+        while (in_pos < text.size()) {
+            if (in_pos + k_ascii_chunk_size <= text.size() && fold_ascii_chunk(text.data() + in_pos, out + out_pos)) {
+                in_pos += k_ascii_chunk_size;
+                out_pos += k_ascii_chunk_size;
+                continue;
+            }
+
+            const auto byte = static_cast<unsigned char>(text[in_pos]);
+            if (byte < 0x80) {
+                out[out_pos++] = ascii_to_lowercase(byte);
+                in_pos++;
+                continue;
+            }
+
+            const auto [codepoint, length] = decode_utf8(text, in_pos);
+            if (length == 0) {
+                out[out_pos++] = text[in_pos++];
+                continue;
+            }
+
+            const size_t written = encode_utf8(fold_codepoint(codepoint, mode), out + out_pos);
+            in_pos += length;
+            out_pos += written;
+            if (written != length)
+                folded.offsets.add_anchor(out_pos, in_pos);
+        }
+
+        folded.text.resize(out_pos);
+        return folded;
+    }
+
+    static std::string fold_string(std::string_view text, FoldMode mode) { return fold(text, mode).text; }
+
+    static constexpr char32_t fold_codepoint(char32_t codepoint, FoldMode mode)
+    {
+        if (codepoint < 0x80)
+            return ascii_to_lowercase(codepoint);
+
+        // Latin-1 Supplement, except for the multiplication sign
+        if (codepoint >= 0xc0 && codepoint <= 0xde && codepoint != 0xd7)
+            codepoint += 0x20;
+        // Latin Extended-A
+        else if (codepoint == 0x130)
+            codepoint = 'i';
+        else if (codepoint == 0x178)
+            codepoint = 0xff;
+        else if ((codepoint >= 0x100 && codepoint <= 0x137) || (codepoint >= 0x14a && codepoint <= 0x177))
+            codepoint |= 1;
+        else if ((codepoint >= 0x139 && codepoint <= 0x148) || (codepoint >= 0x179 && codepoint <= 0x17e))
+            codepoint += codepoint & 1;
+        // Greek and Cyrillic capitals
+        else if ((codepoint >= 0x391 && codepoint <= 0x3a9 && codepoint != 0x3a2) || (codepoint >= 0x410 && codepoint <= 0x42f))
+            codepoint += 0x20;
+        else if (codepoint >= 0x400 && codepoint <= 0x40f)
+            codepoint += 0x50;
+
+        return mode == FoldMode::CaseAndAccentInsensitive ? strip_accent(codepoint) : codepoint;
+    }
+#pragma endregion
+
 #pragma region Transforms
-    static inline void transform_to_lowercase(std::string &str)
+    static inline void transform_to_lowercase(std::string &str, FoldMode mode = FoldMode::CaseInsensitive)
     {
-        std::string tmp;
-        std::transform(str.begin(), str.end(), std::back_inserter(tmp), tolower);
+        str = fold_string(str, mode);
     }
 #pragma endregion
 
 #pragma region Search
     using SearchOcurrence = std::tuple<size_t, size_t>;
 
-    static const SearchOcurrence find_in_string(const std::string &haystack, const std::string &needle, size_t start = 0)
+    static const SearchOcurrence find_in_string(std::string_view haystack, std::string_view needle, size_t start = 0)
     {
         size_t start_pos = haystack.find(needle, start);
         if (start_pos == std::string::npos)
@@ -45,22 +168,191 @@ struct TextHelper final {
 #pragma endregion
 
 #pragma region Contextualization
+    /**
+     * How much text around an occurrence should be extracted.
+     */
+    struct ContextWidth {
+        enum struct Unit {
+            Words,
+            Bytes
+        };
+
+        Unit unit = Unit::Words;
+        size_t count = 1;
+    };
 
-    static const std::string_view get_surrounding_text(const std::string &source_string, size_t start_pos, size_t end_pos)
+    /**
+     * Extracts the text surrounding [start_pos, end_pos) from a text, without
+     * ever going past the line the occurrence is in.
+     * @param text Text the occurrence is in, usually its line or a part of it
+     * @param width Number of words (besides the ones the occurrence is in) or
+     * bytes on each side of the occurrence
+     */
+    static std::string_view get_surrounding_text(std::string_view text, size_t start_pos, size_t end_pos)
     {
-        ssize_t prev_word_pos = std::string::npos;
-        if (start_pos > 0) {
-            prev_word_pos = source_string.rfind(' ', start_pos - 1);
-            prev_word_pos = source_string.rfind(' ', prev_word_pos - 1);
-        }
-        prev_word_pos = std::max(0l, prev_word_pos + 1);
+        return get_surrounding_text(text, start_pos, end_pos, ContextWidth());
+    }
+
+    static std::string_view get_surrounding_text(std::string_view text, size_t start_pos, size_t end_pos, ContextWidth width)
+    {
+        const auto is_line_break = [](char c) { return c == '\n' || c == '\r'; };
+        size_t begin = std::min(start_pos, text.size());
+        size_t end = std::min(end_pos, text.size());
 
-        ssize_t next_word_pos = std::string::npos;
-        if (end_pos < source_string.size() - 1)
-            next_word_pos = source_string.find(' ', end_pos + 1);
+        if (width.unit == ContextWidth::Unit::Bytes) {
+            for (size_t count = 0; count < width.count && begin > 0 && !is_line_break(text[begin - 1]); count++)
+                begin--;
+            for (size_t count = 0; count < width.count && end < text.size() && !is_line_break(text[end]); count++)
+                end++;
 
-        ssize_t length = std::min(next_word_pos - prev_word_pos, static_cast<ssize_t>(source_string.length()));
-        return std::string_view(source_string).substr(prev_word_pos, length);
+            // Don't split UTF-8 sequences
+            while (begin < start_pos && (text[begin] & 0xc0) == 0x80)
+                begin++;
+            while (end > end_pos && end < text.size() && (text[end] & 0xc0) == 0x80)
+                end--;
+        } else {
+            // Finish the words the occurrence is in, then take `count' more on each side
+            for (size_t count = 0; count <= width.count; count++) {
+                while (count > 0 && begin > 0 && text[begin - 1] == ' ')
+                    begin--;
+                while (begin > 0 && text[begin - 1] != ' ' && !is_line_break(text[begin - 1]))
+                    begin--;
+            }
+            for (size_t count = 0; count <= width.count; count++) {
+                while (count > 0 && end < text.size() && text[end] == ' ')
+                    end++;
+                while (end < text.size() && text[end] != ' ' && !is_line_break(text[end]))
+                    end++;
+            }
+        }
+
+        return text.substr(begin, end - begin);
     }
 #pragma endregion
+
+private:
+    static constexpr size_t k_ascii_chunk_size = 16;
+
+    static constexpr char ascii_to_lowercase(unsigned char c) { return static_cast<char>(static_cast<unsigned>(c - 'A') < 26u ? c + 0x20 : c); }
+
+    /**
+     * Lowercases a chunk of k_ascii_chunk_size bytes if, and only if, it is made
+     * of ASCII characters exclusively.
+     * @return Whether the chunk was pure ASCII and has been written to `out'
+     */
+    static inline bool fold_ascii_chunk(const char *in, char *out)
+    {
+#ifdef __SSE2__
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        if (_mm_movemask_epi8(chunk) != 0)
+            return false;
+
+        const __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8('Z' + 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_add_epi8(chunk, _mm_and_si128(is_upper, _mm_set1_epi8(0x20))));
+        return true;
+#else
+        if (!is_ascii(in, k_ascii_chunk_size))
+            return false;
+
+        for (size_t i = 0; i < k_ascii_chunk_size; i++)
+            out[i] = ascii_to_lowercase(in[i]);
+        return true;
+#endif
+    }
+
+    /**
+     * Decodes a single UTF-8 sequence starting at `pos'.
+     * @return The decoded codepoint and the sequence length, which is zero if
+     * the sequence is malformed
+     */
+    static std::tuple<char32_t, size_t> decode_utf8(std::string_view text, size_t pos)
+    {
+        const auto lead = static_cast<unsigned char>(text[pos]);
+        size_t length;
+        char32_t codepoint;
+        if ((lead & 0xe0) == 0xc0) {
+            length = 2;
+            codepoint = lead & 0x1f;
+        } else if ((lead & 0xf0) == 0xe0) {
+            length = 3;
+            codepoint = lead & 0x0f;
+        } else if ((lead & 0xf8) == 0xf0) {
+            length = 4;
+            codepoint = lead & 0x07;
+        } else {
+            return { 0, 0 };
+        }
+
+        if (pos + length > text.size())
+            return { 0, 0 };
+
+        for (size_t i = 1; i < length; i++) {
+            const auto continuation = static_cast<unsigned char>(text[pos + i]);
+            if ((continuation & 0xc0) != 0x80)
+                return { 0, 0 };
+            codepoint = (codepoint << 6) | (continuation & 0x3f);
+        }
+
+        // Reject overlong encodings so that re-encoding preserves the length
+        static constexpr char32_t k_min_codepoint[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (codepoint < k_min_codepoint[length] || codepoint > 0x10ffff)
+            return { 0, 0 };
+
+        return { codepoint, length };
+    }
+
+    static size_t encode_utf8(char32_t codepoint, char *out)
+    {
+        if (codepoint < 0x80) {
+            out[0] = static_cast<char>(codepoint);
+            return 1;
+        }
+        if (codepoint < 0x800) {
+            out[0] = static_cast<char>(0xc0 | (codepoint >> 6));
+            out[1] = static_cast<char>(0x80 | (codepoint & 0x3f));
+            return 2;
+        }
+        if (codepoint < 0x10000) {
+            out[0] = static_cast<char>(0xe0 | (codepoint >> 12));
+            out[1] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+            out[2] = static_cast<char>(0x80 | (codepoint & 0x3f));
+            return 3;
+        }
+        out[0] = static_cast<char>(0xf0 | (codepoint >> 18));
+        out[1] = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+        out[2] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        out[3] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        return 4;
+    }
+
+    /**
+     * Maps an already lowercased Latin letter to its base letter. Ligatures and
+     * letters without a sensible ASCII base (æ, ß, þ...) are kept as they are.
+     */
+    static constexpr char32_t strip_accent(char32_t codepoint)
+    {
+        constexpr char k_latin1_bases[] = "aaaaaa\0ceeeeiiii\0nooooo\0ouuuuy\0y";
+        static_assert(sizeof k_latin1_bases == 0x20 + 1);
+
+        if (codepoint >= 0xe0 && codepoint <= 0xff)
+            return k_latin1_bases[codepoint - 0xe0] ? k_latin1_bases[codepoint - 0xe0] : codepoint;
+
+        struct Range {
+            char32_t first, last;
+            char base;
+        };
+        constexpr Range k_latin_extended_a_bases[] = {
+            { 0x100, 0x105, 'a' }, { 0x106, 0x10d, 'c' }, { 0x10e, 0x111, 'd' }, { 0x112, 0x11b, 'e' },
+            { 0x11c, 0x123, 'g' }, { 0x124, 0x127, 'h' }, { 0x128, 0x131, 'i' }, { 0x134, 0x135, 'j' },
+            { 0x136, 0x137, 'k' }, { 0x139, 0x142, 'l' }, { 0x143, 0x148, 'n' }, { 0x14c, 0x151, 'o' },
+            { 0x154, 0x159, 'r' }, { 0x15a, 0x161, 's' }, { 0x162, 0x167, 't' }, { 0x168, 0x173, 'u' },
+            { 0x174, 0x175, 'w' }, { 0x176, 0x178, 'y' }, { 0x179, 0x17e, 'z' }, { 0x17f, 0x17f, 's' }
+        };
+
+        for (const auto &range : k_latin_extended_a_bases) {
+            if (codepoint >= range.first && codepoint <= range.last)
+                return range.base;
+        }
+        return codepoint;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,264 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "NonCopyable.h"
+#include "NonMoveable.h"
+
+/**
+ * Records what happens to a sample of requests as spans (a name, a start time
+ * and a duration) and writes them in the Chrome trace event format, which
+ * Perfetto and chrome://tracing can load. Every thread records into a ring
+ * buffer of its own, so that recording takes no shared lock; once a thread
+ * exits its buffer is handed to the next thread that needs one, so that the
+ * many short-lived scanning threads don't take a buffer each. Only the most
+ * recent events of each buffer are kept.
+ *
+ * Whether a request is sampled depends on its identifier alone, so every
+ * thread reaches the same decision without passing it around. Tracing is off
+ * until enabled, and then costs nothing for requests that are not sampled.
+ */
+struct Tracer final : NonCopyable, NonMoveable {
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Events kept per buffer.
+     */
+    static constexpr size_t BufferCapacity = 1 << 14;
+
+    static Tracer &instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    /**
+     * @param sample_rate Fraction of the requests to trace, from 0 to 1
+     */
+    void enable(double sample_rate)
+    {
+        sample_rate = std::clamp(sample_rate, 0.0, 1.0);
+        m_sample_threshold = sample_rate >= 1 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(sample_rate * 0x1p64);
+        m_is_enabled = sample_rate > 0;
+    }
+
+    bool is_enabled() const { return m_is_enabled.load(std::memory_order_relaxed); }
+
+    bool is_sampled(uint64_t request_id) const
+    {
+        if (!is_enabled())
+            return false;
+
+        // SplitMix64, so that consecutive identifiers are sampled evenly
+        uint64_t hash = request_id + 0x9e3779b97f4a7c15ull;
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+        hash ^= hash >> 31;
+        return hash <= m_sample_threshold.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Records a span of a sampled request.
+     * @param name Must outlive the tracer, e.g. a string literal
+     * @param detail Shown along with the span, truncated if too long
+     * @param is_async Whether the span is not work done by this thread, but
+     * something the request went through, e.g. waiting in a queue. These
+     * are shown on a track of their own.
+     */
+    void record(const char *name, uint64_t request_id, Clock::time_point start_time, Clock::time_point end_time, std::string_view detail = {}, bool is_async = false)
+    {
+        auto &buffer = thread_buffer();
+        Event event {
+            .name = name,
+            .start_time = start_time,
+            .end_time = end_time,
+            .request_id = request_id,
+            .is_async = is_async
+        };
+        // Don't split UTF-8 sequences
+        size_t detail_length = std::min(detail.size(), sizeof event.detail - 1);
+        while (detail_length < detail.size() && detail_length > 0 && (detail[detail_length] & 0xc0) == 0x80)
+            detail_length--;
+        detail.copy(event.detail, detail_length);
+
+        const std::scoped_lock lock(buffer.lock);
+        buffer.events[buffer.written_count++ % BufferCapacity] = event;
+    }
+
+    /**
+     * Writes every event kept so far as a trace event JSON document.
+     * Timestamps are relative to the creation of the tracer.
+     */
+    void write_chrome_trace(std::ostream &stream) const
+    {
+        const std::scoped_lock lock(m_buffers_lock);
+        stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool is_first = true;
+        for (size_t thread_index = 0; thread_index < m_buffers.size(); thread_index++) {
+            auto &buffer = *m_buffers[thread_index];
+            const std::scoped_lock buffer_lock(buffer.lock);
+            const auto first = buffer.written_count > BufferCapacity ? buffer.written_count - BufferCapacity : 0;
+            for (auto i = first; i < buffer.written_count; i++) {
+                const auto &event = buffer.events[i % BufferCapacity];
+                if (event.is_async) {
+                    write_event(stream, is_first, event, thread_index + 1, 'b', event.start_time);
+                    write_event(stream, is_first, event, thread_index + 1, 'e', event.end_time);
+                } else {
+                    write_event(stream, is_first, event, thread_index + 1, 'X', event.start_time);
+                }
+            }
+        }
+        stream << "\n]}\n";
+    }
+
+private:
+    struct Event {
+        const char *name;
+        Clock::time_point start_time;
+        Clock::time_point end_time;
+        uint64_t request_id;
+        bool is_async;
+        char detail[48] = {};
+    };
+
+    struct Buffer final : NonCopyable, NonMoveable {
+        std::mutex lock;
+        std::vector<Event> events = std::vector<Event>(BufferCapacity);
+        uint64_t written_count = 0;
+    };
+
+    /**
+     * Hands the buffer of a thread back once it exits.
+     */
+    struct BufferLease final : NonCopyable {
+        Buffer *buffer = nullptr;
+
+        ~BufferLease()
+        {
+            if (buffer)
+                Tracer::instance().release(buffer);
+        }
+    };
+
+    std::atomic<bool> m_is_enabled = false;
+    std::atomic<uint64_t> m_sample_threshold = 0;
+    const Clock::time_point m_epoch = Clock::now();
+
+    mutable std::mutex m_buffers_lock;
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    std::vector<Buffer *> m_free_buffers;
+
+    Tracer() = default;
+
+    Buffer &thread_buffer()
+    {
+        thread_local BufferLease t_lease;
+        if (!t_lease.buffer) {
+            const std::scoped_lock lock(m_buffers_lock);
+            if (m_free_buffers.empty()) {
+                m_buffers.push_back(std::make_unique<Buffer>());
+                t_lease.buffer = m_buffers.back().get();
+            } else {
+                t_lease.buffer = m_free_buffers.back();
+                m_free_buffers.pop_back();
+            }
+        }
+        return *t_lease.buffer;
+    }
+
+    void release(Buffer *buffer)
+    {
+        const std::scoped_lock lock(m_buffers_lock);
+        m_free_buffers.push_back(buffer);
+    }
+
+    void write_event(std::ostream &stream, bool &is_first, const Event &event, size_t thread_id, char phase, Clock::time_point time) const
+    {
+        char timestamp[32];
+        std::snprintf(timestamp, sizeof timestamp, "%.3f", std::chrono::duration<double, std::micro>(time - m_epoch).count());
+
+        stream << (is_first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"" << phase << "\",\"ts\":" << timestamp << ",\"pid\":1,\"tid\":" << thread_id;
+        is_first = false;
+        if (phase == 'X') {
+            std::snprintf(timestamp, sizeof timestamp, "%.3f", std::chrono::duration<double, std::micro>(event.end_time - event.start_time).count());
+            stream << ",\"dur\":" << timestamp;
+        } else {
+            stream << ",\"cat\":\"request\",\"id\":" << event.request_id;
+        }
+
+        stream << ",\"args\":{\"request\":" << event.request_id;
+        if (event.detail[0]) {
+            stream << ",\"detail\":\"";
+            for (const char *c = event.detail; *c; c++) {
+                if (*c == '"' || *c == '\\')
+                    stream << '\\' << *c;
+                else if (static_cast<unsigned char>(*c) < 0x20)
+                    stream << ' ';
+                else
+                    stream << *c;
+            }
+            stream << '"';
+        }
+        stream << "}}";
+    }
+};
+
+/**
+ * Records a span from its construction to its destruction, if the request it
+ * belongs to is sampled.
+ */
+struct TraceSpan final : NonCopyable {
+    /**
+     * @param detail Must outlive the span
+     */
+    TraceSpan(const char *name, uint64_t request_id, std::string_view detail = {})
+        : m_name(name)
+        , m_request_id(request_id)
+        , m_detail(detail)
+        , m_is_sampled(Tracer::instance().is_sampled(request_id))
+    {
+        if (m_is_sampled)
+            m_start_time = Tracer::Clock::now();
+    }
+
+    ~TraceSpan()
+    {
+        if (m_is_sampled)
+            Tracer::instance().record(m_name, m_request_id, m_start_time, Tracer::Clock::now(), m_detail);
+    }
+
+private:
+    const char *const m_name;
+    const uint64_t m_request_id;
+    const std::string_view m_detail;
+    const bool m_is_sampled;
+    Tracer::Clock::time_point m_start_time;
+};
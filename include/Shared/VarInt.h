@@ -0,0 +1,54 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/**
+ * Variable-length encoding of unsigned integers (LEB128): seven bits per byte,
+ * least significant group first, with the high bit set on every byte but the
+ * last. Small values, such as the distance between two nearby positions, take
+ * a single byte.
+ */
+struct VarInt final {
+    static void append(std::string &output, uint64_t value)
+    {
+        for (; value >= 0x80; value >>= 7)
+            output.push_back(static_cast<char>(value | 0x80));
+        output.push_back(static_cast<char>(value));
+    }
+
+    /**
+     * Decodes a value from the front of `input' and advances past it.
+     * @throws std::runtime_error if the input ends in the middle of a value
+     */
+    static uint64_t read(std::string_view &input)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0, shift = 0; i < input.size() && shift < 64; i++, shift += 7) {
+            const auto byte = static_cast<uint8_t>(input[i]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                input.remove_prefix(i + 1);
+                return value;
+            }
+        }
+        throw std::runtime_error("truncated variable-length integer");
+    }
+};
@@ -0,0 +1,57 @@
+// Copyright (c) 2021 Ángel Pérez <angel@ttm.sh>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+/**
+ * Picks ranks from 0 to n - 1 with a probability proportional to
+ * 1 / (rank + 1)^exponent, so that a few ranks are much more popular than the
+ * rest. An exponent of zero picks every rank with the same probability.
+ * The cumulative distribution is computed once, and every pick is a binary
+ * search over it.
+ */
+struct ZipfDistribution final {
+    ZipfDistribution(size_t n, double exponent)
+    {
+        m_cumulative_weights.reserve(n);
+        double total_weight = 0;
+        for (size_t rank = 0; rank < n; rank++) {
+            total_weight += 1 / std::pow(static_cast<double>(rank + 1), exponent);
+            m_cumulative_weights.push_back(total_weight);
+        }
+    }
+
+    template<typename RandomEngine>
+    size_t operator()(RandomEngine &random_engine) const
+    {
+        if (m_cumulative_weights.empty())
+            return 0;
+
+        std::uniform_real_distribution<double> generate_weight(0, m_cumulative_weights.back());
+        const auto it = std::upper_bound(m_cumulative_weights.begin(), m_cumulative_weights.end(), generate_weight(random_engine));
+        return std::min<size_t>(it - m_cumulative_weights.begin(), m_cumulative_weights.size() - 1);
+    }
+
+private:
+    std::vector<double> m_cumulative_weights;
+};
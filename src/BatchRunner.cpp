@@ -0,0 +1,283 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <MTFind2/Search/BatchRunner.h>
+#include <Shared/BoundedQueue.h>
+#include <Shared/TextHelper.h>
+
+namespace mtfind2 {
+/**
+ * Lines read at once by the read stage.
+ */
+static constexpr size_t ReadChunkSize = 1024;
+
+template<typename T>
+static void append_bytes(std::string &buffer, const T &value)
+{
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+struct BatchRunner::Query final {
+    uint32_t line;
+    std::string text;
+};
+
+struct BatchRunner::Match final {
+    uint32_t source_index;
+    uint32_t line;
+    uint32_t column;
+    uint64_t offset;
+    uint32_t length;
+};
+
+/**
+ * Unit of work of every stage after reading.
+ */
+struct BatchRunner::Batch final {
+    size_t sequence;
+    std::vector<Query> queries;
+
+    /**
+     * Queries in the batch without repetitions, and the index of each query
+     * among them.
+     */
+    std::vector<std::string> distinct_queries;
+    std::vector<size_t> distinct_indexes;
+
+    /**
+     * Content sources the batch was scanned against, kept alive until their
+     * paths are written out.
+     */
+    std::vector<std::shared_ptr<const ContentSource>> content_sources;
+    std::vector<std::vector<Match>> matches;
+    uint64_t corpus_size = 0;
+};
+
+void BatchRunner::group(Batch &batch)
+{
+    std::unordered_map<std::string_view, size_t> indexes;
+    batch.distinct_indexes.reserve(batch.queries.size());
+    for (const auto &query : batch.queries) {
+        const auto [it, is_new] = indexes.try_emplace(query.text, batch.distinct_queries.size());
+        if (is_new)
+            batch.distinct_queries.push_back(query.text);
+        batch.distinct_indexes.push_back(it->second);
+    }
+}
+
+void BatchRunner::scan(Batch &batch) const
+{
+    // Don't hold the snapshot for the whole batch, that would stall corpus updates
+    batch.content_sources = m_corpus.snapshot()->content_sources();
+    batch.matches.resize(batch.distinct_queries.size());
+
+    for (size_t i = 0; i < batch.distinct_queries.size(); i++) {
+        std::optional<std::string> folded_queries[2];
+        for (uint32_t source_index = 0; source_index < batch.content_sources.size(); source_index++) {
+            const auto &content_source = *batch.content_sources[source_index];
+            auto &folded_query = folded_queries[static_cast<size_t>(content_source.fold_mode())];
+            if (!folded_query)
+                folded_query = TextHelper::fold_string(batch.distinct_queries[i], content_source.fold_mode());
+
+            content_source.scan(*folded_query, [&](const Occurrence &occurrence) {
+                batch.matches[i].push_back({ source_index, static_cast<uint32_t>(occurrence.line), static_cast<uint32_t>(occurrence.column), occurrence.offset, static_cast<uint32_t>(occurrence.length) });
+                return true;
+            });
+            batch.corpus_size += content_source.size();
+        }
+    }
+}
+
+size_t BatchRunner::format(const Batch &batch, OutputFormat output_format, std::unordered_set<uint32_t> &written_source_ids, std::string &buffer)
+{
+    size_t result_count = 0;
+    for (size_t i = 0; i < batch.queries.size(); i++) {
+        const auto &query = batch.queries[i];
+        for (const auto &match : batch.matches[batch.distinct_indexes[i]]) {
+            const auto &content_source = *batch.content_sources[match.source_index];
+            result_count++;
+
+            if (output_format == OutputFormat::Tsv) {
+                buffer += std::to_string(query.line);
+                buffer += '\t';
+                buffer += content_source.file_path();
+                buffer += '\t';
+                buffer += std::to_string(match.line);
+                buffer += '\t';
+                buffer += std::to_string(match.column);
+                buffer += '\t';
+                buffer += std::to_string(match.offset);
+                buffer += '\t';
+                buffer += std::to_string(match.length);
+                buffer += '\n';
+                continue;
+            }
+
+            if (written_source_ids.insert(content_source.id()).second) {
+                const auto path = std::string_view(content_source.file_path()).substr(0, UINT16_MAX);
+                buffer += BatchOutputFormat::SourceTag;
+                append_bytes(buffer, BatchOutputFormat::SourceRecord { content_source.id(), static_cast<uint16_t>(path.size()) });
+                buffer += path;
+            }
+
+            buffer += BatchOutputFormat::ResultTag;
+            append_bytes(buffer, BatchOutputFormat::ResultRecord { query.line, content_source.id(), match.line, match.column, match.offset, match.length });
+        }
+    }
+    return result_count;
+}
+
+void BatchRunner::Report::print(std::ostream &stream) const
+{
+    const double seconds = std::chrono::duration<double>(elapsed_time).count();
+    stream << "batch: " << query_count << " quer" << (query_count == 1 ? "y" : "ies") << " (" << distinct_query_count << " distinct per batch) in " << std::fixed
+           << std::setprecision(3) << seconds << "s, " << result_count << " result(s)" << std::endl;
+    stream << "batch: " << std::setprecision(1) << (seconds > 0 ? query_count / seconds : 0) << " queries/s, "
+           << (seconds > 0 ? corpus_size / seconds / (1 << 20) : 0) << " corpus MiB/s (" << corpus_size / (1 << 20) << " MiB)" << std::defaultfloat << std::endl;
+    if (perf_sample && perf_sample->cycles > 0) {
+        const double queries = std::max<size_t>(query_count, 1);
+        stream << "batch: " << std::fixed << std::setprecision(2) << perf_sample->instructions_per_cycle() << " instructions/cycle, "
+               << static_cast<double>(corpus_size) / perf_sample->cycles << " corpus bytes/cycle, " << std::setprecision(0) << perf_sample->cycles / queries << " cycles, "
+               << perf_sample->cache_misses / queries << " cache misses and " << perf_sample->branch_misses / queries << " branch misses per query" << std::defaultfloat
+               << std::endl;
+    }
+}
+
+BatchRunner::Report BatchRunner::run(std::istream &input, std::ostream &output) const
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto start_perf_totals = PerfCounters::totals();
+    const size_t scan_thread_count = m_options.scan_thread_count ? m_options.scan_thread_count : std::max(1u, std::thread::hardware_concurrency());
+
+    BoundedQueue<std::vector<Query>> read_queue(m_options.queue_capacity);
+    BoundedQueue<std::unique_ptr<Batch>> group_queue(m_options.queue_capacity);
+    BoundedQueue<std::unique_ptr<Batch>> scan_queue(m_options.queue_capacity);
+    Report report;
+
+    std::thread read_thread([&] {
+        std::vector<Query> chunk;
+        std::string line;
+        for (uint32_t line_number = 1; std::getline(input, line); line_number++) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty())
+                continue;
+
+            chunk.push_back({ line_number, std::move(line) });
+            if (chunk.size() == ReadChunkSize && !read_queue.push(std::exchange(chunk, {})))
+                break;
+        }
+        if (!chunk.empty())
+            read_queue.push(std::move(chunk));
+        read_queue.close();
+    });
+
+    std::thread group_thread([&] {
+        size_t sequence = 0;
+        auto batch = std::make_unique<Batch>();
+        const auto flush = [&] {
+            group(*batch);
+            report.query_count += batch->queries.size();
+            report.distinct_query_count += batch->distinct_queries.size();
+            batch->sequence = sequence++;
+            group_queue.push(std::exchange(batch, std::make_unique<Batch>()));
+        };
+
+        while (auto chunk = read_queue.pop()) {
+            for (auto &query : *chunk) {
+                batch->queries.push_back(std::move(query));
+                if (batch->queries.size() == m_options.batch_size)
+                    flush();
+            }
+        }
+        if (!batch->queries.empty())
+            flush();
+        group_queue.close();
+    });
+
+    std::atomic<size_t> running_scan_thread_count = scan_thread_count;
+    std::vector<std::thread> scan_threads;
+    for (size_t i = 0; i < scan_thread_count; i++) {
+        scan_threads.emplace_back([&] {
+            while (auto batch = group_queue.pop()) {
+                {
+                    const PerfScope perf_scope;
+                    scan(**batch);
+                }
+                scan_queue.push(std::move(*batch));
+            }
+            if (--running_scan_thread_count == 0)
+                scan_queue.close();
+        });
+    }
+
+    // Format on this thread, restoring input order
+    std::optional<std::runtime_error> error;
+    {
+        std::map<size_t, std::unique_ptr<Batch>> out_of_order_batches;
+        std::unordered_set<uint32_t> written_source_ids;
+        std::string buffer;
+        size_t next_sequence = 0;
+
+        if (m_options.output_format == OutputFormat::Binary) {
+            BatchOutputFormat::Header header {};
+            std::memcpy(header.magic, BatchOutputFormat::Magic, sizeof header.magic);
+            header.version = BatchOutputFormat::Version;
+            append_bytes(buffer, header);
+        }
+
+        while (auto batch = scan_queue.pop()) {
+            out_of_order_batches.emplace((*batch)->sequence, std::move(*batch));
+            for (auto it = out_of_order_batches.begin(); it != out_of_order_batches.end() && it->first == next_sequence; it = out_of_order_batches.erase(it), next_sequence++) {
+                report.result_count += format(*it->second, m_options.output_format, written_source_ids, buffer);
+                report.corpus_size += it->second->corpus_size;
+            }
+
+            if (!error && !output.write(buffer.data(), buffer.size()))
+                error.emplace("could not write batch results");
+            buffer.clear();
+        }
+        output.flush();
+    }
+
+    read_thread.join();
+    group_thread.join();
+    for (auto &scan_thread : scan_threads)
+        scan_thread.join();
+
+    if (error)
+        throw *error;
+    report.elapsed_time = std::chrono::steady_clock::now() - start_time;
+    if (PerfCounters::is_enabled())
+        report.perf_sample = PerfCounters::totals() - start_perf_totals;
+    return report;
+}
+}
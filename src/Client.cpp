@@ -22,48 +22,119 @@
 #include <MTFind2/Messages/CreditRechargeResponseMessage.h>
 #include <MTFind2/Messages/NoSearchResultsFoundMessage.h>
 #include <MTFind2/Messages/NotEnoughCreditMessage.h>
+#include <MTFind2/Messages/SearchCountMessage.h>
+#include <MTFind2/Messages/SearchFinishedMessage.h>
 #include <MTFind2/Messages/SearchResultFoundMessage.h>
+#include <MTFind2/Messages/ServiceOverloadedMessage.h>
 #include <MTFind2/Payment/PaymentService.h>
 #include <Shared/TextHelper.h>
 
 namespace mtfind2 {
 void Client::push_message(const NotEnoughCreditMessage &message)
 {
-    // Don't lock transaction! Doing so will prevent CreditRechargeResponseMessage
-    // to get through and complete the operation, resulting in a deadlock!
-    std::cout << tag() << ": requesting more credit" << std::endl;
-    PaymentService::instance().push_message(CreditRechargeRequestMessage(*this, message.semaphore(), 15));
+    // Counted right away, so that the client is never considered idle between
+    // the moment it is told and the moment the recharge is done
+    m_pending_recharge_count++;
+    dispatch([this, semaphore = message.semaphore()] {
+        // Don't lock transaction! Doing so will prevent CreditRechargeResponseMessage
+        // to get through and complete the operation, resulting in a deadlock!
+        if (!m_delegate)
+            std::cout << tag() << ": requesting more credit" << std::endl;
+        PaymentService::instance().push_message(CreditRechargeRequestMessage(*this, semaphore, 15));
+    });
 }
 
 void Client::push_message(const CreditRechargeResponseMessage &message)
 {
-    const std::scoped_lock lock(transaction_lock());
-    if (message.amount() == 0) {
-        std::cerr << tag() << ": ran out of credit!" << std::endl;
-    } else {
-        std::cout << tag() << ": got " << message.amount() << " in credit" << std::endl;
-        m_credit += message.amount();
-    }
+    dispatch([this, amount = message.amount(), semaphore = message.semaphore()] {
+        {
+            const std::scoped_lock lock(transaction_lock());
+            if (m_credit != UnlimitedCredit)
+                m_credit += amount;
+            if (m_delegate)
+                m_delegate->on_credit_recharged(amount);
+            else if (amount == 0)
+                std::cerr << tag() << ": ran out of credit!" << std::endl;
+            else
+                std::cout << tag() << ": got " << amount << " in credit" << std::endl;
+        }
+
+        // Notify a credit recharge response
+        if (semaphore)
+            semaphore->notify();
+
+        // Nothing may touch this client past this point, see is_idle()
+        m_pending_recharge_count--;
+    });
 }
 
 void Client::push_message(const NoSearchResultsFoundMessage &message)
 {
-    const std::scoped_lock lock(transaction_lock());
-    std::cerr << tag() << ": no results from " << message.search_request().query() << std::endl;
+    dispatch([this, &search_request = message.search_request()] {
+        const std::scoped_lock lock(transaction_lock());
+        std::cerr << tag() << ": no results from " << search_request.query() << std::endl;
+    });
 }
 
 void Client::push_message(const SearchResultFoundMessage &message)
 {
-    const std::scoped_lock lock(transaction_lock());
-    const auto &search_result = message.search_result();
-    const auto &search_request = message.search_request();
-    std::cout << search_request << ": " << search_result.content_source() << ": line " << search_result.line() << ", column " << search_result.column() << ": ..." << search_result.surrounding_text() << "...";
-    if (search_result.is_final_result())
-        std::cout << " (search yielded no more results)";
-    std::cout << std::endl;
-
-    const auto response_time = search_result.timestamp() - search_request.timestamp();
-    std::cout << "total response time: " << std::chrono::duration<double, std::milli>(response_time).count() << "ms" << std::endl;
+    // The content source is only guaranteed to be alive while the message is
+    // being pushed, hold on to it if it's going to be handled later
+    std::shared_ptr<const ContentSource> content_source_owner;
+    if (has_mailbox())
+        content_source_owner = message.content_source().shared_from_this();
+
+    dispatch([this, &search_request = message.search_request(), &content_source = message.content_source(), search_result = message.search_result(), content_source_owner = std::move(content_source_owner)] {
+        if (m_delegate) {
+            m_delegate->on_search_result(search_request, content_source, search_result);
+            return;
+        }
+
+        const std::scoped_lock lock(transaction_lock());
+        std::cout << search_request << ": " << content_source << ": line " << search_result.line << ", column " << search_result.column << ": ..." << search_result.surrounding_text(content_source, s_context_width) << "...";
+        if (search_result.is_final_result)
+            std::cout << " (search yielded no more results)";
+        std::cout << std::endl;
+
+        const auto response_time = search_result.timestamp - search_request.timestamp();
+        std::cout << "total response time: " << std::chrono::duration<double, std::milli>(response_time).count() << "ms" << std::endl;
+    });
+}
+
+void Client::push_message(const SearchCountMessage &message)
+{
+    dispatch([this, &search_request = message.search_request(), occurrence_count = message.occurrence_count()] {
+        if (m_delegate) {
+            m_delegate->on_search_count(search_request, occurrence_count);
+            return;
+        }
+
+        const std::scoped_lock lock(transaction_lock());
+        std::cout << search_request << ": " << occurrence_count << " occurrence(s) found (results were not sent, the service is overloaded)" << std::endl;
+    });
+}
+
+void Client::push_message(const SearchFinishedMessage &message)
+{
+    dispatch([this, &search_request = message.search_request(), started_time = message.started_time()] {
+        // Must be the last thing done for this request, the delegate may
+        // dispose of it (and of this client)
+        if (m_delegate)
+            m_delegate->on_search_finished(search_request, started_time);
+    });
+}
+
+void Client::push_message(const ServiceOverloadedMessage &message)
+{
+    dispatch([this, &search_request = message.search_request(), retry_after = message.retry_after()] {
+        if (m_delegate) {
+            m_delegate->on_service_overloaded(search_request, retry_after);
+            return;
+        }
+
+        const std::scoped_lock lock(transaction_lock());
+        std::cerr << search_request << ": service overloaded, retry after " << retry_after.count() << "ms" << std::endl;
+    });
 }
 
 void Client::push_message(const Message &message)
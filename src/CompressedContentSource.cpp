@@ -0,0 +1,257 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+#include <MTFind2/Search/CompressedContentSource.h>
+#include <Shared/LzCodec.h>
+#include <Shared/Metrics.h>
+
+namespace mtfind2 {
+struct CompressedContentSource::Window {
+    uint32_t source_id = UINT32_MAX;
+    size_t first_block = 0;
+    size_t block_count = 0;
+    std::string text;
+};
+
+/**
+ * Surrounding text has a buffer of its own, since it may be extracted from
+ * within a scan callback.
+ */
+static thread_local std::string t_context_buffer;
+
+CompressedContentSource::Window &CompressedContentSource::scan_window()
+{
+    static thread_local Window t_window;
+    return t_window;
+}
+
+CompressedContentSource::BlockSequence::BlockSequence(std::string_view text)
+    : size(text.size())
+{
+    for (size_t pos = 0; pos < text.size(); pos += BlockSize) {
+        LzCodec::compress(text.substr(pos, BlockSize), data);
+        offsets.push_back(data.size());
+    }
+    data.shrink_to_fit();
+}
+
+bool CompressedContentSource::BlockSequence::decompress(size_t index, char *output) const
+{
+    const std::string_view block(data.data() + offsets[index], offsets[index + 1] - offsets[index]);
+    return LzCodec::decompress(block, output, block_size(index));
+}
+
+CompressedContentSource::CompressedContentSource(std::string file_path, TextHelper::FoldMode fold_mode)
+    : ContentSource(std::move(file_path), fold_mode)
+{
+    std::string text;
+    std::ifstream stream(this->file_path(), std::ios::in | std::ios::binary | std::ios::ate); // Open read-only
+    if (stream) {
+        text.resize(stream.tellg());
+        stream.seekg(0).read(text.data(), text.size());
+        text.resize(stream.gcount());
+    }
+    const auto folded_text = TextHelper::fold(text, fold_mode);
+    const std::string_view folded(folded_text.text);
+
+    m_text = BlockSequence(text);
+    m_folded_text = BlockSequence(folded);
+    m_anchors = folded_text.offsets.anchors();
+    m_anchors.shrink_to_fit();
+    m_block_filters.resize(m_folded_text.block_count());
+    size_t line_index = 0;
+    uint64_t line_offset = 0;
+    for (size_t block = 0; block < m_block_filters.size(); block++) {
+        m_block_filters[block].add(folded.substr(block * BlockSize), BlockSize + BlockOverlap);
+        m_block_lines.push_back({ line_index, line_offset });
+
+        const auto block_text = folded.substr(block * BlockSize, BlockSize);
+        for (size_t pos = block_text.find('\n'); pos != std::string_view::npos; pos = block_text.find('\n', pos + 1)) {
+            line_index++;
+            line_offset = block * BlockSize + pos + 1;
+        }
+    }
+
+    // Just like std::getline(), don't count an empty trailing line
+    m_line_count = line_index + (line_offset != folded.size() ? 1 : 0);
+
+    m_uncompressed_memory_usage = text.size() + folded.size() + m_anchors.size() * sizeof(OffsetMap::Anchor)
+        + 2 * (m_line_count + 1) * sizeof(uint64_t) + m_block_filters.size() * sizeof(NgramFilter);
+    std::clog << tag() << ": " << m_line_count << " line(s) read, " << memory_usage() << " bytes in memory, "
+              << memory_usage() * 100 / std::max<uint64_t>(m_uncompressed_memory_usage, 1) << "% of the "
+              << m_uncompressed_memory_usage << " it would take uncompressed" << std::endl;
+}
+
+uint64_t CompressedContentSource::memory_usage() const
+{
+    return m_text.memory_usage() + m_folded_text.memory_usage() + m_anchors.size() * sizeof(OffsetMap::Anchor)
+        + m_block_lines.size() * sizeof(BlockLines) + m_block_filters.size() * sizeof(NgramFilter);
+}
+
+std::string_view CompressedContentSource::load_window(Window &window, size_t first_block, size_t count) const
+{
+    static auto &s_decompressed_bytes = MetricsRegistry::instance().counter("mtfind2_decompressed_bytes_total", "Bytes of compressed content sources decompressed to be scanned.");
+
+    count = std::min(count, block_count() - first_block);
+    if (window.source_id != id() || first_block < window.first_block || first_block >= window.first_block + window.block_count) {
+        window.source_id = id();
+        window.block_count = 0;
+    } else if (first_block > window.first_block) {
+        // Moving on to the next block, which was decompressed already
+        const size_t skipped_count = first_block - window.first_block;
+        const uint64_t kept_size = std::min<uint64_t>(m_folded_text.size - first_block * BlockSize, (window.block_count - skipped_count) * BlockSize);
+        std::memmove(window.text.data(), window.text.data() + skipped_count * BlockSize, kept_size);
+        window.block_count -= skipped_count;
+    }
+    window.first_block = first_block;
+
+    window.text.resize(2 * BlockSize);
+    for (; window.block_count < count; window.block_count++) {
+        const size_t block = first_block + window.block_count;
+        if (!m_folded_text.decompress(block, window.text.data() + window.block_count * BlockSize)) {
+            window.source_id = UINT32_MAX;
+            throw std::runtime_error(tag() + ": block " + std::to_string(block) + " is corrupt");
+        }
+        s_decompressed_bytes.increment(m_folded_text.block_size(block));
+    }
+
+    const uint64_t start = first_block * BlockSize;
+    return std::string_view(window.text.data(), std::min<uint64_t>(m_folded_text.size - start, count * BlockSize));
+}
+
+void CompressedContentSource::scan(std::string_view folded_query, const OccurrenceCallback &callback) const
+{
+    if (folded_query.empty())
+        return;
+
+    // Occurrences are reported one step behind so that we know which is the last
+    std::optional<Occurrence> pending_occurrence;
+
+    const auto candidate_blocks = find_candidate_blocks(folded_query);
+    auto &window = scan_window();
+    uint64_t resume_pos = 0; // Occurrences may not overlap
+    for (size_t block = 0; block < block_count(); block++) {
+        const uint64_t block_start = block * BlockSize;
+        const size_t block_size = m_folded_text.block_size(block);
+        if (resume_pos >= block_start + block_size || (!candidate_blocks.empty() && !candidate_blocks[block]))
+            continue;
+
+        auto text = load_window(window, block, 1);
+        size_t line_index = m_block_lines[block].line_index;
+        uint64_t line_offset = m_block_lines[block].line_offset;
+        size_t counted_pos = 0; // Position within the block up to which lines were counted
+
+        for (;;) {
+            const size_t from = std::max(resume_pos, block_start) - block_start;
+            size_t pos = text.find(folded_query, from);
+
+            // An occurrence may start near the end of the block and go on in the
+            // next one, which is only decompressed if the block ends with a
+            // prefix of the query
+            if (pos == std::string_view::npos && block + 1 < block_count()) {
+                for (size_t partial_pos = std::max(from, block_size - std::min(block_size, folded_query.length() - 1)); partial_pos < block_size; partial_pos++) {
+                    if (folded_query.starts_with(text.substr(partial_pos))) {
+                        text = load_window(window, block, 2);
+                        pos = text.find(folded_query, partial_pos);
+                        if (pos >= block_size)
+                            pos = std::string_view::npos;
+                        text = text.substr(0, block_size);
+                        break;
+                    }
+                }
+            }
+            if (pos == std::string_view::npos)
+                break;
+
+            if (pending_occurrence && !callback(*pending_occurrence))
+                return;
+
+            // Occurrences are found in order, so lines only need to be counted once
+            for (const char *newline; (newline = static_cast<const char *>(std::memchr(text.data() + counted_pos, '\n', pos - counted_pos)));) {
+                line_index++;
+                counted_pos = newline - text.data() + 1;
+                line_offset = block_start + counted_pos;
+            }
+            counted_pos = pos;
+
+            const uint64_t folded_pos = block_start + pos;
+            const uint64_t original_start_pos = to_original(folded_pos);
+            const uint64_t original_end_pos = to_original(folded_pos + folded_query.length());
+            pending_occurrence = Occurrence {
+                .offset = original_start_pos,
+                .line = line_index + 1,
+                .column = original_start_pos - to_original(line_offset) + 1,
+                .length = original_end_pos - original_start_pos,
+                .is_final = false
+            };
+            resume_pos = folded_pos + folded_query.length();
+        }
+    }
+
+    if (pending_occurrence) {
+        pending_occurrence->is_final = true;
+        callback(*pending_occurrence);
+    }
+}
+
+std::string CompressedContentSource::surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width) const
+{
+    // Decompress just enough around the occurrence, the rest of the line is not needed
+    const uint64_t margin = width.unit == TextHelper::ContextWidth::Unit::Bytes
+        ? std::min<uint64_t>(width.count + 4, MaxContextSize)
+        : MaxContextSize;
+    const uint64_t start = offset - std::min(offset, margin);
+    const uint64_t end = std::min(m_text.size, offset + length + margin);
+    if (start >= end)
+        return {};
+
+    const size_t first_block = start / BlockSize;
+    const size_t last_block = (end - 1) / BlockSize;
+    t_context_buffer.resize((last_block - first_block + 1) * BlockSize);
+    for (size_t block = first_block; block <= last_block; block++) {
+        if (!m_text.decompress(block, t_context_buffer.data() + (block - first_block) * BlockSize))
+            throw std::runtime_error(tag() + ": block " + std::to_string(block) + " is corrupt");
+    }
+
+    const std::string_view window(t_context_buffer.data() + (start - first_block * BlockSize), end - start);
+    return std::string(TextHelper::get_surrounding_text(window, offset - start, offset - start + length, width));
+}
+
+std::vector<bool> CompressedContentSource::find_candidate_blocks(std::string_view folded_query) const
+{
+    // Empty means that every block is a candidate
+    if (folded_query.length() < NgramFilter::GramLength)
+        return {};
+
+    const size_t gram_count = std::min(folded_query.length() - NgramFilter::GramLength, BlockOverlap) + 1;
+    std::vector<bool> candidate_blocks(m_block_filters.size());
+    for (size_t block = 0; block < m_block_filters.size(); block++) {
+        bool may_match = true;
+        for (size_t pos = 0; pos < gram_count && may_match; pos++)
+            may_match = m_block_filters[block].may_contain(folded_query.data() + pos);
+        candidate_blocks[block] = may_match;
+    }
+    return candidate_blocks;
+}
+}
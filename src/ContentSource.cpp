@@ -0,0 +1,62 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <chrono>
+#include <filesystem>
+
+#include <MTFind2/Search/CompressedContentSource.h>
+#include <MTFind2/Search/ContentSource.h>
+#include <MTFind2/Search/LazyContentSource.h>
+#include <MTFind2/Search/MemoryContentSource.h>
+#include <MTFind2/Search/StreamingContentSource.h>
+#include <Shared/Metrics.h>
+
+namespace mtfind2 {
+std::shared_ptr<const ContentSource> ContentSource::open(const std::string &file_path, const Options &options)
+{
+    static auto &s_memory_load_count = MetricsRegistry::instance().counter("mtfind2_content_source_loads_total", "Content sources opened.", "kind=\"memory\"");
+    static auto &s_compressed_load_count = MetricsRegistry::instance().counter("mtfind2_content_source_loads_total", "Content sources opened.", "kind=\"compressed\"");
+    static auto &s_streaming_load_count = MetricsRegistry::instance().counter("mtfind2_content_source_loads_total", "Content sources opened.", "kind=\"streaming\"");
+    static auto &s_loaded_bytes = MetricsRegistry::instance().counter("mtfind2_content_source_loaded_bytes_total", "Bytes of content sources opened.");
+    static auto &s_load_duration = MetricsRegistry::instance().histogram("mtfind2_content_source_load_duration_seconds", "Time taken to open a content source.");
+
+    const auto start_time = std::chrono::steady_clock::now();
+    std::error_code error_code;
+    const auto file_size = std::filesystem::file_size(file_path, error_code);
+    const bool is_streaming = !error_code && file_size > options.streaming_threshold;
+
+    // Loading is deferred to first use, which opens the source again without a budget
+    if (options.memory_budget && !is_streaming)
+        return std::make_shared<const LazyContentSource>(file_path, options);
+
+    std::shared_ptr<const ContentSource> content_source;
+    if (is_streaming) {
+        content_source = std::make_shared<const StreamingContentSource>(file_path, options.fold_mode);
+        s_streaming_load_count.increment();
+    } else if (options.compress) {
+        content_source = std::make_shared<const CompressedContentSource>(file_path, options.fold_mode);
+        s_compressed_load_count.increment();
+    } else {
+        content_source = std::make_shared<const MemoryContentSource>(file_path, options.fold_mode);
+        s_memory_load_count.increment();
+    }
+
+    s_loaded_bytes.increment(content_source->size());
+    s_load_duration.record(std::chrono::steady_clock::now() - start_time);
+    return content_source;
+}
+}
@@ -0,0 +1,116 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include <MTFind2/Search/CorpusLoader.h>
+#include <MTFind2/Search/CorpusWatcher.h>
+#include <MTFind2/Search/Dictionary.h>
+
+namespace mtfind2 {
+CorpusLoader::CorpusLoader(ContentSource::Options content_source_options, size_t thread_count)
+    : m_content_source_options(content_source_options)
+    , m_thread_count(thread_count > 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+std::vector<std::string> CorpusLoader::list_directory(const std::filesystem::path &directory)
+{
+    std::vector<std::pair<uintmax_t, std::string>> entries;
+    for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+        std::error_code error_code;
+        if (entry.is_regular_file() && CorpusWatcher::is_content_source(entry.path()))
+            entries.emplace_back(entry.file_size(error_code), entry.path().string());
+    }
+
+    // Load the largest files first so that they don't end up as stragglers
+    std::sort(entries.begin(), entries.end(), std::greater<>());
+
+    std::vector<std::string> file_paths;
+    for (auto &[_, file_path] : entries)
+        file_paths.push_back(std::move(file_path));
+    return file_paths;
+}
+
+std::vector<std::shared_ptr<const ContentSource>> CorpusLoader::load(const std::vector<std::string> &file_paths)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<const ContentSource>> content_sources(file_paths.size());
+    m_load_times.assign(file_paths.size(), {});
+
+    // Warm up the dictionary alongside the content sources
+    std::thread dictionary_thread([] {
+        try {
+            const auto start_time = std::chrono::steady_clock::now();
+            const auto word_count = Dictionary::instance().word_count();
+            const auto load_time = std::chrono::steady_clock::now() - start_time;
+            std::clog << "dictionary: " << word_count << " word(s) loaded in " << std::chrono::duration<double, std::milli>(load_time).count() << "ms" << std::endl;
+        } catch (const std::exception &exception) {
+            std::cerr << "dictionary: " << exception.what() << std::endl;
+        }
+    });
+
+    std::atomic<size_t> next_index = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(m_thread_count, file_paths.size()); i++) {
+        threads.emplace_back([&] {
+            for (size_t index; (index = next_index++) < file_paths.size();) {
+                const auto &file_path = file_paths[index];
+                const auto file_start_time = std::chrono::steady_clock::now();
+                try {
+                    content_sources[index] = ContentSource::open(file_path, m_content_source_options);
+                } catch (const std::exception &exception) {
+                    std::cerr << "corpus loader: " << exception.what() << std::endl;
+                }
+
+                std::error_code error_code;
+                const auto size = std::filesystem::file_size(file_path, error_code);
+                m_load_times[index] = { file_path, error_code ? 0 : size, std::chrono::steady_clock::now() - file_start_time };
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+    dictionary_thread.join();
+
+    std::erase(content_sources, nullptr);
+    m_total_duration = std::chrono::steady_clock::now() - start_time;
+    return content_sources;
+}
+
+void CorpusLoader::print_report(std::ostream &stream) const
+{
+    uint64_t total_size = 0;
+    for (const auto &load_time : m_load_times) {
+        total_size += load_time.size;
+        stream << "corpus loader: " << std::fixed << std::setprecision(2) << std::setw(9)
+               << std::chrono::duration<double, std::milli>(load_time.duration).count() << "ms "
+               << load_time.file_path << " (" << load_time.size << " bytes)" << std::endl;
+    }
+
+    const double total_seconds = std::chrono::duration<double>(m_total_duration).count();
+    stream << "corpus loader: " << m_load_times.size() << " file(s), " << total_size << " bytes in "
+           << std::fixed << std::setprecision(2) << total_seconds * 1000 << "ms using " << m_thread_count << " thread(s) ("
+           << (total_seconds > 0 ? total_size / total_seconds / (1 << 20) : 0) << " MiB/s)" << std::endl;
+    stream.unsetf(std::ios::floatfield);
+}
+}
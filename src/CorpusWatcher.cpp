@@ -0,0 +1,101 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <iostream>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <MTFind2/Search/CorpusWatcher.h>
+
+namespace mtfind2 {
+void CorpusWatcher::start()
+{
+#ifdef __linux__
+    if (m_keep_running)
+        return;
+
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd == -1 || inotify_add_watch(m_inotify_fd, m_directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1) {
+        std::cerr << "corpus watcher: could not watch " << m_directory << ", live updates are disabled" << std::endl;
+        if (m_inotify_fd != -1)
+            close(m_inotify_fd);
+        m_inotify_fd = -1;
+        return;
+    }
+
+    m_keep_running = true;
+    m_thread = std::thread([this] { this->watch(); });
+#else
+    std::cerr << "corpus watcher: live updates are not supported on this platform" << std::endl;
+#endif
+}
+
+void CorpusWatcher::stop()
+{
+    m_keep_running = false;
+    if (m_thread.joinable())
+        m_thread.join();
+
+#ifdef __linux__
+    if (m_inotify_fd != -1)
+        close(m_inotify_fd);
+    m_inotify_fd = -1;
+#endif
+}
+
+void CorpusWatcher::watch()
+{
+#ifdef __linux__
+    alignas(inotify_event) char buffer[4096];
+    pollfd poll_fd { m_inotify_fd, POLLIN, 0 };
+
+    while (m_keep_running) {
+        // Wake up periodically so that stop() doesn't need to interrupt us
+        if (poll(&poll_fd, 1, 250) <= 0)
+            continue;
+
+        const ssize_t length = read(m_inotify_fd, buffer, sizeof buffer);
+        for (ssize_t offset = 0; offset < length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->len == 0 || (event->mask & IN_ISDIR))
+                continue;
+
+            const auto path = m_directory / event->name;
+            if (!is_content_source(path) || !m_shard.contains(path))
+                continue;
+
+            if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+                std::clog << "corpus watcher: " << path << " is gone" << std::endl;
+                m_corpus.remove_content_source(path.string());
+            } else {
+                std::clog << "corpus watcher: (re)loading " << path << std::endl;
+                try {
+                    m_corpus.add_content_source(ContentSource::open(path.string(), m_content_source_options));
+                } catch (const std::exception &exception) {
+                    std::cerr << "corpus watcher: " << exception.what() << std::endl;
+                }
+            }
+        }
+    }
+#endif
+}
+}
@@ -0,0 +1,58 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <filesystem>
+
+#include <MTFind2/Search/LazyContentSource.h>
+
+namespace mtfind2 {
+LazyContentSource::LazyContentSource(std::string file_path, const Options &options)
+    : ContentSource(std::move(file_path), options.fold_mode)
+    , m_options(options)
+    , m_memory_budget(options.memory_budget)
+    , m_size([this] {
+        std::error_code error_code;
+        const auto size = std::filesystem::file_size(this->file_path(), error_code);
+        return error_code ? 0 : size;
+    }())
+{
+    // Once loaded, the source must stay loaded for as long as it is referenced
+    m_options.memory_budget = nullptr;
+    m_memory_budget->add(*this);
+}
+
+LazyContentSource::~LazyContentSource()
+{
+    m_memory_budget->remove(*this);
+}
+
+std::shared_ptr<const ContentSource> LazyContentSource::acquire() const
+{
+    m_access_count.fetch_add(1, std::memory_order_relaxed);
+    if (auto content_source = m_content_source.load())
+        return content_source;
+
+    // Concurrent scans of a cold source wait for a single load
+    const std::scoped_lock lock(m_load_lock);
+    if (auto content_source = m_content_source.load())
+        return content_source;
+
+    auto content_source = ContentSource::open(file_path(), m_options);
+    m_memory_budget->admit(*this, content_source);
+    return content_source;
+}
+}
@@ -0,0 +1,220 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+#include <MTFind2/Client/LoadGenerator.h>
+#include <MTFind2/Search/SearchRequest.h>
+#include <Shared/ZipfDistribution.h>
+
+namespace mtfind2 {
+struct LoadGenerator::Request final : NonCopyable {
+    Request(uint32_t client_id, Client::SubscriptionType subscription_type, int32_t credit, size_t request_id, const std::string &query, Clock::time_point scheduled_time)
+        : client(client_id, subscription_type, credit)
+        , search_request(request_id, query)
+        , scheduled_time(scheduled_time)
+    {
+    }
+
+    Client client;
+    SearchRequest search_request;
+    const Clock::time_point scheduled_time;
+};
+
+LoadGenerator::LoadGenerator(SearchProvider &search_provider, std::vector<std::string> words, const Options &options, MailboxDispatcher *mailbox_dispatcher)
+    : m_search_provider(search_provider)
+    , m_words(std::move(words))
+    , m_options(options)
+    , m_mailbox_dispatcher(mailbox_dispatcher)
+{
+    for (const auto subscription_type : { Client::SubscriptionType::Premium, Client::SubscriptionType::Standard })
+        m_statistics.try_emplace(subscription_type);
+}
+
+LoadGenerator::~LoadGenerator() = default;
+
+void LoadGenerator::run(const std::atomic<bool> &keep_running)
+{
+    if (m_words.empty() || m_options.rate <= 0)
+        return;
+
+    std::mt19937 random_engine(m_options.seed ? m_options.seed : std::random_device()());
+
+    // Popularity is not alphabetical, rank words in a random order
+    std::vector<size_t> word_ranks(m_words.size());
+    for (size_t i = 0; i < word_ranks.size(); i++)
+        word_ranks[i] = i;
+    std::shuffle(word_ranks.begin(), word_ranks.end(), random_engine);
+
+    const ZipfDistribution generate_rank(m_words.size(), m_options.zipf_exponent);
+    std::exponential_distribution<double> generate_poisson_gap(m_options.rate);
+    std::bernoulli_distribution generate_is_premium(m_options.premium_ratio);
+    const std::chrono::duration<double> constant_gap(1 / m_options.rate);
+
+    m_start_time = Clock::now();
+    const auto end_time = m_options.duration.count() ? m_start_time + m_options.duration : Clock::time_point::max();
+    auto scheduled_time = m_start_time;
+    uint32_t last_id = 0;
+
+    while (keep_running && scheduled_time < end_time) {
+        std::this_thread::sleep_until(scheduled_time);
+
+        const auto subscription_type = generate_is_premium(random_engine) ? Client::SubscriptionType::Premium : Client::SubscriptionType::Standard;
+        const auto credit = subscription_type == Client::SubscriptionType::Premium ? 15 : Client::NotUsingCredit;
+        issue(std::make_unique<Request>(last_id, subscription_type, credit, last_id, m_words[word_ranks[generate_rank(random_engine)]], scheduled_time));
+        last_id++;
+
+        // Late requests are sent right away, but keep their schedule
+        const auto gap = m_options.arrival_process == ArrivalProcess::Poisson ? std::chrono::duration<double>(generate_poisson_gap(random_engine)) : constant_gap;
+        scheduled_time += std::chrono::duration_cast<Clock::duration>(gap);
+
+        if (last_id % 64 == 0)
+            reap_finished_requests();
+    }
+    m_end_time = std::min(Clock::now(), end_time);
+    drain(keep_running);
+}
+
+void LoadGenerator::replay(const std::vector<CapturedRequest> &requests, double speed, size_t max_outstanding_count, const std::atomic<bool> &keep_running)
+{
+    m_start_time = Clock::now();
+    for (size_t i = 0; i < requests.size() && keep_running; i++) {
+        const auto &captured_request = requests[i];
+        auto scheduled_time = m_start_time;
+        if (speed > 0) {
+            scheduled_time += std::chrono::duration_cast<Clock::duration>(captured_request.arrival_offset / speed);
+            std::this_thread::sleep_until(scheduled_time);
+        } else {
+            // Wake up now and then to see whether we were told to stop
+            std::unique_lock lock(m_requests_lock);
+            while (keep_running && !m_request_finished_condition.wait_for(lock, std::chrono::milliseconds(100), [&] { return m_requests.size() < max_outstanding_count; })) { }
+            scheduled_time = Clock::now();
+        }
+
+        issue(std::make_unique<Request>(i, captured_request.subscription_type, captured_request.credit, i, captured_request.query, scheduled_time));
+        if ((i + 1) % 64 == 0)
+            reap_finished_requests();
+    }
+    m_end_time = Clock::now();
+    drain(keep_running);
+}
+
+void LoadGenerator::on_search_result(const SearchRequest &search_request, const ContentSource &, const SearchResult &)
+{
+    statistics(search_request).result_count++;
+}
+
+void LoadGenerator::on_service_overloaded(const SearchRequest &search_request, std::chrono::milliseconds)
+{
+    statistics(search_request).overloaded_count++;
+}
+
+void LoadGenerator::on_search_finished(const SearchRequest &search_request, Clock::time_point started_time)
+{
+    const auto finished_time = Clock::now();
+    const std::scoped_lock lock(m_requests_lock);
+    const auto it = m_requests.find(&search_request);
+    auto &statistics = m_statistics.at(it->second->client.subscription_type());
+    statistics.finished_count++;
+
+    if (started_time != Clock::time_point()) {
+        // Requests that joined a search in progress didn't wait at all
+        const auto scheduled_time = it->second->scheduled_time;
+        const auto attended_time = std::max(started_time, scheduled_time);
+        statistics.end_to_end.record(finished_time - scheduled_time);
+        statistics.queue_wait.record(attended_time - scheduled_time);
+        statistics.service_time.record(finished_time - attended_time);
+    }
+
+    m_finished_requests.push_back(std::move(it->second));
+    m_requests.erase(it);
+    m_request_finished_condition.notify_one();
+}
+
+void LoadGenerator::print_report(std::ostream &stream) const
+{
+    const double seconds = std::chrono::duration<double>(m_end_time - m_start_time).count();
+    const auto print_percentiles = [&stream](const char *name, const Histogram &histogram) {
+        stream << "  " << std::setw(12) << std::left << name << std::right;
+        for (const double quantile : { 0.5, 0.99, 0.999 })
+            stream << std::setw(12) << std::fixed << std::setprecision(2) << histogram.percentile(quantile) / 1e6 << "ms";
+        stream << std::setw(12) << histogram.max() / 1e6 << "ms" << std::endl;
+    };
+
+    for (const auto &[subscription_type, statistics] : m_statistics) {
+        const auto finished_count = statistics.finished_count.load();
+        stream << (subscription_type == Client::SubscriptionType::Premium ? "premium" : "standard") << " load: "
+               << statistics.issued_count << " issued, " << finished_count << " finished, " << statistics.overloaded_count << " overloaded, "
+               << statistics.result_count << " result(s); " << std::fixed << std::setprecision(1)
+               << (seconds > 0 ? statistics.issued_count / seconds : 0) << " qps offered, "
+               << (seconds > 0 ? (finished_count - statistics.overloaded_count) / seconds : 0) << " qps attended" << std::endl;
+        stream << "  " << std::setw(12) << std::left << "latency" << std::right << std::setw(14) << "p50" << std::setw(14) << "p99" << std::setw(14) << "p99.9" << std::setw(14) << "max" << std::endl;
+        print_percentiles("end-to-end", statistics.end_to_end);
+        print_percentiles("queue wait", statistics.queue_wait);
+        print_percentiles("service", statistics.service_time);
+    }
+    stream << std::defaultfloat;
+}
+
+void LoadGenerator::issue(std::unique_ptr<Request> request)
+{
+    request->client.set_delegate(this);
+    if (m_mailbox_dispatcher)
+        request->client.enable_mailbox(*m_mailbox_dispatcher);
+
+    auto &client = request->client;
+    const auto &search_request = request->search_request;
+    {
+        const std::scoped_lock lock(m_requests_lock);
+        m_requests.emplace(&search_request, std::move(request));
+    }
+    m_statistics.at(client.subscription_type()).issued_count++;
+    m_search_provider.query(client, search_request);
+}
+
+/**
+ * Gives outstanding requests some time to finish.
+ */
+void LoadGenerator::drain(const std::atomic<bool> &keep_running)
+{
+    using namespace std::chrono_literals;
+
+    const auto drain_deadline = Clock::now() + 10s;
+    while (keep_running && Clock::now() < drain_deadline && reap_finished_requests() > 0)
+        std::this_thread::sleep_for(10ms);
+}
+
+LoadGenerator::Statistics &LoadGenerator::statistics(const SearchRequest &search_request)
+{
+    const std::scoped_lock lock(m_requests_lock);
+    return m_statistics.at(m_requests.at(&search_request)->client.subscription_type());
+}
+
+/**
+ * Disposes of the finished requests whose client is idle.
+ * @return How many requests are still outstanding
+ */
+size_t LoadGenerator::reap_finished_requests()
+{
+    const std::scoped_lock lock(m_requests_lock);
+    std::erase_if(m_finished_requests, [](const auto &request) { return request->client.is_idle(); });
+    return m_requests.size() + m_finished_requests.size();
+}
+}
@@ -0,0 +1,131 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <iomanip>
+
+#include <MTFind2/Search/LazyContentSource.h>
+#include <MTFind2/Search/MemoryBudget.h>
+#include <Shared/Metrics.h>
+
+namespace mtfind2 {
+static Gauge &resident_bytes_gauge()
+{
+    static auto &s_gauge = MetricsRegistry::instance().gauge("mtfind2_memory_budget_resident_bytes", "Memory taken by lazily loaded content sources.");
+    return s_gauge;
+}
+
+static Gauge &corpus_bytes_gauge()
+{
+    static auto &s_gauge = MetricsRegistry::instance().gauge("mtfind2_memory_budget_corpus_bytes", "Size of the text of lazily loaded content sources, resident or not.");
+    return s_gauge;
+}
+
+MemoryBudget::MemoryBudget(uint64_t capacity)
+    : m_capacity(capacity)
+{
+    MetricsRegistry::instance().gauge("mtfind2_memory_budget_capacity_bytes", "Memory lazily loaded content sources may take.").increment(capacity);
+}
+
+uint64_t MemoryBudget::resident_size() const
+{
+    const std::scoped_lock lock(m_lock);
+    return m_resident_size;
+}
+
+uint64_t MemoryBudget::total_size() const
+{
+    const std::scoped_lock lock(m_lock);
+    return m_total_size;
+}
+
+void MemoryBudget::print_summary(std::ostream &stream) const
+{
+    const std::scoped_lock lock(m_lock);
+    const auto to_mib = [](uint64_t size) { return size / double(1 << 20); };
+    stream << "memory budget: " << std::fixed << std::setprecision(2) << to_mib(m_resident_size) << " of "
+           << to_mib(m_capacity) << " MiB resident (" << m_resident_count << " of " << m_sources.size()
+           << " content source(s), " << to_mib(m_total_size) << " MiB of text), " << m_load_count << " load(s), "
+           << m_eviction_count << " eviction(s)" << std::endl;
+    stream.unsetf(std::ios::floatfield);
+}
+
+void MemoryBudget::add(const LazyContentSource &source)
+{
+    const std::scoped_lock lock(m_lock);
+    m_sources.push_back(&source);
+    m_total_size += source.size();
+    corpus_bytes_gauge().increment(source.size());
+}
+
+void MemoryBudget::remove(const LazyContentSource &source)
+{
+    const std::scoped_lock lock(m_lock);
+    std::erase(m_sources, &source);
+    m_total_size -= source.size();
+    corpus_bytes_gauge().decrement(source.size());
+    if (source.is_resident()) {
+        m_resident_size -= source.m_memory_usage;
+        m_resident_count--;
+        resident_bytes_gauge().decrement(source.m_memory_usage);
+    }
+}
+
+void MemoryBudget::admit(const LazyContentSource &source, std::shared_ptr<const ContentSource> content_source)
+{
+    static auto &s_eviction_count = MetricsRegistry::instance().counter("mtfind2_memory_budget_evictions_total", "Lazily loaded content sources unloaded to stay within the memory budget.");
+
+    const auto memory_usage = content_source->memory_usage();
+    const std::scoped_lock lock(m_lock);
+    source.m_memory_usage = memory_usage;
+    source.m_content_source.store(std::move(content_source));
+    m_resident_size += memory_usage;
+    m_resident_count++;
+    m_load_count++;
+    int64_t resident_size_delta = memory_usage;
+
+    // Age every access count, and take a snapshot of them since they may
+    // still change while sorting
+    std::vector<std::pair<uint64_t, const LazyContentSource *>> candidates;
+    for (const auto *other : m_sources) {
+        const auto access_count = other->m_access_count.load(std::memory_order_relaxed) / 2;
+        other->m_access_count.store(access_count, std::memory_order_relaxed);
+        if (other != &source && other->is_resident())
+            candidates.emplace_back(access_count, other);
+    }
+
+    if (m_resident_size > m_capacity) {
+        std::sort(candidates.begin(), candidates.end());
+        for (const auto &[_, other] : candidates) {
+            if (m_resident_size <= m_capacity)
+                break;
+
+            // Scans in progress keep their own reference, so the memory is
+            // actually freed once they are done
+            other->m_content_source.store(nullptr);
+            m_resident_size -= other->m_memory_usage;
+            resident_size_delta -= other->m_memory_usage;
+            other->m_memory_usage = 0;
+            m_resident_count--;
+            m_eviction_count++;
+            s_eviction_count.increment();
+        }
+    }
+
+    resident_bytes_gauge().increment(resident_size_delta);
+}
+}
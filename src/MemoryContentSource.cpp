@@ -0,0 +1,171 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <optional>
+
+#include <MTFind2/Search/MemoryContentSource.h>
+#include <Shared/Metrics.h>
+
+namespace mtfind2 {
+void MemoryContentSource::scan(std::string_view folded_query, const OccurrenceCallback &callback) const
+{
+    static auto &s_index_hit_count = MetricsRegistry::instance().counter("mtfind2_index_lookups_total", "Queries looked up in an occurrence index, by whether the index covered them.", "result=\"hit\"");
+    static auto &s_index_miss_count = MetricsRegistry::instance().counter("mtfind2_index_lookups_total", "Queries looked up in an occurrence index, by whether the index covered them.", "result=\"miss\"");
+
+    if (const auto occurrence_index = this->occurrence_index(); occurrence_index && is_valid()) {
+        if (occurrence_index->covers(std::string(folded_query))) {
+            s_index_hit_count.increment();
+            occurrence_index->scan(folded_query, *this, callback);
+            return;
+        }
+        s_index_miss_count.increment();
+    }
+
+    scan_whole_buffer(folded_query, callback);
+}
+
+size_t MemoryContentSource::count(std::string_view folded_query) const
+{
+    if (const auto occurrence_index = this->occurrence_index(); occurrence_index && is_valid() && occurrence_index->covers(std::string(folded_query)))
+        return occurrence_index->count(folded_query);
+
+    return ContentSource::count(folded_query);
+}
+
+void MemoryContentSource::scan_whole_buffer(std::string_view folded_query, const OccurrenceCallback &callback) const
+{
+    if (folded_query.empty() || !is_valid())
+        return;
+
+    const auto folded_text = this->folded_text();
+    size_t line_index = 0;
+
+    /**
+     * Searches each run of candidate blocks separately, letting the search go
+     * past the end of the run just enough to find occurrences that start in it.
+     * Skipped blocks contain no occurrence, so this finds exactly the same
+     * occurrences as searching the whole text.
+     */
+    const auto candidate_blocks = find_candidate_blocks(folded_query);
+    const auto find_next = [&](size_t from) {
+        if (candidate_blocks.empty())
+            return folded_text.find(folded_query, from);
+
+        for (size_t block = from / BlockSize; block < candidate_blocks.size();) {
+            while (block < candidate_blocks.size() && !candidate_blocks[block])
+                block++;
+            if (block == candidate_blocks.size())
+                break;
+
+            size_t run_end = block + 1;
+            while (run_end < candidate_blocks.size() && candidate_blocks[run_end])
+                run_end++;
+
+            const auto window = folded_text.substr(0, run_end * BlockSize + folded_query.length() - 1);
+            const size_t folded_pos = window.find(folded_query, std::max(from, block * BlockSize));
+            if (folded_pos != std::string::npos)
+                return folded_pos;
+            block = run_end;
+        }
+        return std::string_view::npos;
+    };
+
+    // Occurrences are reported one step behind so that we know which is the last
+    std::optional<Occurrence> pending_occurrence;
+
+    for (size_t folded_pos = find_next(0); folded_pos != std::string::npos;
+         folded_pos = find_next(folded_pos + folded_query.length())) {
+        if (pending_occurrence && !callback(*pending_occurrence))
+            return;
+
+        // Occurrences are found in order, so the line can only move forward
+        line_index = folded_line_index(folded_pos, line_index);
+        const uint64_t original_start_pos = to_original(folded_pos);
+        const uint64_t original_end_pos = to_original(folded_pos + folded_query.length());
+        const size_t column = original_start_pos - line_offset(line_index);
+
+        pending_occurrence = Occurrence {
+            .offset = original_start_pos,
+            .line = line_index + 1,
+            .column = column + 1,
+            .length = original_end_pos - original_start_pos,
+            .is_final = false
+        };
+    }
+
+    if (pending_occurrence) {
+        pending_occurrence->is_final = true;
+        callback(*pending_occurrence);
+    }
+}
+
+std::vector<bool> MemoryContentSource::find_candidate_blocks(std::string_view folded_query) const
+{
+    // Empty means that every block is a candidate
+    if (folded_query.length() < NgramFilter::GramLength)
+        return {};
+
+    const auto &block_filters = this->block_filters();
+    const size_t gram_count = std::min(folded_query.length() - NgramFilter::GramLength, BlockOverlap) + 1;
+    std::vector<bool> candidate_blocks(block_filters.size());
+    for (size_t block = 0; block < block_filters.size(); block++) {
+        bool may_match = true;
+        for (size_t pos = 0; pos < gram_count && may_match; pos++)
+            may_match = block_filters[block].may_contain(folded_query.data() + pos);
+        candidate_blocks[block] = may_match;
+    }
+    return candidate_blocks;
+}
+
+void MemoryContentSource::scan_line_by_line(std::string_view folded_query, const OccurrenceCallback &callback) const
+{
+    if (folded_query.empty() || !is_valid())
+        return;
+
+    // Occurrences are reported one step behind so that we know which is the last
+    std::optional<Occurrence> pending_occurrence;
+
+    for (size_t line_index = 0; line_index < line_count(); line_index++) {
+        const auto folded_line = this->folded_line(line_index);
+
+        for (size_t start_pos = folded_line.find(folded_query); start_pos != std::string::npos;
+             start_pos = folded_line.find(folded_query, start_pos + folded_query.length())) {
+            if (pending_occurrence && !callback(*pending_occurrence))
+                return;
+
+            // Translate the occurrence back to the original (unfolded) line
+            const size_t folded_line_offset = this->folded_line_offset(line_index);
+            const uint64_t original_start_pos = to_original(folded_line_offset + start_pos);
+            const uint64_t original_end_pos = to_original(folded_line_offset + start_pos + folded_query.length());
+            const size_t column = original_start_pos - line_offset(line_index);
+
+            pending_occurrence = Occurrence {
+                .offset = original_start_pos,
+                .line = line_index + 1,
+                .column = column + 1,
+                .length = original_end_pos - original_start_pos,
+                .is_final = false
+            };
+        }
+    }
+
+    if (pending_occurrence) {
+        pending_occurrence->is_final = true;
+        callback(*pending_occurrence);
+    }
+}
+}
@@ -0,0 +1,186 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <MTFind2/Server/MetricsExporter.h>
+#include <Shared/Tracing.h>
+
+namespace mtfind2 {
+MetricsExporter::MetricsExporter(Options options, const MetricsRegistry &metrics_registry)
+    : m_options(std::move(options))
+    , m_metrics_registry(metrics_registry)
+    , m_keep_running(false)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+void MetricsExporter::start()
+{
+    if (m_keep_running || (m_options.http_port == 0 && m_options.dump_path.empty()))
+        return;
+
+    if (m_options.http_port != 0) {
+#ifdef __linux__
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_options.http_port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int enable = 1;
+        if (m_listen_fd == -1 || setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof enable) == -1 || bind(m_listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof address) == -1 || listen(m_listen_fd, 16) == -1) {
+            const std::string reason = std::strerror(errno);
+            if (m_listen_fd != -1)
+                ::close(m_listen_fd);
+            m_listen_fd = -1;
+            throw std::runtime_error("metrics: could not listen on 127.0.0.1:" + std::to_string(m_options.http_port) + ": " + reason);
+        }
+        std::clog << "metrics: serving on http://127.0.0.1:" << m_options.http_port << "/metrics" << std::endl;
+#else
+        std::cerr << "metrics: HTTP is not supported on this platform" << std::endl;
+#endif
+    }
+
+    m_keep_running = true;
+    m_thread = std::thread([this] { this->run(); });
+}
+
+void MetricsExporter::stop()
+{
+    if (!m_keep_running.exchange(false))
+        return;
+
+    if (m_thread.joinable())
+        m_thread.join();
+#ifdef __linux__
+    if (m_listen_fd != -1)
+        ::close(m_listen_fd);
+    m_listen_fd = -1;
+#endif
+    if (!m_options.dump_path.empty())
+        dump();
+}
+
+void MetricsExporter::run()
+{
+    using namespace std::chrono_literals;
+
+    auto next_dump_time = std::chrono::steady_clock::now() + m_options.dump_interval;
+    while (m_keep_running) {
+        if (!m_options.dump_path.empty() && std::chrono::steady_clock::now() >= next_dump_time) {
+            dump();
+            next_dump_time += m_options.dump_interval;
+        }
+
+#ifdef __linux__
+        if (m_listen_fd != -1) {
+            // Wake up periodically so that stop() doesn't need to interrupt us
+            pollfd poll_fd { .fd = m_listen_fd, .events = POLLIN, .revents = 0 };
+            if (poll(&poll_fd, 1, 250) == 1) {
+                const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd != -1) {
+                    serve(fd);
+                    ::close(fd);
+                }
+            }
+            continue;
+        }
+#endif
+        std::this_thread::sleep_for(250ms);
+    }
+}
+
+/**
+ * Answers a single HTTP request and closes the connection. Slow clients are
+ * given up on after a second, so that they can't hold up the next scrape.
+ */
+void MetricsExporter::serve(int fd) const
+{
+#ifdef __linux__
+    const timeval timeout { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        const auto read_count = ::recv(fd, buffer, sizeof buffer, 0);
+        if (read_count <= 0)
+            return;
+        request.append(buffer, read_count);
+    }
+
+    std::string status = "200 OK";
+    std::string content_type = "text/plain; version=0.0.4";
+    std::ostringstream body;
+    if (request.starts_with("GET /metrics ") || request.starts_with("GET / ")) {
+        m_metrics_registry.write_prometheus(body);
+    } else if (request.starts_with("GET /trace ") && Tracer::instance().is_enabled()) {
+        Tracer::instance().write_chrome_trace(body);
+        content_type = "application/json";
+    } else {
+        status = "404 Not Found";
+    }
+
+    const auto content = body.str();
+    const auto response = "HTTP/1.0 " + status + "\r\nContent-Type: " + content_type + "\r\nContent-Length: " + std::to_string(content.size()) + "\r\nConnection: close\r\n\r\n" + content;
+    for (size_t written = 0; written < response.size();) {
+        const auto write_count = ::send(fd, response.data() + written, response.size() - written, MSG_NOSIGNAL);
+        if (write_count <= 0)
+            return;
+        written += write_count;
+    }
+#endif
+}
+
+void MetricsExporter::dump() const
+{
+    const auto temporary_path = m_options.dump_path + ".tmp";
+    {
+        std::ofstream stream(temporary_path, std::ios::trunc);
+        if (!stream) {
+            std::cerr << "metrics: could not write '" << temporary_path << "'" << std::endl;
+            return;
+        }
+        m_metrics_registry.write_prometheus(stream);
+    }
+
+    std::error_code error_code;
+    std::filesystem::rename(temporary_path, m_options.dump_path, error_code);
+    if (error_code)
+        std::cerr << "metrics: could not replace '" << m_options.dump_path << "': " << error_code.message() << std::endl;
+}
+}
@@ -0,0 +1,250 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <MTFind2/Search/Dictionary.h>
+#include <MTFind2/Search/MemoryContentSource.h>
+#include <MTFind2/Search/OccurrenceIndex.h>
+#include <Shared/PerfectHash.h>
+#include <Shared/VarInt.h>
+
+namespace mtfind2 {
+#pragma region OccurrenceIndexBuilder
+
+template<typename T>
+static std::string_view bytes_of(std::span<const T> span)
+{
+    return { reinterpret_cast<const char *>(span.data()), span.size_bytes() };
+}
+
+template<typename T>
+static std::string_view bytes_of(const T &value)
+{
+    return { reinterpret_cast<const char *>(&value), sizeof value };
+}
+
+OccurrenceIndexBuilder::OccurrenceIndexBuilder(const std::vector<std::string> &words, uint32_t dictionary_fingerprint, TextHelper::FoldMode fold_mode)
+    : m_dictionary_fingerprint(dictionary_fingerprint)
+    , m_fold_mode(fold_mode)
+{
+    // Different words may fold the same way (e.g. "sí" and "si")
+    std::unordered_set<std::string> seen_words;
+    for (const auto &word : words) {
+        auto folded_word = TextHelper::fold_string(word, fold_mode);
+        if (!folded_word.empty() && seen_words.insert(folded_word).second)
+            m_folded_words.push_back(std::move(folded_word));
+    }
+
+    m_automaton = std::make_unique<const AhoCorasick>(m_folded_words);
+}
+
+std::string OccurrenceIndexBuilder::build(const MemoryContentSource &content_source) const
+{
+    if (content_source.fold_mode() != m_fold_mode)
+        throw std::runtime_error(content_source.tag() + " was folded using a different mode than the index");
+    if (!content_source.is_valid())
+        throw std::runtime_error(content_source.tag() + " can't be indexed");
+
+    struct Posting {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    /**
+     * Occurrences of a word may not overlap, just like when scanning. Since the
+     * automaton reports occurrences in order, it is enough to remember where
+     * the last accepted occurrence of each word ends.
+     */
+    std::vector<std::vector<Posting>> postings(m_folded_words.size());
+    std::vector<uint64_t> resume_positions(m_folded_words.size(), 0);
+    m_automaton->match(content_source.folded_text(), [&](size_t word_index, size_t end_pos) {
+        const size_t start_pos = end_pos - m_folded_words[word_index].size();
+        if (start_pos < resume_positions[word_index])
+            return;
+
+        resume_positions[word_index] = end_pos;
+        const uint64_t original_start_pos = content_source.to_original(start_pos);
+        postings[word_index].push_back({ original_start_pos, content_source.to_original(end_pos) - original_start_pos });
+    });
+
+    // Only words that do occur get a slot
+    std::vector<std::string_view> keys;
+    std::vector<size_t> key_words;
+    for (size_t i = 0; i < m_folded_words.size(); i++) {
+        if (!postings[i].empty()) {
+            keys.push_back(m_folded_words[i]);
+            key_words.push_back(i);
+        }
+    }
+
+    const auto parameters = PerfectHash::build(keys);
+    if (!parameters)
+        throw std::runtime_error("Could not find a perfect hash for " + content_source.tag());
+
+    std::vector<OccurrenceIndexFormat::Slot> slots(parameters->slot_count, OccurrenceIndexFormat::Slot {});
+    std::string words;
+    std::string encoded_postings;
+    for (size_t key = 0; key < keys.size(); ++key) {
+        const auto &word = m_folded_words[key_words[key]];
+        const auto &word_postings = postings[key_words[key]];
+        slots[parameters->slots[key]] = {
+            .postings_offset = encoded_postings.size(),
+            .word_offset = static_cast<uint32_t>(words.size()),
+            .word_length = static_cast<uint32_t>(word.size()),
+            .occurrence_count = static_cast<uint32_t>(word_postings.size()),
+            .reserved = 0
+        };
+        words += word;
+
+        uint64_t previous_offset = 0;
+        for (const auto &posting : word_postings) {
+            const bool has_length = posting.length != word.size();
+            VarInt::append(encoded_postings, (posting.offset - previous_offset) << 1 | has_length);
+            if (has_length)
+                VarInt::append(encoded_postings, posting.length);
+            previous_offset = posting.offset;
+        }
+    }
+
+    OccurrenceIndexFormat::Header header {};
+    std::memcpy(header.magic, OccurrenceIndexFormat::Magic, sizeof header.magic);
+    header.version = OccurrenceIndexFormat::Version;
+    header.fold_mode = static_cast<uint32_t>(m_fold_mode);
+    header.dictionary_fingerprint = m_dictionary_fingerprint;
+    header.word_count = keys.size();
+    header.seed = parameters->seed;
+    header.bucket_count = parameters->displacements.size();
+    header.slot_count = parameters->slot_count;
+    header.words_size = words.size();
+    header.postings_size = encoded_postings.size();
+
+    std::string data;
+    data += bytes_of(header);
+    data += bytes_of(std::span<const uint32_t>(parameters->displacements));
+    data.resize((data.size() + 7) & ~size_t(7), '\0');
+    data += bytes_of(std::span<const OccurrenceIndexFormat::Slot>(slots));
+    data += words;
+    data += encoded_postings;
+    return data;
+}
+
+#pragma endregion
+
+#pragma region OccurrenceIndex
+
+OccurrenceIndex::OccurrenceIndex(std::string_view data, std::shared_ptr<const void> storage)
+    : m_data(data)
+    , m_storage(std::move(storage))
+{
+    const auto fail = [](const std::string &reason) {
+        throw std::runtime_error("Malformed occurrence index: " + reason);
+    };
+
+    if (m_data.size() < sizeof(OccurrenceIndexFormat::Header) || reinterpret_cast<uintptr_t>(m_data.data()) % alignof(uint64_t) != 0)
+        fail("truncated header");
+
+    const auto &header = this->header();
+    if (std::memcmp(header.magic, OccurrenceIndexFormat::Magic, sizeof header.magic) != 0)
+        fail("bad magic");
+    if (header.version != OccurrenceIndexFormat::Version)
+        fail("unsupported version " + std::to_string(header.version));
+    if (header.bucket_count == 0 || header.slot_count == 0)
+        fail("empty hash table");
+
+    // Check every size before adding them up, so that nothing overflows
+    const uint64_t displacements_size = (header.bucket_count * sizeof(uint32_t) + 7) & ~uint64_t(7);
+    if (header.bucket_count > m_data.size() || header.slot_count > m_data.size() || header.words_size > m_data.size() || header.postings_size > m_data.size()
+        || sizeof header + displacements_size + header.slot_count * sizeof(OccurrenceIndexFormat::Slot) + header.words_size + header.postings_size != m_data.size())
+        fail("size mismatch");
+
+    const char *pos = m_data.data() + sizeof header;
+    m_displacements = { reinterpret_cast<const uint32_t *>(pos), header.bucket_count };
+    pos += displacements_size;
+    m_slots = { reinterpret_cast<const OccurrenceIndexFormat::Slot *>(pos), header.slot_count };
+    pos += header.slot_count * sizeof(OccurrenceIndexFormat::Slot);
+    m_words = { pos, header.words_size };
+    m_postings = { pos + header.words_size, header.postings_size };
+
+    for (const auto &slot : m_slots) {
+        if (slot.word_offset > m_words.size() || slot.word_length > m_words.size() - slot.word_offset || slot.postings_offset > m_postings.size())
+            fail("slot out of bounds");
+    }
+}
+
+std::shared_ptr<const OccurrenceIndex> OccurrenceIndex::open(std::string_view data, std::shared_ptr<const void> storage)
+{
+    return std::shared_ptr<const OccurrenceIndex>(new OccurrenceIndex(data, std::move(storage)));
+}
+
+std::shared_ptr<const OccurrenceIndex> OccurrenceIndex::open(std::string data)
+{
+    const auto storage = std::make_shared<const std::string>(std::move(data));
+    return open(*storage, storage);
+}
+
+const OccurrenceIndexFormat::Slot *OccurrenceIndex::find(std::string_view folded_word) const
+{
+    const auto &slot = m_slots[PerfectHash::lookup(folded_word, header().seed, m_displacements, m_slots.size())];
+    if (slot.word_length == 0 || m_words.substr(slot.word_offset, slot.word_length) != folded_word)
+        return nullptr;
+    return &slot;
+}
+
+bool OccurrenceIndex::covers(const std::string &folded_query) const
+{
+    const auto &dictionary = Dictionary::instance();
+    return dictionary.fingerprint() == dictionary_fingerprint() && dictionary.contains(folded_query, fold_mode());
+}
+
+void OccurrenceIndex::scan(std::string_view folded_query, const MemoryContentSource &content_source, const ContentSource::OccurrenceCallback &callback) const
+{
+    const auto *slot = find(folded_query);
+    if (slot == nullptr)
+        return;
+
+    try {
+        auto postings = m_postings.substr(slot->postings_offset);
+        uint64_t offset = 0;
+        for (size_t i = 0; i < slot->occurrence_count; i++) {
+            const uint64_t value = VarInt::read(postings);
+            offset += value >> 1;
+            const uint64_t length = (value & 1) ? VarInt::read(postings) : folded_query.size();
+            if (offset + length > content_source.text().size())
+                throw std::runtime_error("occurrence out of bounds");
+
+            const size_t line_index = content_source.line_index(offset);
+            const Occurrence occurrence {
+                .offset = offset,
+                .line = line_index + 1,
+                .column = offset - content_source.line_offset(line_index) + 1,
+                .length = length,
+                .is_final = i + 1 == slot->occurrence_count
+            };
+            if (!callback(occurrence))
+                return;
+        }
+    } catch (const std::runtime_error &exception) {
+        std::cerr << content_source.tag() << ": occurrence index is corrupt (" << exception.what() << ")" << std::endl;
+    }
+}
+
+#pragma endregion
+}
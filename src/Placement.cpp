@@ -0,0 +1,122 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <map>
+
+#include <MTFind2/Search/Placement.h>
+
+namespace mtfind2 {
+/**
+ * Orders CPUs so that consecutive workers land on different caches and
+ * cores, e.g. "0 4 1 5 2 6 3 7" for two caches of two cores of two threads.
+ */
+static std::vector<unsigned> scatter(const CpuTopology &topology, unsigned cache_level)
+{
+    // Within each cache, the first thread of every core comes first, then the
+    // second thread of every core and so on
+    std::vector<std::vector<unsigned>> domains;
+    for (const auto &domain : topology.cache_domains(cache_level)) {
+        std::map<unsigned, std::vector<unsigned>> cores;
+        for (const auto &cpu : topology.cpus()) {
+            if (std::find(domain.begin(), domain.end(), cpu.id) != domain.end())
+                cores[cpu.core_id].push_back(cpu.id);
+        }
+
+        std::vector<unsigned> cpu_ids;
+        for (size_t thread_index = 0; cpu_ids.size() < domain.size(); thread_index++) {
+            for (const auto &[core_id, core_cpu_ids] : cores) {
+                if (thread_index < core_cpu_ids.size())
+                    cpu_ids.push_back(core_cpu_ids[thread_index]);
+            }
+        }
+        domains.push_back(std::move(cpu_ids));
+    }
+
+    std::vector<unsigned> cpu_ids;
+    for (size_t i = 0; cpu_ids.size() < topology.cpus().size(); i++) {
+        for (const auto &domain : domains) {
+            if (i < domain.size())
+                cpu_ids.push_back(domain[i]);
+        }
+    }
+    return cpu_ids;
+}
+
+Placement::Placement(CpuTopology topology, Options options)
+    : m_topology(std::move(topology))
+    , m_options(options)
+    , m_domains(m_topology.cache_domains(options.cache_level))
+    , m_domain_sizes(m_domains.size())
+{
+    if (options.policy == Policy::Scatter) {
+        m_worker_cpu_ids = scatter(m_topology, options.cache_level);
+    } else {
+        for (const auto &cpu : m_topology.cpus())
+            m_worker_cpu_ids.push_back(cpu.id);
+    }
+}
+
+const char *Placement::policy_name(Policy policy)
+{
+    switch (policy) {
+    case Policy::Compact:
+        return "compact";
+    case Policy::Scatter:
+        return "scatter";
+    default:
+        return "none";
+    }
+}
+
+void Placement::pin_worker(size_t worker_index) const
+{
+    if (!is_enabled() || m_worker_cpu_ids.empty())
+        return;
+
+    const unsigned cpu_id = m_worker_cpu_ids[worker_index % m_worker_cpu_ids.size()];
+    CpuTopology::pin_this_thread({ &cpu_id, 1 });
+}
+
+void Placement::pin_scan(const ContentSource &content_source) const
+{
+    if (!is_enabled() || m_domains.empty())
+        return;
+
+    size_t domain_index;
+    {
+        const std::scoped_lock lock(m_assignment_lock);
+        const auto [it, is_new] = m_source_domains.try_emplace(content_source.id(), 0);
+        if (is_new) {
+            // Sizes of replaced sources are never taken back, which only
+            // matters if the corpus is rewritten many times over
+            it->second = std::min_element(m_domain_sizes.begin(), m_domain_sizes.end()) - m_domain_sizes.begin();
+            m_domain_sizes[it->second] += content_source.size();
+        }
+        domain_index = it->second;
+    }
+
+    CpuTopology::pin_this_thread(m_domains[domain_index]);
+}
+
+void Placement::print_summary(std::ostream &stream) const
+{
+    stream << "placement: " << m_topology.cpus().size() << " CPU(s) on " << m_topology.core_count() << " core(s), " << m_domains.size() << " L"
+           << m_options.cache_level << " cache(s) and " << m_topology.node_count() << " memory node(s); workers are placed " << policy_name(m_options.policy)
+           << std::endl;
+}
+}
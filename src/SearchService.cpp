@@ -20,24 +20,57 @@
 
 #include <MTFind2/Client/Client.h>
 #include <MTFind2/Messages/NotEnoughCreditMessage.h>
+#include <MTFind2/Messages/SearchFinishedMessage.h>
 #include <MTFind2/Messages/SearchResultFoundMessage.h>
 #include <MTFind2/Search/SearchService.h>
-#include <Shared/TextHelper.h>
+#include <Shared/Metrics.h>
+#include <Shared/PerfCounters.h>
 #include <Shared/Semaphore.h>
+#include <Shared/Tracing.h>
 
 namespace mtfind2 {
+/**
+ * Metrics shared by every search service.
+ */
+static struct {
+    Counter &scan_count = MetricsRegistry::instance().counter("mtfind2_scans_total", "Content sources scanned for a query.");
+    Counter &scanned_bytes = MetricsRegistry::instance().counter("mtfind2_scanned_bytes_total", "Bytes of content sources scanned for a query.");
+    Counter &hit_count = MetricsRegistry::instance().counter("mtfind2_scan_hits_total", "Occurrences found by scans.");
+    Histogram &scan_duration = MetricsRegistry::instance().histogram("mtfind2_scan_duration_seconds", "Time taken to scan a content source for a query.");
+
+    // Only scans whose hardware counters could be read count towards these
+    Counter &counted_bytes = MetricsRegistry::instance().counter("mtfind2_scan_counted_bytes_total", "Bytes scanned while hardware counters were being read.");
+    Counter &cycles = MetricsRegistry::instance().counter("mtfind2_scan_cycles_total", "CPU cycles spent scanning content sources.");
+    Counter &instructions = MetricsRegistry::instance().counter("mtfind2_scan_instructions_total", "Instructions retired scanning content sources.");
+    Counter &cache_misses = MetricsRegistry::instance().counter("mtfind2_scan_cache_misses_total", "Last-level cache misses scanning content sources.");
+    Counter &branch_misses = MetricsRegistry::instance().counter("mtfind2_scan_branch_misses_total", "Branch mispredictions scanning content sources.");
+} s_metrics;
+
 void SearchService::query(Client &client, const SearchRequest &search_request)
+{
+    const auto started_time = std::chrono::steady_clock::now();
+    query(search_request, [&client, &search_request](const ContentSource &content_source, const SearchResult &search_result) {
+        return deliver(client, search_request, content_source, search_result);
+    });
+    client.push_message(SearchFinishedMessage(search_request, started_time));
+}
+
+void SearchService::query(const SearchRequest &search_request, const ResultSink &sink, const std::function<void()> &on_scanned)
 {
     /**
-     * Any mutation on the content sources vector will take effect in subsequent
-     * queries (but not this one).
+     * Any mutation on the corpus will take effect in subsequent queries (but
+     * not this one). Holding the snapshot keeps its content sources alive.
      */
-    std::scoped_lock lock(m_content_sources_lock);
-    std::vector<std::thread> threads(m_content_sources.size());
+    const auto snapshot = m_corpus.snapshot();
+    std::vector<std::thread> threads;
+    threads.reserve(snapshot->content_sources().size());
 
-    for (auto *content_source : m_content_sources) {
-        threads.emplace_back([this, content_source, &client, &search_request] {
-            this->find_in_source(*content_source, client, search_request);
+    for (const auto &content_source : snapshot->content_sources()) {
+        threads.emplace_back([this, content_source = content_source.get(), &search_request, &sink] {
+            // Threads start with the affinity of the worker, often a single CPU
+            if (m_placement)
+                m_placement->pin_scan(*content_source);
+            this->find_in_source(*content_source, search_request, sink);
         });
     }
 
@@ -47,46 +80,71 @@ void SearchService::query(Client &client, const SearchRequest &search_request)
     }
 
     threads.clear();
+    if (on_scanned)
+        on_scanned();
 }
 
-void SearchService::find_in_source(const ContentSource &content_source, Client &client, const SearchRequest &search_request) const
+size_t SearchService::count(const SearchRequest &search_request) const
 {
-    size_t line_number = 1;
-    std::string lowercase_query { search_request.query() };
-    TextHelper::transform_to_lowercase(lowercase_query);
-
-    for (const std::string &line : content_source.lines()) {
-        std::string lowercase_line { line };
-        TextHelper::transform_to_lowercase(lowercase_line);
-
-        for (auto [start_pos, end_pos] = std::make_tuple(0, 0);
-             start_pos != std::string::npos;) {
-            if (!client.has_credit()) {
-                Semaphore semaphore;
-                client.push_message(NotEnoughCreditMessage(semaphore));
-                if (client.subscription_type() == Client::SubscriptionType::Standard)
-                    return;
-
-                // Wait for credit recharge if user is premium
-                semaphore.wait();
-                std::cout << search_request << ": resuming search request after credit recharge" << std::endl;
-            }
-
-            std::tie(start_pos, end_pos) = TextHelper::find_in_string(lowercase_line, lowercase_query, end_pos);
-            if (start_pos == std::string::npos)
-                break;
-
-            bool is_final_result = false;
-            if (line_number == content_source.lines().size()) {
-                auto [next_start_pos, _] = TextHelper::find_in_string(lowercase_line, lowercase_query, end_pos);
-                is_final_result = next_start_pos == std::string::npos;
-            }
-
-            client.consume_credit();
-            client.push_message(SearchResultFoundMessage(search_request, SearchResult(content_source, TextHelper::get_surrounding_text(line, start_pos, end_pos), line_number, start_pos + 1, search_request.query().length(), is_final_result)));
-        }
-
-        line_number++;
+    size_t occurrence_count = 0;
+    const auto snapshot = m_corpus.snapshot();
+    for (const auto &content_source : snapshot->content_sources())
+        occurrence_count += content_source->count(search_request.folded_query(content_source->fold_mode()));
+    return occurrence_count;
+}
+
+bool SearchService::deliver(Client &client, const SearchRequest &search_request, const ContentSource &content_source, const SearchResult &search_result)
+{
+    if (!client.has_credit()) {
+        const auto semaphore = std::make_shared<Semaphore>();
+        client.push_message(NotEnoughCreditMessage(semaphore));
+        if (client.subscription_type() == Client::SubscriptionType::Standard)
+            return false;
+
+        // Wait for credit recharge if user is premium
+        const TraceSpan span("credit wait", search_request.id());
+        semaphore->wait();
+        std::cout << search_request << ": resuming search request after credit recharge" << std::endl;
     }
+
+    client.consume_credit();
+    client.push_message(SearchResultFoundMessage(search_request, content_source, search_result));
+    return true;
+}
+
+void SearchService::find_in_source(const ContentSource &content_source, const SearchRequest &search_request, const ResultSink &sink) const
+{
+    const TraceSpan span("scan", search_request.id(), content_source.file_path());
+    const auto start_time = std::chrono::steady_clock::now();
+    PerfScope perf_scope;
+    size_t hit_count = 0;
+    content_source.scan(search_request.folded_query(content_source.fold_mode()), [&](const Occurrence &occurrence) {
+        const SearchResult search_result {
+            .source_id = content_source.id(),
+            .offset = occurrence.offset,
+            .line = static_cast<uint32_t>(occurrence.line),
+            .column = static_cast<uint32_t>(occurrence.column),
+            .length = static_cast<uint32_t>(occurrence.length),
+            .is_final_result = occurrence.is_final,
+            .timestamp = std::chrono::steady_clock::now()
+        };
+        hit_count++;
+        return sink(content_source, search_result);
+    });
+
+    // Delivering results is counted too, since it happens on this thread
+    const auto perf_sample = perf_scope.stop();
+
+    s_metrics.scan_count.increment();
+    s_metrics.scanned_bytes.increment(content_source.size());
+    s_metrics.hit_count.increment(hit_count);
+    s_metrics.scan_duration.record(std::chrono::steady_clock::now() - start_time);
+    if (perf_sample) {
+        s_metrics.counted_bytes.increment(content_source.size());
+        s_metrics.cycles.increment(perf_sample->cycles);
+        s_metrics.instructions.increment(perf_sample->instructions);
+        s_metrics.cache_misses.increment(perf_sample->cache_misses);
+        s_metrics.branch_misses.increment(perf_sample->branch_misses);
+    }
+}
 }
-}
\ No newline at end of file
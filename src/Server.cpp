@@ -0,0 +1,565 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <MTFind2/Client/Client.h>
+#include <MTFind2/Search/ContentSource.h>
+#include <MTFind2/Search/SearchResult.h>
+#include <MTFind2/Server/Protocol.h>
+#include <MTFind2/Server/Server.h>
+
+namespace mtfind2 {
+/**
+ * A connection and the client it stands for. Responses are produced by search
+ * workers (or mailbox dispatchers) and written by the loop, everything else is
+ * only touched by the loop.
+ */
+struct Server::Session final : ClientDelegate, NonCopyable, std::enable_shared_from_this<Session> {
+    struct Request final {
+        uint32_t tag;
+        uint32_t result_count;
+        std::unique_ptr<const SearchRequest> search_request;
+    };
+
+    Session(Server &server, int fd)
+        : server(server)
+        , fd(fd)
+    {
+    }
+
+    ~Session()
+    {
+#ifdef __linux__
+        if (fd != -1)
+            ::close(fd);
+#endif
+    }
+
+    Server &server;
+    int fd;
+    std::unique_ptr<Client> client;
+    std::string input;
+
+    /**
+     * Responses taken by the loop, the first one possibly written in part.
+     */
+    std::deque<std::string> writing;
+    size_t written_size = 0;
+
+    /**
+     * Events the loop polls the connection for.
+     */
+    uint32_t events = 0;
+
+    /**
+     * Whether the peer is done sending requests. The connection is closed
+     * once the responses to those it did send are written.
+     */
+    bool is_read_closed = false;
+
+    std::mutex lock;
+    std::deque<std::string> output;
+    bool is_flush_scheduled = false;
+    bool is_closed = false;
+    std::unordered_map<const SearchRequest *, Request> requests;
+    std::atomic<size_t> backlog_size = 0;
+
+    /**
+     * @return Whether nothing refers to this session anymore
+     */
+    bool is_disposable()
+    {
+        const std::scoped_lock scoped_lock(lock);
+        return is_closed && requests.empty() && (!client || client->is_idle());
+    }
+
+    /**
+     * @return Whether every request has finished and its responses were handed
+     * over to the loop
+     */
+    bool is_done()
+    {
+        const std::scoped_lock scoped_lock(lock);
+        return requests.empty() && output.empty();
+    }
+
+    void send(std::string frame)
+    {
+        const std::scoped_lock scoped_lock(lock);
+        send_locked(std::move(frame));
+    }
+
+    void on_search_result(const SearchRequest &search_request, const ContentSource &content_source, const SearchResult &search_result) override
+    {
+        uint32_t tag;
+        {
+            const std::scoped_lock scoped_lock(lock);
+            auto &request = requests.at(&search_request);
+            request.result_count++;
+            tag = request.tag;
+        }
+
+        send(Protocol::Writer(Protocol::FrameType::Result)
+                 .put(tag)
+                 .put(search_result.line)
+                 .put(search_result.column)
+                 .put(search_result.offset)
+                 .put(search_result.length)
+                 .put(static_cast<uint8_t>(search_result.is_final_result ? Protocol::IsFinalResult : 0))
+                 .put_string16(content_source.file_path())
+                 .put_rest(search_result.surrounding_text(content_source, Client::context_width()))
+                 .finish());
+    }
+
+    void on_search_count(const SearchRequest &search_request, size_t occurrence_count) override
+    {
+        const std::scoped_lock scoped_lock(lock);
+        send_locked(Protocol::Writer(Protocol::FrameType::Count).put(requests.at(&search_request).tag).put(static_cast<uint64_t>(occurrence_count)).finish());
+    }
+
+    void on_service_overloaded(const SearchRequest &search_request, std::chrono::milliseconds retry_after) override
+    {
+        const std::scoped_lock scoped_lock(lock);
+        send_locked(Protocol::Writer(Protocol::FrameType::Overloaded).put(requests.at(&search_request).tag).put(static_cast<uint32_t>(retry_after.count())).finish());
+    }
+
+    void on_search_finished(const SearchRequest &search_request, std::chrono::steady_clock::time_point) override
+    {
+        const std::scoped_lock scoped_lock(lock);
+        const auto it = requests.find(&search_request);
+        send_locked(Protocol::Writer(Protocol::FrameType::Done).put(it->second.tag).put(it->second.result_count).finish());
+        requests.erase(it);
+    }
+
+    void on_credit_recharged(size_t amount) override
+    {
+        send(Protocol::Writer(Protocol::FrameType::Credit).put(static_cast<uint32_t>(amount)).finish());
+    }
+
+private:
+    void send_locked(std::string frame)
+    {
+        if (is_closed)
+            return;
+
+        backlog_size += frame.size();
+        output.push_back(std::move(frame));
+        if (!is_flush_scheduled) {
+            is_flush_scheduled = true;
+            server.schedule_flush(shared_from_this());
+        }
+    }
+};
+
+/**
+ * Compares a key without giving away how much of it was right through the
+ * time it takes. Nothing matches an empty key.
+ */
+static bool is_same_key(std::string_view key, std::string_view expected_key)
+{
+    if (expected_key.empty())
+        return false;
+
+    uint8_t difference = key.size() != expected_key.size();
+    for (size_t i = 0; i < key.size(); i++)
+        difference |= static_cast<uint8_t>(key[i] ^ expected_key[i % expected_key.size()]);
+    return difference == 0;
+}
+
+Server::Server(SearchProvider &search_provider, Options options, MailboxDispatcher *mailbox_dispatcher)
+    : m_search_provider(search_provider)
+    , m_options(std::move(options))
+    , m_mailbox_dispatcher(mailbox_dispatcher)
+    , m_keep_running(false)
+{
+}
+
+Server::~Server()
+{
+    stop();
+    m_closed_sessions.clear();
+}
+
+void Server::start()
+{
+#ifdef __linux__
+    if (m_keep_running)
+        return;
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll_fd == -1 || m_wake_fd == -1)
+        throw std::runtime_error(std::string("server: ") + std::strerror(errno));
+
+    epoll_event event { .events = EPOLLIN, .data = { .fd = m_wake_fd } };
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &event);
+
+    if (!m_options.unix_socket_path.empty()) {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (m_options.unix_socket_path.size() >= sizeof address.sun_path)
+            throw std::runtime_error("server: socket path '" + m_options.unix_socket_path + "' is too long");
+        m_options.unix_socket_path.copy(address.sun_path, sizeof address.sun_path - 1);
+
+        // Replace the socket left behind by a previous run, if any
+        ::unlink(m_options.unix_socket_path.c_str());
+        listen_on(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), &address, sizeof address, m_options.unix_socket_path);
+    }
+
+    if (m_options.tcp_port != 0) {
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_options.tcp_port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        const int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof enable);
+        listen_on(fd, &address, sizeof address, "127.0.0.1:" + std::to_string(m_options.tcp_port));
+    }
+
+    m_keep_running = true;
+    m_thread = std::thread([this] { this->run(); });
+#else
+    std::cerr << "server: not supported on this platform" << std::endl;
+#endif
+}
+
+void Server::stop()
+{
+    m_keep_running = false;
+    if (m_thread.joinable())
+        m_thread.join();
+
+#ifdef __linux__
+    while (!m_sessions.empty())
+        close_session(*m_sessions.begin()->second);
+    reap_closed_sessions();
+
+    for (const int fd : m_listen_fds)
+        ::close(fd);
+    m_listen_fds.clear();
+    if (!m_options.unix_socket_path.empty())
+        ::unlink(m_options.unix_socket_path.c_str());
+
+    if (m_wake_fd != -1)
+        ::close(m_wake_fd);
+    if (m_epoll_fd != -1)
+        ::close(m_epoll_fd);
+    m_wake_fd = m_epoll_fd = -1;
+#endif
+}
+
+void Server::listen_on(int fd, const void *address, size_t address_size, const std::string &description)
+{
+#ifdef __linux__
+    if (fd == -1 || bind(fd, static_cast<const sockaddr *>(address), address_size) == -1 || listen(fd, SOMAXCONN) == -1) {
+        const std::string reason = std::strerror(errno);
+        if (fd != -1)
+            ::close(fd);
+        throw std::runtime_error("server: could not listen on " + description + ": " + reason);
+    }
+
+    epoll_event event { .events = EPOLLIN, .data = { .fd = fd } };
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    m_listen_fds.push_back(fd);
+    std::clog << "server: listening on " << description << std::endl;
+#endif
+}
+
+void Server::run()
+{
+#ifdef __linux__
+    epoll_event events[64];
+    while (m_keep_running) {
+        // Wake up periodically so that stop() doesn't need to interrupt us
+        const int event_count = epoll_wait(m_epoll_fd, events, std::size(events), 250);
+        for (int i = 0; i < event_count; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == m_wake_fd) {
+                uint64_t value;
+                while (::read(m_wake_fd, &value, sizeof value) > 0) { }
+
+                std::vector<std::shared_ptr<Session>> dirty_sessions;
+                {
+                    const std::scoped_lock lock(m_dirty_sessions_lock);
+                    dirty_sessions.swap(m_dirty_sessions);
+                }
+                for (const auto &session : dirty_sessions)
+                    flush(*session);
+            } else if (std::find(m_listen_fds.begin(), m_listen_fds.end(), fd) != m_listen_fds.end()) {
+                accept_all(fd);
+            } else if (const auto it = m_sessions.find(fd); it != m_sessions.end()) {
+                // Keep the session alive, closing it removes it from the map
+                const auto session = it->second;
+                if (events[i].events & EPOLLOUT)
+                    flush(*session);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    read(*session);
+            }
+        }
+
+        reap_closed_sessions();
+    }
+#endif
+}
+
+void Server::accept_all(int listen_fd)
+{
+#ifdef __linux__
+    for (;;) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                std::cerr << "server: accept: " << std::strerror(errno) << std::endl;
+            if (errno != EINTR)
+                return;
+            continue;
+        }
+
+        // Results are small and latency matters more than packet count
+        const int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof enable);
+
+        epoll_event event { .events = EPOLLIN, .data = { .fd = fd } };
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        const auto session = std::make_shared<Session>(*this, fd);
+        session->events = event.events;
+        m_sessions.emplace(fd, session);
+    }
+#endif
+}
+
+void Server::schedule_flush(std::shared_ptr<Session> session)
+{
+#ifdef __linux__
+    {
+        const std::scoped_lock lock(m_dirty_sessions_lock);
+        m_dirty_sessions.push_back(std::move(session));
+    }
+
+    const uint64_t value = 1;
+    [[maybe_unused]] const auto result = ::write(m_wake_fd, &value, sizeof value);
+#endif
+}
+
+void Server::read(Session &session)
+{
+#ifdef __linux__
+    // Once the peer stopped sending, the socket is no longer polled for input,
+    // so getting here means that it hung up or failed altogether
+    if (session.is_read_closed) {
+        close_session(session);
+        return;
+    }
+
+    char buffer[64 << 10];
+    for (;;) {
+        const ssize_t length = ::read(session.fd, buffer, sizeof buffer);
+        if (length > 0) {
+            session.input.append(buffer, length);
+            continue;
+        }
+        if (length == 0) {
+            // End of stream, but the requests read so far still get their responses
+            session.is_read_closed = true;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+        close_session(session);
+        return;
+    }
+
+    try {
+        std::string_view input(session.input);
+        while (const auto payload = Protocol::next_frame(input))
+            handle_frame(session, *payload);
+        session.input.erase(0, session.input.size() - input.size());
+        if (session.is_read_closed)
+            flush(session);
+    } catch (const std::exception &exception) {
+        session.send(Protocol::Writer(Protocol::FrameType::Error).put_rest(exception.what()).finish());
+        flush(session);
+        close_session(session);
+    }
+#endif
+}
+
+void Server::handle_frame(Session &session, std::string_view payload)
+{
+    Protocol::Reader reader(payload);
+    switch (reader.type()) {
+    case Protocol::FrameType::Hello: {
+        if (session.client)
+            throw std::runtime_error("already greeted");
+
+        const auto subscription_type = reader.get<uint8_t>() ? Client::SubscriptionType::Premium : Client::SubscriptionType::Standard;
+        const uint8_t flags = reader.is_empty() ? 0 : reader.get<uint8_t>();
+        auto credit = subscription_type == Client::SubscriptionType::Premium ? 15 : Client::NotUsingCredit;
+        if (flags & Protocol::IsCoordinator) {
+            if (!is_same_key(reader.get_rest(), m_options.coordinator_key))
+                throw std::runtime_error("not trusted as a coordinator");
+            credit = Client::UnlimitedCredit;
+        }
+        session.client = std::make_unique<Client>(m_last_client_id++, subscription_type, credit);
+        session.client->set_delegate(&session);
+        if (m_mailbox_dispatcher)
+            session.client->enable_mailbox(*m_mailbox_dispatcher);
+        break;
+    }
+    case Protocol::FrameType::Query: {
+        if (!session.client)
+            throw std::runtime_error("expected hello");
+
+        const auto tag = reader.get<uint32_t>();
+        const auto query = reader.get_rest();
+        if (query.empty())
+            throw std::runtime_error("empty query");
+
+        auto search_request = std::make_unique<const SearchRequest>(m_last_request_id++, std::string(query));
+        const auto &search_request_ref = *search_request;
+        {
+            const std::scoped_lock lock(session.lock);
+            session.requests.emplace(&search_request_ref, Session::Request { tag, 0, std::move(search_request) });
+        }
+        m_search_provider.query(*session.client, search_request_ref);
+        break;
+    }
+    default:
+        throw std::runtime_error("unexpected frame type");
+    }
+}
+
+void Server::flush(Session &session)
+{
+#ifdef __linux__
+    {
+        const std::scoped_lock lock(session.lock);
+        session.is_flush_scheduled = false;
+        std::move(session.output.begin(), session.output.end(), std::back_inserter(session.writing));
+        session.output.clear();
+    }
+    if (session.fd == -1)
+        return;
+
+    if (session.backlog_size > MaxBacklogSize) {
+        std::cerr << "server: " << *session.client << " is not keeping up, closing connection" << std::endl;
+        close_session(session);
+        return;
+    }
+
+    while (!session.writing.empty()) {
+        iovec iov[64];
+        size_t iov_count = 0;
+        for (auto it = session.writing.begin(); it != session.writing.end() && iov_count < std::size(iov); ++it, ++iov_count) {
+            const size_t skip = iov_count == 0 ? session.written_size : 0;
+            iov[iov_count] = { it->data() + skip, it->size() - skip };
+        }
+
+        // Not writev(), so that a peer that went away doesn't raise SIGPIPE
+        msghdr message {};
+        message.msg_iov = iov;
+        message.msg_iovlen = iov_count;
+        ssize_t length = sendmsg(session.fd, &message, MSG_NOSIGNAL);
+        if (length == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            close_session(session);
+            return;
+        }
+
+        session.backlog_size -= length;
+        while (length > 0) {
+            const size_t left = session.writing.front().size() - session.written_size;
+            if (static_cast<size_t>(length) < left) {
+                session.written_size += length;
+                break;
+            }
+            length -= left;
+            session.writing.pop_front();
+            session.written_size = 0;
+        }
+    }
+
+    // Wait for the socket to drain before writing the rest
+    const bool must_wait = !session.writing.empty();
+    if (session.is_read_closed && !must_wait && session.is_done()) {
+        close_session(session);
+        return;
+    }
+
+    const uint32_t events = (session.is_read_closed ? 0u : EPOLLIN) | (must_wait ? EPOLLOUT : 0u);
+    if (events != session.events) {
+        epoll_event event { .events = events, .data = { .fd = session.fd } };
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, session.fd, &event);
+        session.events = events;
+    }
+#endif
+}
+
+void Server::close_session(Session &session)
+{
+#ifdef __linux__
+    if (session.fd == -1)
+        return;
+
+    {
+        const std::scoped_lock lock(session.lock);
+        session.is_closed = true;
+        session.output.clear();
+    }
+    session.writing.clear();
+
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, session.fd, nullptr);
+    ::close(session.fd);
+    const auto it = m_sessions.find(session.fd);
+    session.fd = -1;
+    if (it != m_sessions.end()) {
+        m_closed_sessions.push_back(std::move(it->second));
+        m_sessions.erase(it);
+    }
+#endif
+}
+
+void Server::reap_closed_sessions()
+{
+    std::erase_if(m_closed_sessions, [](const auto &session) { return session->is_disposable(); });
+}
+}
@@ -0,0 +1,555 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <tuple>
+#ifdef __unix__
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <MTFind2/Messages/SearchCountMessage.h>
+#include <MTFind2/Messages/SearchFinishedMessage.h>
+#include <MTFind2/Messages/ServiceOverloadedMessage.h>
+#include <MTFind2/Search/RemoteContentSource.h>
+#include <MTFind2/Search/SearchService.h>
+#include <MTFind2/Server/Protocol.h>
+#include <MTFind2/Server/ShardCoordinator.h>
+
+using namespace std::chrono_literals;
+
+namespace mtfind2 {
+/**
+ * Connection to a worker. Each connection gets a new generation number, so
+ * that losing it only fails the requests that were actually sent through it.
+ */
+struct ShardCoordinator::Link final : NonCopyable {
+    Link(std::string address, size_t worker_index, Client::SubscriptionType subscription_type)
+        : address(std::move(address))
+        , worker_index(worker_index)
+        , subscription_type(subscription_type)
+    {
+    }
+
+    const std::string address;
+    const size_t worker_index;
+    const Client::SubscriptionType subscription_type;
+
+    /**
+     * Held while (re)connecting and while sending.
+     */
+    std::mutex lock;
+    int fd = -1;
+    uint64_t generation = 0;
+    std::thread reader;
+};
+
+struct ShardCoordinator::PendingRequest final : NonCopyable {
+    struct Result {
+        std::string source_path;
+        uint32_t line;
+        uint32_t column;
+        uint64_t offset;
+        uint32_t length;
+        std::string surrounding_text;
+    };
+
+    PendingRequest(Client &client, const SearchRequest &search_request, size_t worker_count)
+        : client(client)
+        , search_request(search_request)
+        , generations(worker_count, 0)
+        , is_done(worker_count, false)
+        , waiting_count(worker_count)
+        , started_time(std::chrono::steady_clock::now())
+    {
+    }
+
+    Client &client;
+    const SearchRequest &search_request;
+
+    std::mutex lock;
+
+    /**
+     * Generation of the connection the request was sent through, per worker.
+     */
+    std::vector<uint64_t> generations;
+    std::vector<bool> is_done;
+    size_t waiting_count;
+
+    /**
+     * When the request was sent out to the workers. Queueing happens there,
+     * so as far as the coordinator knows it starts right away.
+     */
+    const std::chrono::steady_clock::time_point started_time;
+
+    std::vector<Result> results;
+    uint64_t occurrence_count = 0;
+    bool is_count_only = false;
+    bool is_overloaded = false;
+    std::chrono::milliseconds retry_after { 0 };
+
+    /**
+     * Whether a worker may still send anything about this request through the
+     * given connection.
+     */
+    bool is_waiting_for(size_t worker_index, uint64_t generation) const
+    {
+        return !is_done[worker_index] && generations[worker_index] == generation;
+    }
+
+    /**
+     * @return Whether no worker is left to answer
+     */
+    bool mark_done(size_t worker_index)
+    {
+        if (is_done[worker_index])
+            return false;
+        is_done[worker_index] = true;
+        return --waiting_count == 0;
+    }
+};
+
+ShardCoordinator::ShardCoordinator(std::vector<std::string> worker_addresses, TextHelper::FoldMode fold_mode, size_t delivery_thread_count, std::string coordinator_key,
+    std::chrono::milliseconds request_timeout)
+    : m_fold_mode(fold_mode)
+    , m_delivery_thread_count(std::max<size_t>(delivery_thread_count, 1))
+    , m_coordinator_key(std::move(coordinator_key))
+    , m_request_timeout(request_timeout)
+    , m_keep_running(false)
+    , m_worker_count(worker_addresses.size())
+{
+    for (size_t i = 0; i < worker_addresses.size(); i++) {
+        m_links.push_back(std::make_unique<Link>(worker_addresses[i], i, Client::SubscriptionType::Standard));
+        m_links.push_back(std::make_unique<Link>(worker_addresses[i], i, Client::SubscriptionType::Premium));
+    }
+}
+
+ShardCoordinator::~ShardCoordinator()
+{
+    stop();
+}
+
+void ShardCoordinator::start()
+{
+    if (m_keep_running)
+        return;
+
+    m_keep_running = true;
+    m_is_delivering = true;
+    for (auto &link : m_links) {
+        const std::scoped_lock lock(link->lock);
+        connect(*link);
+    }
+
+    // Delivery threads also give up on workers that take too long, checking
+    // a few times per timeout
+    const auto expiry_interval = std::clamp<std::chrono::steady_clock::duration>(m_request_timeout / 4, 1ms, 1s);
+    m_next_expiry_time = std::chrono::steady_clock::now() + expiry_interval;
+    for (size_t i = 0; i < m_delivery_thread_count; i++) {
+        m_delivery_threads.emplace_back([this, expiry_interval] {
+            for (;;) {
+                std::shared_ptr<PendingRequest> pending_request;
+                {
+                    std::unique_lock lock(m_completed_lock);
+                    m_completed_condition.wait_for(lock, expiry_interval, [this] { return !m_completed.empty() || !m_is_delivering; });
+                    if (m_completed.empty() && !m_is_delivering)
+                        return;
+                    if (!m_completed.empty()) {
+                        pending_request = std::move(m_completed.front());
+                        m_completed.pop_front();
+                    }
+                }
+                if (pending_request)
+                    deliver(*pending_request);
+
+                const auto now = std::chrono::steady_clock::now();
+                auto next_expiry_time = m_next_expiry_time.load();
+                if (now >= next_expiry_time && m_next_expiry_time.compare_exchange_strong(next_expiry_time, now + expiry_interval))
+                    expire(now);
+            }
+        });
+    }
+}
+
+void ShardCoordinator::stop()
+{
+    m_keep_running = false;
+
+#ifdef __unix__
+    // Requests still waiting for a worker are failed, and delivered below
+    for (auto &link : m_links) {
+        std::thread reader;
+        {
+            const std::scoped_lock lock(link->lock);
+            if (link->fd != -1)
+                shutdown(link->fd, SHUT_RDWR);
+            reader = std::move(link->reader);
+        }
+        if (reader.joinable())
+            reader.join();
+    }
+#endif
+
+    {
+        const std::scoped_lock lock(m_completed_lock);
+        m_is_delivering = false;
+    }
+    m_completed_condition.notify_all();
+    for (auto &thread : m_delivery_threads)
+        thread.join();
+    m_delivery_threads.clear();
+}
+
+void ShardCoordinator::query(Client &client, const SearchRequest &search_request)
+{
+    m_request_count++;
+    const uint32_t tag = m_last_tag++;
+    const auto pending_request = std::make_shared<PendingRequest>(client, search_request, m_worker_count);
+    {
+        const std::scoped_lock lock(m_pending_lock);
+        m_pending.emplace(tag, pending_request);
+    }
+
+    const auto frame = Protocol::Writer(Protocol::FrameType::Query).put(tag).put_rest(search_request.query()).finish();
+    for (size_t worker_index = 0; worker_index < m_worker_count; worker_index++) {
+        if (send(link(worker_index, client.subscription_type()), tag, frame))
+            continue;
+
+        // Nothing was sent, so nothing will come back
+        m_failure_count++;
+        bool is_complete;
+        {
+            const std::scoped_lock lock(pending_request->lock);
+            pending_request->is_overloaded = true;
+            pending_request->retry_after = std::max<std::chrono::milliseconds>(pending_request->retry_after, 1s);
+            is_complete = pending_request->mark_done(worker_index);
+        }
+        if (is_complete)
+            complete(tag);
+    }
+}
+
+void ShardCoordinator::print_statistics(std::ostream &stream) const
+{
+    stream << "coordinator: " << m_request_count << " request(s) over " << m_worker_count << " worker(s), "
+           << m_result_count << " result(s) merged, " << m_failure_count << " worker failure(s)" << std::endl;
+}
+
+ShardCoordinator::Link &ShardCoordinator::link(size_t worker_index, Client::SubscriptionType subscription_type)
+{
+    return *m_links[2 * worker_index + (subscription_type == Client::SubscriptionType::Premium ? 1 : 0)];
+}
+
+bool ShardCoordinator::connect(Link &link)
+{
+#ifdef __unix__
+    if (link.fd != -1)
+        return true;
+
+    // The previous reader is done with its connection by now
+    if (link.reader.joinable())
+        link.reader.join();
+
+    int fd = -1;
+    const auto colon = link.address.rfind(':');
+    if (colon != std::string::npos && link.address.find('/') == std::string::npos) {
+        const std::string host = link.address.substr(0, colon), port = link.address.substr(colon + 1);
+        addrinfo hints {}, *addresses = nullptr;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) == 0) {
+            for (auto *address = addresses; address && fd == -1; address = address->ai_next) {
+                fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+                if (fd != -1 && ::connect(fd, address->ai_addr, address->ai_addrlen) == -1) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(addresses);
+        }
+    } else if (link.address.size() < sizeof(sockaddr_un::sun_path)) {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        link.address.copy(address.sun_path, sizeof address.sun_path - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof address) == -1) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd == -1) {
+        std::cerr << "coordinator: could not connect to worker " << link.address << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const auto hello = Protocol::Writer(Protocol::FrameType::Hello)
+                           .put(static_cast<uint8_t>(link.subscription_type == Client::SubscriptionType::Premium ? 1 : 0))
+                           .put(Protocol::IsCoordinator)
+                           .put_rest(m_coordinator_key)
+                           .finish();
+    if (::send(fd, hello.data(), hello.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(hello.size())) {
+        ::close(fd);
+        return false;
+    }
+
+    link.fd = fd;
+    link.generation++;
+    link.reader = std::thread(&ShardCoordinator::read, this, std::ref(link), fd, link.generation);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ShardCoordinator::send(Link &link, uint32_t tag, const std::string &frame)
+{
+#ifdef __unix__
+    const std::scoped_lock lock(link.lock);
+    if (!m_keep_running || !connect(link))
+        return false;
+
+    {
+        const std::scoped_lock pending_lock(m_pending_lock);
+        const auto &pending_request = m_pending.at(tag);
+        const std::scoped_lock request_lock(pending_request->lock);
+        pending_request->generations[link.worker_index] = link.generation;
+    }
+
+    for (size_t offset = 0; offset < frame.size();) {
+        const ssize_t length = ::send(link.fd, frame.data() + offset, frame.size() - offset, MSG_NOSIGNAL);
+        if (length == -1 && errno == EINTR)
+            continue;
+        if (length <= 0) {
+            // The reader fails every request sent through this connection, this one included
+            shutdown(link.fd, SHUT_RDWR);
+            break;
+        }
+        offset += length;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ShardCoordinator::read(Link &link, int fd, uint64_t generation)
+{
+#ifdef __unix__
+    std::string input;
+    char buffer[64 << 10];
+    try {
+        for (;;) {
+            const ssize_t length = recv(fd, buffer, sizeof buffer, 0);
+            if (length == -1 && errno == EINTR)
+                continue;
+            if (length <= 0)
+                break;
+            input.append(buffer, length);
+
+            std::string_view frames(input);
+            while (const auto payload = Protocol::next_frame(frames)) {
+                Protocol::Reader reader(*payload);
+                const auto type = reader.type();
+                if (type == Protocol::FrameType::Credit)
+                    continue;
+                if (type == Protocol::FrameType::Error)
+                    throw std::runtime_error(std::string(reader.get_rest()));
+
+                const uint32_t tag = reader.get<uint32_t>();
+                std::shared_ptr<PendingRequest> pending_request;
+                {
+                    const std::scoped_lock lock(m_pending_lock);
+                    const auto it = m_pending.find(tag);
+                    if (it == m_pending.end())
+                        continue;
+                    pending_request = it->second;
+                }
+
+                bool is_complete = false;
+                {
+                    const std::scoped_lock lock(pending_request->lock);
+                    if (!pending_request->is_waiting_for(link.worker_index, generation))
+                        continue;
+
+                    switch (type) {
+                    case Protocol::FrameType::Result: {
+                        PendingRequest::Result result;
+                        result.line = reader.get<uint32_t>();
+                        result.column = reader.get<uint32_t>();
+                        result.offset = reader.get<uint64_t>();
+                        result.length = reader.get<uint32_t>();
+                        reader.get<uint8_t>(); // The last result of each source is worked out again once merged
+                        result.source_path = reader.get_string16();
+                        result.surrounding_text = reader.get_rest();
+                        pending_request->results.push_back(std::move(result));
+                        break;
+                    }
+                    case Protocol::FrameType::Count:
+                        pending_request->is_count_only = true;
+                        pending_request->occurrence_count += reader.get<uint64_t>();
+                        break;
+                    case Protocol::FrameType::Overloaded:
+                        pending_request->is_overloaded = true;
+                        pending_request->retry_after = std::max<std::chrono::milliseconds>(pending_request->retry_after, std::chrono::milliseconds(reader.get<uint32_t>()));
+                        break;
+                    case Protocol::FrameType::Done:
+                        is_complete = pending_request->mark_done(link.worker_index);
+                        break;
+                    default:
+                        throw std::runtime_error("unexpected frame type");
+                    }
+                }
+                if (is_complete)
+                    complete(tag);
+            }
+            input.erase(0, input.size() - frames.size());
+        }
+    } catch (const std::exception &exception) {
+        std::cerr << "coordinator: worker " << link.address << ": " << exception.what() << std::endl;
+    }
+
+    {
+        const std::scoped_lock lock(link.lock);
+        ::close(fd);
+        link.fd = -1;
+    }
+    fail(link.worker_index, generation, link.subscription_type);
+#endif
+}
+
+void ShardCoordinator::fail(size_t worker_index, uint64_t generation, Client::SubscriptionType subscription_type)
+{
+    std::vector<uint32_t> complete_tags;
+    {
+        const std::scoped_lock lock(m_pending_lock);
+        for (const auto &[tag, pending_request] : m_pending) {
+            if (pending_request->client.subscription_type() != subscription_type)
+                continue;
+
+            const std::scoped_lock request_lock(pending_request->lock);
+            if (!pending_request->is_waiting_for(worker_index, generation))
+                continue;
+
+            m_failure_count++;
+            pending_request->is_overloaded = true;
+            pending_request->retry_after = std::max<std::chrono::milliseconds>(pending_request->retry_after, 1s);
+            if (pending_request->mark_done(worker_index))
+                complete_tags.push_back(tag);
+        }
+    }
+
+    for (const auto tag : complete_tags)
+        complete(tag);
+}
+
+void ShardCoordinator::expire(std::chrono::steady_clock::time_point now)
+{
+    std::vector<uint32_t> complete_tags;
+    {
+        const std::scoped_lock lock(m_pending_lock);
+        for (const auto &[tag, pending_request] : m_pending) {
+            if (now - pending_request->started_time < m_request_timeout)
+                continue;
+
+            // As if every worker still silent had failed
+            const std::scoped_lock request_lock(pending_request->lock);
+            pending_request->is_overloaded = true;
+            pending_request->retry_after = std::max<std::chrono::milliseconds>(pending_request->retry_after, 1s);
+            for (size_t worker_index = 0; worker_index < m_worker_count; worker_index++) {
+                if (pending_request->is_done[worker_index])
+                    continue;
+                m_failure_count++;
+                if (pending_request->mark_done(worker_index))
+                    complete_tags.push_back(tag);
+            }
+        }
+    }
+
+    for (const auto tag : complete_tags)
+        complete(tag);
+}
+
+void ShardCoordinator::complete(uint32_t tag)
+{
+    std::shared_ptr<PendingRequest> pending_request;
+    {
+        const std::scoped_lock lock(m_pending_lock);
+        const auto it = m_pending.find(tag);
+        if (it == m_pending.end())
+            return;
+        pending_request = std::move(it->second);
+        m_pending.erase(it);
+    }
+
+    {
+        const std::scoped_lock lock(m_completed_lock);
+        m_completed.push_back(std::move(pending_request));
+    }
+    m_completed_condition.notify_one();
+}
+
+void ShardCoordinator::deliver(PendingRequest &pending_request)
+{
+    auto &client = pending_request.client;
+    const auto &search_request = pending_request.search_request;
+
+    // Answer as the least capable worker did, partial results would be misleading
+    if (pending_request.is_overloaded) {
+        client.push_message(ServiceOverloadedMessage(search_request, pending_request.retry_after));
+    } else if (pending_request.is_count_only) {
+        client.push_message(SearchCountMessage(search_request, pending_request.occurrence_count + pending_request.results.size()));
+    } else {
+        auto &results = pending_request.results;
+        std::sort(results.begin(), results.end(), [](const auto &a, const auto &b) {
+            return std::tie(a.source_path, a.line, a.column) < std::tie(b.source_path, b.line, b.column);
+        });
+        m_result_count += results.size();
+
+        for (size_t first = 0; first < results.size();) {
+            size_t last = first;
+            std::unordered_map<uint64_t, std::string> surrounding_texts;
+            for (; last < results.size() && results[last].source_path == results[first].source_path; last++)
+                surrounding_texts.emplace(results[last].offset, std::move(results[last].surrounding_text));
+            const auto content_source = std::make_shared<const RemoteContentSource>(results[first].source_path, m_fold_mode, std::move(surrounding_texts));
+
+            bool is_charged = true;
+            for (size_t i = first; i < last && is_charged; i++) {
+                const SearchResult search_result {
+                    .source_id = content_source->id(),
+                    .offset = results[i].offset,
+                    .line = results[i].line,
+                    .column = results[i].column,
+                    .length = results[i].length,
+                    .is_final_result = i + 1 == last,
+                    .timestamp = std::chrono::steady_clock::now()
+                };
+                is_charged = SearchService::deliver(client, search_request, *content_source, search_result);
+            }
+            if (!is_charged)
+                break;
+            first = last;
+        }
+    }
+
+    client.push_message(SearchFinishedMessage(search_request, pending_request.is_overloaded ? std::chrono::steady_clock::time_point() : pending_request.started_time));
+}
+}
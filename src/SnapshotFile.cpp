@@ -0,0 +1,279 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <MTFind2/Storage/SnapshotFile.h>
+#include <Shared/Checksum.h>
+
+namespace mtfind2 {
+#pragma region SnapshotWriter
+
+size_t SnapshotWriter::add_content_source(std::shared_ptr<const MemoryContentSource> content_source)
+{
+    if (content_source->fold_mode() != m_fold_mode)
+        throw std::runtime_error(content_source->tag() + " was folded using a different mode than the snapshot");
+
+    m_entries.push_back({ std::move(content_source), {} });
+    return m_entries.size() - 1;
+}
+
+void SnapshotWriter::add_index(size_t source_index, SnapshotFormat::SectionKind kind, std::string data)
+{
+    m_entries.at(source_index).indexes.emplace_back(kind, std::move(data));
+}
+
+template<typename T>
+static std::string_view bytes_of(std::span<const T> span)
+{
+    return { reinterpret_cast<const char *>(span.data()), span.size_bytes() };
+}
+
+template<typename T>
+static std::string_view bytes_of(const T &value)
+{
+    return { reinterpret_cast<const char *>(&value), sizeof value };
+}
+
+void SnapshotWriter::write(const std::string &file_path) const
+{
+    const std::string temporary_path = file_path + ".tmp";
+    std::ofstream stream(temporary_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream)
+        throw std::runtime_error("Could not create '" + temporary_path + "'");
+
+    uint64_t offset = 0;
+    const auto append = [&](std::string_view data) {
+        stream.write(data.data(), data.size());
+        offset += data.size();
+    };
+    const auto align = [&] {
+        static constexpr char k_padding[SnapshotFormat::Alignment] = {};
+        append(std::string_view(k_padding, (SnapshotFormat::Alignment - offset % SnapshotFormat::Alignment) % SnapshotFormat::Alignment));
+    };
+
+    // The header is written last, once every offset is known
+    SnapshotFormat::Header header {};
+    append(bytes_of(header));
+
+    std::vector<SnapshotFormat::SourceEntry> source_entries;
+    std::vector<SnapshotFormat::Section> sections;
+    std::string strings;
+    for (const auto &entry : m_entries) {
+        const auto &layout = entry.content_source->layout();
+        source_entries.push_back({ strings.size(), entry.content_source->file_path().size(), sections.size(), 0 });
+        strings += entry.content_source->file_path();
+
+        const auto add_section = [&](SnapshotFormat::SectionKind kind, std::string_view data) {
+            align();
+            sections.push_back({ static_cast<uint32_t>(kind), Checksum::crc32c(data), offset, data.size() });
+            append(data);
+            source_entries.back().section_count++;
+        };
+
+        add_section(SnapshotFormat::SectionKind::Text, layout.text);
+        add_section(SnapshotFormat::SectionKind::FoldedText, layout.folded_text);
+        add_section(SnapshotFormat::SectionKind::Anchors, bytes_of(layout.anchors));
+        add_section(SnapshotFormat::SectionKind::LineOffsets, bytes_of(layout.line_offsets));
+        add_section(SnapshotFormat::SectionKind::FoldedLineOffsets, bytes_of(layout.folded_line_offsets));
+        for (const auto &[kind, data] : entry.indexes)
+            add_section(kind, data);
+    }
+
+    align();
+    header.sources_offset = offset;
+    header.source_count = source_entries.size();
+    append(bytes_of(std::span<const SnapshotFormat::SourceEntry>(source_entries)));
+    header.sections_offset = offset;
+    header.section_count = sections.size();
+    append(bytes_of(std::span<const SnapshotFormat::Section>(sections)));
+    header.strings_offset = offset;
+    header.strings_size = strings.size();
+    append(strings);
+    header.file_size = offset;
+
+    std::memcpy(header.magic, SnapshotFormat::Magic, sizeof header.magic);
+    header.version = SnapshotFormat::Version;
+    header.fold_mode = static_cast<uint32_t>(m_fold_mode);
+    uint32_t directory_checksum = Checksum::crc32c(bytes_of(std::span<const SnapshotFormat::SourceEntry>(source_entries)));
+    directory_checksum = Checksum::crc32c(bytes_of(std::span<const SnapshotFormat::Section>(sections)), directory_checksum);
+    header.directory_checksum = Checksum::crc32c(strings, directory_checksum);
+    header.header_checksum = Checksum::crc32c(bytes_of(header));
+
+    stream.seekp(0);
+    stream.write(reinterpret_cast<const char *>(&header), sizeof header);
+    stream.close();
+    if (!stream)
+        throw std::runtime_error("Could not write '" + temporary_path + "'");
+
+    std::filesystem::rename(temporary_path, file_path);
+}
+
+#pragma endregion
+
+#pragma region SnapshotFile
+
+std::shared_ptr<const SnapshotFile> SnapshotFile::open(const std::string &file_path)
+{
+    return std::shared_ptr<const SnapshotFile>(new SnapshotFile(file_path, MappedFile::open(file_path)));
+}
+
+SnapshotFile::SnapshotFile(std::string file_path, std::shared_ptr<const MappedFile> mapped_file)
+    : m_file_path(std::move(file_path))
+    , m_mapped_file(std::move(mapped_file))
+{
+    const auto fail = [this](const std::string &reason) {
+        throw std::runtime_error("'" + m_file_path + "' is not a valid snapshot: " + reason);
+    };
+
+    if (m_mapped_file->size() < sizeof(SnapshotFormat::Header))
+        fail("file is too small");
+
+    auto header = this->header();
+    if (std::memcmp(header.magic, SnapshotFormat::Magic, sizeof header.magic) != 0)
+        fail("bad magic");
+    if (header.version != SnapshotFormat::Version)
+        fail("unsupported version " + std::to_string(header.version));
+
+    const uint32_t header_checksum = header.header_checksum;
+    header.header_checksum = 0;
+    if (Checksum::crc32c(bytes_of(header)) != header_checksum)
+        fail("header checksum mismatch");
+    if (header.file_size != m_mapped_file->size())
+        fail("file is truncated");
+
+    const auto in_bounds = [&](uint64_t offset, uint64_t count, uint64_t size) {
+        return count <= m_mapped_file->size() / std::max<uint64_t>(size, 1) && offset <= m_mapped_file->size() - count * size;
+    };
+    if (!in_bounds(header.sources_offset, header.source_count, sizeof(SnapshotFormat::SourceEntry))
+        || !in_bounds(header.sections_offset, header.section_count, sizeof(SnapshotFormat::Section))
+        || !in_bounds(header.strings_offset, header.strings_size, 1))
+        fail("directory out of bounds");
+    if (header.sources_offset % alignof(SnapshotFormat::SourceEntry) != 0 || header.sections_offset % alignof(SnapshotFormat::Section) != 0)
+        fail("misaligned directory");
+
+    uint32_t directory_checksum = Checksum::crc32c(m_mapped_file->view(header.sources_offset, header.source_count * sizeof(SnapshotFormat::SourceEntry)));
+    directory_checksum = Checksum::crc32c(m_mapped_file->view(header.sections_offset, header.section_count * sizeof(SnapshotFormat::Section)), directory_checksum);
+    if (Checksum::crc32c(m_mapped_file->view(header.strings_offset, header.strings_size), directory_checksum) != header.directory_checksum)
+        fail("directory checksum mismatch");
+
+    for (size_t source_index = 0; source_index < header.source_count; source_index++) {
+        const auto &entry = source_entry(source_index);
+        if (entry.path_offset > header.strings_size || entry.path_length > header.strings_size - entry.path_offset
+            || entry.first_section > header.section_count || entry.section_count > header.section_count - entry.first_section)
+            fail("source entry out of bounds");
+
+        for (size_t i = 0; i < entry.section_count; i++) {
+            const auto &section = section_at(entry.first_section + i);
+            if (!in_bounds(section.offset, section.length, 1) || section.offset % SnapshotFormat::Alignment != 0)
+                fail("section out of bounds");
+        }
+    }
+}
+
+const SnapshotFormat::SourceEntry &SnapshotFile::source_entry(size_t source_index) const
+{
+    return reinterpret_cast<const SnapshotFormat::SourceEntry *>(m_mapped_file->data() + header().sources_offset)[source_index];
+}
+
+const SnapshotFormat::Section &SnapshotFile::section_at(size_t section_index) const
+{
+    return reinterpret_cast<const SnapshotFormat::Section *>(m_mapped_file->data() + header().sections_offset)[section_index];
+}
+
+std::string_view SnapshotFile::source_path(size_t source_index) const
+{
+    const auto &entry = source_entry(source_index);
+    return m_mapped_file->view(header().strings_offset + entry.path_offset, entry.path_length);
+}
+
+std::optional<std::string_view> SnapshotFile::section(size_t source_index, SnapshotFormat::SectionKind kind) const
+{
+    const auto &entry = source_entry(source_index);
+    for (size_t i = 0; i < entry.section_count; i++) {
+        const auto &section = section_at(entry.first_section + i);
+        if (section.kind == static_cast<uint32_t>(kind))
+            return m_mapped_file->view(section.offset, section.length);
+    }
+    return std::nullopt;
+}
+
+bool SnapshotFile::validate(size_t source_index) const
+{
+    const auto &entry = source_entry(source_index);
+    for (size_t i = 0; i < entry.section_count; i++) {
+        const auto &section = section_at(entry.first_section + i);
+        if (Checksum::crc32c(m_mapped_file->view(section.offset, section.length)) != section.checksum)
+            return false;
+    }
+    return true;
+}
+
+template<typename T>
+static std::span<const T> as_span(std::string_view data)
+{
+    return { reinterpret_cast<const T *>(data.data()), data.size() / sizeof(T) };
+}
+
+std::shared_ptr<const MemoryContentSource> SnapshotFile::content_source(size_t source_index) const
+{
+    const auto required_section = [&](SnapshotFormat::SectionKind kind) {
+        const auto data = section(source_index, kind);
+        if (!data)
+            throw std::runtime_error("'" + m_file_path + "' is not a valid snapshot: missing section " + std::to_string(static_cast<uint32_t>(kind)));
+        return *data;
+    };
+
+    const MemoryContentSource::Layout layout {
+        .text = required_section(SnapshotFormat::SectionKind::Text),
+        .folded_text = required_section(SnapshotFormat::SectionKind::FoldedText),
+        .anchors = as_span<OffsetMap::Anchor>(required_section(SnapshotFormat::SectionKind::Anchors)),
+        .line_offsets = as_span<uint64_t>(required_section(SnapshotFormat::SectionKind::LineOffsets)),
+        .folded_line_offsets = as_span<uint64_t>(required_section(SnapshotFormat::SectionKind::FoldedLineOffsets))
+    };
+    if (layout.line_offsets.empty() || layout.line_offsets.size() != layout.folded_line_offsets.size())
+        throw std::runtime_error("'" + m_file_path + "' is not a valid snapshot: inconsistent line offsets");
+
+    auto self = shared_from_this();
+    auto content_source = std::make_shared<const MemoryContentSource>(std::string(source_path(source_index)), fold_mode(), layout, self,
+        [self, source_index] { return self->validate(source_index); });
+
+    if (const auto occurrence_index = section(source_index, SnapshotFormat::SectionKind::OccurrenceIndex)) {
+        try {
+            content_source->set_occurrence_index(OccurrenceIndex::open(*occurrence_index, self));
+        } catch (const std::runtime_error &exception) {
+            std::cerr << content_source->tag() << ": " << exception.what() << ", ignoring index" << std::endl;
+        }
+    }
+    return content_source;
+}
+
+std::vector<std::shared_ptr<const ContentSource>> SnapshotFile::content_sources() const
+{
+    std::vector<std::shared_ptr<const ContentSource>> content_sources;
+    for (size_t source_index = 0; source_index < source_count(); source_index++)
+        content_sources.push_back(content_source(source_index));
+    return content_sources;
+}
+
+#pragma endregion
+}
@@ -0,0 +1,220 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <MTFind2/Search/StreamingContentSource.h>
+#include <Shared/ChunkReader.h>
+
+namespace mtfind2 {
+StreamingContentSource::StreamingContentSource(std::string file_path, TextHelper::FoldMode fold_mode, size_t chunk_size)
+    : ContentSource(std::move(file_path), fold_mode)
+    , m_fd(::open(this->file_path().c_str(), O_RDONLY | O_CLOEXEC))
+    , m_size(0)
+    , m_chunk_size(chunk_size)
+    , m_line_count(0)
+{
+    struct stat status;
+    if (m_fd == -1 || fstat(m_fd, &status) == -1) {
+        if (m_fd != -1)
+            close(m_fd);
+        throw std::runtime_error("Could not open '" + this->file_path() + "': " + std::strerror(errno));
+    }
+
+    m_size = status.st_size;
+    build_checkpoints();
+    std::cout << tag() << ": " << m_line_count << " line(s) indexed for streaming (" << m_checkpoints.size() << " checkpoint(s))" << std::endl;
+}
+
+StreamingContentSource::~StreamingContentSource()
+{
+    close(m_fd);
+}
+
+void StreamingContentSource::build_checkpoints()
+{
+    ChunkReader reader(m_fd, 0, m_size, m_chunk_size);
+    m_checkpoints = { { 0, 1 } };
+
+    uint64_t chunk_offset = 0;
+    size_t line = 1;
+    bool ends_with_newline = true;
+    for (ChunkReader::Chunk chunk; reader.next(chunk); chunk_offset += chunk.length) {
+        for (const char *pos = chunk.data, *end = chunk.data + chunk.length;
+             (pos = static_cast<const char *>(std::memchr(pos, '\n', end - pos))) != nullptr;) {
+            const uint64_t line_offset = chunk_offset + (++pos - chunk.data);
+            line++;
+            if (line_offset - m_checkpoints.back().offset >= CheckpointInterval)
+                m_checkpoints.push_back({ line_offset, line });
+        }
+        ends_with_newline = chunk.data[chunk.length - 1] == '\n';
+    }
+
+    // Just like std::getline(), don't count an empty trailing line
+    m_line_count = ends_with_newline ? line - 1 : line;
+}
+
+std::tuple<size_t, uint64_t> StreamingContentSource::locate_line(uint64_t offset) const
+{
+    const auto checkpoint = *std::prev(std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), offset,
+        [](uint64_t offset, const Checkpoint &checkpoint) { return offset < checkpoint.offset; }));
+
+    size_t line = checkpoint.line;
+    uint64_t line_offset = checkpoint.offset;
+    char buffer[64 << 10];
+    for (uint64_t pos = checkpoint.offset; pos < offset;) {
+        const ssize_t count = pread(m_fd, buffer, std::min<uint64_t>(sizeof buffer, offset - pos), pos);
+        if (count <= 0)
+            break;
+
+        for (ssize_t i = 0; i < count; i++) {
+            if (buffer[i] == '\n') {
+                line++;
+                line_offset = pos + i + 1;
+            }
+        }
+        pos += count;
+    }
+
+    return { line, line_offset };
+}
+
+std::string StreamingContentSource::surrounding_text(uint64_t offset, size_t length, TextHelper::ContextWidth width) const
+{
+    // Read just enough around the occurrence, the rest of the line is not needed
+    const uint64_t margin = width.unit == TextHelper::ContextWidth::Unit::Bytes
+        ? std::min<uint64_t>(width.count + 4, MaxContextSize)
+        : MaxContextSize;
+    const uint64_t start = offset - std::min(offset, margin);
+    const uint64_t end = std::min(m_size, offset + length + margin);
+
+    std::string window(end - start, '\0');
+    const ssize_t count = pread(m_fd, window.data(), window.size(), start);
+    if (count < 0 || static_cast<uint64_t>(count) < offset + length - start)
+        return {};
+
+    window.resize(count);
+    return std::string(TextHelper::get_surrounding_text(window, offset - start, offset - start + length, width));
+}
+
+void StreamingContentSource::scan(std::string_view folded_query, const OccurrenceCallback &callback) const
+{
+    if (folded_query.empty())
+        return;
+
+    /**
+     * Folding only ever shrinks text, and never by more than half, so an
+     * occurrence never takes more than this many bytes of the original text.
+     */
+    const size_t max_occurrence_length = 2 * folded_query.length();
+    if (max_occurrence_length + 4 > MaxCarrySize) {
+        std::cerr << tag() << ": query is too long to be streamed" << std::endl;
+        return;
+    }
+
+    // Occurrences are reported one step behind so that we know which is the last
+    std::optional<Occurrence> pending_occurrence;
+
+    ChunkReader reader(m_fd, 0, m_size, m_chunk_size, MaxCarrySize);
+    std::string carry;
+    uint64_t window_offset = 0; // Offset of the first byte of the window
+    size_t line = 1; // Line the last counted position belongs to
+    uint64_t line_offset = 0; // Offset where that line starts
+    uint64_t resume_offset = 0; // Occurrences may not overlap
+
+    for (bool eof = false; !eof;) {
+        std::string_view window;
+        ChunkReader::Chunk chunk;
+        if (reader.next(chunk)) {
+            // Prepend the partial line left over from the previous chunk
+            std::memcpy(chunk.data - carry.size(), carry.data(), carry.size());
+            window = std::string_view(chunk.data - carry.size(), carry.size() + chunk.length);
+        } else if (!carry.empty()) {
+            window = carry;
+            eof = true;
+        } else {
+            break;
+        }
+
+        // Only match up to the last complete line, the rest is carried over
+        size_t cut = window.size();
+        if (!eof) {
+            cut = window.rfind('\n') + 1;
+            if (cut == 0 || window.size() - cut > MaxCarrySize) {
+                cut = window.size() - std::min(window.size(), max_occurrence_length);
+                // Don't split UTF-8 sequences
+                while (cut > 0 && (window[cut] & 0xc0) == 0x80)
+                    cut--;
+            }
+        }
+
+        const auto folded_window = TextHelper::fold(window, fold_mode());
+        size_t counted_pos = 0;
+        const auto count_lines_until = [&](size_t pos) {
+            for (const char *p = window.data() + counted_pos, *end = window.data() + pos;
+                 (p = static_cast<const char *>(std::memchr(p, '\n', end - p))) != nullptr;) {
+                line++;
+                line_offset = window_offset + (++p - window.data());
+            }
+            counted_pos = pos;
+        };
+
+        for (size_t folded_pos = folded_window.text.find(folded_query); folded_pos != std::string::npos;
+             folded_pos = folded_window.text.find(folded_query, folded_pos + folded_query.length())) {
+            const size_t start_pos = folded_window.offsets.to_original(folded_pos);
+            if (start_pos >= cut)
+                break;
+            if (window_offset + start_pos < resume_offset)
+                continue;
+
+            const size_t end_pos = folded_window.offsets.to_original(folded_pos + folded_query.length());
+            count_lines_until(start_pos);
+            if (pending_occurrence && !callback(*pending_occurrence))
+                return;
+
+            resume_offset = window_offset + end_pos;
+            pending_occurrence = Occurrence {
+                .offset = window_offset + start_pos,
+                .line = line,
+                .column = window_offset + start_pos - line_offset + 1,
+                .length = end_pos - start_pos,
+                .is_final = false
+            };
+        }
+
+        count_lines_until(cut);
+        carry.assign(window.substr(cut));
+        window_offset += cut;
+    }
+
+    if (reader.failed())
+        std::cerr << tag() << ": I/O error, search results may be incomplete" << std::endl;
+
+    if (pending_occurrence) {
+        pending_occurrence->is_final = true;
+        callback(*pending_occurrence);
+    }
+}
+}
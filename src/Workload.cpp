@@ -0,0 +1,134 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+
+#include <MTFind2/Client/Workload.h>
+#include <MTFind2/Search/SearchRequest.h>
+#include <Shared/VarInt.h>
+
+namespace mtfind2 {
+/**
+ * Records are written out once this many bytes are buffered.
+ */
+static constexpr size_t FlushThreshold = 64 * 1024;
+
+/**
+ * Maps signed integers to unsigned ones so that small magnitudes stay small
+ * (0, -1, 1, -2... become 0, 1, 2, 3...).
+ */
+static uint64_t zigzag_encode(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+static int32_t zigzag_decode(uint64_t value) { return static_cast<int32_t>(static_cast<uint32_t>(value >> 1) ^ -static_cast<uint32_t>(value & 1)); }
+
+std::vector<CapturedRequest> WorkloadFormat::read(const std::string &file_path)
+{
+    std::ifstream stream(file_path, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("could not open '" + file_path + "'");
+
+    const std::string contents { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+    Header header;
+    if (contents.size() < sizeof(header))
+        throw std::runtime_error("'" + file_path + "' is not a captured workload");
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version)
+        throw std::runtime_error("'" + file_path + "' is not a captured workload, or is from another version");
+
+    std::vector<CapturedRequest> requests;
+    std::string_view input(contents);
+    input.remove_prefix(sizeof(header));
+    std::chrono::microseconds arrival_offset {};
+    try {
+        while (!input.empty()) {
+            CapturedRequest request;
+            arrival_offset += std::chrono::microseconds(VarInt::read(input));
+            request.arrival_offset = arrival_offset;
+            if (input.empty() || (input.front() != 'S' && input.front() != 'P'))
+                throw std::runtime_error("bad subscription type");
+            request.subscription_type = input.front() == 'P' ? Client::SubscriptionType::Premium : Client::SubscriptionType::Standard;
+            input.remove_prefix(1);
+            request.credit = zigzag_decode(VarInt::read(input));
+            const auto query_length = VarInt::read(input);
+            if (query_length > input.size())
+                throw std::runtime_error("truncated query");
+            request.query = input.substr(0, query_length);
+            input.remove_prefix(query_length);
+            requests.push_back(std::move(request));
+        }
+    } catch (const std::runtime_error &error) {
+        throw std::runtime_error("'" + file_path + "' is corrupt after " + std::to_string(requests.size()) + " request(s): " + error.what());
+    }
+    return requests;
+}
+
+WorkloadRecorder::WorkloadRecorder(SearchProvider &search_provider, const std::string &file_path)
+    : m_search_provider(search_provider)
+    , m_stream(file_path, std::ios::binary | std::ios::trunc)
+    , m_start_time(Clock::now())
+{
+    WorkloadFormat::Header header;
+    std::memcpy(header.magic, WorkloadFormat::Magic, sizeof(header.magic));
+    header.version = WorkloadFormat::Version;
+    if (!m_stream.write(reinterpret_cast<const char *>(&header), sizeof(header)))
+        throw std::runtime_error("could not open '" + file_path + "' for writing");
+}
+
+void WorkloadRecorder::query(Client &client, const SearchRequest &search_request)
+{
+    {
+        const std::scoped_lock lock(m_lock);
+        if (m_stream.is_open()) {
+            // Offsets are taken under the lock, so that they never go backwards
+            const auto offset = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_start_time);
+            VarInt::append(m_buffer, (offset - m_last_offset).count());
+            m_buffer.push_back(client.subscription_type() == Client::SubscriptionType::Premium ? 'P' : 'S');
+            VarInt::append(m_buffer, zigzag_encode(client.credit()));
+            VarInt::append(m_buffer, search_request.query().size());
+            m_buffer += search_request.query();
+            m_last_offset = offset;
+            m_request_count++;
+
+            if (m_buffer.size() >= FlushThreshold) {
+                m_stream.write(m_buffer.data(), m_buffer.size());
+                m_buffer.clear();
+            }
+        }
+    }
+
+    m_search_provider.query(client, search_request);
+}
+
+void WorkloadRecorder::close()
+{
+    const std::scoped_lock lock(m_lock);
+    if (!m_stream.is_open())
+        return;
+
+    m_stream.write(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+    m_stream.close();
+}
+
+size_t WorkloadRecorder::request_count() const
+{
+    const std::scoped_lock lock(m_lock);
+    return m_request_count;
+}
+}
@@ -15,16 +15,37 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
+#include <cctype>
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <optional>
 #include <thread>
 #ifdef __unix__
 #include <csignal>
 #endif
 
+#include <MTFind2/Client/LoadGenerator.h>
+#include <MTFind2/Client/Workload.h>
+#include <MTFind2/Payment/PaymentService.h>
+#include <MTFind2/Search/BatchRunner.h>
+#include <MTFind2/Search/CorpusLoader.h>
+#include <MTFind2/Search/CorpusWatcher.h>
+#include <MTFind2/Search/MemoryBudget.h>
+#include <MTFind2/Search/MemoryContentSource.h>
 #include <MTFind2/Search/SearchProxy.h>
+#include <MTFind2/Search/Placement.h>
 #include <MTFind2/Search/SearchService.h>
+#include <MTFind2/Search/Shard.h>
+#include <MTFind2/Server/MetricsExporter.h>
+#include <MTFind2/Server/Server.h>
+#include <MTFind2/Server/ShardCoordinator.h>
+#include <MTFind2/Storage/SnapshotFile.h>
+#include <Shared/ConcurrencyLimit.h>
+#include <Shared/Mailbox.h>
+#include <Shared/PerfCounters.h>
 #include <Shared/TextHelper.h>
+#include <Shared/Tracing.h>
 
 using namespace mtfind2;
 using namespace std::chrono_literals;
@@ -32,6 +53,7 @@ using namespace std::chrono_literals;
 #pragma region Signal handling
 
 static std::atomic<bool> g_keep_running = true;
+static std::atomic<bool> g_write_trace = false;
 
 #ifdef __unix__
 static void signal_handler(int signal_num)
@@ -39,57 +61,683 @@ static void signal_handler(int signal_num)
     if (signal_num == SIGINT) {
         g_keep_running = false;
         std::cout << "received SIGINT" << std::endl;
+    } else if (signal_num == SIGUSR1) {
+        g_write_trace = true;
     }
 }
 #endif // __unix__
 
 #pragma endregion
 
-static void add_sample_content_sources(std::vector<SearchService> &search_services)
+#pragma region Command line
+
+struct Options final {
+    /**
+     * Accent-insensitive search is opt-in, case-insensitive search is always on.
+     * Content sources are loaded into memory unless told otherwise.
+     */
+    ContentSource::Options content_source_options;
+    bool watch_data_directory = true;
+
+    /**
+     * Corpus snapshot to load instead of reading the data directory.
+     */
+    std::string snapshot_path;
+
+    /**
+     * Threads used to load the corpus, zero meaning one per core.
+     */
+    size_t load_thread_count = 0;
+
+    /**
+     * Whether to precompute the occurrences of every dictionary word.
+     */
+    bool index_dictionary = false;
+
+    /**
+     * Admission control settings, shared by the queues of every subscription type.
+     */
+    SearchProxy::QueueOptions queue_options;
+
+    /**
+     * Text displayed around each search result.
+     */
+    TextHelper::ContextWidth context_width;
+
+    /**
+     * Threads handling client and payment messages asynchronously, zero meaning
+     * that messages are handled by whoever sends them.
+     */
+    size_t mailbox_thread_count = 0;
+
+    /**
+     * Where to accept search requests from. Random requests are issued
+     * instead if there is nowhere to listen on.
+     */
+    Server::Options server_options;
+
+    /**
+     * Part of the corpus to load when running as one of several workers.
+     */
+    Shard shard;
+
+    /**
+     * Workers to send search requests to instead of loading the corpus, see
+     * ShardCoordinator.
+     */
+    std::vector<std::string> worker_addresses;
+
+    /**
+     * File holding the key shared by a coordinator and its workers, which
+     * workers need to tell the coordinator apart from clients to be charged.
+     */
+    std::string coordinator_key_path;
+
+    /**
+     * Queries to run in batch mode, "-" meaning stdin, and where to write
+     * their results to. Nothing else is done in batch mode.
+     */
+    std::string batch_input_path;
+    std::string batch_output_path = "-";
+    BatchRunner::Options batch_options;
+
+    /**
+     * Whether random requests are issued at a steady rate by a LoadGenerator
+     * instead of in bursts.
+     */
+    bool generate_load = false;
+    LoadGenerator::Options load_options;
+
+    /**
+     * Where to record incoming search requests to, and a recording to replay
+     * instead of issuing random requests, see WorkloadFormat. Replays run at
+     * the captured pace times the speed, or as fast as possible if zero.
+     */
+    std::string capture_path;
+    std::string replay_path;
+    double replay_speed = 1;
+
+    /**
+     * Where to expose metrics, if anywhere.
+     */
+    MetricsExporter::Options metrics_options;
+
+    /**
+     * Where to write the trace of sampled requests to, nowhere if empty.
+     */
+    std::string trace_path;
+    double trace_sample_rate = 1;
+
+    /**
+     * Whether to count hardware events (cycles, instructions...) of scans.
+     * Outside batch mode, every scan runs on a thread of its own and opens
+     * and closes its counters, which costs a few system calls per scan.
+     */
+    bool use_perf_counters = false;
+
+    /**
+     * Where to run search workers and scans, see Placement.
+     */
+    Placement::Options placement_options;
+
+    /**
+     * Bounds of the number of workers attending requests at once, if it is
+     * to be adapted to their latency rather than be one per core.
+     */
+    std::optional<ConcurrencyLimit::Options> concurrency_options;
+};
+
+static void print_usage(const char *program_name)
 {
-    for (const auto &entry : std::filesystem::directory_iterator("data")) {
-        if (entry.is_regular_file() && entry.path().extension() == ".txt") {
-            const auto *content_source = new ContentSource(entry.path().string());
-            for (auto &search_service : search_services)
-                search_service.add_content_source(*content_source);
+    std::cerr << "usage: " << program_name << " [-a|--ignore-accents] [--no-watch] [--stream-larger-than BYTES] [--compress] [--memory-budget BYTES] [--snapshot FILE] [--load-threads N] [--context N[w|b]] [--index] [--mailboxes N] [--listen-unix PATH] [--listen-tcp PORT]"
+              << " [--shard K/N] [--workers ADDRESS[,ADDRESS...]] [--coordinator-key FILE] [--batch FILE|- [--output FILE] [--format tsv|binary]]"
+              << " [--load QPS [--arrivals poisson|constant] [--zipf S] [--premium-ratio F] [--duration SECONDS] [--seed N]]"
+              << " [--capture FILE] [--replay FILE [--replay-speed FACTOR|max]]"
+              << " [--metrics-port PORT] [--metrics-file FILE [--metrics-interval SECONDS]] [--trace FILE [--trace-sample FRACTION]] [--perf-counters] [--pin none|compact|scatter [--pin-cache 2|3]]"
+              << " [--adaptive-concurrency [--min-workers N] [--max-workers N]]"
+              << " [--queue-capacity N] [--overload-policy reject|drop-oldest|count-only] [--target-delay MS]" << std::endl;
+}
+
+static bool parse_options(int argc, char *argv[], Options &options)
+try {
+    bool is_shard_worker = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        if (arg == "-a" || arg == "--ignore-accents") {
+            options.content_source_options.fold_mode = TextHelper::FoldMode::CaseAndAccentInsensitive;
+        } else if (arg == "--no-watch") {
+            options.watch_data_directory = false;
+        } else if (arg == "--stream-larger-than" && i + 1 < argc) {
+            options.content_source_options.streaming_threshold = std::stoull(argv[++i]);
+        } else if (arg == "--compress") {
+            options.content_source_options.compress = true;
+        } else if (arg == "--memory-budget" && i + 1 < argc) {
+            options.content_source_options.memory_budget = std::make_shared<MemoryBudget>(std::stoull(argv[++i]));
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            options.snapshot_path = argv[++i];
+        } else if (arg == "--load-threads" && i + 1 < argc) {
+            options.load_thread_count = std::stoul(argv[++i]);
+        } else if (arg == "--queue-capacity" && i + 1 < argc) {
+            options.queue_options.capacity = std::stoul(argv[++i]);
+        } else if (arg == "--overload-policy" && i + 1 < argc) {
+            const std::string_view policy(argv[++i]);
+            if (policy == "reject")
+                options.queue_options.overload_policy = OverloadPolicy::Reject;
+            else if (policy == "drop-oldest")
+                options.queue_options.overload_policy = OverloadPolicy::DropOldest;
+            else if (policy == "count-only")
+                options.queue_options.overload_policy = OverloadPolicy::CountOnly;
+            else
+                return false;
+        } else if (arg == "--target-delay" && i + 1 < argc) {
+            options.queue_options.target_delay = std::chrono::milliseconds(std::stoul(argv[++i]));
+        } else if (arg == "--mailboxes" && i + 1 < argc) {
+            options.mailbox_thread_count = std::stoul(argv[++i]);
+        } else if (arg == "--listen-unix" && i + 1 < argc) {
+            options.server_options.unix_socket_path = argv[++i];
+        } else if (arg == "--listen-tcp" && i + 1 < argc) {
+            const auto port = std::stoul(argv[++i]);
+            if (port == 0 || port > UINT16_MAX)
+                return false;
+            options.server_options.tcp_port = static_cast<uint16_t>(port);
+        } else if (arg == "--shard" && i + 1 < argc) {
+            // Zero-based shard number out of a shard count, e.g. "0/4"
+            const std::string value(argv[++i]);
+            const auto slash = value.find('/');
+            if (slash == std::string::npos)
+                return false;
+            options.shard.index = std::stoul(value.substr(0, slash));
+            options.shard.count = std::stoul(value.substr(slash + 1));
+            if (options.shard.count == 0 || options.shard.index >= options.shard.count)
+                return false;
+            is_shard_worker = true;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            const std::string_view value(argv[++i]);
+            for (size_t start = 0; start <= value.size();) {
+                const auto end = std::min(value.find(',', start), value.size());
+                if (end == start)
+                    return false;
+                options.worker_addresses.emplace_back(value.substr(start, end - start));
+                start = end + 1;
+            }
+        } else if (arg == "--coordinator-key" && i + 1 < argc) {
+            options.coordinator_key_path = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            options.batch_input_path = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.batch_output_path = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            const std::string_view format(argv[++i]);
+            if (format == "tsv")
+                options.batch_options.output_format = BatchRunner::OutputFormat::Tsv;
+            else if (format == "binary")
+                options.batch_options.output_format = BatchRunner::OutputFormat::Binary;
+            else
+                return false;
+        } else if (arg == "--load" && i + 1 < argc) {
+            options.generate_load = true;
+            options.load_options.rate = std::stod(argv[++i]);
+            if (options.load_options.rate <= 0)
+                return false;
+        } else if (arg == "--arrivals" && i + 1 < argc) {
+            const std::string_view arrivals(argv[++i]);
+            if (arrivals == "poisson")
+                options.load_options.arrival_process = LoadGenerator::ArrivalProcess::Poisson;
+            else if (arrivals == "constant")
+                options.load_options.arrival_process = LoadGenerator::ArrivalProcess::Constant;
+            else
+                return false;
+        } else if (arg == "--zipf" && i + 1 < argc) {
+            options.load_options.zipf_exponent = std::stod(argv[++i]);
+        } else if (arg == "--premium-ratio" && i + 1 < argc) {
+            options.load_options.premium_ratio = std::stod(argv[++i]);
+            if (options.load_options.premium_ratio < 0 || options.load_options.premium_ratio > 1)
+                return false;
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.load_options.duration = std::chrono::seconds(std::stoul(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.load_options.seed = std::stoul(argv[++i]);
+        } else if (arg == "--capture" && i + 1 < argc) {
+            options.capture_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            options.replay_path = argv[++i];
+        } else if (arg == "--replay-speed" && i + 1 < argc) {
+            const std::string_view speed(argv[++i]);
+            options.replay_speed = speed == "max" ? 0 : std::stod(std::string(speed));
+            if (options.replay_speed < 0)
+                return false;
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            const auto port = std::stoul(argv[++i]);
+            if (port == 0 || port > UINT16_MAX)
+                return false;
+            options.metrics_options.http_port = static_cast<uint16_t>(port);
+        } else if (arg == "--metrics-file" && i + 1 < argc) {
+            options.metrics_options.dump_path = argv[++i];
+        } else if (arg == "--metrics-interval" && i + 1 < argc) {
+            options.metrics_options.dump_interval = std::chrono::seconds(std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.trace_path = argv[++i];
+        } else if (arg == "--trace-sample" && i + 1 < argc) {
+            options.trace_sample_rate = std::stod(argv[++i]);
+            if (options.trace_sample_rate < 0 || options.trace_sample_rate > 1)
+                return false;
+        } else if (arg == "--perf-counters") {
+            options.use_perf_counters = true;
+        } else if (arg == "--pin" && i + 1 < argc) {
+            const std::string_view policy(argv[++i]);
+            if (policy == "none")
+                options.placement_options.policy = Placement::Policy::None;
+            else if (policy == "compact")
+                options.placement_options.policy = Placement::Policy::Compact;
+            else if (policy == "scatter")
+                options.placement_options.policy = Placement::Policy::Scatter;
+            else
+                return false;
+        } else if (arg == "--adaptive-concurrency" || ((arg == "--min-workers" || arg == "--max-workers") && i + 1 < argc)) {
+            // Up to four workers per core. The limit starts at the minimum, so
+            // that the latency without contention is known early on
+            if (!options.concurrency_options)
+                options.concurrency_options = ConcurrencyLimit::Options { .max_limit = 4 * std::max(1u, std::thread::hardware_concurrency()) };
+            if (arg == "--min-workers")
+                options.concurrency_options->min_limit = std::max(1ul, std::stoul(argv[++i]));
+            else if (arg == "--max-workers")
+                options.concurrency_options->max_limit = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--pin-cache" && i + 1 < argc) {
+            options.placement_options.cache_level = std::stoul(argv[++i]);
+            if (options.placement_options.cache_level != 2 && options.placement_options.cache_level != 3)
+                return false;
+        } else if (arg == "--index") {
+            options.index_dictionary = true;
+        } else if (arg == "--context" && i + 1 < argc) {
+            // Number of words (default) or bytes on each side, e.g. "3w" or "40b"
+            const std::string_view value(argv[++i]);
+            size_t length;
+            options.context_width.count = std::stoul(std::string(value), &length);
+            if (value.substr(length) == "b")
+                options.context_width.unit = TextHelper::ContextWidth::Unit::Bytes;
+            else if (value.substr(length) != "" && value.substr(length) != "w")
+                return false;
+        } else {
+            return false;
         }
     }
+    // Only shard workers and their coordinator have a use for the key, and the
+    // coordinator can't be trusted by its workers without one
+    return options.coordinator_key_path.empty() != (is_shard_worker || !options.worker_addresses.empty());
+} catch (const std::exception &) {
+    // Malformed numeric argument
+    return false;
+}
+
+#pragma endregion
+
+static const std::filesystem::path k_data_directory { "data" };
+
+static void add_snapshot_content_sources(Corpus &corpus, const std::string &snapshot_path, TextHelper::FoldMode fold_mode, const Shard &shard)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto snapshot_file = SnapshotFile::open(snapshot_path);
+    if (snapshot_file->fold_mode() != fold_mode)
+        throw std::runtime_error("'" + snapshot_path + "' was built with a different folding mode, use --ignore-accents consistently");
+
+    auto content_sources = snapshot_file->content_sources();
+    std::erase_if(content_sources, [&shard](const auto &content_source) { return !shard.contains(content_source->file_path()); });
+    corpus.add_content_sources(std::move(content_sources));
+    Dictionary::instance();
+    const auto load_time = std::chrono::steady_clock::now() - start_time;
+    std::clog << "loaded " << snapshot_file->source_count() << " content source(s) from '" << snapshot_path << "' in " << std::chrono::duration<double, std::milli>(load_time).count() << "ms" << std::endl;
+}
+
+static void add_sample_content_sources(Corpus &corpus, const ContentSource::Options &content_source_options, size_t thread_count, const Shard &shard)
+{
+    auto file_paths = CorpusLoader::list_directory(k_data_directory);
+    std::erase_if(file_paths, [&shard](const auto &file_path) { return !shard.contains(file_path); });
+
+    CorpusLoader corpus_loader(content_source_options, thread_count);
+    corpus.add_content_sources(corpus_loader.load(file_paths));
+    corpus_loader.print_report(std::clog);
+}
+
+/**
+ * Builds the occurrence index of every content source in the corpus that
+ * doesn't have one yet. Queries are scanned for as usual in the meantime.
+ * The thread is joined when dropped, so that returning early doesn't leave it
+ * running.
+ */
+static std::jthread start_indexing(const Corpus &corpus, TextHelper::FoldMode fold_mode)
+{
+    // Don't hold the snapshot while indexing, that would stall corpus updates
+    std::vector<std::shared_ptr<const ContentSource>> content_sources = corpus.snapshot()->content_sources();
+
+    return std::jthread([content_sources = std::move(content_sources), fold_mode] {
+        try {
+            const auto start_time = std::chrono::steady_clock::now();
+            const auto &dictionary = Dictionary::instance();
+            const OccurrenceIndexBuilder occurrence_index_builder(dictionary.words(), dictionary.fingerprint(), fold_mode);
+
+            size_t index_count = 0, index_size = 0, text_size = 0;
+            for (const auto &content_source : content_sources) {
+                const auto memory_content_source = std::dynamic_pointer_cast<const MemoryContentSource>(content_source);
+                if (!memory_content_source || memory_content_source->occurrence_index())
+                    continue;
+
+                auto occurrence_index = OccurrenceIndex::open(occurrence_index_builder.build(*memory_content_source));
+                index_count++;
+                index_size += occurrence_index->size();
+                text_size += memory_content_source->text().size();
+                memory_content_source->set_occurrence_index(std::move(occurrence_index));
+            }
+
+            const auto index_time = std::chrono::steady_clock::now() - start_time;
+            std::clog << "indexed " << index_count << " content source(s) in " << std::chrono::duration<double, std::milli>(index_time).count() << "ms ("
+                      << index_size << " bytes of index for " << text_size << " bytes of text)" << std::endl;
+        } catch (const std::exception &exception) {
+            std::cerr << "indexing: " << exception.what() << std::endl;
+        }
+    });
+}
+
+/**
+ * Reads the key shared by a coordinator and its workers from the first line
+ * of a file, so that it doesn't show up in the list of processes.
+ */
+static std::string read_coordinator_key(const std::string &path)
+{
+    std::ifstream file(path);
+    std::string key;
+    if (!file || !std::getline(file, key))
+        throw std::runtime_error("could not read the coordinator key from '" + path + "'");
+    while (!key.empty() && std::isspace(static_cast<unsigned char>(key.back())))
+        key.pop_back();
+    if (key.empty())
+        throw std::runtime_error("'" + path + "' holds an empty coordinator key");
+    return key;
+}
+
+/**
+ * Runs the queries of a file against the corpus and exits.
+ */
+static int run_batch(const Corpus &corpus, const Options &options)
+try {
+    std::ifstream input_file;
+    if (options.batch_input_path != "-") {
+        input_file.open(options.batch_input_path);
+        if (!input_file)
+            throw std::runtime_error("could not open '" + options.batch_input_path + "'");
+    }
+
+    std::ofstream output_file;
+    if (options.batch_output_path != "-") {
+        output_file.open(options.batch_output_path, std::ios::binary | std::ios::trunc);
+        if (!output_file)
+            throw std::runtime_error("could not open '" + options.batch_output_path + "' for writing");
+    } else {
+        std::ios::sync_with_stdio(false);
+    }
+
+    const BatchRunner batch_runner(corpus, options.batch_options);
+    const auto report = batch_runner.run(
+        input_file.is_open() ? input_file : std::cin,
+        output_file.is_open() ? output_file : std::cout);
+    report.print(std::clog);
+    return 0;
+} catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+    return 1;
+}
+
+/**
+ * Writes the trace of the requests sampled so far.
+ */
+static void write_trace(const std::string &trace_path)
+{
+    std::ofstream stream(trace_path, std::ios::trunc);
+    if (!stream) {
+        std::cerr << "could not write trace to '" << trace_path << "'" << std::endl;
+        return;
+    }
+    Tracer::instance().write_chrome_trace(stream);
+    std::clog << "wrote trace to '" << trace_path << "'" << std::endl;
 }
 
 int main(int argc, char *argv[])
 {
 #ifdef __unix__
     signal(SIGINT, signal_handler);
+    signal(SIGUSR1, signal_handler);
 #endif
 
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    Client::set_context_width(options.context_width);
+    if (options.load_options.seed) {
+        Client::set_random_seed(options.load_options.seed);
+        Dictionary::set_random_seed(options.load_options.seed);
+    }
+    if (!options.trace_path.empty())
+        Tracer::instance().enable(options.trace_sample_rate);
+    if (options.use_perf_counters) {
+        try {
+            PerfCounters::enable();
+        } catch (const std::runtime_error &error) {
+            std::cerr << "warning: hardware counters are unavailable (" << error.what() << ")" << std::endl;
+        }
+    }
+
+    MetricsExporter metrics_exporter(options.metrics_options);
+    try {
+        metrics_exporter.start();
+    } catch (const std::exception &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+
+    std::string coordinator_key;
+    if (!options.coordinator_key_path.empty()) {
+        try {
+            coordinator_key = read_coordinator_key(options.coordinator_key_path);
+        } catch (const std::exception &exception) {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<CapturedRequest> replay_requests;
+    if (!options.replay_path.empty()) {
+        try {
+            replay_requests = WorkloadFormat::read(options.replay_path);
+        } catch (const std::exception &exception) {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+        std::clog << "replaying " << replay_requests.size() << " request(s) from '" << options.replay_path << "'" << std::endl;
+    }
+
+    // Let search workers hand messages off instead of handling them themselves
+    MailboxDispatcher mailbox_dispatcher;
+    const bool use_mailboxes = options.mailbox_thread_count > 0;
+    if (use_mailboxes) {
+        PaymentService::instance().enable_mailbox(mailbox_dispatcher);
+        mailbox_dispatcher.start(options.mailbox_thread_count);
+    }
+
+    // Load the corpus and keep it in sync with the data directory, unless
+    // workers hold it for us
+    const bool is_coordinator = !options.worker_addresses.empty();
+    Corpus corpus;
+    try {
+        if (is_coordinator)
+            Dictionary::instance();
+        else if (!options.snapshot_path.empty())
+            add_snapshot_content_sources(corpus, options.snapshot_path, options.content_source_options.fold_mode, options.shard);
+        else
+            add_sample_content_sources(corpus, options.content_source_options, options.load_thread_count, options.shard);
+    } catch (const std::exception &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+    const auto &memory_budget = options.content_source_options.memory_budget;
+    const bool saves_memory = memory_budget || options.content_source_options.compress;
+    if (saves_memory && (is_coordinator || !options.snapshot_path.empty()))
+        std::cerr << "warning: --compress and --memory-budget only apply to files loaded from the data directory" << std::endl;
+    else if (saves_memory && options.index_dictionary)
+        std::cerr << "warning: files that are compressed or loaded on demand are not indexed" << std::endl;
+
+    std::jthread indexing_thread;
+    if (options.index_dictionary && !is_coordinator)
+        indexing_thread = start_indexing(corpus, options.content_source_options.fold_mode);
+
+    if (!options.batch_input_path.empty()) {
+        if (is_coordinator) {
+            std::cerr << "batch mode needs the corpus, it can't be used with --workers" << std::endl;
+            return 1;
+        }
+
+        // Dictionary queries are much cheaper once indexed
+        if (indexing_thread.joinable())
+            indexing_thread.join();
+        const int exit_code = run_batch(corpus, options);
+        if (memory_budget)
+            memory_budget->print_summary(std::clog);
+        return exit_code;
+    }
+
+    CorpusWatcher corpus_watcher(corpus, k_data_directory, options.content_source_options, options.shard);
+    if (options.watch_data_directory && !is_coordinator)
+        corpus_watcher.start();
+
     // Initialize search services
     const auto num_cores = std::thread::hardware_concurrency();
-    std::vector<SearchService> search_services(num_cores);
-    add_sample_content_sources(search_services);
+    const Placement placement(options.placement_options.policy != Placement::Policy::None ? CpuTopology::discover() : CpuTopology(), options.placement_options);
+    if (placement.is_enabled())
+        placement.print_summary(std::clog);
+    const size_t worker_count = options.concurrency_options ? std::max(options.concurrency_options->min_limit, options.concurrency_options->max_limit) : num_cores;
+    std::vector<std::unique_ptr<SearchService>> search_services;
+    for (size_t i = 0; i < worker_count && !is_coordinator; i++)
+        search_services.push_back(std::make_unique<SearchService>(corpus, &placement, i));
 
     // Create search proxy for concurrent and parallel search resolution
-    SearchProxy search_proxy;
+    SearchProxy search_proxy(
+        {
+            { Client::SubscriptionType::Premium, options.queue_options },
+            { Client::SubscriptionType::Standard, options.queue_options },
+        },
+        options.concurrency_options);
     for (auto &search_service : search_services)
-        search_proxy.add_search_service(search_service);
+        search_proxy.add_search_service(*search_service);
+
+    ShardCoordinator shard_coordinator(options.worker_addresses, options.content_source_options.fold_mode, num_cores, is_coordinator ? coordinator_key : std::string());
+    SearchProvider &search_backend = is_coordinator ? static_cast<SearchProvider &>(shard_coordinator) : search_proxy;
+
+    // Write down every request on its way in, wherever it comes from
+    std::unique_ptr<WorkloadRecorder> workload_recorder;
+    if (!options.capture_path.empty()) {
+        try {
+            workload_recorder = std::make_unique<WorkloadRecorder>(search_backend, options.capture_path);
+        } catch (const std::exception &exception) {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+    }
+    SearchProvider &search_provider = workload_recorder ? static_cast<SearchProvider &>(*workload_recorder) : search_backend;
+
+    // Either serve search requests from other processes... The server is
+    // started first so that nothing is left running if it can't listen
+    if (!is_coordinator)
+        options.server_options.coordinator_key = coordinator_key;
+    Server server(search_provider, options.server_options, use_mailboxes ? &mailbox_dispatcher : nullptr);
+    const bool is_server = !options.server_options.unix_socket_path.empty() || options.server_options.tcp_port != 0;
+    if (is_server) {
+        try {
+            server.start();
+        } catch (const std::exception &exception) {
+            std::cerr << exception.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (is_coordinator)
+        shard_coordinator.start();
+    else
+        search_proxy.start();
+
+    // ...or create thread for mocking search requests continuously, at a
+    // steady rate if asked to
+    std::unique_ptr<LoadGenerator> load_generator;
+    if (options.generate_load || !replay_requests.empty())
+        load_generator = std::make_unique<LoadGenerator>(search_provider, Dictionary::instance().words(), options.load_options, use_mailboxes ? &mailbox_dispatcher : nullptr);
+
+    std::thread mock_thread([&search_provider, &mailbox_dispatcher, &load_generator, &replay_requests, &options, use_mailboxes, is_server]() {
+        if (load_generator && !replay_requests.empty()) {
+            const size_t max_outstanding_count = 4 * std::max(1u, std::thread::hardware_concurrency());
+            load_generator->replay(replay_requests, options.replay_speed, max_outstanding_count, g_keep_running);
+            return;
+        }
+
+        if (load_generator) {
+            load_generator->run(g_keep_running);
+            return;
+        }
+
+        if (is_server) {
+            while (g_keep_running)
+                std::this_thread::sleep_for(250ms);
+            return;
+        }
 
-    // Create thread for mocking search requests continuously
-    std::thread mock_thread([&search_proxy]() {
         const size_t search_request_count = 15;
         const auto period = 2s;
 
         while (g_keep_running) {
             for (size_t i = 0; i < search_request_count; i++) {
                 auto client = Client::create_random();
+                if (use_mailboxes)
+                    client->enable_mailbox(mailbox_dispatcher);
                 auto search_request = SearchRequest::create_random();
-                search_proxy.query(*client, *search_request);
+                search_provider.query(*client, *search_request);
             }
             std::this_thread::sleep_for(period);
         }
     });
 
-    search_proxy.start();
+    // Write the trace whenever we get SIGUSR1
+    std::thread trace_thread([&options] {
+        while (g_keep_running && !options.trace_path.empty()) {
+            if (g_write_trace.exchange(false))
+                write_trace(options.trace_path);
+            std::this_thread::sleep_for(250ms);
+        }
+    });
+
     mock_thread.join();
+    g_keep_running = false;
+    trace_thread.join();
+    server.stop();
     search_proxy.stop();
+    shard_coordinator.stop();
+    mailbox_dispatcher.stop();
+    if (is_coordinator)
+        shard_coordinator.print_statistics(std::clog);
+    else
+        search_proxy.print_statistics(std::clog);
+    if (load_generator)
+        load_generator->print_report(std::clog);
+    if (memory_budget)
+        memory_budget->print_summary(std::clog);
+    if (workload_recorder) {
+        workload_recorder->close();
+        std::clog << "captured " << workload_recorder->request_count() << " request(s) to '" << options.capture_path << "'" << std::endl;
+    }
+    corpus_watcher.stop();
+    if (indexing_thread.joinable())
+        indexing_thread.join();
+    metrics_exporter.stop();
+    if (!options.trace_path.empty())
+        write_trace(options.trace_path);
 
     return 0;
 }
\ No newline at end of file
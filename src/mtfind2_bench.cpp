@@ -0,0 +1,654 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <MTFind2/Client/Client.h>
+#include <MTFind2/Search/CompressedContentSource.h>
+#include <MTFind2/Search/Corpus.h>
+#include <MTFind2/Search/CorpusLoader.h>
+#include <MTFind2/Search/Dictionary.h>
+#include <MTFind2/Search/MemoryContentSource.h>
+#include <MTFind2/Search/Placement.h>
+#include <MTFind2/Search/SearchProxy.h>
+#include <MTFind2/Search/SearchService.h>
+#include <Shared/Benchmark.h>
+#include <Shared/CpuTopology.h>
+#include <Shared/LzCodec.h>
+#include <Shared/PerfCounters.h>
+#include <Shared/Semaphore.h>
+#include <Shared/TextHelper.h>
+
+using namespace mtfind2;
+using namespace std::chrono_literals;
+
+struct Options {
+    Benchmark::Options benchmark_options;
+    std::filesystem::path data_directory { "data" };
+
+    /**
+     * Only benchmarks whose name contains this are run.
+     */
+    std::string filter;
+
+    /**
+     * How many times the data directory is replicated for macro-benchmarks.
+     */
+    std::vector<size_t> scales { 1, 4 };
+    size_t client_count = 4;
+
+    std::string output_path = "-";
+    std::string baseline_path;
+
+    /**
+     * Slowdown over the baseline above which a benchmark is considered to
+     * have regressed, in percent.
+     */
+    double tolerance = 10;
+
+    /**
+     * Whether to report hardware counter figures along with times.
+     */
+    bool use_perf_counters = false;
+
+    /**
+     * Placements the search benchmarks are run with, see Placement.
+     */
+    std::vector<Placement::Policy> placement_policies { Placement::Policy::None, Placement::Policy::Compact, Placement::Policy::Scatter };
+};
+
+/**
+ * Runs the benchmarks and collects their results.
+ */
+struct Suite final {
+    Suite(const Options &options, std::ostream &output)
+        : m_options(options)
+        , m_benchmark(options.benchmark_options)
+        , m_output(output)
+    {
+        Benchmark::write_header(m_output);
+    }
+
+    bool wants(const std::string &name) const { return name.find(m_options.filter) != std::string::npos; }
+
+    void run(const std::string &name, Benchmark::Work work, const std::function<void()> &iteration)
+    {
+        if (wants(name))
+            add(m_benchmark.run(name, work, iteration));
+    }
+
+    void add(const Benchmark::Result &result)
+    {
+        std::clog << "bench: " << result.name << ": " << result.median_ns << "ns" << std::endl;
+        Benchmark::write(m_output, result);
+        m_results.push_back(result);
+    }
+
+    const std::vector<Benchmark::Result> &results() const { return m_results; }
+
+private:
+    const Options &m_options;
+    const Benchmark m_benchmark;
+    std::ostream &m_output;
+    std::vector<Benchmark::Result> m_results;
+};
+
+#pragma region Synthetic text
+/**
+ * Generates lowercase ASCII text made of words of 2 to 9 letters from `a' to
+ * `t' and lines of about 80 bytes, with the needle inserted once every
+ * `hit_spacing' bytes (or never, if zero).
+ */
+static std::string generate_text(size_t size, std::string_view needle, size_t hit_spacing, uint32_t seed = 1)
+{
+    std::mt19937 random_engine(seed);
+    std::uniform_int_distribution<int> generate_letter('a', 't');
+    std::uniform_int_distribution<size_t> generate_word_length(2, 9);
+
+    std::string text;
+    text.reserve(size + needle.size() + 16);
+    size_t line_start = 0;
+    size_t next_hit = hit_spacing ? hit_spacing / 2 : SIZE_MAX;
+    while (text.size() < size) {
+        if (text.size() >= next_hit) {
+            text += needle;
+            next_hit += hit_spacing;
+        } else {
+            for (size_t length = generate_word_length(random_engine); length > 0; length--)
+                text += static_cast<char>(generate_letter(random_engine));
+        }
+
+        if (text.size() - line_start >= 80) {
+            text += '\n';
+            line_start = text.size();
+        } else {
+            text += ' ';
+        }
+    }
+    text.resize(size);
+    return text;
+}
+
+/**
+ * Generates a needle that doesn't occur naturally in generated text, but
+ * starts with its most common letter so that false starts are realistic.
+ */
+static std::string generate_needle(size_t length)
+{
+    std::mt19937 random_engine(static_cast<uint32_t>(length));
+    std::uniform_int_distribution<int> generate_letter('u', 'z');
+
+    std::string needle("e");
+    while (needle.size() < length)
+        needle += static_cast<char>(generate_letter(random_engine));
+    return needle;
+}
+
+/**
+ * Reads up to `size' bytes of the text files in a directory, repeating them if
+ * there are not enough.
+ */
+static std::string read_sample_text(const std::filesystem::path &directory, size_t size)
+{
+    std::string text;
+    const auto file_paths = CorpusLoader::list_directory(directory);
+    while (!file_paths.empty() && text.size() < size) {
+        for (const auto &file_path : file_paths) {
+            std::ifstream stream(file_path, std::ios::binary);
+            text.append(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        }
+    }
+    text.resize(std::min(text.size(), size));
+    return text;
+}
+
+static std::string to_mixed_case(std::string text)
+{
+    for (size_t i = 0; i < text.size(); i += 7)
+        text[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(text[i])));
+    return text;
+}
+#pragma endregion
+
+#pragma region Micro-benchmarks
+static constexpr size_t k_haystack_size = 1 << 20;
+
+/**
+ * Hits per MiB of text. Zero means that the needle is never found.
+ */
+static constexpr size_t k_hit_densities[] = { 0, 16, 1024, 16384 };
+
+static void run_find_benchmarks(Suite &suite)
+{
+    for (const size_t needle_length : { 2, 4, 8, 16, 32 }) {
+        const auto needle = generate_needle(needle_length);
+        for (const size_t hit_density : k_hit_densities) {
+            const auto name = "find_in_string/len=" + std::to_string(needle_length) + "/hits_per_mib=" + std::to_string(hit_density);
+            if (!suite.wants(name))
+                continue;
+
+            const auto haystack = generate_text(k_haystack_size, needle, hit_density ? k_haystack_size / hit_density : 0);
+            suite.run(name, { .bytes = haystack.size() }, [&] {
+                size_t hit_count = 0;
+                for (size_t pos = 0;;) {
+                    const auto [start_pos, end_pos] = TextHelper::find_in_string(haystack, needle, pos);
+                    if (start_pos == std::string::npos)
+                        break;
+                    hit_count++;
+                    pos = end_pos;
+                }
+                Benchmark::keep(hit_count);
+            });
+        }
+    }
+}
+
+static void run_fold_benchmarks(Suite &suite, const std::filesystem::path &data_directory)
+{
+    const auto sample_text = read_sample_text(data_directory, k_haystack_size);
+    const std::pair<std::string, std::string> texts[] = {
+        { "ascii", to_mixed_case(generate_text(k_haystack_size, {}, 0)) },
+        { "corpus", sample_text.empty() ? "ÚLTIMA sirena, AÑO" : sample_text }
+    };
+
+    for (const auto &[text_name, text] : texts) {
+        for (const size_t size : { size_t(16), size_t(64), k_haystack_size }) {
+            const std::string input = text.substr(0, size);
+            for (const auto mode : { TextHelper::FoldMode::CaseInsensitive, TextHelper::FoldMode::CaseAndAccentInsensitive }) {
+                const auto mode_name = mode == TextHelper::FoldMode::CaseInsensitive ? "case" : "case_accents";
+                suite.run("transform_to_lowercase/" + text_name + "/" + mode_name + "/size=" + std::to_string(input.size()), { .bytes = input.size() }, [&] {
+                    std::string str(input);
+                    TextHelper::transform_to_lowercase(str, mode);
+                    Benchmark::keep(str.data());
+                });
+            }
+        }
+    }
+}
+
+static void run_surrounding_text_benchmarks(Suite &suite)
+{
+    const auto needle = generate_needle(8);
+    const std::pair<std::string, TextHelper::ContextWidth> widths[] = {
+        { "1w", { TextHelper::ContextWidth::Unit::Words, 1 } },
+        { "8w", { TextHelper::ContextWidth::Unit::Words, 8 } },
+        { "40b", { TextHelper::ContextWidth::Unit::Bytes, 40 } }
+    };
+
+    for (const size_t hit_density : k_hit_densities) {
+        if (hit_density == 0)
+            continue;
+
+        const auto haystack = generate_text(k_haystack_size, needle, k_haystack_size / hit_density);
+        std::vector<size_t> hit_positions;
+        for (size_t pos = 0; (pos = haystack.find(needle, pos)) != std::string::npos; pos += needle.size())
+            hit_positions.push_back(pos);
+
+        for (const auto &[width_name, width] : widths) {
+            // Extract the surrounding text of every hit, within its line as clients do
+            size_t hit_index = 0;
+            suite.run("get_surrounding_text/" + width_name + "/hits_per_mib=" + std::to_string(hit_density), { .items = 1 }, [&] {
+                const size_t start_pos = hit_positions[hit_index++ % hit_positions.size()];
+                const size_t line_start = haystack.rfind('\n', start_pos) + 1;
+                const size_t line_end = std::min(haystack.find('\n', start_pos), haystack.size());
+                const std::string_view line(haystack.data() + line_start, line_end - line_start);
+                Benchmark::keep(TextHelper::get_surrounding_text(line, start_pos - line_start, start_pos - line_start + needle.size(), width).size());
+            });
+        }
+    }
+}
+static void run_compression_benchmarks(Suite &suite, const std::filesystem::path &data_directory)
+{
+    const auto sample_text = read_sample_text(data_directory, k_haystack_size);
+    if (sample_text.empty() || !suite.wants("lz_codec/"))
+        return;
+
+    const auto block = std::string_view(sample_text).substr(0, CompressedContentSource::BlockSize);
+    const auto compressed_block = LzCodec::compress(block);
+    std::clog << "bench: lz_codec: " << block.size() << " bytes compressed to " << compressed_block.size() << std::endl;
+    suite.run("lz_codec/compress", { .bytes = block.size() }, [&] {
+        Benchmark::keep(LzCodec::compress(block).size());
+    });
+
+    std::string decompressed_block(block.size(), '\0');
+    suite.run("lz_codec/decompress", { .bytes = block.size() }, [&] {
+        Benchmark::keep(LzCodec::decompress(compressed_block, decompressed_block.data(), decompressed_block.size()));
+    });
+}
+
+/**
+ * Scans the largest file of the corpus both as it is and compressed.
+ */
+static void run_content_source_benchmarks(Suite &suite, const std::filesystem::path &data_directory)
+{
+    const auto file_paths = CorpusLoader::list_directory(data_directory);
+    if (file_paths.empty() || !suite.wants("content_source_scan/"))
+        return;
+
+    const std::pair<std::string, std::shared_ptr<const ContentSource>> content_sources[] = {
+        { "memory", std::make_shared<const MemoryContentSource>(file_paths.front()) },
+        { "compressed", std::make_shared<const CompressedContentSource>(file_paths.front()) }
+    };
+
+    for (const auto &[kind, content_source] : content_sources)
+        std::clog << "bench: " << kind << ": " << content_source->memory_usage() << " bytes in memory" << std::endl;
+
+    // A frequent short word, a rare word and one that is nowhere to be found
+    for (const std::string query : { "que", "sirena", "zzyzx" }) {
+        for (const auto &[kind, content_source] : content_sources) {
+            suite.run("content_source_scan/" + kind + "/query=" + query, { .bytes = content_source->size() }, [&] {
+                Benchmark::keep(content_source->count(query));
+            });
+        }
+    }
+}
+#pragma endregion
+
+#pragma region Macro-benchmarks
+/**
+ * Client that keeps track of its requests for end-to-end benchmarks. Search
+ * requests are owned by the client until they are finished.
+ */
+struct BenchClient final : ClientDelegate {
+    BenchClient(uint32_t id, Semaphore &finished_semaphore)
+        : m_client(id, Client::SubscriptionType::Premium, Client::UnlimitedCredit)
+        , m_finished_semaphore(finished_semaphore)
+    {
+        m_client.set_delegate(this);
+    }
+
+    void query(SearchProvider &search_provider, const std::string &query)
+    {
+        static std::atomic<size_t> s_last_id = 0;
+        auto *search_request = new SearchRequest(s_last_id++, query);
+        search_provider.query(m_client, *search_request);
+    }
+
+    void on_search_result(const SearchRequest &, const ContentSource &, const SearchResult &) override { m_result_count++; }
+    void on_search_count(const SearchRequest &, size_t) override { }
+    void on_service_overloaded(const SearchRequest &, std::chrono::milliseconds) override { m_overloaded_count++; }
+    void on_credit_recharged(size_t) override { }
+
+    void on_search_finished(const SearchRequest &search_request, std::chrono::steady_clock::time_point) override
+    {
+        {
+            const std::scoped_lock lock(m_latencies_lock);
+            m_latencies.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - search_request.timestamp()).count());
+        }
+        delete &search_request;
+        m_finished_semaphore.notify();
+    }
+
+    size_t result_count() const { return m_result_count; }
+    size_t overloaded_count() const { return m_overloaded_count; }
+
+    std::vector<double> latencies() const
+    {
+        const std::scoped_lock lock(m_latencies_lock);
+        return m_latencies;
+    }
+
+private:
+    Client m_client;
+    Semaphore &m_finished_semaphore;
+    std::atomic<size_t> m_result_count = 0;
+    std::atomic<size_t> m_overloaded_count = 0;
+    mutable std::mutex m_latencies_lock;
+    std::vector<double> m_latencies;
+};
+
+/**
+ * Points to every text file in a directory `scale' times over, so that a
+ * corpus of any size can be loaded without storing it.
+ */
+static std::vector<std::string> replicate_directory(const std::filesystem::path &data_directory, const std::filesystem::path &scratch_directory, size_t scale)
+{
+    const auto file_paths = CorpusLoader::list_directory(data_directory);
+    if (scale <= 1)
+        return file_paths;
+
+    std::vector<std::string> replica_paths;
+    std::filesystem::create_directories(scratch_directory);
+    for (size_t i = 0; i < scale; i++) {
+        for (const auto &file_path : file_paths) {
+            const auto replica_path = scratch_directory / (std::to_string(i) + "-" + std::filesystem::path(file_path).filename().string());
+            if (!std::filesystem::exists(std::filesystem::symlink_status(replica_path)))
+                std::filesystem::create_symlink(std::filesystem::absolute(file_path), replica_path);
+            replica_paths.push_back(replica_path.string());
+        }
+    }
+    return replica_paths;
+}
+
+/**
+ * Runs the search benchmarks on a corpus with search work placed as told.
+ */
+static void run_search_benchmarks(Suite &suite, const Options &options, const Corpus &corpus, uint64_t corpus_size, const Placement &placement, const std::string &suffix,
+    const std::vector<std::unique_ptr<SearchRequest>> &search_requests)
+{
+    SearchService search_service(corpus, &placement);
+    size_t request_index = 0;
+    suite.run("search_service/query" + suffix, { .bytes = corpus_size, .items = 1 }, [&] {
+        std::atomic<size_t> result_count = 0;
+        search_service.query(*search_requests[request_index++ % search_requests.size()], [&](const ContentSource &, const SearchResult &) {
+            result_count++;
+            return true;
+        });
+        Benchmark::keep(result_count.load());
+    });
+
+    // Counts run on the calling thread, so placement makes no difference
+    if (!placement.is_enabled()) {
+        suite.run("search_service/count" + suffix, { .bytes = corpus_size, .items = 1 }, [&] {
+            Benchmark::keep(search_service.count(*search_requests[request_index++ % search_requests.size()]));
+        });
+    }
+
+    const auto name = "search_proxy/end_to_end" + suffix + "/clients=" + std::to_string(options.client_count);
+    if (!suite.wants(name))
+        return;
+
+    // One search service per core, as mtfind2 does
+    std::vector<std::unique_ptr<SearchService>> search_services;
+    SearchProxy search_proxy;
+    for (size_t i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++) {
+        search_services.push_back(std::make_unique<SearchService>(corpus, &placement, i));
+        search_proxy.add_search_service(*search_services.back());
+    }
+    search_proxy.start();
+
+    // Closed loop: every client issues a new request as soon as one finishes
+    Semaphore finished_semaphore;
+    std::vector<std::unique_ptr<BenchClient>> clients;
+    for (size_t i = 0; i < options.client_count; i++)
+        clients.push_back(std::make_unique<BenchClient>(i, finished_semaphore));
+
+    const size_t min_request_count = 64;
+    const auto start_perf_totals = PerfCounters::totals();
+    const auto start_time = std::chrono::steady_clock::now();
+    size_t request_count = 0;
+    for (auto &client : clients)
+        client->query(search_proxy, search_requests[request_count++ % search_requests.size()]->query());
+    for (size_t finished_count = 0; finished_count < request_count; finished_count++) {
+        finished_semaphore.wait();
+        if (request_count < min_request_count || std::chrono::steady_clock::now() - start_time < options.benchmark_options.min_time) {
+            auto &client = clients[request_count % clients.size()];
+            client->query(search_proxy, search_requests[request_count++ % search_requests.size()]->query());
+        }
+    }
+    const auto elapsed_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    search_proxy.stop();
+
+    std::vector<double> latencies;
+    size_t overloaded_count = 0;
+    for (const auto &client : clients) {
+        const auto client_latencies = client->latencies();
+        latencies.insert(latencies.end(), client_latencies.begin(), client_latencies.end());
+        overloaded_count += client->overloaded_count();
+    }
+    if (overloaded_count > 0)
+        std::clog << "bench: " << name << ": " << overloaded_count << " request(s) turned away" << std::endl;
+
+    // Latencies are per request, but throughput is measured across clients
+    auto result = Benchmark::summarize(name, request_count, {}, std::move(latencies));
+    result.bytes_per_second = request_count * corpus_size / elapsed_time;
+    result.items_per_second = request_count / elapsed_time;
+    if (PerfCounters::is_enabled())
+        Benchmark::add_perf_sample(result, PerfCounters::totals() - start_perf_totals, { .bytes = corpus_size });
+    suite.add(result);
+}
+
+static void run_search_benchmarks(Suite &suite, const Options &options)
+{
+    const auto &words = Dictionary::instance().words();
+    if (words.empty())
+        return;
+
+    // The same queries every time, so that runs can be compared
+    std::mt19937 random_engine(42);
+    std::uniform_int_distribution<size_t> generate_word_index(0, words.size() - 1);
+    std::vector<std::unique_ptr<SearchRequest>> search_requests;
+    for (size_t i = 0; i < 64; i++)
+        search_requests.push_back(std::make_unique<SearchRequest>(i, words[generate_word_index(random_engine)]));
+
+    const auto scratch_directory = std::filesystem::temp_directory_path() / ("mtfind2_bench." + std::to_string(getpid()));
+    for (const size_t scale : options.scales) {
+        const auto suffix = [&](Placement::Policy policy) {
+            return "/scale=" + std::to_string(scale) + (policy == Placement::Policy::None ? "" : std::string("/pin=") + Placement::policy_name(policy));
+        };
+        const bool is_wanted = std::any_of(options.placement_policies.begin(), options.placement_policies.end(), [&](Placement::Policy policy) {
+            return suite.wants("search_service/query" + suffix(policy)) || suite.wants("search_service/count" + suffix(policy)) || suite.wants("search_proxy/end_to_end" + suffix(policy));
+        });
+        if (!is_wanted)
+            continue;
+
+        Corpus corpus;
+        CorpusLoader corpus_loader({});
+        corpus.add_content_sources(corpus_loader.load(replicate_directory(options.data_directory, scratch_directory, scale)));
+        uint64_t corpus_size = 0;
+        for (const auto &content_source : corpus.snapshot()->content_sources())
+            corpus_size += content_source->size();
+
+        const auto topology = CpuTopology::discover();
+        for (const auto policy : options.placement_policies)
+            run_search_benchmarks(suite, options, corpus, corpus_size, Placement(topology, { .policy = policy }), suffix(policy), search_requests);
+    }
+
+    std::error_code error_code;
+    std::filesystem::remove_all(scratch_directory, error_code);
+}
+#pragma endregion
+
+/**
+ * Compares the results to those of a previous run.
+ * @return Whether no benchmark got slower than the tolerance allows
+ */
+static bool compare_with_baseline(const std::vector<Benchmark::Result> &results, const Options &options)
+{
+    std::ifstream stream(options.baseline_path);
+    if (!stream)
+        throw std::runtime_error("could not open '" + options.baseline_path + "'");
+
+    const auto baseline_medians = Benchmark::read_medians(stream);
+    bool is_ok = true;
+    for (const auto &result : results) {
+        const auto it = baseline_medians.find(result.name);
+        if (it == baseline_medians.end() || it->second <= 0)
+            continue;
+
+        const double change = (result.median_ns / it->second - 1) * 100;
+        if (change > options.tolerance) {
+            std::clog << "bench: " << result.name << " regressed by " << change << "% (" << it->second << "ns -> " << result.median_ns << "ns)" << std::endl;
+            is_ok = false;
+        }
+    }
+    return is_ok;
+}
+
+static bool parse_options(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            options.benchmark_options.min_time = std::chrono::milliseconds(std::stoul(argv[++i]));
+        } else if (arg == "--scale" && i + 1 < argc) {
+            options.scales.clear();
+            std::istringstream scales(argv[++i]);
+            for (std::string scale; std::getline(scales, scale, ',');)
+                options.scales.push_back(std::stoul(scale));
+        } else if (arg == "--clients" && i + 1 < argc) {
+            options.client_count = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--data" && i + 1 < argc) {
+            options.data_directory = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.output_path = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            options.baseline_path = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            options.tolerance = std::stod(argv[++i]);
+        } else if (arg == "--perf-counters") {
+            options.use_perf_counters = true;
+        } else if (arg == "--pin" && i + 1 < argc) {
+            options.placement_policies.clear();
+            std::istringstream policies(argv[++i]);
+            for (std::string policy; std::getline(policies, policy, ',');) {
+                if (policy == "none")
+                    options.placement_policies.push_back(Placement::Policy::None);
+                else if (policy == "compact")
+                    options.placement_policies.push_back(Placement::Policy::Compact);
+                else if (policy == "scatter")
+                    options.placement_policies.push_back(Placement::Policy::Scatter);
+                else
+                    return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Runs micro-benchmarks on the text helpers and end-to-end benchmarks on the
+ * search path, and writes their results as TSV. With --baseline, results are
+ * compared against a previous run and the exit status tells whether anything
+ * regressed.
+ */
+int main(int argc, char *argv[])
+try {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "usage: " << argv[0] << " [--filter TEXT] [--min-time MS] [--scale N[,N...]] [--clients N] [--data DIRECTORY]" << std::endl
+                  << "       [--output FILE|-] [--baseline FILE] [--tolerance PERCENT] [--perf-counters]" << std::endl
+                  << "       [--pin POLICY[,POLICY...]]" << std::endl;
+        return 1;
+    }
+
+    std::ofstream output_file;
+    if (options.output_path != "-") {
+        output_file.open(options.output_path, std::ios::trunc);
+        if (!output_file)
+            throw std::runtime_error("could not open '" + options.output_path + "' for writing");
+    }
+
+    // The search path logs every request to stdout, which is where results go by default
+    std::ostream output(output_file.is_open() ? output_file.rdbuf() : std::cout.rdbuf());
+    std::cout.rdbuf(nullptr);
+
+    if (options.use_perf_counters) {
+        try {
+            PerfCounters::enable();
+        } catch (const std::runtime_error &error) {
+            std::clog << "bench: warning: hardware counters are unavailable (" << error.what() << ")" << std::endl;
+        }
+    }
+
+#ifndef __OPTIMIZE__
+    std::clog << "bench: warning: built without optimizations" << std::endl;
+#endif
+
+    Suite suite(options, output);
+    run_find_benchmarks(suite);
+    run_fold_benchmarks(suite, options.data_directory);
+    run_surrounding_text_benchmarks(suite);
+    run_compression_benchmarks(suite, options.data_directory);
+    run_content_source_benchmarks(suite, options.data_directory);
+    run_search_benchmarks(suite, options);
+
+    if (!options.baseline_path.empty() && !compare_with_baseline(suite.results(), options))
+        return 2;
+    return 0;
+} catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,87 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+
+#include <MTFind2/Search/CorpusLoader.h>
+#include <MTFind2/Search/Dictionary.h>
+#include <MTFind2/Search/MemoryContentSource.h>
+#include <MTFind2/Search/OccurrenceIndex.h>
+#include <MTFind2/Storage/SnapshotFile.h>
+
+using namespace mtfind2;
+
+/**
+ * Builds a corpus snapshot out of every `.txt' file in a directory, so that
+ * mtfind2 can map it in place on startup (see the --snapshot option). With
+ * --index, the occurrences of every dictionary word are precomputed as well.
+ */
+int main(int argc, char *argv[])
+{
+    auto fold_mode = TextHelper::FoldMode::CaseInsensitive;
+    bool build_occurrence_index = false;
+    std::vector<std::string_view> positional_args;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        if (arg == "-a" || arg == "--ignore-accents")
+            fold_mode = TextHelper::FoldMode::CaseAndAccentInsensitive;
+        else if (arg == "--index")
+            build_occurrence_index = true;
+        else
+            positional_args.push_back(arg);
+    }
+
+    if (positional_args.empty() || positional_args.size() > 2) {
+        std::cerr << "usage: " << argv[0] << " [-a|--ignore-accents] [--index] OUTPUT [DIRECTORY]" << std::endl;
+        return 1;
+    }
+
+    const std::string output_path(positional_args[0]);
+    const std::filesystem::path directory(positional_args.size() > 1 ? positional_args[1] : "data");
+    const auto start_time = std::chrono::steady_clock::now();
+
+    try {
+        CorpusLoader corpus_loader({ .fold_mode = fold_mode });
+        const auto content_sources = corpus_loader.load(CorpusLoader::list_directory(directory));
+        corpus_loader.print_report(std::clog);
+
+        std::unique_ptr<OccurrenceIndexBuilder> occurrence_index_builder;
+        if (build_occurrence_index) {
+            const auto &dictionary = Dictionary::instance();
+            occurrence_index_builder = std::make_unique<OccurrenceIndexBuilder>(dictionary.words(), dictionary.fingerprint(), fold_mode);
+        }
+
+        SnapshotWriter snapshot_writer(fold_mode);
+        for (const auto &content_source : content_sources) {
+            const auto memory_content_source = std::dynamic_pointer_cast<const MemoryContentSource>(content_source);
+            const auto source_index = snapshot_writer.add_content_source(memory_content_source);
+            if (occurrence_index_builder)
+                snapshot_writer.add_index(source_index, SnapshotFormat::SectionKind::OccurrenceIndex, occurrence_index_builder->build(*memory_content_source));
+        }
+        snapshot_writer.write(output_path);
+    } catch (const std::exception &exception) {
+        std::cerr << exception.what() << std::endl;
+        return 1;
+    }
+
+    const auto build_time = std::chrono::steady_clock::now() - start_time;
+    std::cout << "wrote '" << output_path << "' (" << std::filesystem::file_size(output_path) << " bytes) in " << std::chrono::duration<double, std::milli>(build_time).count() << "ms" << std::endl;
+    return 0;
+}
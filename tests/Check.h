@@ -0,0 +1,76 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <iostream>
+
+/**
+ * Minimal assertions for the test programs, which have no dependencies. A
+ * failed check is reported and counted but doesn't stop the test, and the
+ * program fails if any check did, see check_report().
+ */
+inline int &check_failure_count()
+{
+    static int s_failure_count = 0;
+    return s_failure_count;
+}
+
+#define CHECK(condition)                                                                              \
+    do {                                                                                              \
+        if (!(condition)) {                                                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            check_failure_count()++;                                                                  \
+        }                                                                                             \
+    } while (false)
+
+#define CHECK_EQUAL(actual, expected)                                                                                                \
+    do {                                                                                                                             \
+        const auto &check_actual = (actual);                                                                                         \
+        const auto &check_expected = (expected);                                                                                     \
+        if (!(check_actual == check_expected)) {                                                                                     \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #actual " == " #expected " (got " << check_actual << ")" \
+                      << std::endl;                                                                                                  \
+            check_failure_count()++;                                                                                                 \
+        }                                                                                                                            \
+    } while (false)
+
+#define CHECK_THROWS(expression)                                                                                  \
+    do {                                                                                                          \
+        bool check_has_thrown = false;                                                                            \
+        try {                                                                                                     \
+            (void)(expression);                                                                                   \
+        } catch (const std::exception &) {                                                                        \
+            check_has_thrown = true;                                                                              \
+        }                                                                                                         \
+        if (!check_has_thrown) {                                                                                  \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #expression " should throw" << std::endl; \
+            check_failure_count()++;                                                                              \
+        }                                                                                                         \
+    } while (false)
+
+/**
+ * @return The exit status of a test program
+ */
+inline int check_report(const char *test_name)
+{
+    if (check_failure_count() == 0)
+        std::clog << test_name << ": all checks passed" << std::endl;
+    else
+        std::clog << test_name << ": " << check_failure_count() << " check(s) failed" << std::endl;
+    return check_failure_count() == 0 ? 0 : 1;
+}
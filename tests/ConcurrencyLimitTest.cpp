@@ -0,0 +1,80 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <chrono>
+
+#include <Shared/ConcurrencyLimit.h>
+
+#include "Check.h"
+
+using namespace std::chrono_literals;
+
+/**
+ * Limit that is updated on every release and takes every new estimate whole.
+ */
+static ConcurrencyLimit::Options immediate_options()
+{
+    return { .min_limit = 1, .max_limit = 64, .initial_limit = 4, .window = 0ms, .min_sample_count = 1, .smoothing = 1 };
+}
+
+int main()
+{
+    // Slots are handed out up to the limit
+    {
+        ConcurrencyLimit concurrency_limit(immediate_options());
+        for (int i = 0; i < 4; i++)
+            CHECK(concurrency_limit.try_acquire());
+        CHECK(!concurrency_limit.try_acquire());
+        CHECK_EQUAL(concurrency_limit.in_flight_count(), 4u);
+        concurrency_limit.release();
+        CHECK(concurrency_limit.try_acquire());
+    }
+
+    // The limit doesn't grow while it isn't reached, however close work gets
+    {
+        ConcurrencyLimit concurrency_limit(immediate_options());
+        for (int i = 0; i < 3; i++)
+            CHECK(concurrency_limit.try_acquire());
+        for (int i = 0; i < 3; i++)
+            concurrency_limit.release(1ms);
+        CHECK_EQUAL(concurrency_limit.limit(), 4u);
+    }
+
+    // But does when it is reached and latency holds
+    {
+        ConcurrencyLimit concurrency_limit(immediate_options());
+        for (int i = 0; i < 4; i++)
+            CHECK(concurrency_limit.try_acquire());
+        concurrency_limit.release(1ms);
+        CHECK_EQUAL(concurrency_limit.limit(), 6u);
+    }
+
+    // And shrinks when latency goes up with it
+    {
+        auto options = immediate_options();
+        options.initial_limit = 16;
+        ConcurrencyLimit concurrency_limit(options);
+        CHECK(concurrency_limit.try_acquire());
+        concurrency_limit.release(1ms);
+        for (int i = 0; i < 16; i++)
+            CHECK(concurrency_limit.try_acquire());
+        concurrency_limit.release(10ms);
+        CHECK_EQUAL(concurrency_limit.limit(), 12u);
+    }
+
+    return check_report("concurrency_limit_test");
+}
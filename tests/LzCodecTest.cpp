@@ -0,0 +1,161 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include <Shared/LzCodec.h>
+
+#include "Check.h"
+
+/**
+ * Bytes after the output that decompression must leave alone.
+ */
+static constexpr size_t GuardSize = 32;
+
+/**
+ * Decompresses into a buffer followed by a guard.
+ * @return Whether decompression succeeded and wrote nothing past the output
+ */
+static bool decompress(std::string_view block, size_t output_size, std::string &output)
+{
+    std::string buffer(output_size + GuardSize, '\x5a');
+    const bool is_valid = LzCodec::decompress(block, buffer.data(), output_size);
+    CHECK(buffer.find_first_not_of('\x5a', output_size) == std::string::npos);
+    output = buffer.substr(0, output_size);
+    return is_valid;
+}
+
+static void check_round_trip(const std::string &input)
+{
+    const auto block = LzCodec::compress(input);
+    std::string output;
+    CHECK(decompress(block, input.size(), output));
+    CHECK(output == input);
+
+    // The size must be exactly right
+    CHECK(!decompress(block, input.size() + 1, output));
+    if (!input.empty())
+        CHECK(!decompress(block, input.size() - 1, output));
+
+    // And so must the block, down to its last byte
+    const size_t step = std::max<size_t>(block.size() / 256, 1);
+    for (size_t length = block.size() - 1; length < block.size(); length = length >= step ? length - step : block.size())
+        CHECK(!decompress(block.substr(0, length), input.size(), output));
+}
+
+static std::string random_bytes(std::mt19937 &random, size_t size)
+{
+    std::string bytes(size, '\0');
+    for (auto &byte : bytes)
+        byte = static_cast<char>(random());
+    return bytes;
+}
+
+/**
+ * Text-like data: words drawn from a small vocabulary, so that matches of
+ * every length and offset turn up.
+ */
+static std::string random_text(std::mt19937 &random, size_t size)
+{
+    static constexpr std::string_view Words[] = { "sirena ", "de ", "la ", "liderazgo ", "equipo ", "\n", "leyes ", "gente ", "un ", "ganarse " };
+    std::string text;
+    while (text.size() < size)
+        text += Words[random() % std::size(Words)];
+    text.resize(size);
+    return text;
+}
+
+int main()
+{
+    std::mt19937 random(42);
+
+    check_round_trip("");
+    check_round_trip("a");
+    check_round_trip("abcd");
+    check_round_trip(std::string(100000, ' '));
+
+    // Runs of short patterns, which overlap the matches that copy them
+    for (size_t period = 1; period <= 16; period++) {
+        const auto pattern = random_bytes(random, period);
+        std::string input;
+        while (input.size() < 5000)
+            input += pattern;
+        check_round_trip(input);
+    }
+    check_round_trip(random_bytes(random, 1000));
+    check_round_trip(random_bytes(random, 100000));
+    for (const size_t size : { 15, 16, 17, 255, 270, 65535, 65536, 65537 }) {
+        check_round_trip(random_text(random, size));
+        check_round_trip(random_bytes(random, size));
+    }
+
+    // Matches as far back as they can go, and just beyond
+    {
+        const auto head = random_bytes(random, 100);
+        for (const size_t gap : { LzCodec::MaxOffset - 100, LzCodec::MaxOffset - 99, LzCodec::MaxOffset - 98 })
+            check_round_trip(head + random_bytes(random, gap) + head);
+    }
+
+    // Incompressible data grows by little
+    {
+        const auto input = random_bytes(random, 65536);
+        CHECK(LzCodec::compress(input).size() < input.size() + input.size() / 100);
+    }
+
+    // Text compresses
+    {
+        const auto input = random_text(random, 65536);
+        CHECK(LzCodec::compress(input).size() < input.size() / 2);
+    }
+
+    // Corrupt blocks are rejected
+    {
+        std::string output;
+        CHECK(!decompress("", 0, output));
+        // Literal run longer than the block
+        CHECK(!decompress("\x30" "ab", 3, output));
+        // Offset of zero, or reaching before the output
+        CHECK(!decompress(std::string("\x10" "a\x00\x00", 4), 5, output));
+        CHECK(!decompress(std::string("\x10" "a\x02\x00", 4), 5, output));
+        // Match longer than the output
+        CHECK(!decompress(std::string("\x10" "a\x01\x00", 4), 4, output));
+        // Length continuation cut short
+        CHECK(!decompress(std::string("\xf0\xff", 2), 300, output));
+        // Valid, for reference
+        CHECK(decompress(std::string("\x10" "a\x01\x00\x00", 5), 5, output));
+        CHECK_EQUAL(output, "aaaaa");
+        // Trailing garbage
+        CHECK(!decompress(std::string("\x10" "a\x01\x00\x00!", 6), 5, output));
+    }
+
+    // Damaged blocks may decompress to anything, but never past the output
+    {
+        const auto input = random_text(random, 20000);
+        const auto block = LzCodec::compress(input);
+        std::string output;
+        for (int i = 0; i < 2000; i++) {
+            auto damaged_block = block;
+            damaged_block[random() % damaged_block.size()] ^= static_cast<char>(1 + random() % 255);
+            decompress(damaged_block, input.size(), output);
+        }
+    }
+
+    return check_report("lz_codec_test");
+}
@@ -0,0 +1,125 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <string>
+#include <string_view>
+
+#include <MTFind2/Server/Protocol.h>
+
+#include "Check.h"
+
+using namespace mtfind2;
+
+static std::string encode_length(uint32_t length)
+{
+    return Protocol::Writer(Protocol::FrameType::Hello).put(length).finish().substr(Protocol::LengthSize + 1);
+}
+
+int main()
+{
+    // Integers are little-endian, after the payload length and the frame type
+    {
+        const auto frame = Protocol::Writer(Protocol::FrameType::Query).put(uint32_t(0x04030201)).put_rest("ab").finish();
+        CHECK_EQUAL(frame, std::string("\x07\x00\x00\x00\x02\x01\x02\x03\x04" "ab", 11));
+    }
+
+    // Every field reads back as written
+    {
+        const auto frame = Protocol::Writer(Protocol::FrameType::Result)
+                               .put(uint32_t(7))
+                               .put(uint64_t(0x0102030405060708))
+                               .put(uint8_t(Protocol::IsFinalResult))
+                               .put_string16("data/file.txt")
+                               .put_string16("")
+                               .put_rest("surrounding text")
+                               .finish();
+        std::string_view buffer(frame);
+        const auto payload = Protocol::next_frame(buffer);
+        CHECK(payload.has_value());
+        CHECK(buffer.empty());
+
+        Protocol::Reader reader(*payload);
+        CHECK(reader.type() == Protocol::FrameType::Result);
+        CHECK_EQUAL(reader.get<uint32_t>(), 7u);
+        CHECK_EQUAL(reader.get<uint64_t>(), 0x0102030405060708u);
+        CHECK_EQUAL(reader.get<uint8_t>(), Protocol::IsFinalResult);
+        CHECK_EQUAL(reader.get_string16(), "data/file.txt");
+        CHECK_EQUAL(reader.get_string16(), "");
+        CHECK(!reader.is_empty());
+        CHECK_EQUAL(reader.get_rest(), "surrounding text");
+        CHECK(reader.is_empty());
+        CHECK_EQUAL(reader.get_rest(), "");
+    }
+
+    // Strings too long for their length are cut short
+    {
+        const std::string value(UINT16_MAX + 10, 'x');
+        const auto frame = Protocol::Writer(Protocol::FrameType::Error).put_string16(value).finish();
+        Protocol::Reader reader(std::string_view(frame).substr(Protocol::LengthSize));
+        reader.type();
+        CHECK_EQUAL(reader.get_string16().size(), size_t(UINT16_MAX));
+        CHECK(reader.is_empty());
+    }
+
+    // Reading past the end of a payload throws
+    {
+        Protocol::Reader reader(std::string_view("\x84\x01\x02\x03", 4));
+        CHECK(reader.type() == Protocol::FrameType::Done);
+        CHECK_THROWS(reader.get<uint32_t>());
+        CHECK_EQUAL(reader.get<uint16_t>(), 0x0201u);
+        CHECK_THROWS(reader.get<uint16_t>());
+        CHECK_EQUAL(reader.get<uint8_t>(), 3u);
+        CHECK_THROWS(reader.get<uint8_t>());
+        CHECK_THROWS(Protocol::Reader("").type());
+        CHECK_THROWS(Protocol::Reader(std::string_view("\x05\x00" "abcd", 6)).get_string16());
+    }
+
+    // Frames are only taken out of a buffer once complete
+    {
+        const auto first = Protocol::Writer(Protocol::FrameType::Credit).put(uint32_t(15)).finish();
+        const auto second = Protocol::Writer(Protocol::FrameType::Hello).put(uint8_t(1)).finish();
+        const auto input = first + second;
+        for (size_t size = 0; size <= input.size(); size++) {
+            std::string_view buffer(input.data(), size);
+            size_t frame_count = 0;
+            while (const auto payload = Protocol::next_frame(buffer)) {
+                CHECK_EQUAL(*payload, std::string_view(frame_count == 0 ? first : second).substr(Protocol::LengthSize));
+                frame_count++;
+            }
+            CHECK_EQUAL(frame_count, size_t(size >= first.size()) + size_t(size == input.size()));
+            CHECK_EQUAL(buffer.size(), size - (frame_count >= 1 ? first.size() : 0) - (frame_count == 2 ? second.size() : 0));
+        }
+    }
+
+    // Bad lengths are rejected as soon as they are known
+    {
+        std::string_view empty_frame("\x00\x00\x00\x00", 4);
+        CHECK_THROWS(Protocol::next_frame(empty_frame));
+
+        const auto oversized_length = encode_length(Protocol::MaxFrameSize + 1);
+        std::string_view oversized_frame(oversized_length);
+        CHECK_THROWS(Protocol::next_frame(oversized_frame));
+
+        const auto largest_frame = encode_length(Protocol::MaxFrameSize) + std::string(Protocol::MaxFrameSize, '\x02');
+        std::string_view buffer(largest_frame);
+        const auto payload = Protocol::next_frame(buffer);
+        CHECK(payload.has_value() && payload->size() == Protocol::MaxFrameSize);
+        CHECK(buffer.empty());
+    }
+
+    return check_report("protocol_test");
+}
@@ -0,0 +1,206 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <MTFind2/Messages/SearchCountMessage.h>
+#include <MTFind2/Messages/SearchFinishedMessage.h>
+#include <MTFind2/Server/Protocol.h>
+#include <MTFind2/Server/Server.h>
+
+#include "Check.h"
+
+using namespace mtfind2;
+using namespace std::chrono_literals;
+
+/**
+ * Answers every query with its length as the occurrence count, either right
+ * away or after a while from a thread of its own.
+ */
+struct CountingProvider final : SearchProvider {
+    explicit CountingProvider(std::chrono::milliseconds delay)
+        : m_delay(delay)
+    {
+    }
+
+    ~CountingProvider()
+    {
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    void query(Client &client, const SearchRequest &search_request) override
+    {
+        const auto answer = [&client, &search_request, delay = m_delay] {
+            std::this_thread::sleep_for(delay);
+            client.push_message(SearchCountMessage(search_request, search_request.query().size()));
+            client.push_message(SearchFinishedMessage(search_request));
+        };
+
+        if (m_delay == 0ms) {
+            answer();
+            return;
+        }
+        const std::scoped_lock lock(m_threads_lock);
+        m_threads.emplace_back(answer);
+    }
+
+private:
+    const std::chrono::milliseconds m_delay;
+    std::mutex m_threads_lock;
+    std::vector<std::thread> m_threads;
+};
+
+static int connect_to(const std::string &socket_path)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    socket_path.copy(address.sun_path, sizeof address.sun_path - 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof address) == -1) {
+        ::close(fd);
+        return -1;
+    }
+
+    const timeval timeout { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    return fd;
+}
+
+static std::string standard_hello()
+{
+    return Protocol::Writer(Protocol::FrameType::Hello).put(uint8_t(0)).finish();
+}
+
+static std::string coordinator_hello(std::string_view key)
+{
+    return Protocol::Writer(Protocol::FrameType::Hello).put(uint8_t(0)).put(Protocol::IsCoordinator).put_rest(key).finish();
+}
+
+/**
+ * Sends a hello and some queries, stops sending and reads responses until
+ * the server closes the connection.
+ * @return The payloads of the frames received
+ */
+static std::vector<std::string> query_and_half_close(const std::string &socket_path, const std::vector<std::string> &queries, const std::string &hello = standard_hello())
+{
+    const int fd = connect_to(socket_path);
+    CHECK(fd != -1);
+    if (fd == -1)
+        return {};
+
+    // Everything in one write, so that the server reads the frames and the end
+    // of the stream at once
+    std::string request = hello;
+    for (size_t i = 0; i < queries.size(); i++)
+        request += Protocol::Writer(Protocol::FrameType::Query).put(static_cast<uint32_t>(i)).put_rest(queries[i]).finish();
+    CHECK_EQUAL(::write(fd, request.data(), request.size()), static_cast<ssize_t>(request.size()));
+    shutdown(fd, SHUT_WR);
+
+    std::string input;
+    char buffer[4096];
+    for (ssize_t length; (length = ::read(fd, buffer, sizeof buffer)) > 0;)
+        input.append(buffer, length);
+    ::close(fd);
+
+    std::vector<std::string> payloads;
+    std::string_view rest(input);
+    while (const auto payload = Protocol::next_frame(rest))
+        payloads.emplace_back(*payload);
+    CHECK(rest.empty());
+    return payloads;
+}
+
+/**
+ * Checks that every query got its count and then its Done frame.
+ */
+static void check_responses(const std::vector<std::string> &payloads, const std::vector<std::string> &queries)
+{
+    CHECK_EQUAL(payloads.size(), 2 * queries.size());
+    std::vector<int> stages(queries.size(), 0);
+    for (const auto &payload : payloads) {
+        Protocol::Reader reader(payload);
+        const auto type = reader.type();
+        const auto tag = reader.get<uint32_t>();
+        CHECK(tag < queries.size());
+        if (tag >= queries.size())
+            continue;
+
+        if (type == Protocol::FrameType::Count) {
+            CHECK_EQUAL(stages[tag], 0);
+            CHECK_EQUAL(reader.get<uint64_t>(), queries[tag].size());
+            stages[tag] = 1;
+        } else {
+            CHECK(type == Protocol::FrameType::Done);
+            CHECK_EQUAL(stages[tag], 1);
+            CHECK_EQUAL(reader.get<uint32_t>(), 0u);
+            stages[tag] = 2;
+        }
+    }
+    for (const int stage : stages)
+        CHECK_EQUAL(stage, 2);
+}
+
+int main()
+{
+    const std::vector<std::string> queries { "sirena", "de", "liderazgo" };
+    for (const auto delay : { 0ms, 200ms }) {
+        const std::string socket_path = "/tmp/mtfind2_server_test." + std::to_string(getpid()) + ".sock";
+        CountingProvider provider(delay);
+        Server server(provider, { .unix_socket_path = socket_path });
+        server.start();
+
+        // A client that stops sending after its queries still gets every response
+        check_responses(query_and_half_close(socket_path, queries), queries);
+
+        // And so does a client that sends nothing but a hello
+        CHECK(query_and_half_close(socket_path, {}).empty());
+
+        server.stop();
+    }
+
+    // Coordinators are only exempt from charging with the key of the worker
+    const auto is_refused = [](const std::vector<std::string> &payloads) {
+        return payloads.size() == 1 && Protocol::Reader(payloads.front()).type() == Protocol::FrameType::Error;
+    };
+    const std::string socket_path = "/tmp/mtfind2_server_test." + std::to_string(getpid()) + ".sock";
+    CountingProvider provider(0ms);
+    for (const std::string key : { "", "secret" }) {
+        Server server(provider, { .unix_socket_path = socket_path, .coordinator_key = key });
+        server.start();
+
+        CHECK(is_refused(query_and_half_close(socket_path, queries, coordinator_hello(""))));
+        CHECK(is_refused(query_and_half_close(socket_path, queries, coordinator_hello("secreT"))));
+        CHECK(is_refused(query_and_half_close(socket_path, queries, coordinator_hello("secret!"))));
+        const auto payloads = query_and_half_close(socket_path, queries, coordinator_hello("secret"));
+        if (key.empty())
+            CHECK(is_refused(payloads));
+        else
+            check_responses(payloads, queries);
+
+        server.stop();
+    }
+
+    return check_report("server_test");
+}
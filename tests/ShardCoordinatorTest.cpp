@@ -0,0 +1,243 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <MTFind2/Messages/SearchFinishedMessage.h>
+#include <MTFind2/Messages/SearchResultFoundMessage.h>
+#include <MTFind2/Search/RemoteContentSource.h>
+#include <MTFind2/Server/Server.h>
+#include <MTFind2/Server/ShardCoordinator.h>
+
+#include "Check.h"
+
+using namespace mtfind2;
+using namespace std::chrono_literals;
+
+/**
+ * Where a worker found the query.
+ */
+struct Hit final {
+    std::string source_path;
+    uint32_t line;
+    uint32_t column;
+};
+
+/**
+ * Stands for the part of the corpus a worker holds: it answers every query
+ * with the same occurrences, in no particular order, or never answers at all.
+ */
+struct ShardProvider final : SearchProvider {
+    ShardProvider(const std::vector<Hit> &hits, bool is_answering = true)
+        : m_is_answering(is_answering)
+    {
+        for (const auto &hit : hits) {
+            auto &content_source = m_content_sources[hit.source_path];
+            if (!content_source)
+                content_source = std::make_shared<const RemoteContentSource>(hit.source_path, TextHelper::FoldMode::CaseInsensitive, std::unordered_map<uint64_t, std::string>());
+            m_hits.emplace_back(content_source.get(), hit);
+        }
+    }
+
+    void query(Client &client, const SearchRequest &search_request) override
+    {
+        if (!m_is_answering)
+            return;
+
+        for (const auto &[content_source, hit] : m_hits) {
+            const SearchResult search_result {
+                .source_id = content_source->id(),
+                .offset = hit.line * 100 + hit.column,
+                .line = hit.line,
+                .column = hit.column,
+                .length = static_cast<uint32_t>(search_request.query().size()),
+                .is_final_result = false,
+                .timestamp = std::chrono::steady_clock::now()
+            };
+            client.push_message(SearchResultFoundMessage(search_request, *content_source, search_result));
+        }
+        client.push_message(SearchFinishedMessage(search_request, std::chrono::steady_clock::now()));
+    }
+
+private:
+    const bool m_is_answering;
+    std::unordered_map<std::string, std::shared_ptr<const RemoteContentSource>> m_content_sources;
+    std::vector<std::pair<const RemoteContentSource *, Hit>> m_hits;
+};
+
+/**
+ * Collects what a coordinator answers to a single request.
+ */
+struct Answer final : ClientDelegate {
+    struct Result final {
+        Hit hit;
+        bool is_final_result;
+    };
+
+    void on_search_result(const SearchRequest &, const ContentSource &content_source, const SearchResult &search_result) override
+    {
+        const std::scoped_lock lock(m_lock);
+        results.push_back({ { content_source.file_path(), search_result.line, search_result.column }, search_result.is_final_result });
+    }
+
+    void on_search_count(const SearchRequest &, size_t) override { }
+
+    void on_service_overloaded(const SearchRequest &, std::chrono::milliseconds) override
+    {
+        const std::scoped_lock lock(m_lock);
+        is_overloaded = true;
+    }
+
+    void on_search_finished(const SearchRequest &, std::chrono::steady_clock::time_point) override
+    {
+        const std::scoped_lock lock(m_lock);
+        is_finished = true;
+        m_finished_condition.notify_all();
+    }
+
+    void on_credit_recharged(size_t) override { }
+
+    /**
+     * @return Whether the request finished in time
+     */
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(m_lock);
+        return m_finished_condition.wait_for(lock, timeout, [this] { return is_finished; });
+    }
+
+    std::vector<Result> results;
+    bool is_overloaded = false;
+    bool is_finished = false;
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_finished_condition;
+};
+
+/**
+ * Sends a query through a coordinator and waits for its answer.
+ * @remarks The coordinator must be stopped before the answer is dropped,
+ * since it may still be handing the last message to its client
+ */
+static void ask(ShardCoordinator &shard_coordinator, Client &client, Answer &answer)
+{
+    client.set_delegate(&answer);
+    const SearchRequest search_request(0, "sirena");
+    shard_coordinator.query(client, search_request);
+    CHECK(answer.wait(5s));
+}
+
+int main()
+{
+    const std::string coordinator_key = "test key";
+    const std::string socket_prefix = "/tmp/mtfind2_shard_test." + std::to_string(getpid());
+    const std::vector<std::string> socket_paths { socket_prefix + ".0.sock", socket_prefix + ".1.sock", socket_prefix + ".2.sock" };
+
+    // Two workers answering with their own sources, out of order, and one
+    // that never answers
+    ShardProvider first_provider({ { "c.txt", 4, 1 }, { "a.txt", 2, 9 }, { "a.txt", 1, 5 }, { "a.txt", 2, 3 } });
+    ShardProvider second_provider({ { "b.txt", 7, 2 }, { "b.txt", 1, 1 } });
+    ShardProvider silent_provider({ { "d.txt", 1, 1 } }, false);
+    Server first_worker(first_provider, { .unix_socket_path = socket_paths[0], .coordinator_key = coordinator_key });
+    Server second_worker(second_provider, { .unix_socket_path = socket_paths[1], .coordinator_key = coordinator_key });
+    Server silent_worker(silent_provider, { .unix_socket_path = socket_paths[2], .coordinator_key = coordinator_key });
+    first_worker.start();
+    second_worker.start();
+    silent_worker.start();
+
+    Client client(0, Client::SubscriptionType::Standard, Client::UnlimitedCredit);
+
+    // Results are merged in (source, line, column) order, with the last one of
+    // each source marked as such
+    {
+        Answer answers[2];
+        ShardCoordinator shard_coordinator({ socket_paths[0], socket_paths[1] }, TextHelper::FoldMode::CaseInsensitive, 2, coordinator_key);
+        shard_coordinator.start();
+        for (auto &answer : answers)
+            ask(shard_coordinator, client, answer);
+        shard_coordinator.stop();
+
+        const std::vector<std::tuple<std::string, uint32_t, uint32_t, bool>> expected_results {
+            { "a.txt", 1, 5, false },
+            { "a.txt", 2, 3, false },
+            { "a.txt", 2, 9, true },
+            { "b.txt", 1, 1, false },
+            { "b.txt", 7, 2, true },
+            { "c.txt", 4, 1, true },
+        };
+        for (const auto &answer : answers) {
+            CHECK(!answer.is_overloaded);
+            CHECK_EQUAL(answer.results.size(), expected_results.size());
+            for (size_t i = 0; i < std::min(answer.results.size(), expected_results.size()); i++) {
+                const auto &result = answer.results[i];
+                CHECK(std::tie(result.hit.source_path, result.hit.line, result.hit.column, result.is_final_result) == expected_results[i]);
+            }
+        }
+    }
+
+    // Workers refuse coordinators without their key, which is as good as
+    // being unreachable
+    {
+        Answer answer;
+        ShardCoordinator shard_coordinator({ socket_paths[0], socket_paths[1] }, TextHelper::FoldMode::CaseInsensitive, 2, "wrong key");
+        shard_coordinator.start();
+        ask(shard_coordinator, client, answer);
+        shard_coordinator.stop();
+        CHECK(answer.is_overloaded);
+        CHECK(answer.results.empty());
+    }
+
+    // Requests a worker can't be reached for are answered as overloaded
+    {
+        Answer answer;
+        ShardCoordinator shard_coordinator({ socket_paths[0], socket_prefix + ".missing.sock" }, TextHelper::FoldMode::CaseInsensitive, 2, coordinator_key);
+        shard_coordinator.start();
+        ask(shard_coordinator, client, answer);
+        shard_coordinator.stop();
+        CHECK(answer.is_overloaded);
+        CHECK(answer.results.empty());
+    }
+
+    // And so are requests a worker doesn't answer in time
+    {
+        Answer answer;
+        ShardCoordinator shard_coordinator({ socket_paths[0], socket_paths[2] }, TextHelper::FoldMode::CaseInsensitive, 2, coordinator_key, 200ms);
+        shard_coordinator.start();
+        const auto start_time = std::chrono::steady_clock::now();
+        ask(shard_coordinator, client, answer);
+        CHECK(std::chrono::steady_clock::now() - start_time >= 200ms);
+        shard_coordinator.stop();
+        CHECK(answer.is_overloaded);
+        CHECK(answer.results.empty());
+    }
+
+    first_worker.stop();
+    second_worker.stop();
+    silent_worker.stop();
+
+    return check_report("shard_coordinator_test");
+}
@@ -0,0 +1,170 @@
+// mtfind2(1) -- Multi-thread find utility: the sequel that nobody needs
+// Copyright (c) 2021 Ángel Pérez <angel.perez7@alu.uclm.es>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <MTFind2/Client/Workload.h>
+#include <MTFind2/Search/SearchRequest.h>
+
+#include "Check.h"
+
+using namespace mtfind2;
+using namespace std::chrono_literals;
+
+/**
+ * Remembers the queries it is handed, in order.
+ */
+struct QueryLog final : SearchProvider {
+    void query(Client &, const SearchRequest &search_request) override { queries.push_back(search_request.query()); }
+
+    std::vector<std::string> queries;
+};
+
+static std::string read_file(const std::string &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    return { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+}
+
+static void write_file(const std::string &path, const std::string &contents)
+{
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+}
+
+static bool is_same_request(const CapturedRequest &request, const CapturedRequest &expected_request)
+{
+    return request.arrival_offset == expected_request.arrival_offset && request.subscription_type == expected_request.subscription_type
+        && request.credit == expected_request.credit && request.query == expected_request.query;
+}
+
+int main()
+{
+    const std::string path = "/tmp/mtfind2_workload_test." + std::to_string(getpid());
+
+    // Every request is recorded and handed on, including every credit value a
+    // client may have
+    struct Issued {
+        Client::SubscriptionType subscription_type;
+        int32_t credit;
+        std::string query;
+    };
+    std::vector<Issued> issued {
+        { Client::SubscriptionType::Standard, Client::NotUsingCredit, "sirena" },
+        { Client::SubscriptionType::Premium, 15, "liderazgo" },
+        { Client::SubscriptionType::Premium, 0, "niño" },
+        { Client::SubscriptionType::Premium, Client::UnlimitedCredit, std::string(300, 'q') },
+        { Client::SubscriptionType::Standard, INT32_MIN, "" },
+        { Client::SubscriptionType::Premium, -2, "de" },
+    };
+    // Enough of them to be written out before the recorder is closed
+    for (int i = 0; i < 2000; i++)
+        issued.push_back({ i % 3 ? Client::SubscriptionType::Standard : Client::SubscriptionType::Premium, i - 1000, "query number " + std::to_string(i) + std::string(40, '.') });
+
+    QueryLog query_log;
+    {
+        WorkloadRecorder recorder(query_log, path);
+        for (size_t i = 0; i < issued.size(); i++) {
+            if (i == 1)
+                std::this_thread::sleep_for(5ms);
+            Client client(i, issued[i].subscription_type, issued[i].credit);
+            recorder.query(client, SearchRequest(i, issued[i].query));
+        }
+        CHECK_EQUAL(recorder.request_count(), issued.size());
+
+        // Requests are no longer recorded once closed, but still handed on
+        recorder.close();
+        Client client(0, Client::SubscriptionType::Standard);
+        recorder.query(client, SearchRequest(0, "late"));
+        CHECK_EQUAL(recorder.request_count(), issued.size());
+    }
+    CHECK_EQUAL(query_log.queries.size(), issued.size() + 1);
+    CHECK_EQUAL(query_log.queries.back(), "late");
+
+    const auto requests = WorkloadFormat::read(path);
+    CHECK_EQUAL(requests.size(), issued.size());
+    for (size_t i = 0; i < std::min(requests.size(), issued.size()); i++) {
+        CHECK(requests[i].subscription_type == issued[i].subscription_type);
+        CHECK_EQUAL(requests[i].credit, issued[i].credit);
+        CHECK_EQUAL(requests[i].query, issued[i].query);
+        CHECK_EQUAL(query_log.queries[i], issued[i].query);
+        if (i > 0)
+            CHECK(requests[i].arrival_offset >= requests[i - 1].arrival_offset);
+    }
+    if (requests.size() >= 2)
+        CHECK(requests[1].arrival_offset - requests[0].arrival_offset >= 5ms);
+
+    // A file cut anywhere reads back as the requests before the cut if it
+    // falls between two of them, and is rejected otherwise
+    {
+        const auto contents = read_file(path);
+        size_t boundary_count = 0;
+        for (size_t size = sizeof(WorkloadFormat::Header); size < 1024; size++) {
+            write_file(path, contents.substr(0, size));
+            try {
+                const auto truncated_requests = WorkloadFormat::read(path);
+                CHECK_EQUAL(truncated_requests.size(), boundary_count);
+                for (size_t i = 0; i < truncated_requests.size(); i++)
+                    CHECK(is_same_request(truncated_requests[i], requests[i]));
+                boundary_count++;
+            } catch (const std::runtime_error &) {
+            }
+        }
+        CHECK(boundary_count > 6);
+
+        write_file(path, contents.substr(0, contents.size() - 1));
+        CHECK_THROWS(WorkloadFormat::read(path));
+    }
+
+    // As are files that are not captured workloads, or from another version
+    {
+        const auto valid_record = std::string("\x00" "S\x01\x02" "de", 6);
+        WorkloadFormat::Header header;
+        std::memcpy(header.magic, WorkloadFormat::Magic, sizeof header.magic);
+        header.version = WorkloadFormat::Version;
+        const std::string header_bytes(reinterpret_cast<const char *>(&header), sizeof header);
+
+        write_file(path, header_bytes + valid_record);
+        const auto valid_requests = WorkloadFormat::read(path);
+        CHECK_EQUAL(valid_requests.size(), 1u);
+        CHECK(!valid_requests.empty() && valid_requests.front().credit == Client::NotUsingCredit && valid_requests.front().query == "de");
+
+        write_file(path, header_bytes + std::string("\x00" "X\x01\x02" "de", 6));
+        CHECK_THROWS(WorkloadFormat::read(path));
+        write_file(path, header_bytes + std::string("\x00" "S\x01\x03" "de", 6));
+        CHECK_THROWS(WorkloadFormat::read(path));
+        write_file(path, header_bytes.substr(0, sizeof header - 1));
+        CHECK_THROWS(WorkloadFormat::read(path));
+        header.version++;
+        write_file(path, std::string(reinterpret_cast<const char *>(&header), sizeof header) + valid_record);
+        CHECK_THROWS(WorkloadFormat::read(path));
+        write_file(path, "not a workload at all");
+        CHECK_THROWS(WorkloadFormat::read(path));
+    }
+
+    ::unlink(path.c_str());
+    CHECK_THROWS(WorkloadFormat::read(path));
+
+    return check_report("workload_test");
+}